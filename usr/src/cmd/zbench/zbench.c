@@ -0,0 +1,2190 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#pragma ident	"%Z%%M%	%I%	%E% SMI"
+
+/*
+ * zbench is a repeatable performance benchmark for the ZFS core.  Where
+ * ztest randomizes everything to find bugs, zbench holds everything
+ * fixed so that two builds can be compared: it creates a pool on
+ * file-backed vdevs, creates one dataset with the requested compression
+ * and checksum, and runs each named workload for a fixed time with a
+ * fixed number of threads.  -t can also list several thread counts, as
+ * in -w create -t 1,2,4,8,16,32,64; each workload then runs once per
+ * count, which is how the scaling of e.g. object creation is swept.
+ *
+ * Each workload prints one line of key=value pairs: throughput, latency
+ * percentiles, CPU time per operation (for the whole process, so the
+ * sync and I/O threads are included) and the I/O the vdevs saw.  The
+ * lines are meant to be collected and compared by scripts.
+ *
+ * The read workloads other than "warmread", traverse and scrub start from
+ * a cold ARC: the data is written and synced first, then the ARC is
+ * flushed.  "strideread"
+ * reads one record out of every ZBENCH_STRIDE, the pattern the strided
+ * prefetch streams are meant to catch.  "warmread" is randread from the
+ * ARC the fill left behind; run it with -c to compare the cost of a hit
+ * on a compressed buffer, and with -s larger than the ARC to see how
+ * much more of the data compression lets it hold.  "import"
+ * exports the pool and times importing it and opening each dataset.
+ * "snapone" and "snapbatch" snapshot a set of datasets one snapshot at a
+ * time and a whole set per call; both count one op per snapshot.
+ * "labelscan" and "labelscancold" create an exported pool of
+ * zopt_labelvdevs file vdevs in a directory of their own and time
+ * zpool_find_import() on that directory, as "zpool import -d" does:
+ * "labelscancold" removes the label cache before every scan, so each
+ * one reads every label, "labelscan" runs with the cache filled.  Both
+ * count one op per scan and go through libzfs, so, like zdb -e, they
+ * need /dev/zfs.
+ * "config" takes and drops the pool config lock as reader, the hold
+ * every I/O takes, to measure the read side of the lock on its own;
+ * each of its ops is ZBENCH_CONFIG_HOLDS holds.
+ * "zapchurn" has every thread add and remove names in one directory ZAP,
+ * as parallel creates and unlinks in a single directory do, and checks
+ * at the end that no entry was lost.
+ * "dirscan" and "dirscanra" walk a directory of zopt_dirents entries
+ * from a cold ARC and read the bonus buffer of every entry's object, as
+ * ls -l does through readdir and stat; "dirscanra" runs the zap
+ * readahead readdir uses ZBENCH_DIR_RA_WINDOW entries ahead of the
+ * cursor, "dirscan" only prefetches each entry just before reading it,
+ * as readdir does with zfs_dir_ra_window set to 0.  Both count one op
+ * per entry.
+ * "unpack" and "unpackborrow" unpack the packed pool config, the way
+ * libzfs unpacks every config and property list the kernel hands back,
+ * by copying and by borrowing from the buffer; build the pool with many
+ * vdevs (-v, -m) for a large config.
+ * The read ops of the busiest and idlest leaf vdevs are reported too, so
+ * that runs with -m show how evenly mirror reads are spread.  -S slows
+ * the first child of each mirror down, and slow_leaf_read_ops counts
+ * the reads those children took: a balancing mirror moves reads to the
+ * fast side.
+ * With -L the write workloads hand full records over in loaned ARC
+ * buffers instead of copying them in; compare seqwrite with and without
+ * it for the cost of that copy.
+ * The pool is destroyed and its files removed when zbench exits.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/dmu.h>
+#include <sys/txg.h>
+#include <sys/zap.h>
+#include <sys/arc.h>
+#include <sys/dmu_traverse.h>
+#include <sys/dmu_objset.h>
+#include <sys/dsl_prop.h>
+#include <sys/refcount.h>
+#include <sys/zio.h>
+#include <sys/zio_checksum.h>
+#include <sys/zio_compress.h>
+#include <sys/zil.h>
+#include <sys/vdev_impl.h>
+#include <sys/spa_impl.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <umem.h>
+#include <ctype.h>
+#include <sys/fs/zfs.h>
+#include <libzfs.h>
+
+#define	ZBENCH_SWEEP_MAX	16	/* thread counts one -t can list */
+
+static char cmdname[] = "zbench";
+static char *zopt_pool = cmdname;
+static char *zopt_dir = "/tmp";
+static char *zopt_workloads = "seqwrite,randwrite,seqread,randread";
+static int zopt_vdevs = 1;
+static int zopt_mirrors = 0;
+static uint64_t zopt_slow = 0;		/* msec per read, mirror child 0 */
+static uint64_t zopt_vdev_size = 1ULL << 30;
+static int zopt_threads[ZBENCH_SWEEP_MAX] = { 4 };
+static int zopt_nsweep = 1;		/* thread counts in zopt_threads */
+static uint64_t zopt_recsize = 128 << 10;
+static uint64_t zopt_size = 64 << 20;	/* per thread */
+static uint64_t zopt_time = 10;		/* seconds per workload */
+static int zopt_qdepth = 16;
+static int zopt_compressible = 50;	/* percent */
+static uint64_t zopt_compress = ZIO_COMPRESS_OFF;
+static uint64_t zopt_checksum = ZIO_CHECKSUM_ON;
+static boolean_t zopt_loan;
+static int zopt_datasets = 1000;	/* for "import" and "snap*" */
+static uint64_t zopt_dirents = 100000;	/* for "dirscan*" */
+static int zopt_labelvdevs = 100;	/* for "labelscan*" */
+
+#define	ZBENCH_DIROBJ		1	/* ZAP of the files "create" makes */
+#define	ZBENCH_FILES		1024	/* files each "create" thread keeps */
+#define	ZBENCH_FILESIZE		4096
+#define	ZBENCH_HOLD_BLOCKS	4	/* hot blocks "hold" threads share */
+#define	ZBENCH_CONFIG_HOLDS	1000	/* lock holds per "config" op */
+#define	ZBENCH_STRIDE		4	/* "strideread" step, in records */
+#define	ZBENCH_DIR_RA_WINDOW	128	/* "dirscanra", as zfs_dir_ra_window */
+#define	ZBENCH_BONUSLEN		256	/* about a znode_phys_t */
+
+typedef struct zbench_thread {
+	int		zt_id;
+	thread_t	zt_tid;
+	hrtime_t	zt_stop;
+	uint64_t	zt_rand;
+	uint64_t	zt_object;
+	uint64_t	zt_offset;
+	char		*zt_buf;
+	char		*zt_rbuf;
+	kmutex_t	zt_lock;	/* protects everything below */
+	kcondvar_t	zt_cv;
+	int		zt_inflight;	/* async reads */
+	uint64_t	zt_ops;
+	uint64_t	zt_bytes;
+	uint64_t	zt_errors;
+	hrtime_t	*zt_lat;
+	uint64_t	zt_nlat;
+	uint64_t	zt_maxlat;
+	uint64_t	zt_count;	/* per-workload state */
+	uint64_t	zt_files[ZBENCH_FILES];
+} zbench_thread_t;
+
+typedef void zbench_func_t(zbench_thread_t *);
+typedef int zbench_op_t(zbench_thread_t *);
+
+#define	ZW_COLD		0x1	/* write the data, then flush the ARC */
+#define	ZW_SINGLE	0x2	/* run with one thread */
+
+typedef struct zbench_workload {
+	const char	*zw_name;
+	zbench_func_t	*zw_setup;	/* untimed, per thread */
+	zbench_op_t	*zw_op;		/* timed; records its own latency */
+	zbench_func_t	*zw_drain;	/* timed, once the time is up */
+	zbench_func_t	*zw_fini;	/* untimed, per thread */
+	int		zw_flags;
+} zbench_workload_t;
+
+static zbench_func_t zbench_setup_object;
+static zbench_func_t zbench_setup_fill;
+static zbench_func_t zbench_fini_object;
+static zbench_func_t zbench_fini_create;
+static zbench_func_t zbench_fini_zapchurn;
+static zbench_func_t zbench_fini_snapshot;
+static zbench_func_t zbench_setup_hold;
+static zbench_func_t zbench_fini_hold;
+static zbench_func_t zbench_setup_import;
+static zbench_func_t zbench_fini_import;
+static zbench_func_t zbench_fini_snapmany;
+static zbench_func_t zbench_setup_labelscan;
+static zbench_func_t zbench_fini_labelscan;
+static zbench_func_t zbench_setup_unpack;
+static zbench_func_t zbench_setup_dirscan;
+static zbench_func_t zbench_fini_dirscan;
+static zbench_func_t zbench_fini_unpack;
+static zbench_func_t zbench_drain_aread;
+static zbench_op_t zbench_seqwrite;
+static zbench_op_t zbench_randwrite;
+static zbench_op_t zbench_seqread;
+static zbench_op_t zbench_randread;
+static zbench_op_t zbench_strideread;
+static zbench_op_t zbench_warmread;
+static zbench_op_t zbench_aread;
+static zbench_op_t zbench_create;
+static zbench_op_t zbench_zapchurn;
+static zbench_op_t zbench_fsync;
+static zbench_op_t zbench_snapshot;
+static zbench_op_t zbench_traverse;
+static zbench_op_t zbench_scrub;
+static zbench_op_t zbench_hold;
+static zbench_op_t zbench_import;
+static zbench_op_t zbench_snapone;
+static zbench_op_t zbench_snapbatch;
+static zbench_op_t zbench_labelscan;
+static zbench_op_t zbench_labelscancold;
+static zbench_op_t zbench_config;
+static zbench_op_t zbench_unpack;
+static zbench_op_t zbench_dirscan;
+static zbench_op_t zbench_dirscanra;
+static zbench_op_t zbench_unpackborrow;
+static void zbench_vdev_stats(vdev_stat_t *);
+
+static zbench_workload_t zbench_workloads[] = {
+	{ "seqwrite", zbench_setup_object, zbench_seqwrite, NULL,
+	    zbench_fini_object, 0 },
+	{ "randwrite", zbench_setup_fill, zbench_randwrite, NULL,
+	    zbench_fini_object, 0 },
+	{ "seqread", zbench_setup_fill, zbench_seqread, NULL,
+	    zbench_fini_object, ZW_COLD },
+	{ "randread", zbench_setup_fill, zbench_randread, NULL,
+	    zbench_fini_object, ZW_COLD },
+	{ "strideread", zbench_setup_fill, zbench_strideread, NULL,
+	    zbench_fini_object, ZW_COLD },
+	{ "warmread", zbench_setup_fill, zbench_warmread, NULL,
+	    zbench_fini_object, 0 },
+	{ "aread", zbench_setup_fill, zbench_aread, zbench_drain_aread,
+	    zbench_fini_object, ZW_COLD },
+	{ "create", NULL, zbench_create, NULL,
+	    zbench_fini_create, 0 },
+	{ "zapchurn", NULL, zbench_zapchurn, NULL,
+	    zbench_fini_zapchurn, 0 },
+	{ "fsync", zbench_setup_object, zbench_fsync, NULL,
+	    zbench_fini_object, 0 },
+	{ "snapshot", zbench_setup_object, zbench_snapshot, NULL,
+	    zbench_fini_snapshot, 0 },
+	{ "traverse", zbench_setup_fill, zbench_traverse, NULL,
+	    zbench_fini_object, ZW_COLD | ZW_SINGLE },
+	{ "scrub", zbench_setup_fill, zbench_scrub, NULL,
+	    zbench_fini_object, ZW_COLD | ZW_SINGLE },
+	{ "hold", zbench_setup_hold, zbench_hold, NULL,
+	    zbench_fini_hold, 0 },
+	{ "import", zbench_setup_import, zbench_import, NULL,
+	    zbench_fini_import, ZW_SINGLE },
+	{ "snapone", zbench_setup_import, zbench_snapone, NULL,
+	    zbench_fini_snapmany, ZW_SINGLE },
+	{ "snapbatch", zbench_setup_import, zbench_snapbatch, NULL,
+	    zbench_fini_snapmany, ZW_SINGLE },
+	{ "labelscan", zbench_setup_labelscan, zbench_labelscan, NULL,
+	    zbench_fini_labelscan, ZW_SINGLE },
+	{ "labelscancold", zbench_setup_labelscan, zbench_labelscancold,
+	    NULL, zbench_fini_labelscan, ZW_SINGLE },
+	{ "config", NULL, zbench_config, NULL, NULL, 0 },
+	{ "dirscan", zbench_setup_dirscan, zbench_dirscan, NULL,
+	    zbench_fini_dirscan, ZW_COLD | ZW_SINGLE },
+	{ "dirscanra", zbench_setup_dirscan, zbench_dirscanra, NULL,
+	    zbench_fini_dirscan, ZW_COLD | ZW_SINGLE },
+	{ "unpack", zbench_setup_unpack, zbench_unpack, NULL,
+	    zbench_fini_unpack, 0 },
+	{ "unpackborrow", zbench_setup_unpack, zbench_unpackborrow, NULL,
+	    zbench_fini_unpack, 0 },
+};
+
+#define	ZBENCH_WORKLOADS \
+	(sizeof (zbench_workloads) / sizeof (zbench_workload_t))
+
+static char zbench_dev_template[] = "%s/%s.%da";
+static char zbench_label_template[] = "%s/%s.labels";	/* directory */
+static char zbench_label_pool[MAXNAMELEN];
+static char zbench_label_dir[MAXPATHLEN];
+static libzfs_handle_t *zbench_zfs;
+static char zbench_dsname[MAXNAMELEN];
+static objset_t *zbench_os;
+static zilog_t *zbench_zilog;
+static vdev_stat_t zbench_vdev_carry;	/* I/O before the last import */
+
+static void usage(boolean_t) __NORETURN;
+
+static void
+fatal(int do_perror, char *message, ...)
+{
+	va_list args;
+	int save_errno = errno;
+
+	(void) fflush(stdout);
+
+	(void) fprintf(stderr, "%s: ", cmdname);
+	va_start(args, message);
+	(void) vfprintf(stderr, message, args);
+	va_end(args);
+	if (do_perror)
+		(void) fprintf(stderr, ": %s", strerror(save_errno));
+	(void) fprintf(stderr, "\n");
+	exit(3);
+}
+
+static int
+str2shift(const char *buf)
+{
+	const char *ends = "BKMGTPEZ";
+	int i;
+
+	if (buf[0] == '\0')
+		return (0);
+	for (i = 0; i < strlen(ends); i++) {
+		if (toupper(buf[0]) == ends[i])
+			break;
+	}
+	if (i == strlen(ends)) {
+		(void) fprintf(stderr, "%s: invalid bytes suffix: %s\n",
+		    cmdname, buf);
+		usage(B_FALSE);
+	}
+	if (buf[1] == '\0' || (toupper(buf[1]) == 'B' && buf[2] == '\0')) {
+		return (10*i);
+	}
+	(void) fprintf(stderr, "%s: invalid bytes suffix: %s\n", cmdname, buf);
+	usage(B_FALSE);
+	/* NOTREACHED */
+}
+
+static uint64_t
+nicenumtoull(const char *buf)
+{
+	char *end;
+	uint64_t val;
+
+	val = strtoull(buf, &end, 0);
+	if (end == buf) {
+		(void) fprintf(stderr, "%s: bad numeric value: %s\n",
+		    cmdname, buf);
+		usage(B_FALSE);
+	} else if (end[0] != '\0') {
+		int shift = str2shift(end);
+		if (shift >= 64 || (val << shift) >> shift != val) {
+			(void) fprintf(stderr, "%s: value too large: %s\n",
+			    cmdname, buf);
+			usage(B_FALSE);
+		}
+		val <<= shift;
+	}
+	return (val);
+}
+
+static void
+usage(boolean_t requested)
+{
+	char nice_vdev_size[10];
+	char nice_recsize[10];
+	char nice_size[10];
+	FILE *fp = requested ? stdout : stderr;
+	int w;
+
+	nicenum(zopt_vdev_size, nice_vdev_size);
+	nicenum(zopt_recsize, nice_recsize);
+	nicenum(zopt_size, nice_size);
+
+	(void) fprintf(fp, "Usage: %s\n"
+	    "\t[-w workload[,...] (default: %s)]\n"
+	    "\t[-t threads[,threads...] (default: %d)]\n"
+	    "\t[-b record_size (default: %s)]\n"
+	    "\t[-s data_per_thread (default: %s)]\n"
+	    "\t[-T seconds_per_workload (default: %llu)]\n"
+	    "\t[-q async_read_depth (default: %d)]\n"
+	    "\t[-c compression (default: %s)]\n"
+	    "\t[-C checksum (default: %s)]\n"
+	    "\t[-z compressible_percent (default: %d)]\n"
+	    "\t[-L] (write through loaned ARC buffers)\n"
+	    "\t[-D datasets_for_import_and_snap (default: %d)]\n"
+	    "\t[-E entries_for_dirscan (default: %llu)]\n"
+	    "\t[-l vdevs_for_labelscan (default: %d)]\n"
+	    "\t[-v vdevs (default: %d)]\n"
+	    "\t[-m mirror_copies (default: %d)]\n"
+	    "\t[-S msec_to_delay_reads_of_first_mirror_child "
+	    "(default: %llu)]\n"
+	    "\t[-V size_of_each_vdev (default: %s)]\n"
+	    "\t[-p pool_name (default: %s)]\n"
+	    "\t[-f file directory for vdev files (default: %s)]\n"
+	    "\t[-h] (print help)\n"
+	    "workloads:",
+	    cmdname,
+	    zopt_workloads,			/* -w */
+	    zopt_threads[0],			/* -t */
+	    nice_recsize,			/* -b */
+	    nice_size,				/* -s */
+	    (u_longlong_t)zopt_time,		/* -T */
+	    zopt_qdepth,			/* -q */
+	    zio_compress_table[zopt_compress].ci_name,	/* -c */
+	    zio_checksum_table[zopt_checksum].ci_name,	/* -C */
+	    zopt_compressible,			/* -z */
+	    zopt_datasets,			/* -D */
+	    (u_longlong_t)zopt_dirents,		/* -E */
+	    zopt_labelvdevs,			/* -l */
+	    zopt_vdevs,				/* -v */
+	    zopt_mirrors,			/* -m */
+	    (u_longlong_t)zopt_slow,		/* -S */
+	    nice_vdev_size,			/* -V */
+	    zopt_pool,				/* -p */
+	    zopt_dir);				/* -f */
+	for (w = 0; w < ZBENCH_WORKLOADS; w++)
+		(void) fprintf(fp, " %s", zbench_workloads[w].zw_name);
+	(void) fprintf(fp, " all\n");
+	exit(requested ? 0 : 1);
+}
+
+static void
+process_options(int argc, char **argv)
+{
+	char *arg, *lasts;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv,
+	    "w:t:b:s:T:q:c:C:z:LD:E:l:v:m:S:V:p:f:h")) != EOF) {
+		switch (opt) {
+		case 'w':
+			zopt_workloads = optarg;
+			break;
+		case 't':
+			zopt_nsweep = 0;
+			for (arg = strtok_r(optarg, ",", &lasts); arg != NULL;
+			    arg = strtok_r(NULL, ",", &lasts)) {
+				if (zopt_nsweep == ZBENCH_SWEEP_MAX)
+					fatal(0, "at most %d thread counts",
+					    ZBENCH_SWEEP_MAX);
+				zopt_threads[zopt_nsweep++] =
+				    MAX(1, nicenumtoull(arg));
+			}
+			if (zopt_nsweep == 0)
+				usage(B_FALSE);
+			break;
+		case 'b':
+			zopt_recsize = nicenumtoull(optarg);
+			break;
+		case 's':
+			zopt_size = nicenumtoull(optarg);
+			break;
+		case 'T':
+			zopt_time = MAX(1, nicenumtoull(optarg));
+			break;
+		case 'q':
+			zopt_qdepth = MAX(1, nicenumtoull(optarg));
+			break;
+		case 'c':
+			for (i = 0; i < ZIO_COMPRESS_FUNCTIONS; i++)
+				if (strcmp(optarg,
+				    zio_compress_table[i].ci_name) == 0)
+					break;
+			if (i == ZIO_COMPRESS_FUNCTIONS)
+				fatal(0, "unknown compression '%s'", optarg);
+			zopt_compress = i;
+			break;
+		case 'C':
+			for (i = 0; i < ZIO_CHECKSUM_FUNCTIONS; i++)
+				if (strcmp(optarg,
+				    zio_checksum_table[i].ci_name) == 0)
+					break;
+			if (i == ZIO_CHECKSUM_FUNCTIONS)
+				fatal(0, "unknown checksum '%s'", optarg);
+			zopt_checksum = i;
+			break;
+		case 'z':
+			zopt_compressible = MIN(100, nicenumtoull(optarg));
+			break;
+		case 'L':
+			zopt_loan = B_TRUE;
+			break;
+		case 'D':
+			zopt_datasets = MAX(1, nicenumtoull(optarg));
+			break;
+		case 'E':
+			zopt_dirents = MAX(1, nicenumtoull(optarg));
+			break;
+		case 'l':
+			zopt_labelvdevs = MAX(1, nicenumtoull(optarg));
+			break;
+		case 'v':
+			zopt_vdevs = MAX(1, nicenumtoull(optarg));
+			break;
+		case 'm':
+			zopt_mirrors = nicenumtoull(optarg);
+			break;
+		case 'S':
+			zopt_slow = nicenumtoull(optarg);
+			break;
+		case 'V':
+			zopt_vdev_size = MAX(SPA_MINDEVSIZE,
+			    nicenumtoull(optarg));
+			break;
+		case 'p':
+			zopt_pool = strdup(optarg);
+			break;
+		case 'f':
+			zopt_dir = strdup(optarg);
+			break;
+		case 'h':
+			usage(B_TRUE);
+			break;
+		case '?':
+		default:
+			usage(B_FALSE);
+			break;
+		}
+	}
+
+	if (!ISP2(zopt_recsize) || zopt_recsize < SPA_MINBLOCKSIZE ||
+	    zopt_recsize > SPA_MAXBLOCKSIZE)
+		fatal(0, "record size must be a power of two from %d to %d",
+		    SPA_MINBLOCKSIZE, SPA_MAXBLOCKSIZE);
+	zopt_size = MAX(P2ROUNDUP(zopt_size, zopt_recsize), zopt_recsize);
+}
+
+/*
+ * =========================================================================
+ * Pool setup
+ * =========================================================================
+ */
+static nvlist_t *
+make_vdev_file(int vdev)
+{
+	char dev_name[MAXPATHLEN];
+	nvlist_t *file;
+	int fd;
+
+	(void) snprintf(dev_name, sizeof (dev_name), zbench_dev_template,
+	    zopt_dir, zopt_pool, vdev);
+
+	fd = open(dev_name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (fd == -1)
+		fatal(1, "can't open %s", dev_name);
+	if (ftruncate(fd, zopt_vdev_size) != 0)
+		fatal(1, "can't ftruncate %s", dev_name);
+	(void) close(fd);
+
+	VERIFY(nvlist_alloc(&file, NV_UNIQUE_NAME, 0) == 0);
+	VERIFY(nvlist_add_string(file, ZPOOL_CONFIG_TYPE, VDEV_TYPE_FILE) == 0);
+	VERIFY(nvlist_add_string(file, ZPOOL_CONFIG_PATH, dev_name) == 0);
+	VERIFY(nvlist_add_uint64(file, ZPOOL_CONFIG_ASHIFT,
+	    SPA_MINBLOCKSHIFT) == 0);
+
+	return (file);
+}
+
+static nvlist_t *
+make_vdev_mirror(int top)
+{
+	nvlist_t *mirror, **child;
+	int m = MAX(zopt_mirrors, 1);
+	int c;
+
+	if (zopt_mirrors < 2)
+		return (make_vdev_file(top));
+
+	child = umem_alloc(m * sizeof (nvlist_t *), UMEM_NOFAIL);
+
+	for (c = 0; c < m; c++)
+		child[c] = make_vdev_file(top * m + c);
+
+	VERIFY(nvlist_alloc(&mirror, NV_UNIQUE_NAME, 0) == 0);
+	VERIFY(nvlist_add_string(mirror, ZPOOL_CONFIG_TYPE,
+	    VDEV_TYPE_MIRROR) == 0);
+	VERIFY(nvlist_add_nvlist_array(mirror, ZPOOL_CONFIG_CHILDREN,
+	    child, m) == 0);
+
+	for (c = 0; c < m; c++)
+		nvlist_free(child[c]);
+
+	umem_free(child, m * sizeof (nvlist_t *));
+
+	return (mirror);
+}
+
+static nvlist_t *
+make_vdev_root(void)
+{
+	nvlist_t *root, **child;
+	int c, t = zopt_vdevs;
+
+	child = umem_alloc(t * sizeof (nvlist_t *), UMEM_NOFAIL);
+
+	for (c = 0; c < t; c++)
+		child[c] = make_vdev_mirror(c);
+
+	VERIFY(nvlist_alloc(&root, NV_UNIQUE_NAME, 0) == 0);
+	VERIFY(nvlist_add_string(root, ZPOOL_CONFIG_TYPE, VDEV_TYPE_ROOT) == 0);
+	VERIFY(nvlist_add_nvlist_array(root, ZPOOL_CONFIG_CHILDREN,
+	    child, t) == 0);
+
+	for (c = 0; c < t; c++)
+		nvlist_free(child[c]);
+
+	umem_free(child, t * sizeof (nvlist_t *));
+
+	return (root);
+}
+
+static void
+remove_vdev_files(void)
+{
+	char dev_name[MAXPATHLEN];
+	int v;
+
+	for (v = 0; v < zopt_vdevs * MAX(zopt_mirrors, 1); v++) {
+		(void) snprintf(dev_name, sizeof (dev_name),
+		    zbench_dev_template, zopt_dir, zopt_pool, v);
+		(void) unlink(dev_name);
+	}
+}
+
+/* ARGSUSED */
+static void
+zbench_create_cb(objset_t *os, void *arg, cred_t *cr, dmu_tx_t *tx)
+{
+	VERIFY(zap_create_claim(os, ZBENCH_DIROBJ,
+	    DMU_OT_ZAP_OTHER, DMU_OT_NONE, 0, tx) == 0);
+}
+
+/*
+ * fsync writes are logged WR_COPIED, so the ZIL never asks for data.
+ */
+/* ARGSUSED */
+static int
+zbench_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
+{
+	return (ENOENT);
+}
+
+/*
+ * With -S, make the first child of every mirror a slow disk: each of its
+ * reads is held up zopt_slow msec by the vdev fault injection ztest
+ * uses.  Opening a vdev clears the fault, so this is redone after every
+ * open of the pool.
+ */
+static void
+zbench_slow_child(void)
+{
+	spa_t *spa = dmu_objset_spa(zbench_os);
+	vdev_t *rvd = spa->spa_root_vdev;
+	vdev_t *vd;
+	int c;
+
+	if (zopt_slow == 0 || zopt_mirrors < 2)
+		return;
+
+	spa_config_enter(spa, RW_READER, FTAG);
+	for (c = 0; c < rvd->vdev_children; c++) {
+		vd = rvd->vdev_child[c]->vdev_child[0];
+		vd->vdev_fault_arg = zopt_slow;
+		vd->vdev_fault_mask = 1ULL << ZIO_TYPE_READ;
+		vd->vdev_fault_mode = VDEV_FAULT_DELAY;
+	}
+	spa_config_exit(spa, FTAG);
+}
+
+static void
+zbench_open(void)
+{
+	int error;
+
+	error = dmu_objset_open(zbench_dsname, DMU_OST_OTHER,
+	    DS_MODE_STANDARD, &zbench_os);
+	if (error)
+		fatal(0, "dmu_objset_open(%s) = %d", zbench_dsname, error);
+	zbench_zilog = zil_open(zbench_os, zbench_get_data);
+	zbench_slow_child();
+}
+
+static void
+zbench_close(void)
+{
+	zil_close(zbench_zilog);
+	dmu_objset_close(zbench_os);
+}
+
+static void
+zbench_init(void)
+{
+	nvlist_t *nvroot;
+	int error;
+
+	(void) spa_destroy(zopt_pool);
+	nvroot = make_vdev_root();
+	error = spa_create(zopt_pool, nvroot, NULL, NULL);
+	nvlist_free(nvroot);
+	if (error)
+		fatal(0, "spa_create(%s) = %d", zopt_pool, error);
+
+	(void) snprintf(zbench_dsname, sizeof (zbench_dsname), "%s/%s",
+	    zopt_pool, cmdname);
+	error = dmu_objset_create(zbench_dsname, DMU_OST_OTHER, NULL,
+	    zbench_create_cb, NULL);
+	if (error)
+		fatal(0, "dmu_objset_create(%s) = %d", zbench_dsname, error);
+
+	if ((error = dsl_prop_set(zbench_dsname, "compression",
+	    sizeof (zopt_compress), 1, &zopt_compress)) != 0 ||
+	    (error = dsl_prop_set(zbench_dsname, "checksum",
+	    sizeof (zopt_checksum), 1, &zopt_checksum)) != 0)
+		fatal(0, "dsl_prop_set(%s) = %d", zbench_dsname, error);
+
+	zbench_open();
+}
+
+static void
+zbench_fini(void)
+{
+	zbench_close();
+	(void) spa_destroy(zopt_pool);
+	remove_vdev_files();
+	if (zbench_zfs != NULL)
+		libzfs_fini(zbench_zfs);
+}
+
+/*
+ * =========================================================================
+ * Helpers
+ * =========================================================================
+ */
+/*
+ * Raw xorshift64: the next 64 random bits of the thread's stream.
+ */
+static uint64_t
+zbench_rand64(zbench_thread_t *zt)
+{
+	uint64_t x = zt->zt_rand;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	zt->zt_rand = x;
+
+	return (x);
+}
+
+static uint64_t
+zbench_random(zbench_thread_t *zt, uint64_t range)
+{
+	uint64_t x = zbench_rand64(zt);
+
+	return (range == 0 ? 0 : x % range);
+}
+
+/*
+ * Fill a record so that about zopt_compressible percent of it is zeroes.
+ */
+static void
+zbench_fill(zbench_thread_t *zt, char *buf, uint64_t len)
+{
+	uint64_t random = len - len * zopt_compressible / 100;
+	uint64_t i;
+
+	for (i = 0; i + sizeof (uint64_t) <= random; i += sizeof (uint64_t))
+		*(uint64_t *)(buf + i) = zbench_rand64(zt);
+	bzero(buf + i, len - i);
+}
+
+static void
+zbench_record(zbench_thread_t *zt, hrtime_t start, uint64_t bytes)
+{
+	hrtime_t lat = gethrtime() - start;
+
+	mutex_enter(&zt->zt_lock);
+	if (zt->zt_nlat == zt->zt_maxlat) {
+		uint64_t max = MAX(zt->zt_maxlat * 2, 1024);
+		hrtime_t *new = umem_alloc(max * sizeof (hrtime_t),
+		    UMEM_NOFAIL);
+
+		if (zt->zt_lat != NULL) {
+			bcopy(zt->zt_lat, new, zt->zt_nlat * sizeof (hrtime_t));
+			umem_free(zt->zt_lat,
+			    zt->zt_maxlat * sizeof (hrtime_t));
+		}
+		zt->zt_lat = new;
+		zt->zt_maxlat = max;
+	}
+	zt->zt_lat[zt->zt_nlat++] = lat;
+	zt->zt_ops++;
+	zt->zt_bytes += bytes;
+	mutex_exit(&zt->zt_lock);
+}
+
+static int
+zbench_write(zbench_thread_t *zt, uint64_t off)
+{
+	objset_t *os = zbench_os;
+	arc_buf_t *abuf = NULL;
+	dmu_tx_t *tx;
+	int error;
+
+	/*
+	 * With -L, copy into a loaned ARC buffer and hand it over, the way
+	 * zfs_write() does for full blocks, instead of letting dmu_write()
+	 * copy into the dbuf.
+	 */
+	if (zopt_loan) {
+		abuf = dmu_request_arcbuf(os, zopt_recsize);
+		bcopy(zt->zt_buf, abuf->b_data, zopt_recsize);
+	}
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_write(tx, zt->zt_object, off, zopt_recsize);
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error) {
+		dmu_tx_abort(tx);
+		if (abuf != NULL)
+			dmu_return_arcbuf(abuf);
+		return (error);
+	}
+	if (abuf != NULL)
+		dmu_assign_arcbuf(os, zt->zt_object, off, abuf, tx);
+	else
+		dmu_write(os, zt->zt_object, off, zopt_recsize, zt->zt_buf, tx);
+	dmu_tx_commit(tx);
+
+	return (0);
+}
+
+static uint64_t
+zbench_next_offset(zbench_thread_t *zt)
+{
+	uint64_t off = zt->zt_offset;
+
+	zt->zt_offset = (off + zopt_recsize) % zopt_size;
+	return (off);
+}
+
+static uint64_t
+zbench_random_offset(zbench_thread_t *zt)
+{
+	return (zbench_random(zt, zopt_size / zopt_recsize) * zopt_recsize);
+}
+
+/*
+ * =========================================================================
+ * Workloads
+ * =========================================================================
+ */
+static void
+zbench_setup_object(zbench_thread_t *zt)
+{
+	dmu_tx_t *tx;
+
+	tx = dmu_tx_create(zbench_os);
+	dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
+	if (dmu_tx_assign(tx, TXG_WAIT) != 0)
+		fatal(0, "can't create an object: out of space");
+	zt->zt_object = dmu_object_alloc(zbench_os, DMU_OT_UINT64_OTHER,
+	    zopt_recsize, DMU_OT_NONE, 0, tx);
+	dmu_tx_commit(tx);
+}
+
+static void
+zbench_setup_fill(zbench_thread_t *zt)
+{
+	uint64_t off;
+
+	zbench_setup_object(zt);
+	for (off = 0; off < zopt_size; off += zopt_recsize)
+		if (zbench_write(zt, off) != 0)
+			fatal(0, "can't fill object %llu: out of space",
+			    (u_longlong_t)zt->zt_object);
+}
+
+static void
+zbench_fini_object(zbench_thread_t *zt)
+{
+	dmu_tx_t *tx;
+
+	tx = dmu_tx_create(zbench_os);
+	dmu_tx_hold_free(tx, zt->zt_object, 0, DMU_OBJECT_END);
+	if (dmu_tx_assign(tx, TXG_WAIT) != 0) {
+		dmu_tx_abort(tx);
+		return;
+	}
+	VERIFY(dmu_object_free(zbench_os, zt->zt_object, tx) == 0);
+	dmu_tx_commit(tx);
+}
+
+static int
+zbench_timed_write(zbench_thread_t *zt, uint64_t off)
+{
+	hrtime_t start = gethrtime();
+	int error;
+
+	if ((error = zbench_write(zt, off)) == 0)
+		zbench_record(zt, start, zopt_recsize);
+	return (error);
+}
+
+static int
+zbench_seqwrite(zbench_thread_t *zt)
+{
+	return (zbench_timed_write(zt, zbench_next_offset(zt)));
+}
+
+static int
+zbench_randwrite(zbench_thread_t *zt)
+{
+	return (zbench_timed_write(zt, zbench_random_offset(zt)));
+}
+
+static int
+zbench_timed_read(zbench_thread_t *zt, uint64_t off)
+{
+	hrtime_t start = gethrtime();
+	int error;
+
+	error = dmu_read(zbench_os, zt->zt_object, off, zopt_recsize,
+	    zt->zt_rbuf);
+	if (error == 0)
+		zbench_record(zt, start, zopt_recsize);
+	return (error);
+}
+
+static int
+zbench_seqread(zbench_thread_t *zt)
+{
+	return (zbench_timed_read(zt, zbench_next_offset(zt)));
+}
+
+static int
+zbench_randread(zbench_thread_t *zt)
+{
+	return (zbench_timed_read(zt, zbench_random_offset(zt)));
+}
+
+static int
+zbench_warmread(zbench_thread_t *zt)
+{
+	return (zbench_timed_read(zt, zbench_random_offset(zt)));
+}
+
+/*
+ * Read the first record of every ZBENCH_STRIDE, wrapping around to the
+ * next record of each stride once the end of the object is reached.
+ */
+static int
+zbench_strideread(zbench_thread_t *zt)
+{
+	uint64_t off = zt->zt_offset;
+
+	zt->zt_offset += ZBENCH_STRIDE * zopt_recsize;
+	if (zt->zt_offset >= zopt_size)
+		zt->zt_offset = (off % (ZBENCH_STRIDE * zopt_recsize) +
+		    zopt_recsize) % (ZBENCH_STRIDE * zopt_recsize);
+	return (zbench_timed_read(zt, off));
+}
+
+/*
+ * Random reads through dmu_read_async(), keeping zopt_qdepth of them in
+ * flight per thread.  Latency is measured from issue to callback; the
+ * data isn't copied out.
+ */
+typedef struct zbench_aread {
+	zbench_thread_t	*za_zt;
+	hrtime_t	za_start;
+} zbench_aread_t;
+
+static void
+zbench_aread_done(dmu_read_req_t *req, int err, dmu_buf_t **dbp,
+    int numbufs, void *arg)
+{
+	zbench_aread_t *za = arg;
+	zbench_thread_t *zt = za->za_zt;
+
+	if (err == 0)
+		zbench_record(zt, za->za_start, zopt_recsize);
+	dmu_read_async_rele(req);
+	umem_free(za, sizeof (zbench_aread_t));
+
+	mutex_enter(&zt->zt_lock);
+	if (err != 0)
+		zt->zt_errors++;
+	zt->zt_inflight--;
+	cv_signal(&zt->zt_cv);
+	mutex_exit(&zt->zt_lock);
+}
+
+static int
+zbench_aread(zbench_thread_t *zt)
+{
+	zbench_aread_t *za;
+	dmu_read_req_t *req;
+	int error;
+
+	mutex_enter(&zt->zt_lock);
+	while (zt->zt_inflight >= zopt_qdepth)
+		cv_wait(&zt->zt_cv, &zt->zt_lock);
+	zt->zt_inflight++;
+	mutex_exit(&zt->zt_lock);
+
+	za = umem_alloc(sizeof (zbench_aread_t), UMEM_NOFAIL);
+	za->za_zt = zt;
+	za->za_start = gethrtime();
+	error = dmu_read_async(zbench_os, zt->zt_object,
+	    zbench_random_offset(zt), zopt_recsize, 0, zbench_aread_done, za,
+	    &req);
+	if (error) {
+		umem_free(za, sizeof (zbench_aread_t));
+		mutex_enter(&zt->zt_lock);
+		zt->zt_inflight--;
+		mutex_exit(&zt->zt_lock);
+	}
+	return (error);
+}
+
+static void
+zbench_drain_aread(zbench_thread_t *zt)
+{
+	mutex_enter(&zt->zt_lock);
+	while (zt->zt_inflight != 0)
+		cv_wait(&zt->zt_cv, &zt->zt_lock);
+	mutex_exit(&zt->zt_lock);
+}
+
+/*
+ * Small-file churn: each operation creates an object, writes
+ * ZBENCH_FILESIZE bytes to it and enters it in the shared directory ZAP,
+ * then removes the file created ZBENCH_FILES operations earlier.
+ */
+static int
+zbench_create(zbench_thread_t *zt)
+{
+	objset_t *os = zbench_os;
+	uint64_t slot = zt->zt_count % ZBENCH_FILES;
+	uint64_t old = zt->zt_files[slot];
+	char name[32], oldname[32];
+	hrtime_t start = gethrtime();
+	dmu_tx_t *tx;
+	uint64_t obj;
+	int error;
+
+	(void) snprintf(name, sizeof (name), "%d.%llu", zt->zt_id,
+	    (u_longlong_t)zt->zt_count);
+	(void) snprintf(oldname, sizeof (oldname), "%d.%llu", zt->zt_id,
+	    (u_longlong_t)(zt->zt_count - ZBENCH_FILES));
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
+	dmu_tx_hold_write(tx, DMU_NEW_OBJECT, 0, ZBENCH_FILESIZE);
+	dmu_tx_hold_zap(tx, ZBENCH_DIROBJ, B_TRUE, name);
+	if (old != 0) {
+		dmu_tx_hold_zap(tx, ZBENCH_DIROBJ, B_FALSE, oldname);
+		dmu_tx_hold_free(tx, old, 0, DMU_OBJECT_END);
+	}
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error) {
+		dmu_tx_abort(tx);
+		return (error);
+	}
+
+	obj = dmu_object_alloc(os, DMU_OT_UINT64_OTHER, 0, DMU_OT_NONE, 0, tx);
+	dmu_write(os, obj, 0, MIN(ZBENCH_FILESIZE, zopt_recsize), zt->zt_buf,
+	    tx);
+	VERIFY(zap_add(os, ZBENCH_DIROBJ, name, sizeof (uint64_t), 1,
+	    &obj, tx) == 0);
+	if (old != 0) {
+		VERIFY(zap_remove(os, ZBENCH_DIROBJ, oldname, tx) == 0);
+		VERIFY(dmu_object_free(os, old, tx) == 0);
+	}
+	dmu_tx_commit(tx);
+
+	zt->zt_files[slot] = obj;
+	zt->zt_count++;
+	zbench_record(zt, start, ZBENCH_FILESIZE);
+	return (0);
+}
+
+static void
+zbench_fini_create(zbench_thread_t *zt)
+{
+	char name[32];
+	dmu_tx_t *tx;
+	uint64_t n, slot;
+
+	for (n = zt->zt_count - MIN(zt->zt_count, ZBENCH_FILES);
+	    n < zt->zt_count; n++) {
+		slot = n % ZBENCH_FILES;
+		(void) snprintf(name, sizeof (name), "%d.%llu", zt->zt_id,
+		    (u_longlong_t)n);
+		tx = dmu_tx_create(zbench_os);
+		dmu_tx_hold_zap(tx, ZBENCH_DIROBJ, B_FALSE, name);
+		dmu_tx_hold_free(tx, zt->zt_files[slot], 0, DMU_OBJECT_END);
+		if (dmu_tx_assign(tx, TXG_WAIT) != 0) {
+			dmu_tx_abort(tx);
+			return;
+		}
+		VERIFY(zap_remove(zbench_os, ZBENCH_DIROBJ, name, tx) == 0);
+		VERIFY(dmu_object_free(zbench_os, zt->zt_files[slot], tx) == 0);
+		dmu_tx_commit(tx);
+	}
+}
+
+/*
+ * Directory churn without the objects: each operation adds a name to
+ * the shared directory ZAP and removes the one the thread added
+ * ZBENCH_FILES operations earlier, so with several threads the fat-ZAP
+ * leaves keep splitting under concurrent adds and removes.  Each entry
+ * holds its own sequence number; when the time is up every name a
+ * thread still has is looked up, so an entry lost in a split is caught.
+ */
+static int
+zbench_zapchurn(zbench_thread_t *zt)
+{
+	objset_t *os = zbench_os;
+	char name[32], oldname[32];
+	hrtime_t start = gethrtime();
+	boolean_t remove = (zt->zt_count >= ZBENCH_FILES);
+	dmu_tx_t *tx;
+	int error;
+
+	(void) snprintf(name, sizeof (name), "z%d.%llu", zt->zt_id,
+	    (u_longlong_t)zt->zt_count);
+	(void) snprintf(oldname, sizeof (oldname), "z%d.%llu", zt->zt_id,
+	    (u_longlong_t)(zt->zt_count - ZBENCH_FILES));
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_zap(tx, ZBENCH_DIROBJ, B_TRUE, name);
+	if (remove)
+		dmu_tx_hold_zap(tx, ZBENCH_DIROBJ, B_FALSE, oldname);
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error) {
+		dmu_tx_abort(tx);
+		return (error);
+	}
+
+	error = zap_add(os, ZBENCH_DIROBJ, name, sizeof (uint64_t), 1,
+	    &zt->zt_count, tx);
+	if (error != 0)
+		fatal(0, "zap_add(%s) = %d", name, error);
+	if (remove &&
+	    (error = zap_remove(os, ZBENCH_DIROBJ, oldname, tx)) != 0)
+		fatal(0, "lost directory entry %s: zap_remove() = %d",
+		    oldname, error);
+	dmu_tx_commit(tx);
+
+	zt->zt_count++;
+	zbench_record(zt, start, 0);
+	return (0);
+}
+
+static void
+zbench_fini_zapchurn(zbench_thread_t *zt)
+{
+	char name[32];
+	dmu_tx_t *tx;
+	uint64_t n, value = 0;
+	int error;
+
+	for (n = zt->zt_count - MIN(zt->zt_count, ZBENCH_FILES);
+	    n < zt->zt_count; n++) {
+		(void) snprintf(name, sizeof (name), "z%d.%llu", zt->zt_id,
+		    (u_longlong_t)n);
+		error = zap_lookup(zbench_os, ZBENCH_DIROBJ, name,
+		    sizeof (uint64_t), 1, &value);
+		if (error != 0 || value != n)
+			fatal(0, "lost directory entry %s: zap_lookup() = %d, "
+			    "value %llu", name, error, (u_longlong_t)value);
+
+		tx = dmu_tx_create(zbench_os);
+		dmu_tx_hold_zap(tx, ZBENCH_DIROBJ, B_FALSE, name);
+		if (dmu_tx_assign(tx, TXG_WAIT) != 0) {
+			dmu_tx_abort(tx);
+			return;
+		}
+		VERIFY(zap_remove(zbench_os, ZBENCH_DIROBJ, name, tx) == 0);
+		dmu_tx_commit(tx);
+	}
+}
+
+/*
+ * An fsync storm: every write is logged and committed to the ZIL before
+ * the next one is issued.
+ */
+static int
+zbench_fsync(zbench_thread_t *zt)
+{
+	objset_t *os = zbench_os;
+	uint64_t off = zbench_next_offset(zt);
+	hrtime_t start = gethrtime();
+	lr_write_t *lr;
+	itx_t *itx;
+	dmu_tx_t *tx;
+	uint64_t seq;
+	int error;
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_write(tx, zt->zt_object, off, zopt_recsize);
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error) {
+		dmu_tx_abort(tx);
+		return (error);
+	}
+	dmu_write(os, zt->zt_object, off, zopt_recsize, zt->zt_buf, tx);
+
+	itx = zil_itx_create(TX_WRITE, sizeof (*lr) + zopt_recsize);
+	itx->itx_wr_state = WR_COPIED;
+	lr = (lr_write_t *)&itx->itx_lr;
+	lr->lr_foid = zt->zt_object;
+	lr->lr_offset = off;
+	lr->lr_length = zopt_recsize;
+	lr->lr_blkoff = 0;
+	BP_ZERO(&lr->lr_blkptr);
+	bcopy(zt->zt_buf, lr + 1, zopt_recsize);
+	seq = zil_itx_assign(zbench_zilog, itx, tx);
+	dmu_tx_commit(tx);
+
+	zil_commit(zbench_zilog, seq, zt->zt_object);
+	zbench_record(zt, start, zopt_recsize);
+	return (0);
+}
+
+/*
+ * Snapshot churn: write a record, snapshot the dataset, and destroy the
+ * snapshot the previous operation took.
+ */
+static int
+zbench_snapshot(zbench_thread_t *zt)
+{
+	char snapname[MAXNAMELEN];
+	hrtime_t start = gethrtime();
+	int error;
+
+	if ((error = zbench_write(zt, zbench_next_offset(zt))) != 0)
+		return (error);
+
+	(void) snprintf(snapname, sizeof (snapname), "%d.%llu", zt->zt_id,
+	    (u_longlong_t)zt->zt_count);
+	if ((error = dmu_objset_snapshot(zbench_dsname, snapname,
+	    B_FALSE)) != 0)
+		return (error);
+	if (zt->zt_count != 0) {
+		(void) snprintf(snapname, sizeof (snapname), "%s@%d.%llu",
+		    zbench_dsname, zt->zt_id, (u_longlong_t)zt->zt_count - 1);
+		if ((error = dmu_objset_destroy(snapname)) != 0)
+			return (error);
+	}
+	zt->zt_count++;
+
+	zbench_record(zt, start, zopt_recsize);
+	return (0);
+}
+
+static void
+zbench_fini_snapshot(zbench_thread_t *zt)
+{
+	char snapname[MAXNAMELEN];
+
+	if (zt->zt_count != 0) {
+		(void) snprintf(snapname, sizeof (snapname), "%s@%d.%llu",
+		    zbench_dsname, zt->zt_id, (u_longlong_t)zt->zt_count - 1);
+		(void) dmu_objset_destroy(snapname);
+	}
+	zbench_fini_object(zt);
+}
+
+/* ARGSUSED */
+static int
+zbench_traverse_cb(traverse_blk_cache_t *bc, spa_t *spa, void *arg)
+{
+	uint64_t *bytes = arg;
+
+	if (bc->bc_errno)
+		return (ERESTART);
+	if (bc->bc_bookmark.zb_level >= 0 && bc->bc_blkptr.blk_birth != 0)
+		*bytes += BP_GET_LSIZE(&bc->bc_blkptr);
+	return (0);
+}
+
+/*
+ * Walk the whole pool, reading data blocks too, from a cold ARC.
+ */
+static int
+zbench_traverse(zbench_thread_t *zt)
+{
+	traverse_handle_t *th;
+	uint64_t bytes = 0;
+	hrtime_t start;
+	int error;
+
+	arc_flush();
+	start = gethrtime();
+	th = traverse_init(dmu_objset_spa(zbench_os), zbench_traverse_cb,
+	    &bytes, ADVANCE_PRE | ADVANCE_DATA, ZIO_FLAG_CANFAIL);
+	traverse_add_pool(th, 0, -1ULL);
+	while ((error = traverse_more(th)) == EAGAIN)
+		continue;
+	traverse_fini(th);
+
+	if (error == 0)
+		zbench_record(zt, start, bytes);
+	return (error);
+}
+
+static int
+zbench_scrub(zbench_thread_t *zt)
+{
+	spa_t *spa = dmu_objset_spa(zbench_os);
+	hrtime_t start = gethrtime();
+	vdev_stat_t vs;
+	int error;
+
+	mutex_enter(&spa_namespace_lock);
+	error = spa_scrub(spa, POOL_SCRUB_EVERYTHING, B_FALSE);
+	mutex_exit(&spa_namespace_lock);
+	if (error)
+		return (error);
+
+	mutex_enter(&spa->spa_scrub_lock);
+	while (spa->spa_scrub_thread != NULL)
+		cv_wait(&spa->spa_scrub_cv, &spa->spa_scrub_lock);
+	mutex_exit(&spa->spa_scrub_lock);
+
+	zbench_vdev_stats(&vs);
+	zbench_record(zt, start, vs.vs_scrub_examined);
+	return (0);
+}
+
+/*
+ * All threads hold and release dbufs of the same few cached blocks, so
+ * the cost is dominated by the dnode and dbuf refcounts and hash locks;
+ * this is the workload to compare tracked and atomic refcount_t builds.
+ * Thread 0 creates and fills the object; the others share it.
+ */
+static uint64_t zbench_hold_object;
+
+static void
+zbench_setup_hold(zbench_thread_t *zt)
+{
+	uint64_t off;
+
+	if (zt->zt_id != 0) {
+		zt->zt_object = zbench_hold_object;
+		return;
+	}
+
+	zbench_setup_object(zt);
+	for (off = 0; off < ZBENCH_HOLD_BLOCKS * zopt_recsize;
+	    off += zopt_recsize)
+		if (zbench_write(zt, off) != 0)
+			fatal(0, "can't fill object %llu: out of space",
+			    (u_longlong_t)zt->zt_object);
+	zbench_hold_object = zt->zt_object;
+}
+
+static void
+zbench_fini_hold(zbench_thread_t *zt)
+{
+	if (zt->zt_id == 0)
+		zbench_fini_object(zt);
+}
+
+static int
+zbench_hold(zbench_thread_t *zt)
+{
+	uint64_t off = zbench_random(zt, ZBENCH_HOLD_BLOCKS) * zopt_recsize;
+	hrtime_t start = gethrtime();
+	dmu_buf_t *db;
+	int error;
+
+	error = dmu_buf_hold(zbench_os, zt->zt_object, off, FTAG, &db);
+	if (error)
+		return (error);
+	dmu_buf_rele(db, FTAG);
+	zbench_record(zt, start, 0);
+	return (0);
+}
+
+/*
+ * Create zopt_datasets empty datasets, then repeatedly export the pool
+ * (which empties the ARC) and time importing it and opening every
+ * dataset, as an import followed by mount -a would.
+ */
+/* ARGSUSED */
+static void
+zbench_setup_import(zbench_thread_t *zt)
+{
+	char name[MAXNAMELEN];
+	int d, error;
+
+	for (d = 0; d < zopt_datasets; d++) {
+		(void) snprintf(name, sizeof (name), "%s/%d",
+		    zbench_dsname, d);
+		error = dmu_objset_create(name, DMU_OST_OTHER, NULL,
+		    NULL, NULL);
+		if (error)
+			fatal(0, "dmu_objset_create(%s) = %d", name, error);
+	}
+}
+
+/* ARGSUSED */
+static void
+zbench_fini_import(zbench_thread_t *zt)
+{
+	char name[MAXNAMELEN];
+	int d;
+
+	for (d = 0; d < zopt_datasets; d++) {
+		(void) snprintf(name, sizeof (name), "%s/%d",
+		    zbench_dsname, d);
+		(void) dmu_objset_destroy(name);
+	}
+}
+
+/* ARGSUSED */
+static int
+zbench_import_cb(char *name, void *arg)
+{
+	objset_t *os;
+
+	if (dmu_objset_open(name, DMU_OST_ANY,
+	    DS_MODE_STANDARD | DS_MODE_READONLY, &os) == 0)
+		dmu_objset_close(os);
+	return (0);
+}
+
+static int
+zbench_import(zbench_thread_t *zt)
+{
+	nvlist_t *config;
+	hrtime_t start;
+	int error;
+
+	/* the new spa starts its vdev counters from zero */
+	zbench_vdev_stats(&zbench_vdev_carry);
+
+	zbench_close();
+	if ((error = spa_export(zopt_pool, &config)) != 0)
+		fatal(0, "spa_export(%s) = %d", zopt_pool, error);
+
+	start = gethrtime();
+	error = spa_import(zopt_pool, config, NULL);
+	nvlist_free(config);
+	if (error)
+		fatal(0, "spa_import(%s) = %d", zopt_pool, error);
+	(void) dmu_objset_find(zopt_pool, zbench_import_cb, NULL,
+	    DS_FIND_CHILDREN);
+	zbench_record(zt, start, 0);
+
+	zbench_open();
+	return (0);
+}
+
+/*
+ * "snapone" and "snapbatch" take snapshots of the zopt_datasets datasets
+ * made by zbench_setup_import(), round after round.  zt_count is the
+ * number of snapshots asked for so far; snapshot n is named after its
+ * round, n / zopt_datasets.  "snapone" takes one snapshot per
+ * dmu_objset_snapshot() call, so each waits for a txg of its own;
+ * "snapbatch" takes a whole round with one dmu_objset_snapshot_batch()
+ * call, and its latencies are per round rather than per snapshot.
+ */
+static int
+zbench_snapone(zbench_thread_t *zt)
+{
+	char fsname[MAXNAMELEN];
+	char snapname[MAXNAMELEN];
+	hrtime_t start = gethrtime();
+	int error;
+
+	(void) snprintf(fsname, sizeof (fsname), "%s/%llu", zbench_dsname,
+	    (u_longlong_t)(zt->zt_count % zopt_datasets));
+	(void) snprintf(snapname, sizeof (snapname), "%llu",
+	    (u_longlong_t)(zt->zt_count / zopt_datasets));
+	zt->zt_count++;
+
+	if ((error = dmu_objset_snapshot(fsname, snapname, B_FALSE)) != 0)
+		return (error);
+
+	zbench_record(zt, start, 0);
+	return (0);
+}
+
+static int
+zbench_snapbatch(zbench_thread_t *zt)
+{
+	char name[MAXNAMELEN];
+	nvlist_t *snaps, *errors;
+	nvpair_t *elem;
+	hrtime_t start;
+	uint64_t round = zt->zt_count / zopt_datasets;
+	int d, failed, error;
+
+	VERIFY(nvlist_alloc(&snaps, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+	VERIFY(nvlist_alloc(&errors, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+	for (d = 0; d < zopt_datasets; d++) {
+		(void) snprintf(name, sizeof (name), "%s/%d@%llu",
+		    zbench_dsname, d, (u_longlong_t)round);
+		VERIFY(nvlist_add_boolean(snaps, name) == 0);
+	}
+	zt->zt_count += zopt_datasets;
+
+	start = gethrtime();
+	error = dmu_objset_snapshot_batch(snaps, errors);
+
+	failed = 0;
+	for (elem = NULL; (elem = nvlist_next_nvpair(errors, elem)) != NULL; )
+		failed++;
+	if (failed < zopt_datasets)
+		zbench_record(zt, start, 0);
+
+	/*
+	 * zbench_record() counted one op and zbench_run_thread() will
+	 * count one error; account for the rest of the round.
+	 */
+	mutex_enter(&zt->zt_lock);
+	if (failed < zopt_datasets)
+		zt->zt_ops += zopt_datasets - 1 - failed;
+	if (failed > 1)
+		zt->zt_errors += failed - 1;
+	mutex_exit(&zt->zt_lock);
+
+	nvlist_free(errors);
+	nvlist_free(snaps);
+	return (error);
+}
+
+static void
+zbench_fini_snapmany(zbench_thread_t *zt)
+{
+	char fsname[MAXNAMELEN];
+	char snapname[MAXNAMELEN];
+	uint64_t round;
+
+	for (round = 0; round * zopt_datasets < zt->zt_count; round++) {
+		(void) strcpy(fsname, zbench_dsname);
+		(void) snprintf(snapname, sizeof (snapname), "%llu",
+		    (u_longlong_t)round);
+		(void) dmu_snapshots_destroy(fsname, snapname);
+	}
+	zbench_fini_import(zt);
+}
+
+/*
+ * Build an exported pool on zopt_labelvdevs files of their own, for
+ * zpool_find_import() to find.  The files are the smallest a vdev can
+ * be; only their labels are read.
+ */
+/* ARGSUSED */
+static void
+zbench_setup_labelscan(zbench_thread_t *zt)
+{
+	char path[MAXPATHLEN];
+	char *dir = zbench_label_dir;
+	nvlist_t *root, **child;
+	int c, fd, error;
+
+	if (zbench_zfs == NULL && (zbench_zfs = libzfs_init()) == NULL)
+		fatal(0, "labelscan needs libzfs, which can't open %s",
+		    ZFS_DEV);
+
+	(void) snprintf(zbench_label_pool, sizeof (zbench_label_pool),
+	    "%s_labels", zopt_pool);
+	(void) snprintf(zbench_label_dir, sizeof (zbench_label_dir),
+	    zbench_label_template, zopt_dir, zopt_pool);
+	if (mkdir(zbench_label_dir, 0755) != 0 && errno != EEXIST)
+		fatal(1, "can't create %s", zbench_label_dir);
+
+	child = umem_alloc(zopt_labelvdevs * sizeof (nvlist_t *),
+	    UMEM_NOFAIL);
+	for (c = 0; c < zopt_labelvdevs; c++) {
+		(void) snprintf(path, sizeof (path), "%s/%d",
+		    zbench_label_dir, c);
+		fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+		if (fd == -1)
+			fatal(1, "can't open %s", path);
+		if (ftruncate(fd, SPA_MINDEVSIZE) != 0)
+			fatal(1, "can't ftruncate %s", path);
+		(void) close(fd);
+
+		VERIFY(nvlist_alloc(&child[c], NV_UNIQUE_NAME, 0) == 0);
+		VERIFY(nvlist_add_string(child[c], ZPOOL_CONFIG_TYPE,
+		    VDEV_TYPE_FILE) == 0);
+		VERIFY(nvlist_add_string(child[c], ZPOOL_CONFIG_PATH,
+		    path) == 0);
+	}
+	VERIFY(nvlist_alloc(&root, NV_UNIQUE_NAME, 0) == 0);
+	VERIFY(nvlist_add_string(root, ZPOOL_CONFIG_TYPE, VDEV_TYPE_ROOT) == 0);
+	VERIFY(nvlist_add_nvlist_array(root, ZPOOL_CONFIG_CHILDREN,
+	    child, zopt_labelvdevs) == 0);
+	for (c = 0; c < zopt_labelvdevs; c++)
+		nvlist_free(child[c]);
+	umem_free(child, zopt_labelvdevs * sizeof (nvlist_t *));
+
+	error = spa_create(zbench_label_pool, root, NULL, NULL);
+	nvlist_free(root);
+	if (error)
+		fatal(0, "spa_create(%s) = %d", zbench_label_pool, error);
+	if ((error = spa_export(zbench_label_pool, NULL)) != 0)
+		fatal(0, "spa_export(%s) = %d", zbench_label_pool, error);
+
+	/* a first scan, so that "labelscan" starts with the cache filled */
+	(void) unlink(ZPOOL_LABEL_CACHE);
+	nvlist_free(zpool_find_import(zbench_zfs, 1, &dir));
+}
+
+/* ARGSUSED */
+static void
+zbench_fini_labelscan(zbench_thread_t *zt)
+{
+	char path[MAXPATHLEN];
+	char *dir = zbench_label_dir;
+	int c;
+
+	for (c = 0; c < zopt_labelvdevs; c++) {
+		(void) snprintf(path, sizeof (path), "%s/%d",
+		    zbench_label_dir, c);
+		(void) unlink(path);
+	}
+	(void) rmdir(zbench_label_dir);
+
+	/* let the cache forget the files */
+	nvlist_free(zpool_find_import(zbench_zfs, 1, &dir));
+}
+
+static int
+zbench_labelscan_common(zbench_thread_t *zt, boolean_t cold)
+{
+	char *dir = zbench_label_dir;
+	nvlist_t *pools, *config;
+	nvpair_t *elem = NULL;
+	hrtime_t start;
+	char *name;
+	boolean_t found = B_FALSE;
+
+	if (cold)
+		(void) unlink(ZPOOL_LABEL_CACHE);
+
+	start = gethrtime();
+	pools = zpool_find_import(zbench_zfs, 1, &dir);
+	zbench_record(zt, start, 0);
+
+	while (pools != NULL &&
+	    (elem = nvlist_next_nvpair(pools, elem)) != NULL) {
+		if (nvpair_value_nvlist(elem, &config) == 0 &&
+		    nvlist_lookup_string(config, ZPOOL_CONFIG_POOL_NAME,
+		    &name) == 0 && strcmp(name, zbench_label_pool) == 0)
+			found = B_TRUE;
+	}
+	nvlist_free(pools);
+	if (!found)
+		fatal(0, "zpool_find_import(%s) didn't find %s", dir,
+		    zbench_label_pool);
+
+	return (0);
+}
+
+static int
+zbench_labelscan(zbench_thread_t *zt)
+{
+	return (zbench_labelscan_common(zt, B_FALSE));
+}
+
+static int
+zbench_labelscancold(zbench_thread_t *zt)
+{
+	return (zbench_labelscan_common(zt, B_TRUE));
+}
+
+/*
+ * Each op is ZBENCH_CONFIG_HOLDS read holds of the config lock; a single
+ * hold is too short to time on its own.
+ */
+static int
+zbench_config(zbench_thread_t *zt)
+{
+	spa_t *spa = dmu_objset_spa(zbench_os);
+	hrtime_t start = gethrtime();
+	int i;
+
+	for (i = 0; i < ZBENCH_CONFIG_HOLDS; i++) {
+		spa_config_enter(spa, RW_READER, FTAG);
+		spa_config_exit(spa, FTAG);
+	}
+	zbench_record(zt, start, 0);
+	return (0);
+}
+
+/*
+ * The directory "dirscan" and "dirscanra" walk, filled by the single
+ * thread's setup with one object per entry, allocated in entry order.
+ */
+static uint64_t zbench_dir;
+static uint64_t *zbench_dir_objs;
+
+static void
+zbench_setup_dirscan(zbench_thread_t *zt)
+{
+	objset_t *os = zbench_os;
+	char name[32];
+	dmu_tx_t *tx;
+	uint64_t n;
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_zap(tx, DMU_NEW_OBJECT, B_TRUE, NULL);
+	if (dmu_tx_assign(tx, TXG_WAIT) != 0)
+		fatal(0, "can't create a directory: out of space");
+	zbench_dir = zap_create(os, DMU_OT_ZAP_OTHER, DMU_OT_NONE, 0, tx);
+	dmu_tx_commit(tx);
+
+	zbench_dir_objs = umem_alloc(zopt_dirents * sizeof (uint64_t),
+	    UMEM_NOFAIL);
+	for (n = 0; n < zopt_dirents; n++) {
+		(void) snprintf(name, sizeof (name), "%llu", (u_longlong_t)n);
+		tx = dmu_tx_create(os);
+		dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
+		dmu_tx_hold_zap(tx, zbench_dir, B_TRUE, name);
+		if (dmu_tx_assign(tx, TXG_WAIT) != 0)
+			fatal(0, "can't fill the directory: out of space");
+		zbench_dir_objs[n] = dmu_object_alloc(os, DMU_OT_UINT64_OTHER,
+		    0, DMU_OT_UINT64_OTHER, ZBENCH_BONUSLEN, tx);
+		VERIFY(zap_add(os, zbench_dir, name, sizeof (uint64_t), 1,
+		    &zbench_dir_objs[n], tx) == 0);
+		dmu_tx_commit(tx);
+	}
+	zt->zt_count = zopt_dirents;
+}
+
+static void
+zbench_fini_dirscan(zbench_thread_t *zt)
+{
+	objset_t *os = zbench_os;
+	dmu_tx_t *tx;
+	uint64_t n;
+
+	for (n = 0; n < zopt_dirents; n++) {
+		tx = dmu_tx_create(os);
+		dmu_tx_hold_free(tx, zbench_dir_objs[n], 0, DMU_OBJECT_END);
+		if (dmu_tx_assign(tx, TXG_WAIT) != 0) {
+			dmu_tx_abort(tx);
+			break;
+		}
+		VERIFY(dmu_object_free(os, zbench_dir_objs[n], tx) == 0);
+		dmu_tx_commit(tx);
+	}
+	umem_free(zbench_dir_objs, zopt_dirents * sizeof (uint64_t));
+	zbench_dir_objs = NULL;
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_free(tx, zbench_dir, 0, DMU_OBJECT_END);
+	if (dmu_tx_assign(tx, TXG_WAIT) != 0) {
+		dmu_tx_abort(tx);
+		return;
+	}
+	VERIFY(zap_destroy(os, zbench_dir, tx) == 0);
+	dmu_tx_commit(tx);
+}
+
+static int
+zbench_dirscan_common(zbench_thread_t *zt, boolean_t readahead)
+{
+	objset_t *os = zbench_os;
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	zap_ra_t *ra = NULL;
+	dmu_buf_t *db;
+	hrtime_t start;
+	uint64_t n = 0;
+	int error;
+
+	arc_flush();
+	start = gethrtime();
+	if (readahead)
+		ra = zap_ra_init(os, zbench_dir, 0, ZBENCH_DIR_RA_WINDOW);
+	for (zap_cursor_init(&zc, os, zbench_dir);
+	    (error = zap_cursor_retrieve(&zc, &za)) == 0;
+	    zap_cursor_advance(&zc)) {
+		if (ra == NULL)
+			dmu_prefetch(os, za.za_first_integer, 0, 0);
+		error = dmu_bonus_hold(os, za.za_first_integer, FTAG, &db);
+		if (error)
+			break;
+		dmu_buf_rele(db, FTAG);
+		zap_ra_advance(ra);
+		n++;
+	}
+	zap_cursor_fini(&zc);
+	zap_ra_fini(ra);
+
+	if (error != ENOENT)
+		return (error);
+	if (n != zt->zt_count)
+		fatal(0, "directory scan found %llu of %llu entries",
+		    (u_longlong_t)n, (u_longlong_t)zt->zt_count);
+
+	zbench_record(zt, start, 0);
+	mutex_enter(&zt->zt_lock);
+	zt->zt_ops += n - 1;
+	mutex_exit(&zt->zt_lock);
+	return (0);
+}
+
+static int
+zbench_dirscan(zbench_thread_t *zt)
+{
+	return (zbench_dirscan_common(zt, B_FALSE));
+}
+
+static int
+zbench_dirscanra(zbench_thread_t *zt)
+{
+	return (zbench_dirscan_common(zt, B_TRUE));
+}
+
+/*
+ * Thread 0 packs the pool config, with its vdev stats, once; every
+ * thread then unpacks the same buffer and walks the top level of the
+ * result.  The borrowed unpack leaves the buffer untouched, so it can
+ * be shared.
+ */
+static char *zbench_packed;
+static size_t zbench_packed_len;
+
+static void
+zbench_setup_unpack(zbench_thread_t *zt)
+{
+	nvlist_t *config;
+	int error;
+
+	if (zt->zt_id != 0)
+		return;
+
+	if ((error = spa_get_stats(zopt_pool, &config, NULL, 0)) != 0)
+		fatal(0, "spa_get_stats(%s) = %d", zopt_pool, error);
+	VERIFY(nvlist_size(config, &zbench_packed_len,
+	    NV_ENCODE_NATIVE) == 0);
+	zbench_packed = kmem_alloc(zbench_packed_len, KM_SLEEP);
+	VERIFY(nvlist_pack(config, &zbench_packed, &zbench_packed_len,
+	    NV_ENCODE_NATIVE, KM_SLEEP) == 0);
+	nvlist_free(config);
+}
+
+static void
+zbench_fini_unpack(zbench_thread_t *zt)
+{
+	if (zt->zt_id != 0)
+		return;
+
+	kmem_free(zbench_packed, zbench_packed_len);
+	zbench_packed = NULL;
+}
+
+static int
+zbench_unpack_common(zbench_thread_t *zt, boolean_t borrow)
+{
+	hrtime_t start = gethrtime();
+	nvlist_t *nvl;
+	nvpair_t *elem;
+	int error;
+
+	if (borrow)
+		error = nvlist_unpack_borrowed(zbench_packed,
+		    zbench_packed_len, &nvl, KM_SLEEP);
+	else
+		error = nvlist_unpack(zbench_packed, zbench_packed_len,
+		    &nvl, KM_SLEEP);
+	if (error)
+		return (error);
+	for (elem = NULL; (elem = nvlist_next_nvpair(nvl, elem)) != NULL; )
+		continue;
+	nvlist_free(nvl);
+
+	zbench_record(zt, start, zbench_packed_len);
+	return (0);
+}
+
+static int
+zbench_unpack(zbench_thread_t *zt)
+{
+	return (zbench_unpack_common(zt, B_FALSE));
+}
+
+static int
+zbench_unpackborrow(zbench_thread_t *zt)
+{
+	return (zbench_unpack_common(zt, B_TRUE));
+}
+
+/*
+ * =========================================================================
+ * Running and reporting
+ * =========================================================================
+ */
+static zbench_workload_t *zbench_current;
+
+static void *
+zbench_run_thread(void *arg)
+{
+	zbench_thread_t *zt = arg;
+	zbench_workload_t *zw = zbench_current;
+	int error;
+
+	do {
+		if ((error = zw->zw_op(zt)) != 0) {
+			mutex_enter(&zt->zt_lock);
+			zt->zt_errors++;
+			mutex_exit(&zt->zt_lock);
+			if (error == ENOSPC)
+				break;
+		}
+	} while (gethrtime() < zt->zt_stop);
+
+	if (zw->zw_drain != NULL)
+		zw->zw_drain(zt);
+
+	return (NULL);
+}
+
+static int
+zbench_hrtime_compare(const void *a, const void *b)
+{
+	hrtime_t x = *(const hrtime_t *)a;
+	hrtime_t y = *(const hrtime_t *)b;
+
+	return (x < y ? -1 : x > y ? 1 : 0);
+}
+
+static uint64_t
+zbench_usec(struct timeval *tv)
+{
+	return ((uint64_t)tv->tv_sec * MICROSEC + tv->tv_usec);
+}
+
+static void
+zbench_vdev_stats(vdev_stat_t *vs)
+{
+	spa_t *spa = dmu_objset_spa(zbench_os);
+	int t;
+
+	spa_config_enter(spa, RW_READER, FTAG);
+	vdev_get_stats(spa->spa_root_vdev, vs);
+	spa_config_exit(spa, FTAG);
+
+	for (t = 0; t < ZIO_TYPES; t++) {
+		vs->vs_ops[t] += zbench_vdev_carry.vs_ops[t];
+		vs->vs_bytes[t] += zbench_vdev_carry.vs_bytes[t];
+	}
+}
+
+/*
+ * Read ops so far of each leaf vdev, in pool order.
+ */
+static void
+zbench_leaf_reads(uint64_t *ops)
+{
+	spa_t *spa = dmu_objset_spa(zbench_os);
+	vdev_t *rvd = spa->spa_root_vdev;
+	vdev_t *tvd, *vd;
+	vdev_stat_t vs;
+	int c, l, n = 0;
+
+	spa_config_enter(spa, RW_READER, FTAG);
+	for (c = 0; c < rvd->vdev_children; c++) {
+		tvd = rvd->vdev_child[c];
+		for (l = 0; l < MAX(tvd->vdev_children, 1); l++) {
+			vd = tvd->vdev_children ? tvd->vdev_child[l] : tvd;
+			vdev_get_stats(vd, &vs);
+			ops[n++] = vs.vs_ops[ZIO_TYPE_READ];
+		}
+	}
+	spa_config_exit(spa, FTAG);
+}
+
+static void
+zbench_run(zbench_workload_t *zw, int nthreads)
+{
+	zbench_thread_t *zt;
+	struct rusage ru0, ru1;
+	vdev_stat_t vs0, vs1;
+	hrtime_t start, end, *lat, lat_total = 0;
+	uint64_t ops = 0, bytes = 0, errors = 0, nlat = 0, cpu, i;
+	uint64_t vdev_read_bytes;
+	int nleaves = zopt_vdevs * MAX(zopt_mirrors, 1);
+	uint64_t *leaf0, *leaf1, leaf_min = -1ULL, leaf_max = 0;
+	uint64_t leaf_slow = 0;
+	double secs, read_ratio;
+	int t;
+
+	leaf0 = umem_alloc(nleaves * sizeof (uint64_t), UMEM_NOFAIL);
+	leaf1 = umem_alloc(nleaves * sizeof (uint64_t), UMEM_NOFAIL);
+
+	zt = umem_zalloc(nthreads * sizeof (zbench_thread_t), UMEM_NOFAIL);
+	for (t = 0; t < nthreads; t++) {
+		zt[t].zt_id = t;
+		zt[t].zt_rand = 0x9e3779b97f4a7c15ULL * (t + 1);
+		zt[t].zt_buf = umem_alloc(zopt_recsize, UMEM_NOFAIL);
+		zt[t].zt_rbuf = umem_alloc(zopt_recsize, UMEM_NOFAIL);
+		mutex_init(&zt[t].zt_lock, NULL, MUTEX_DEFAULT, NULL);
+		cv_init(&zt[t].zt_cv, NULL, CV_DEFAULT, NULL);
+		zbench_fill(&zt[t], zt[t].zt_buf, zopt_recsize);
+		if (zw->zw_setup != NULL)
+			zw->zw_setup(&zt[t]);
+	}
+
+	txg_wait_synced(dmu_objset_pool(zbench_os), 0);
+	if (zw->zw_flags & ZW_COLD)
+		arc_flush();
+
+	zbench_current = zw;
+	zbench_vdev_stats(&vs0);
+	zbench_leaf_reads(leaf0);
+	(void) getrusage(RUSAGE_SELF, &ru0);
+	start = gethrtime();
+
+	for (t = 0; t < nthreads; t++) {
+		zt[t].zt_stop = start + zopt_time * NANOSEC;
+		VERIFY(thr_create(0, 0, zbench_run_thread, &zt[t], THR_BOUND,
+		    &zt[t].zt_tid) == 0);
+	}
+	for (t = 0; t < nthreads; t++)
+		VERIFY(thr_join(zt[t].zt_tid, NULL, NULL) == 0);
+
+	end = gethrtime();
+	(void) getrusage(RUSAGE_SELF, &ru1);
+	zbench_vdev_stats(&vs1);
+	zbench_leaf_reads(leaf1);
+
+	/*
+	 * An import in the middle of the run resets the leaves' stats.
+	 */
+	for (t = 0; t < nleaves; t++) {
+		uint64_t reads = leaf1[t] >= leaf0[t] ?
+		    leaf1[t] - leaf0[t] : leaf1[t];
+
+		leaf_min = MIN(leaf_min, reads);
+		leaf_max = MAX(leaf_max, reads);
+		if (zopt_slow != 0 && zopt_mirrors >= 2 &&
+		    t % zopt_mirrors == 0)
+			leaf_slow += reads;
+	}
+	umem_free(leaf0, nleaves * sizeof (uint64_t));
+	umem_free(leaf1, nleaves * sizeof (uint64_t));
+
+	for (t = 0; t < nthreads; t++) {
+		ops += zt[t].zt_ops;
+		bytes += zt[t].zt_bytes;
+		errors += zt[t].zt_errors;
+		nlat += zt[t].zt_nlat;
+	}
+	lat = umem_alloc(MAX(nlat, 1) * sizeof (hrtime_t), UMEM_NOFAIL);
+	for (nlat = 0, t = 0; t < nthreads; t++) {
+		if (zt[t].zt_lat == NULL)
+			continue;
+		bcopy(zt[t].zt_lat, lat + nlat,
+		    zt[t].zt_nlat * sizeof (hrtime_t));
+		nlat += zt[t].zt_nlat;
+	}
+	qsort(lat, nlat, sizeof (hrtime_t), zbench_hrtime_compare);
+	for (i = 0; i < nlat; i++)
+		lat_total += lat[i];
+
+	secs = (double)(end - start) / NANOSEC;
+	cpu = zbench_usec(&ru1.ru_utime) + zbench_usec(&ru1.ru_stime) -
+	    zbench_usec(&ru0.ru_utime) - zbench_usec(&ru0.ru_stime);
+
+	/*
+	 * A cold read workload that reads far less from the vdevs than it
+	 * hands back was served by something other than the disks, most
+	 * likely holes left by compressing all-zero records.
+	 */
+	vdev_read_bytes = vs1.vs_bytes[ZIO_TYPE_READ] -
+	    vs0.vs_bytes[ZIO_TYPE_READ];
+	read_ratio = bytes == 0 ? 0.0 : (double)vdev_read_bytes / bytes;
+	if ((zw->zw_flags & ZW_COLD) && bytes != 0 && read_ratio < 0.05)
+		(void) fprintf(stderr, "%s: warning: %s read %llu bytes "
+		    "from the vdevs for %llu logical bytes\n", cmdname,
+		    zw->zw_name, (u_longlong_t)vdev_read_bytes,
+		    (u_longlong_t)bytes);
+
+#define	ZB_PCT(pm)	(nlat == 0 ? 0 : lat[(nlat - 1) * (pm) / 1000] / 1000)
+
+	(void) printf("workload=%s threads=%d recsize=%llu compress=%s "
+	    "checksum=%s loan=%d refcount=%s secs=%.3f ops=%llu bytes=%llu "
+	    "errors=%llu ops_per_sec=%.1f bytes_per_sec=%.0f "
+	    "lat_avg_us=%llu lat_p50_us=%llu lat_p90_us=%llu "
+	    "lat_p99_us=%llu lat_p999_us=%llu lat_max_us=%llu "
+	    "cpu_us_per_op=%.1f vdev_read_ops=%llu vdev_read_bytes=%llu "
+	    "vdev_read_per_byte=%.3f vdev_write_ops=%llu "
+	    "vdev_write_bytes=%llu leaf_read_ops_min=%llu "
+	    "leaf_read_ops_max=%llu slow_leaf_read_ops=%llu\n",
+	    zw->zw_name, nthreads, (u_longlong_t)zopt_recsize,
+	    zio_compress_table[zopt_compress].ci_name,
+	    zio_checksum_table[zopt_checksum].ci_name, zopt_loan,
+#ifdef ZFS_REFCOUNT_TRACKING
+	    "tracked",
+#else
+	    "atomic",
+#endif
+	    secs, (u_longlong_t)ops, (u_longlong_t)bytes,
+	    (u_longlong_t)errors, ops / secs, bytes / secs,
+	    (u_longlong_t)(nlat == 0 ? 0 : lat_total / nlat / 1000),
+	    (u_longlong_t)ZB_PCT(500), (u_longlong_t)ZB_PCT(900),
+	    (u_longlong_t)ZB_PCT(990), (u_longlong_t)ZB_PCT(999),
+	    (u_longlong_t)ZB_PCT(1000),
+	    ops == 0 ? 0.0 : (double)cpu / ops,
+	    (u_longlong_t)(vs1.vs_ops[ZIO_TYPE_READ] -
+	    vs0.vs_ops[ZIO_TYPE_READ]),
+	    (u_longlong_t)vdev_read_bytes, read_ratio,
+	    (u_longlong_t)(vs1.vs_ops[ZIO_TYPE_WRITE] -
+	    vs0.vs_ops[ZIO_TYPE_WRITE]),
+	    (u_longlong_t)(vs1.vs_bytes[ZIO_TYPE_WRITE] -
+	    vs0.vs_bytes[ZIO_TYPE_WRITE]),
+	    (u_longlong_t)leaf_min, (u_longlong_t)leaf_max,
+	    (u_longlong_t)leaf_slow);
+	(void) fflush(stdout);
+
+#undef	ZB_PCT
+
+	umem_free(lat, MAX(nlat, 1) * sizeof (hrtime_t));
+	for (t = 0; t < nthreads; t++) {
+		if (zw->zw_fini != NULL)
+			zw->zw_fini(&zt[t]);
+		if (zt[t].zt_lat != NULL)
+			umem_free(zt[t].zt_lat,
+			    zt[t].zt_maxlat * sizeof (hrtime_t));
+		umem_free(zt[t].zt_buf, zopt_recsize);
+		umem_free(zt[t].zt_rbuf, zopt_recsize);
+		mutex_destroy(&zt[t].zt_lock);
+		cv_destroy(&zt[t].zt_cv);
+	}
+	umem_free(zt, nthreads * sizeof (zbench_thread_t));
+	txg_wait_synced(dmu_objset_pool(zbench_os), 0);
+}
+
+/*
+ * Run a workload once for each thread count given with -t; the
+ * single-threaded ones run just once.
+ */
+static void
+zbench_sweep(zbench_workload_t *zw)
+{
+	int i;
+
+	if (zw->zw_flags & ZW_SINGLE) {
+		zbench_run(zw, 1);
+		return;
+	}
+	for (i = 0; i < zopt_nsweep; i++)
+		zbench_run(zw, zopt_threads[i]);
+}
+
+int
+main(int argc, char **argv)
+{
+	char *list, *name, *lasts;
+	int w;
+
+	(void) setvbuf(stdout, NULL, _IOLBF, 0);
+
+	process_options(argc, argv);
+
+	/* check the names before spending time on a pool */
+	list = strdup(zopt_workloads);
+	for (name = strtok_r(list, ",", &lasts); name != NULL;
+	    name = strtok_r(NULL, ",", &lasts)) {
+		for (w = 0; w < ZBENCH_WORKLOADS; w++)
+			if (strcmp(name, zbench_workloads[w].zw_name) == 0)
+				break;
+		if (w == ZBENCH_WORKLOADS && strcmp(name, "all") != 0)
+			fatal(0, "unknown workload '%s'", name);
+	}
+	free(list);
+
+	kernel_init(FREAD | FWRITE);
+	zbench_init();
+
+	list = strdup(zopt_workloads);
+	for (name = strtok_r(list, ",", &lasts); name != NULL;
+	    name = strtok_r(NULL, ",", &lasts)) {
+		for (w = 0; w < ZBENCH_WORKLOADS; w++)
+			if (strcmp(name, "all") == 0 ||
+			    strcmp(name, zbench_workloads[w].zw_name) == 0)
+				zbench_sweep(&zbench_workloads[w]);
+	}
+	free(list);
+
+	zbench_fini();
+	kernel_fini();
+
+	return (0);
+}
@@ -0,0 +1,310 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#pragma ident	"%Z%%M%	%I%	%E% SMI"
+
+/*
+ * zmountbench times zfs_foreach_mountpoint(), the scheduler behind
+ * "zfs mount -a", without a pool or the kernel.  It builds handles for a
+ * tree of filesystems, -f children per filesystem and -d levels deep,
+ * with each mountpoint below its parent's, hands them over in a random
+ * order and calls zfs_foreach_mountpoint() with a callback that sleeps
+ * for -s msec in place of a mount.  The tree is visited once
+ * serially and once with each of the listed thread counts; every run
+ * prints one line of key=value pairs, and the parallel runs report
+ * their speedup over the serial one.
+ *
+ * The callback also checks the ordering guarantee: a filesystem must not
+ * be visited before its parent has been, or the run fails.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <libzfs.h>
+
+#include "libzfs_impl.h"
+#include "zfs_prop.h"
+
+#define	ZMB_SWEEP_MAX	16	/* thread counts one -t can list */
+
+static char cmdname[] = "zmountbench";
+static int zopt_fanout = 8;
+static int zopt_depth = 3;
+static int zopt_sleep = 2;		/* msec per mount */
+static int zopt_threads[ZMB_SWEEP_MAX] = { 8 };
+static int zopt_nsweep = 1;
+
+typedef struct zmb_fs {
+	zfs_handle_t	*zf_zhp;
+	int		zf_parent;	/* index, or -1 for the root */
+	boolean_t	zf_done;
+} zmb_fs_t;
+
+static zmb_fs_t *zmb_fs;
+static int zmb_nfs;
+static pthread_mutex_t zmb_lock = PTHREAD_MUTEX_INITIALIZER;
+static int zmb_active;
+static int zmb_maxactive;
+static int zmb_misordered;
+
+static void
+usage(boolean_t requested)
+{
+	FILE *fp = requested ? stdout : stderr;
+
+	(void) fprintf(fp, "Usage: %s\n"
+	    "\t[-f fanout (default: %d)]\n"
+	    "\t[-d depth (default: %d)]\n"
+	    "\t[-s msec_per_mount (default: %d)]\n"
+	    "\t[-t threads[,threads...] (default: %d)]\n"
+	    "\t[-h] (print help)\n",
+	    cmdname, zopt_fanout, zopt_depth, zopt_sleep, zopt_threads[0]);
+	exit(requested ? 0 : 1);
+}
+
+static void
+fatal(const char *message)
+{
+	(void) fprintf(stderr, "%s: %s\n", cmdname, message);
+	exit(3);
+}
+
+static void
+process_options(int argc, char **argv)
+{
+	char *arg, *lasts;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:d:s:t:h")) != EOF) {
+		switch (opt) {
+		case 'f':
+			zopt_fanout = atoi(optarg);
+			break;
+		case 'd':
+			zopt_depth = atoi(optarg);
+			break;
+		case 's':
+			zopt_sleep = atoi(optarg);
+			break;
+		case 't':
+			zopt_nsweep = 0;
+			for (arg = strtok_r(optarg, ",", &lasts); arg != NULL;
+			    arg = strtok_r(NULL, ",", &lasts)) {
+				if (zopt_nsweep == ZMB_SWEEP_MAX)
+					usage(B_FALSE);
+				zopt_threads[zopt_nsweep++] = atoi(arg);
+			}
+			break;
+		case 'h':
+			usage(B_TRUE);
+			break;
+		default:
+			usage(B_FALSE);
+			break;
+		}
+	}
+
+	if (zopt_fanout < 1 || zopt_depth < 0 || zopt_sleep < 0 ||
+	    zopt_nsweep == 0)
+		usage(B_FALSE);
+}
+
+static zfs_handle_t *
+zmb_handle(libzfs_handle_t *hdl, const char *name)
+{
+	zfs_handle_t *zhp;
+	nvlist_t *mp;
+	char path[MAXPATHLEN];
+
+	if ((zhp = calloc(1, sizeof (zfs_handle_t))) == NULL)
+		fatal("out of memory");
+	zhp->zfs_hdl = hdl;
+	(void) strlcpy(zhp->zfs_name, name, sizeof (zhp->zfs_name));
+	zhp->zfs_type = zhp->zfs_head_type = ZFS_TYPE_FILESYSTEM;
+
+	/* a local mountpoint, so zfs_prop_get() returns it as is */
+	(void) snprintf(path, sizeof (path), "/%s", name);
+	if (nvlist_alloc(&zhp->zfs_props, NV_UNIQUE_NAME, 0) != 0 ||
+	    nvlist_alloc(&mp, NV_UNIQUE_NAME, 0) != 0 ||
+	    nvlist_add_string(mp, ZFS_PROP_VALUE, path) != 0 ||
+	    nvlist_add_string(mp, ZFS_PROP_SOURCE, name) != 0 ||
+	    nvlist_add_nvlist(zhp->zfs_props,
+	    zfs_prop_to_name(ZFS_PROP_MOUNTPOINT), mp) != 0)
+		fatal("out of memory");
+	nvlist_free(mp);
+
+	return (zhp);
+}
+
+/*
+ * Add the filesystem 'name' and, below it, the rest of its subtree.
+ */
+static void
+zmb_build(libzfs_handle_t *hdl, const char *name, int parent, int depth)
+{
+	char child[ZFS_MAXNAMELEN];
+	int self = zmb_nfs++;
+	int c;
+
+	zmb_fs[self].zf_zhp = zmb_handle(hdl, name);
+	zmb_fs[self].zf_parent = parent;
+
+	if (depth == zopt_depth)
+		return;
+	for (c = 0; c < zopt_fanout; c++) {
+		(void) snprintf(child, sizeof (child), "%s/fs%d", name, c);
+		zmb_build(hdl, child, self, depth + 1);
+	}
+}
+
+static int
+zmb_find(zfs_handle_t *zhp)
+{
+	int i;
+
+	for (i = 0; i < zmb_nfs; i++)
+		if (zmb_fs[i].zf_zhp == zhp)
+			return (i);
+	fatal("callback got an unknown handle");
+	return (-1);
+}
+
+static int
+zmb_mount_cb(zfs_handle_t *zhp, void *arg)
+{
+	zmb_fs_t *zf = &zmb_fs[zmb_find(zhp)];
+
+	(void) pthread_mutex_lock(&zmb_lock);
+	if (zf->zf_parent != -1 && !zmb_fs[zf->zf_parent].zf_done)
+		zmb_misordered++;
+	if (++zmb_active > zmb_maxactive)
+		zmb_maxactive = zmb_active;
+	(void) pthread_mutex_unlock(&zmb_lock);
+
+	(void) usleep(zopt_sleep * 1000);
+
+	(void) pthread_mutex_lock(&zmb_lock);
+	zmb_active--;
+	zf->zf_done = B_TRUE;
+	(void) pthread_mutex_unlock(&zmb_lock);
+
+	return (0);
+}
+
+static double
+zmb_run(libzfs_handle_t *hdl, zfs_handle_t **handles, int nthreads)
+{
+	struct timeval start, end;
+	int i, j;
+
+	for (i = 0; i < zmb_nfs; i++) {
+		zmb_fs[i].zf_done = B_FALSE;
+		handles[i] = zmb_fs[i].zf_zhp;
+	}
+	for (i = zmb_nfs - 1; i > 0; i--) {
+		zfs_handle_t *tmp = handles[i];
+
+		j = random() % (i + 1);
+		handles[i] = handles[j];
+		handles[j] = tmp;
+	}
+	zmb_maxactive = 0;
+	zmb_misordered = 0;
+
+	libzfs_set_mount_threads(hdl, nthreads);
+	(void) gettimeofday(&start, NULL);
+	if (zfs_foreach_mountpoint(hdl, handles, zmb_nfs, zmb_mount_cb,
+	    NULL, nthreads > 1) != 0)
+		fatal("zfs_foreach_mountpoint() failed");
+	(void) gettimeofday(&end, NULL);
+
+	for (i = 0; i < zmb_nfs; i++)
+		if (!zmb_fs[i].zf_done)
+			fatal("a filesystem was not visited");
+	if (zmb_misordered != 0)
+		fatal("a filesystem was visited before its parent");
+
+	return ((end.tv_sec - start.tv_sec) +
+	    (end.tv_usec - start.tv_usec) / 1000000.0);
+}
+
+int
+main(int argc, char **argv)
+{
+	libzfs_handle_t *hdl;
+	zfs_handle_t **handles;
+	double serial, secs;
+	int i, n, total;
+
+	(void) setvbuf(stdout, NULL, _IOLBF, 0);
+
+	process_options(argc, argv);
+
+	for (total = 1, n = 1, i = 0; i < zopt_depth; i++)
+		total += (n *= zopt_fanout);
+
+	/*
+	 * Only the fields zfs_foreach_mountpoint() looks at are set up;
+	 * nothing here talks to /dev/zfs.
+	 */
+	zfs_prop_init();
+	if ((hdl = calloc(1, sizeof (libzfs_handle_t))) == NULL ||
+	    (zmb_fs = calloc(total, sizeof (zmb_fs_t))) == NULL ||
+	    (handles = calloc(total, sizeof (zfs_handle_t *))) == NULL)
+		fatal("out of memory");
+	hdl->libzfs_fd = -1;
+	(void) pthread_mutex_init(&hdl->libzfs_mnt_lock, NULL);
+	srandom(getpid());
+
+	zmb_build(hdl, "bench", -1, 0);
+
+	serial = zmb_run(hdl, handles, 1);
+	(void) printf("mode=serial filesystems=%d fanout=%d depth=%d "
+	    "sleep_ms=%d threads=1 seconds=%.3f max_concurrent=%d\n",
+	    zmb_nfs, zopt_fanout, zopt_depth, zopt_sleep, serial,
+	    zmb_maxactive);
+
+	for (i = 0; i < zopt_nsweep; i++) {
+		secs = zmb_run(hdl, handles, zopt_threads[i]);
+		(void) printf("mode=parallel filesystems=%d fanout=%d "
+		    "depth=%d sleep_ms=%d threads=%d seconds=%.3f "
+		    "max_concurrent=%d speedup=%.2f\n",
+		    zmb_nfs, zopt_fanout, zopt_depth, zopt_sleep,
+		    zopt_threads[i], secs, zmb_maxactive,
+		    secs > 0 ? serial / secs : 0.0);
+	}
+
+	for (i = 0; i < zmb_nfs; i++) {
+		nvlist_free(zmb_fs[i].zf_zhp->zfs_props);
+		free(zmb_fs[i].zf_zhp);
+	}
+	free(handles);
+	free(zmb_fs);
+	free(hdl);
+
+	return (0);
+}
@@ -64,6 +64,7 @@ extern void dump_intent_log(zilog_t *);
 uint64_t *zopt_object = NULL;
 int zopt_objects = 0;
 int zdb_advance = ADVANCE_PRE;
+int zdb_threads = 0;
 zbookmark_t zdb_noread = { 0, 0, ZB_NO_LEVEL, 0 };
 libzfs_handle_t *g_zfs;
 
@@ -88,7 +89,7 @@ usage(void)
 {
 	(void) fprintf(stderr,
 	    "Usage: %s [-udibcsvLUe] [-O order] [-B os:obj:level:blkid] "
-	    "dataset [object...]\n"
+	    "[-t threads] dataset [object...]\n"
 	    "       %s -C [pool]\n"
 	    "       %s -l dev\n"
 	    "       %s -R vdev:offset:size:flags\n"
@@ -108,6 +109,8 @@ usage(void)
 	(void) fprintf(stderr, "	-O [!]<pre|post|prune|data|holes> "
 	    "visitation order\n");
 	(void) fprintf(stderr, "	-U use zpool.cache in /tmp\n");
+	(void) fprintf(stderr, "	-t threads used to traverse blocks "
+	    "(default: one per CPU)\n");
 	(void) fprintf(stderr, "	-B objset:object:level:blkid -- "
 	    "simulate bad block\n");
 	(void) fprintf(stderr, "        -R read and display block from a"
@@ -1256,39 +1259,40 @@ zdb_space_map_load(spa_t *spa)
 	}
 }
 
+/*
+ * Block pointers whose space a traversal worker has yet to claim, in the
+ * order it visited them.  Gang headers have already been expanded, and
+ * every DVA of each entry is in bounds with its gang bit cleared.
+ */
+typedef struct zdb_claims {
+	blkptr_t	*zcl_blks;
+	uint64_t	zcl_count;
+	uint64_t	zcl_max;
+} zdb_claims_t;
+
+/*
+ * Remove the space of each DVA in 'bp' from the metaslabs' loaded
+ * allocation maps.  The DVAs must already have been checked and any
+ * gang bits cleared by zdb_space_map_claim().
+ */
 static int
-zdb_space_map_claim(spa_t *spa, blkptr_t *bp, zbookmark_t *zb)
+zdb_claim_dvas(spa_t *spa, blkptr_t *bp)
 {
 	dva_t *dva = bp->blk_dva;
 	vdev_t *vd;
 	metaslab_t *msp;
 	space_map_t *allocmap, *freemap;
-	int error;
 	int d;
-	blkptr_t blk = *bp;
 
 	for (d = 0; d < BP_GET_NDVAS(bp); d++) {
-		uint64_t vdev = DVA_GET_VDEV(&dva[d]);
 		uint64_t offset = DVA_GET_OFFSET(&dva[d]);
 		uint64_t size = DVA_GET_ASIZE(&dva[d]);
 
-		if ((vd = vdev_lookup_top(spa, vdev)) == NULL)
-			return (ENXIO);
-
-		if ((offset >> vd->vdev_ms_shift) >= vd->vdev_ms_count)
-			return (ENXIO);
-
+		vd = vdev_lookup_top(spa, DVA_GET_VDEV(&dva[d]));
 		msp = vd->vdev_ms[offset >> vd->vdev_ms_shift];
 		allocmap = &msp->ms_allocmap[0];
 		freemap = &msp->ms_freemap[0];
 
-		/* Prepare our copy of the bp in case we need to read GBHs */
-		if (DVA_GET_GANG(&dva[d])) {
-			size = vdev_psize_to_asize(vd, SPA_GANGBLOCKSIZE);
-			DVA_SET_ASIZE(&blk.blk_dva[d], size);
-			DVA_SET_GANG(&blk.blk_dva[d], 0);
-		}
-
 		mutex_enter(&msp->ms_lock);
 		if (space_map_contains(freemap, offset, size)) {
 			mutex_exit(&msp->ms_lock);
@@ -1306,6 +1310,56 @@ zdb_space_map_claim(spa_t *spa, blkptr_t *bp, zbookmark_t *zb)
 		mutex_exit(&msp->ms_lock);
 	}
 
+	return (0);
+}
+
+/*
+ * Claim the space referenced by a block pointer.  If 'claims' is NULL the
+ * space is removed from the metaslabs' loaded allocation maps right away.
+ * Otherwise the block pointer is appended to 'claims' and claimed later,
+ * one block at a time, by zdb_claims_merge().
+ */
+static int
+zdb_space_map_claim(spa_t *spa, zdb_claims_t *claims, blkptr_t *bp,
+    zbookmark_t *zb)
+{
+	dva_t *dva = bp->blk_dva;
+	vdev_t *vd;
+	int error;
+	int d;
+	blkptr_t blk = *bp;
+
+	for (d = 0; d < BP_GET_NDVAS(bp); d++) {
+		uint64_t vdev = DVA_GET_VDEV(&dva[d]);
+		uint64_t offset = DVA_GET_OFFSET(&dva[d]);
+
+		if ((vd = vdev_lookup_top(spa, vdev)) == NULL)
+			return (ENXIO);
+
+		if ((offset >> vd->vdev_ms_shift) >= vd->vdev_ms_count)
+			return (ENXIO);
+
+		/* Prepare our copy of the bp in case we need to read GBHs */
+		if (DVA_GET_GANG(&dva[d])) {
+			DVA_SET_ASIZE(&blk.blk_dva[d],
+			    vdev_psize_to_asize(vd, SPA_GANGBLOCKSIZE));
+			DVA_SET_GANG(&blk.blk_dva[d], 0);
+		}
+	}
+
+	if (claims != NULL) {
+		if (claims->zcl_count == claims->zcl_max) {
+			claims->zcl_max = MAX(claims->zcl_max * 2, 1024);
+			claims->zcl_blks = realloc(claims->zcl_blks,
+			    claims->zcl_max * sizeof (blkptr_t));
+			if (claims->zcl_blks == NULL)
+				fatal("out of memory");
+		}
+		claims->zcl_blks[claims->zcl_count++] = blk;
+	} else if ((error = zdb_claim_dvas(spa, &blk)) != 0) {
+		return (error);
+	}
+
 	if (BP_IS_GANG(bp)) {
 		zio_gbh_phys_t gbh;
 		int g;
@@ -1327,7 +1381,8 @@ zdb_space_map_claim(spa_t *spa, blkptr_t *bp, zbookmark_t *zb)
 		for (g = 0; g < SPA_GBH_NBLKPTRS; g++) {
 			if (BP_IS_HOLE(&gbh.zg_blkptr[g]))
 				break;
-			error = zdb_space_map_claim(spa, &gbh.zg_blkptr[g], zb);
+			error = zdb_space_map_claim(spa, claims,
+			    &gbh.zg_blkptr[g], zb);
 			if (error)
 				return (error);
 		}
@@ -1412,8 +1467,21 @@ typedef struct zdb_cb {
 	traverse_blk_cache_t *zcb_cache;
 	int		zcb_readfails;
 	int		zcb_haderrors;
+	zdb_claims_t	*zcb_claims;	/* deferred claims, if any */
 } zdb_cb_t;
 
+static void
+zdb_claim_error(int error, blkptr_t *bp)
+{
+	if (error == EAGAIN)
+		(void) fatal("double-allocation, bp=%p", bp);
+
+	if (error == ESTALE)
+		(void) fatal("reference to freed block, bp=%p", bp);
+
+	(void) fatal("fatal error %d in bp %p", error, bp);
+}
+
 static void
 zdb_count_block(spa_t *spa, zdb_cb_t *zcb, blkptr_t *bp, int type)
 {
@@ -1433,18 +1501,11 @@ zdb_count_block(spa_t *spa, zdb_cb_t *zcb, blkptr_t *bp, int type)
 	if (dump_opt['L'])
 		return;
 
-	error = zdb_space_map_claim(spa, bp, &zcb->zcb_cache->bc_bookmark);
+	error = zdb_space_map_claim(spa, zcb->zcb_claims, bp,
+	    &zcb->zcb_cache->bc_bookmark);
 
-	if (error == 0)
-		return;
-
-	if (error == EAGAIN)
-		(void) fatal("double-allocation, bp=%p", bp);
-
-	if (error == ESTALE)
-		(void) fatal("reference to freed block, bp=%p", bp);
-
-	(void) fatal("fatal error %d in bp %p", error, bp);
+	if (error != 0)
+		zdb_claim_error(error, bp);
 }
 
 static int
@@ -1503,6 +1564,272 @@ zdb_blkptr_cb(traverse_blk_cache_t *bc, spa_t *spa, void *arg)
 	return (0);
 }
 
+/*
+ * Parallel block traversal.  The pool is cut into segments -- the MOS, and
+ * every dataset's objset, large objsets further split into ranges of
+ * ZDB_CHUNK_OBJECTS objects -- which a pool of worker threads, each with its
+ * own traversal handle and zdb_cb_t, pulls from a shared list.  Workers
+ * record the blocks they visit in private claim lists; once they're done,
+ * the statistics are summed and the blocks claimed against the metaslabs,
+ * so the result is the same as that of a single-threaded traversal.
+ */
+#define	ZDB_CHUNK_OBJECTS	(DNODES_PER_BLOCK * 256)
+
+typedef struct zdb_seg {
+	uint64_t	zs_objset;
+	uint64_t	zs_sobject;
+	uint64_t	zs_eobject;
+} zdb_seg_t;
+
+typedef struct zdb_traverse {
+	spa_t		*zt_spa;
+	int		zt_advance;
+	int		zt_flags;
+	uint64_t	zt_maxtxg;
+	zdb_seg_t	*zt_segs;
+	uint64_t	zt_nsegs;
+	uint64_t	zt_maxsegs;
+	kmutex_t	zt_lock;	/* protects the fields below */
+	uint64_t	zt_next;
+	boolean_t	zt_abort;
+} zdb_traverse_t;
+
+typedef struct zdb_worker {
+	zdb_traverse_t	*zw_zt;
+	zdb_cb_t	zw_cb;
+	traverse_blk_cache_t zw_cache;
+} zdb_worker_t;
+
+static void
+zdb_add_seg(zdb_traverse_t *zt, uint64_t objset, uint64_t sobject,
+    uint64_t eobject)
+{
+	zdb_seg_t *zs;
+
+	if (zt->zt_nsegs == zt->zt_maxsegs) {
+		zt->zt_maxsegs = MAX(zt->zt_maxsegs * 2, 64);
+		zt->zt_segs = realloc(zt->zt_segs,
+		    zt->zt_maxsegs * sizeof (zdb_seg_t));
+		if (zt->zt_segs == NULL)
+			fatal("out of memory");
+	}
+
+	zs = &zt->zt_segs[zt->zt_nsegs++];
+	zs->zs_objset = objset;
+	zs->zs_sobject = sobject;
+	zs->zs_eobject = eobject;
+}
+
+/*
+ * Add the segments for one dataset.  Its object count comes from the meta
+ * dnode in its objset_phys_t; if that can't be read the objset is added
+ * whole, and the traversal will report the error.
+ */
+static void
+zdb_add_dataset_segs(zdb_traverse_t *zt, objset_t *mos, uint64_t dsobj)
+{
+	spa_t *spa = zt->zt_spa;
+	dmu_buf_t *db;
+	blkptr_t bp;
+	zbookmark_t zb;
+	uint64_t maxobj = 0;
+	uint64_t obj;
+
+	VERIFY(dmu_bonus_hold(mos, dsobj, FTAG, &db) == 0);
+	bp = ((dsl_dataset_phys_t *)db->db_data)->ds_bp;
+	dmu_buf_rele(db, FTAG);
+
+	if ((zt->zt_advance & ADVANCE_PRE) && !BP_IS_HOLE(&bp)) {
+		uint64_t size = BP_GET_LSIZE(&bp);
+		void *buf = zio_buf_alloc(size);
+
+		zb.zb_objset = dsobj;
+		zb.zb_object = 0;
+		zb.zb_level = -1;
+		zb.zb_blkid = 0;
+
+		if (zio_wait(zio_read(NULL, spa, &bp, buf, size, NULL, NULL,
+		    ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_CANFAIL, &zb)) == 0) {
+			dnode_phys_t *mdn;
+
+			if (BP_SHOULD_BYTESWAP(&bp))
+				dmu_ot[DMU_OT_OBJSET].ot_byteswap(buf, size);
+			mdn = &((objset_phys_t *)buf)->os_meta_dnode;
+			maxobj = (mdn->dn_maxblkid + 1) * DNODES_PER_BLOCK;
+		}
+		zio_buf_free(buf, size);
+	}
+
+	if (maxobj <= ZDB_CHUNK_OBJECTS) {
+		zdb_add_seg(zt, dsobj, 0, ZB_MAXOBJECT);
+		return;
+	}
+
+	for (obj = 0; obj < maxobj; obj += ZDB_CHUNK_OBJECTS) {
+		zdb_add_seg(zt, dsobj, obj,
+		    obj + ZDB_CHUNK_OBJECTS >= maxobj ? ZB_MAXOBJECT :
+		    obj + ZDB_CHUNK_OBJECTS - 1);
+	}
+}
+
+static void
+zdb_traverse_thread(void *arg)
+{
+	zdb_worker_t *zw = arg;
+	zdb_traverse_t *zt = zw->zw_zt;
+	traverse_handle_t *th;
+	zdb_seg_t *zs;
+	int error;
+
+	th = traverse_init(zt->zt_spa, zdb_blkptr_cb, &zw->zw_cb,
+	    zt->zt_advance, zt->zt_flags);
+	th->th_noread = zdb_noread;
+
+	for (;;) {
+		mutex_enter(&zt->zt_lock);
+		if (zt->zt_abort || zt->zt_next == zt->zt_nsegs) {
+			mutex_exit(&zt->zt_lock);
+			break;
+		}
+		zs = &zt->zt_segs[zt->zt_next++];
+		mutex_exit(&zt->zt_lock);
+
+		if (zs->zs_sobject == 0 && zs->zs_eobject == ZB_MAXOBJECT)
+			traverse_add_objset(th, 0, zt->zt_maxtxg,
+			    zs->zs_objset);
+		else
+			traverse_add_objects(th, 0, zt->zt_maxtxg,
+			    zs->zs_objset, zs->zs_sobject, zs->zs_eobject);
+
+		/*
+		 * Segments aren't visited in bookmark order across the
+		 * handle's lifetime, only within each segment.
+		 */
+		th->th_lastcb.zb_level = ZB_NO_LEVEL;
+
+		while ((error = traverse_more(th)) == EAGAIN)
+			continue;
+
+		/*
+		 * As in the single-threaded case, a segment that can't make
+		 * progress ends the whole traversal.
+		 */
+		if (error != 0) {
+			mutex_enter(&zt->zt_lock);
+			zt->zt_abort = B_TRUE;
+			mutex_exit(&zt->zt_lock);
+			break;
+		}
+	}
+
+	traverse_fini(th);
+}
+
+static void
+zdb_claims_create(zdb_cb_t *zcb)
+{
+	zcb->zcb_claims = umem_zalloc(sizeof (zdb_claims_t), UMEM_NOFAIL);
+}
+
+/*
+ * Claim one worker's blocks against the metaslabs, exactly as
+ * zdb_space_map_claim() would have done when it visited them, and free
+ * them.  Claims are replayed block by block rather than coalesced, so a
+ * double allocation is reported as such and in the same words.
+ */
+static void
+zdb_claims_merge(spa_t *spa, zdb_cb_t *zcb)
+{
+	zdb_claims_t *claims = zcb->zcb_claims;
+	uint64_t i;
+	int error;
+
+	for (i = 0; i < claims->zcl_count; i++) {
+		error = zdb_claim_dvas(spa, &claims->zcl_blks[i]);
+		if (error != 0)
+			zdb_claim_error(error, &claims->zcl_blks[i]);
+	}
+
+	free(claims->zcl_blks);
+	umem_free(claims, sizeof (zdb_claims_t));
+	zcb->zcb_claims = NULL;
+}
+
+/*
+ * Traverse the pool with 'nthreads' workers and fold their results into
+ * 'zcb'.
+ */
+static void
+zdb_traverse_parallel(spa_t *spa, zdb_cb_t *zcb, int advance, int flags,
+    int nthreads)
+{
+	objset_t *mos = spa->spa_meta_objset;
+	zdb_traverse_t zt = { 0 };
+	zdb_worker_t *workers;
+	dmu_object_info_t doi;
+	taskq_t *tq;
+	uint64_t obj;
+	int i, l, t, e;
+
+	zt.zt_spa = spa;
+	zt.zt_advance = advance;
+	zt.zt_flags = flags;
+	zt.zt_maxtxg = spa_first_txg(spa) + TXG_CONCURRENT_STATES;
+	mutex_init(&zt.zt_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	/*
+	 * The MOS, then every dataset, just as traverse_add_pool() would.
+	 */
+	zdb_add_seg(&zt, 0, 0, ZB_MAXOBJECT);
+	for (obj = 0; dmu_object_next(mos, &obj, B_FALSE, 0) == 0; ) {
+		if (dmu_object_info(mos, obj, &doi) == 0 &&
+		    doi.doi_type == DMU_OT_DSL_DATASET)
+			zdb_add_dataset_segs(&zt, mos, obj);
+	}
+
+	workers = umem_zalloc(nthreads * sizeof (zdb_worker_t), UMEM_NOFAIL);
+	for (i = 0; i < nthreads; i++) {
+		workers[i].zw_zt = &zt;
+		workers[i].zw_cb.zcb_cache = &workers[i].zw_cache;
+		if (!dump_opt['L'])
+			zdb_claims_create(&workers[i].zw_cb);
+	}
+
+	tq = taskq_create("zdb_traverse", nthreads, minclsyspri,
+	    nthreads, nthreads, TASKQ_PREPOPULATE);
+	for (i = 0; i < nthreads; i++)
+		VERIFY(taskq_dispatch(tq, zdb_traverse_thread, &workers[i],
+		    TQ_SLEEP) != 0);
+	taskq_wait(tq);
+	taskq_destroy(tq);
+
+	for (i = 0; i < nthreads; i++) {
+		zdb_cb_t *wcb = &workers[i].zw_cb;
+
+		for (l = 0; l <= ZB_TOTAL; l++) {
+			for (t = 0; t <= DMU_OT_TOTAL; t++) {
+				zdb_blkstats_t *zb = &zcb->zcb_type[l][t];
+				zdb_blkstats_t *wzb = &wcb->zcb_type[l][t];
+
+				zb->zb_asize += wzb->zb_asize;
+				zb->zb_lsize += wzb->zb_lsize;
+				zb->zb_psize += wzb->zb_psize;
+				zb->zb_count += wzb->zb_count;
+			}
+		}
+		for (e = 0; e < 256; e++)
+			zcb->zcb_errors[e] += wcb->zcb_errors[e];
+		zcb->zcb_haderrors |= wcb->zcb_haderrors;
+
+		if (wcb->zcb_claims != NULL)
+			zdb_claims_merge(spa, wcb);
+	}
+
+	umem_free(workers, nthreads * sizeof (zdb_worker_t));
+	free(zt.zt_segs);
+	mutex_destroy(&zt.zt_lock);
+}
+
 static int
 dump_block_stats(spa_t *spa)
 {
@@ -1514,10 +1841,16 @@ dump_block_stats(spa_t *spa)
 	vdev_t *rvd = spa->spa_root_vdev;
 	int leaks = 0;
 	int advance = zdb_advance;
+	int nthreads = zdb_threads;
 	int c, e, flags;
+	hrtime_t start, elapsed;
 
 	zcb.zcb_cache = &dummy_cache;
 
+	if (nthreads == 0)
+		nthreads = MIN(MAX(sysconf(_SC_NPROCESSORS_ONLN), 1),
+		    max_ncpus);
+
 	if (dump_opt['c'])
 		advance |= ADVANCE_DATA;
 
@@ -1568,15 +1901,30 @@ dump_block_stats(spa_t *spa)
 	flags = ZIO_FLAG_CANFAIL;
 	if (advance & ADVANCE_DATA)
 		flags |= ZIO_FLAG_SCRUB;
-	th = traverse_init(spa, zdb_blkptr_cb, &zcb, advance, flags);
-	th->th_noread = zdb_noread;
 
-	traverse_add_pool(th, 0, spa_first_txg(spa) + TXG_CONCURRENT_STATES);
+	start = gethrtime();
 
-	while (traverse_more(th) == EAGAIN)
-		continue;
+	/*
+	 * Printing every block wants them in traversal order, and a live
+	 * pool traversal retries failed reads by reloading the uberblock
+	 * under everyone's feet, so both of those stay single-threaded.
+	 */
+	if (nthreads > 1 && dump_opt['b'] < 4 && !dump_opt['L']) {
+		zdb_traverse_parallel(spa, &zcb, advance, flags, nthreads);
+	} else {
+		th = traverse_init(spa, zdb_blkptr_cb, &zcb, advance, flags);
+		th->th_noread = zdb_noread;
 
-	traverse_fini(th);
+		traverse_add_pool(th, 0,
+		    spa_first_txg(spa) + TXG_CONCURRENT_STATES);
+
+		while (traverse_more(th) == EAGAIN)
+			continue;
+
+		traverse_fini(th);
+	}
+
+	elapsed = gethrtime() - start;
 
 	if (zcb.zcb_haderrors) {
 		(void) printf("\nError counts:\n\n");
@@ -1648,6 +1996,12 @@ dump_block_stats(spa_t *spa)
 	(void) printf("\tSPA allocated: %10llu\tused: %5.2f%%\n",
 	    (u_longlong_t)alloc, 100.0 * alloc / space);
 
+	if (dump_opt['s'] >= 2) {
+		(void) printf("\ttraversal:     %10.2fs\t%.0f blocks/sec\n",
+		    (double)elapsed / NANOSEC,
+		    (double)tzb->zb_count * NANOSEC / MAX(elapsed, 1));
+	}
+
 	if (dump_opt['b'] >= 2) {
 		int l, t, level;
 		(void) printf("\nBlocks\tLSIZE\tPSIZE\tASIZE"
@@ -2211,7 +2565,7 @@ main(int argc, char **argv)
 
 	dprintf_setup(&argc, argv);
 
-	while ((c = getopt(argc, argv, "udibcsvCLO:B:UlRep:")) != -1) {
+	while ((c = getopt(argc, argv, "udibcsvCLO:B:UlRep:t:")) != -1) {
 		switch (c) {
 		case 'u':
 		case 'd':
@@ -2280,6 +2634,11 @@ main(int argc, char **argv)
 		case 'p':
 			vdev_dir = optarg;
 			break;
+		case 't':
+			zdb_threads = atoi(optarg);
+			if (zdb_threads <= 0)
+				usage();
+			break;
 		default:
 			usage();
 			break;
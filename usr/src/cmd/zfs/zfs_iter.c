@@ -308,6 +308,50 @@ zfs_sort(const void *larg, const void *rarg, void *data)
 	return (zfs_compare(larg, rarg, NULL));
 }
 
+/*
+ * When only a fixed set of properties will be looked at, tell libzfs so that
+ * it doesn't gather every property of every dataset while iterating.  The
+ * hidden CREATETXG property is always needed to sort snapshots.
+ */
+static void
+zfs_prefetch_props(zfs_proplist_t *pl, zfs_sort_column_t *sc)
+{
+	nvlist_t *props;
+
+	if (pl == NULL || pl->pl_all)
+		return;
+
+	if (nvlist_alloc(&props, NV_UNIQUE_NAME, 0) != 0) {
+		(void) fprintf(stderr,
+		    gettext("internal error: out of memory\n"));
+		exit(1);
+	}
+
+	for (; pl != NULL; pl = pl->pl_next) {
+		if (nvlist_add_boolean(props, pl->pl_prop == ZFS_PROP_INVAL ?
+		    pl->pl_user_prop : zfs_prop_to_name(pl->pl_prop)) != 0)
+			goto nomem;
+	}
+	for (; sc != NULL; sc = sc->sc_next) {
+		if (nvlist_add_boolean(props, sc->sc_prop == ZFS_PROP_INVAL ?
+		    sc->sc_user_prop : zfs_prop_to_name(sc->sc_prop)) != 0)
+			goto nomem;
+	}
+	if (nvlist_add_boolean(props,
+	    zfs_prop_to_name(ZFS_PROP_CREATETXG)) != 0)
+		goto nomem;
+
+	if (zfs_iter_set_props(g_zfs, props) != 0)
+		goto nomem;
+
+	nvlist_free(props);
+	return;
+
+nomem:
+	(void) fprintf(stderr, gettext("internal error: out of memory\n"));
+	exit(1);
+}
+
 int
 zfs_for_each(int argc, char **argv, boolean_t recurse, zfs_type_t types,
     zfs_sort_column_t *sortcol, zfs_proplist_t **proplist, zfs_iter_f callback,
@@ -337,6 +381,9 @@ zfs_for_each(int argc, char **argv, boolean_t recurse, zfs_type_t types,
 		exit(1);
 	}
 
+	if (proplist != NULL)
+		zfs_prefetch_props(*proplist, sortcol);
+
 	if (argc == 0) {
 		/*
 		 * If given no arguments, iterate over all datasets.
@@ -374,6 +421,8 @@ zfs_for_each(int argc, char **argv, boolean_t recurse, zfs_type_t types,
 		}
 	}
 
+	(void) zfs_iter_set_props(g_zfs, NULL);
+
 	/*
 	 * At this point we've got our AVL tree full of zfs handles, so iterate
 	 * over each one and execute the real user callback.
@@ -36,6 +36,7 @@
 #include <libuutil.h>
 #include <libnvpair.h>
 #include <locale.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -239,7 +240,7 @@ get_usage(zfs_help_t idx)
 		return (gettext("\tshare <-a | filesystem>\n"));
 	case HELP_SNAPSHOT:
 		return (gettext("\tsnapshot [-r] "
-		    "<filesystem@snapname|volume@snapname>\n"));
+		    "<filesystem@snapname|volume@snapname> ...\n"));
 	case HELP_UNMOUNT:
 		return (gettext("\tunmount [-f] "
 		    "<-a | filesystem|mountpoint>\n"));
@@ -2129,10 +2130,12 @@ zfs_do_set(int argc, char **argv)
 }
 
 /*
- * zfs snapshot [-r] <fs@snap>
+ * zfs snapshot [-r] <fs@snap> ...
  *
  * Creates a snapshot with the given name.  While functionally equivalent to
- * 'zfs create', it is a separate command to diffferentiate intent.
+ * 'zfs create', it is a separate command to diffferentiate intent.  Several
+ * snapshots in the same pool may be named; they are then created together
+ * and each one that fails is reported on its own.
  */
 static int
 zfs_do_snapshot(int argc, char **argv)
@@ -2162,11 +2165,48 @@ zfs_do_snapshot(int argc, char **argv)
 		(void) fprintf(stderr, gettext("missing snapshot argument\n"));
 		usage(B_FALSE);
 	}
-	if (argc > 1) {
+	if (argc > 1 && recursive) {
 		(void) fprintf(stderr, gettext("too many arguments\n"));
 		usage(B_FALSE);
 	}
 
+	if (argc > 1) {
+		nvlist_t *snaps, *errors = NULL;
+		nvpair_t *elem;
+		int32_t err;
+		int i;
+
+		if (nvlist_alloc(&snaps, NV_UNIQUE_NAME, 0) != 0) {
+			(void) fprintf(stderr, gettext("internal error: "
+			    "out of memory\n"));
+			return (1);
+		}
+		for (i = 0; i < argc; i++) {
+			if (nvlist_add_boolean(snaps, argv[i]) != 0) {
+				(void) fprintf(stderr, gettext("internal "
+				    "error: out of memory\n"));
+				nvlist_free(snaps);
+				return (1);
+			}
+		}
+
+		ret = zfs_snapshot_batch(g_zfs, snaps, &errors);
+
+		elem = NULL;
+		while (errors != NULL &&
+		    (elem = nvlist_next_nvpair(errors, elem)) != NULL) {
+			verify(nvpair_value_int32(elem, &err) == 0);
+			(void) fprintf(stderr, gettext("cannot create "
+			    "snapshot '%s': %s\n"), nvpair_name(elem),
+			    strerror(err));
+		}
+
+		if (errors != NULL)
+			nvlist_free(errors);
+		nvlist_free(snaps);
+		return (ret != 0);
+	}
+
 	ret = zfs_snapshot(g_zfs, argv[0], recursive);
 	if (ret && recursive)
 		(void) fprintf(stderr, gettext("no snapshots were created\n"));
@@ -3058,6 +3098,46 @@ report_mount_progress(int current, int total)
 	(void) fflush(stdout);
 }
 
+typedef struct share_mount_cbdata {
+	pthread_mutex_t	sm_lock;
+	int		sm_op;
+	int		sm_flags;
+	const char	*sm_options;
+	boolean_t	sm_verbose;
+	int		sm_started;
+	int		sm_total;
+	int		sm_ret;
+} share_mount_cbdata_t;
+
+/*
+ * Called by zfs_foreach_mountpoint(), from several threads at once for
+ * "mount -a".
+ */
+static int
+share_mount_one_cb(zfs_handle_t *zhp, void *data)
+{
+	share_mount_cbdata_t *sm = data;
+	int ret;
+
+	/* as in the serial case, report each mount before starting it */
+	if (sm->sm_verbose) {
+		(void) pthread_mutex_lock(&sm->sm_lock);
+		report_mount_progress(sm->sm_started++, sm->sm_total);
+		(void) pthread_mutex_unlock(&sm->sm_lock);
+	}
+
+	ret = share_mount_one(zhp, sm->sm_op, sm->sm_flags, B_FALSE,
+	    sm->sm_options);
+
+	if (ret != 0) {
+		(void) pthread_mutex_lock(&sm->sm_lock);
+		sm->sm_ret = 1;
+		(void) pthread_mutex_unlock(&sm->sm_lock);
+	}
+
+	return (ret);
+}
+
 static int
 share_mount(int op, int argc, char **argv)
 {
@@ -3111,6 +3191,7 @@ share_mount(int op, int argc, char **argv)
 	/* check number of arguments */
 	if (do_all) {
 		zfs_handle_t **dslist = NULL;
+		share_mount_cbdata_t sm = { 0 };
 		size_t i, count = 0;
 
 		if (op == OP_MOUNT) {
@@ -3142,17 +3223,24 @@ share_mount(int op, int argc, char **argv)
 		if (count == 0)
 			return (0);
 
-		qsort(dslist, count, sizeof (void *), dataset_cmp);
-
-		for (i = 0; i < count; i++) {
-			if (verbose)
-				report_mount_progress(i, count);
-
-			if (share_mount_one(dslist[i], op, flags, B_FALSE,
-			    options) != 0)
-				ret = 1;
+		/*
+		 * Mounts of independent subtrees run in parallel; sharing
+		 * goes through libshare, which isn't thread safe.
+		 */
+		(void) pthread_mutex_init(&sm.sm_lock, NULL);
+		sm.sm_op = op;
+		sm.sm_flags = flags;
+		sm.sm_options = options;
+		sm.sm_verbose = verbose;
+		sm.sm_total = count;
+		if (zfs_foreach_mountpoint(g_zfs, dslist, count,
+		    share_mount_one_cb, &sm, op == OP_MOUNT) != 0)
+			sm.sm_ret = 1;
+		(void) pthread_mutex_destroy(&sm.sm_lock);
+		ret = sm.sm_ret;
+
+		for (i = 0; i < count; i++)
 			zfs_close(dslist[i]);
-		}
 
 		free(dslist);
 	} else if (argc == 0) {
@@ -91,6 +91,7 @@ static int zpool_do_export(int, char **);
 static int zpool_do_upgrade(int, char **);
 
 static int zpool_do_history(int, char **);
+static int zpool_do_txgs(int, char **);
 
 static int zpool_do_get(int, char **);
 static int zpool_do_set(int, char **);
@@ -131,7 +132,8 @@ typedef enum {
 	HELP_STATUS,
 	HELP_UPGRADE,
 	HELP_GET,
-	HELP_SET
+	HELP_SET,
+	HELP_TXGS
 } zpool_help_t;
 
 
@@ -176,6 +178,7 @@ static zpool_command_t command_table[] = {
 	{ "upgrade",	zpool_do_upgrade,	HELP_UPGRADE		},
 	{ NULL },
 	{ "history",	zpool_do_history,	HELP_HISTORY		},
+	{ "txgs",	zpool_do_txgs,		HELP_TXGS		},
 	{ "get",	zpool_do_get,		HELP_GET		},
 	{ "set",	zpool_do_set,		HELP_SET		},
 };
@@ -213,7 +216,7 @@ get_usage(zpool_help_t idx) {
 		    "\timport [-p property=value] [-d dir] [-D] [-f] \n"
 		    "\t    [-o opts] [-R root ] <pool | id> [newpool]\n"));
 	case HELP_IOSTAT:
-		return (gettext("\tiostat [-v] [pool] ... [interval "
+		return (gettext("\tiostat [-lv] [pool] ... [interval "
 		    "[count]]\n"));
 	case HELP_LIST:
 		return (gettext("\tlist [-H] [-o field[,...]] [pool] ...\n"));
@@ -239,6 +242,8 @@ get_usage(zpool_help_t idx) {
 		    "<pool> ...\n"));
 	case HELP_SET:
 		return (gettext("\tset <property=value> <pool> \n"));
+	case HELP_TXGS:
+		return (gettext("\ttxgs [-Hh] [pool] ...\n"));
 	}
 
 	abort();
@@ -1614,6 +1619,7 @@ error:
 typedef struct iostat_cbdata {
 	zpool_list_t *cb_list;
 	int cb_verbose;
+	int cb_latency;
 	int cb_iteration;
 	int cb_namewidth;
 } iostat_cbdata_t;
@@ -1650,6 +1656,79 @@ print_one_stat(uint64_t value)
 	(void) printf("  %5s", buf);
 }
 
+/*
+ * Print the latency histograms of a vdev for the last interval: one row
+ * per non-empty power-of-two bucket, with the queue wait and the device
+ * service time for each class of I/O.  Scrub and resilver I/O is shown
+ * as a single class, reads and writes combined.
+ */
+static void
+print_vdev_latency(nvlist_t *oldnv, nvlist_t *newnv, iostat_cbdata_t *cb)
+{
+	vdev_lat_stat_t *oldvls, *newvls;
+	vdev_lat_stat_t zerovls = { 0 };
+	uint64_t row[10];
+	char label[16];
+	uint_t c;
+	int b, i, k;
+
+	if (nvlist_lookup_uint64_array(newnv, ZPOOL_CONFIG_LATENCY,
+	    (uint64_t **)&newvls, &c) != 0)
+		return;
+	if (oldnv == NULL || nvlist_lookup_uint64_array(oldnv,
+	    ZPOOL_CONFIG_LATENCY, (uint64_t **)&oldvls, &c) != 0)
+		oldvls = &zerovls;
+
+	(void) printf("%*s     sync read    async read    sync write"
+	    "   async write         scrub\n", cb->cb_namewidth, "");
+	(void) printf("%-*s  queue   disk  queue   disk  queue   disk"
+	    "  queue   disk  queue   disk\n", cb->cb_namewidth, "latency");
+
+#define	LAT_DELTA(t, c, k, b) \
+	(newvls->vls_hist[t][c][k][b] - oldvls->vls_hist[t][c][k][b])
+
+	for (b = 0; b < VDEV_LAT_BUCKETS; b++) {
+		uint64_t any = 0;
+
+		for (k = 0; k < VDEV_LAT_KINDS; k++) {
+			row[0 + k] = LAT_DELTA(VDEV_LAT_READ,
+			    VDEV_LAT_SYNC, k, b);
+			row[2 + k] = LAT_DELTA(VDEV_LAT_READ,
+			    VDEV_LAT_ASYNC, k, b);
+			row[4 + k] = LAT_DELTA(VDEV_LAT_WRITE,
+			    VDEV_LAT_SYNC, k, b);
+			row[6 + k] = LAT_DELTA(VDEV_LAT_WRITE,
+			    VDEV_LAT_ASYNC, k, b);
+			row[8 + k] = LAT_DELTA(VDEV_LAT_READ,
+			    VDEV_LAT_SCRUB, k, b) + LAT_DELTA(VDEV_LAT_WRITE,
+			    VDEV_LAT_SCRUB, k, b);
+		}
+		for (i = 0; i < 10; i++)
+			any |= row[i];
+		if (any == 0)
+			continue;
+
+		if (b < 10)
+			(void) snprintf(label, sizeof (label), "%lluus",
+			    1ULL << b);
+		else if (b < 20)
+			(void) snprintf(label, sizeof (label), "%llums",
+			    1ULL << (b - 10));
+		else
+			(void) snprintf(label, sizeof (label), "%llus",
+			    1ULL << (b - 20));
+		if (b == VDEV_LAT_BUCKETS - 1)
+			(void) strlcat(label, "+", sizeof (label));
+
+		(void) printf("%*s", cb->cb_namewidth, label);
+		for (i = 0; i < 10; i++)
+			print_one_stat(row[i]);
+		(void) printf("\n");
+	}
+
+#undef	LAT_DELTA
+}
+
 /*
  * Print out all the statistics for the given vdev.  This can either be the
  * toplevel configuration, or called recursively.  If 'name' is NULL, then this
@@ -1712,6 +1791,9 @@ print_vdev_stats(zpool_handle_t *zhp, const char *name, nvlist_t *oldnv,
 
 	(void) printf("\n");
 
+	if (cb->cb_latency)
+		print_vdev_latency(oldnv, newnv, cb);
+
 	if (!cb->cb_verbose)
 		return;
 
@@ -1812,8 +1894,9 @@ get_namewidth(zpool_handle_t *zhp, void *data)
 }
 
 /*
- * zpool iostat [-v] [pool] ... [interval [count]]
+ * zpool iostat [-lv] [pool] ... [interval [count]]
  *
+ *	-l	Display latency histograms (of each vdev, with -v)
  *	-v	Display statistics for individual vdevs
  *
  * This command can be tricky because we want to be able to deal with pool
@@ -1831,11 +1914,15 @@ zpool_do_iostat(int argc, char **argv)
 	unsigned long interval = 0, count = 0;
 	zpool_list_t *list;
 	boolean_t verbose = B_FALSE;
+	boolean_t latency = B_FALSE;
 	iostat_cbdata_t cb;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "v")) != -1) {
+	while ((c = getopt(argc, argv, "lv")) != -1) {
 		switch (c) {
+		case 'l':
+			latency = B_TRUE;
+			break;
 		case 'v':
 			verbose = B_TRUE;
 			break;
@@ -1929,6 +2016,7 @@ zpool_do_iostat(int argc, char **argv)
 	 */
 	cb.cb_list = list;
 	cb.cb_verbose = verbose;
+	cb.cb_latency = latency;
 	cb.cb_iteration = 0;
 	cb.cb_namewidth = 0;
 
@@ -1955,7 +2043,7 @@ zpool_do_iostat(int argc, char **argv)
 		/*
 		 * If it's the first time, or verbose mode, print the header.
 		 */
-		if (++cb.cb_iteration == 1 || verbose)
+		if (++cb.cb_iteration == 1 || verbose || latency)
 			print_iostat_header(&cb);
 
 		(void) pool_list_iter(list, B_FALSE, print_iostat, &cb);
@@ -3645,6 +3733,176 @@ zpool_do_history(int argc, char **argv)
 	return (ret);
 }
 
+typedef struct txgs_cbdata {
+	boolean_t	scripted;
+	boolean_t	histograms;
+	boolean_t	first;
+} txgs_cbdata_t;
+
+static const char *txg_phase_names[TXG_PHASES] = {
+	"FREES",
+	"DSL",
+	"VDEV",
+	"MISC",
+	"CONFIG",
+	"DONE"
+};
+
+static void
+print_txg_histogram(const char *title, uint64_t *hist, uint_t n)
+{
+	char range[32];
+	int i;
+
+	(void) printf("%s:\n", title);
+	for (i = 0; i < n; i++) {
+		if (hist[i] == 0)
+			continue;
+		if (i == 0)
+			(void) snprintf(range, sizeof (range), "< 2ms");
+		else if (i == n - 1)
+			(void) snprintf(range, sizeof (range), ">= %llums",
+			    1ULL << i);
+		else
+			(void) snprintf(range, sizeof (range), "%llu-%llums",
+			    1ULL << i, (1ULL << (i + 1)) - 1);
+		(void) printf("  %14s %llu\n", range, (u_longlong_t)hist[i]);
+	}
+}
+
+#define	NS2MS(ns)	((u_longlong_t)((ns) / 1000000))
+
+/*
+ * Print the recent txg sync statistics for a single pool.  Times are in
+ * milliseconds; with -H they are in nanoseconds and byte counts are exact.
+ */
+static int
+get_txgs_one(zpool_handle_t *zhp, void *data)
+{
+	txgs_cbdata_t *cb = data;
+	nvlist_t *nvl;
+	txg_stat_t *ts;
+	uint64_t *records, *hist, count;
+	uint_t nrecords, nhist, i, p;
+	char dirty[6], written[6];
+
+	if (zpool_get_txg_history(zhp, &nvl) != 0)
+		return (1);
+
+	verify(nvlist_lookup_uint64(nvl, ZPOOL_TXG_HISTORY_COUNT,
+	    &count) == 0);
+	verify(nvlist_lookup_uint64_array(nvl, ZPOOL_TXG_HISTORY_RECORDS,
+	    &records, &nrecords) == 0);
+	ts = (txg_stat_t *)records;
+	nrecords = nrecords * sizeof (uint64_t) / sizeof (txg_stat_t);
+
+	if (!cb->scripted) {
+		if (!cb->first)
+			(void) printf("\n");
+		(void) printf(gettext("txgs for '%s' (%llu synced):\n"),
+		    zpool_get_name(zhp), (u_longlong_t)count);
+		(void) printf("%10s %5s %5s %6s %4s %7s %7s %7s %7s",
+		    "TXG", "DIRTY", "WRITE", "IOS", "PASS", "OPEN",
+		    "QUIESCE", "WAIT", "SYNC");
+		for (p = 0; p < TXG_PHASES; p++)
+			(void) printf(" %6s", txg_phase_names[p]);
+		(void) printf("\n");
+	}
+	cb->first = B_FALSE;
+
+	for (i = 0; i < nrecords; i++, ts++) {
+		if (cb->scripted) {
+			(void) printf("%s\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu"
+			    "\t%llu\t%llu\t%llu\t%llu",
+			    zpool_get_name(zhp), (u_longlong_t)ts->ts_txg,
+			    (u_longlong_t)ts->ts_time,
+			    (u_longlong_t)ts->ts_dirty,
+			    (u_longlong_t)ts->ts_written,
+			    (u_longlong_t)ts->ts_writes,
+			    (u_longlong_t)ts->ts_passes,
+			    (u_longlong_t)ts->ts_open_ns,
+			    (u_longlong_t)ts->ts_quiesce_ns,
+			    (u_longlong_t)ts->ts_wait_ns,
+			    (u_longlong_t)ts->ts_sync_ns);
+			for (p = 0; p < TXG_PHASES; p++) {
+				(void) printf("\t%llu",
+				    (u_longlong_t)ts->ts_phase_ns[p]);
+			}
+			(void) printf("\n");
+			continue;
+		}
+
+		zfs_nicenum(ts->ts_dirty, dirty, sizeof (dirty));
+		zfs_nicenum(ts->ts_written, written, sizeof (written));
+		(void) printf("%10llu %5s %5s %6llu %4llu %7llu %7llu %7llu "
+		    "%7llu", (u_longlong_t)ts->ts_txg, dirty, written,
+		    (u_longlong_t)ts->ts_writes, (u_longlong_t)ts->ts_passes,
+		    NS2MS(ts->ts_open_ns), NS2MS(ts->ts_quiesce_ns),
+		    NS2MS(ts->ts_wait_ns), NS2MS(ts->ts_sync_ns));
+		for (p = 0; p < TXG_PHASES; p++)
+			(void) printf(" %6llu", NS2MS(ts->ts_phase_ns[p]));
+		(void) printf("\n");
+	}
+
+	if (cb->histograms && !cb->scripted) {
+		verify(nvlist_lookup_uint64_array(nvl,
+		    ZPOOL_TXG_HISTORY_SYNC, &hist, &nhist) == 0);
+		print_txg_histogram(gettext("sync time"), hist, nhist);
+		verify(nvlist_lookup_uint64_array(nvl,
+		    ZPOOL_TXG_HISTORY_QUIESCE, &hist, &nhist) == 0);
+		print_txg_histogram(gettext("quiesce time"), hist, nhist);
+	}
+
+	nvlist_free(nvl);
+	return (0);
+}
+
+/*
+ * zpool txgs [-Hh] [pool] ...
+ *
+ *	-H	Scripted mode.  One tab-separated line per txg, prefixed with
+ *		the pool name: txg, time, dirty, written, writes, passes, then
+ *		the open, quiesce, wait, sync and per-phase times in ns.
+ *	-h	Also print the sync and quiesce time histograms.
+ *
+ * Displays the most recent transaction groups synced by each pool, with
+ * a breakdown of where spa_sync() spent its time.
+ */
+int
+zpool_do_txgs(int argc, char **argv)
+{
+	txgs_cbdata_t cb = { 0 };
+	int ret;
+	int c;
+
+	cb.first = B_TRUE;
+	while ((c = getopt(argc, argv, "Hh")) != -1) {
+		switch (c) {
+		case 'H':
+			cb.scripted = B_TRUE;
+			break;
+		case 'h':
+			cb.histograms = B_TRUE;
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	ret = for_each_pool(argc, argv, B_FALSE, NULL, get_txgs_one, &cb);
+
+	if (argc == 0 && cb.first == B_TRUE) {
+		(void) printf(gettext("no pools available\n"));
+		return (0);
+	}
+
+	return (ret);
+}
+
 static int
 get_callback(zpool_handle_t *zhp, void *data)
 {
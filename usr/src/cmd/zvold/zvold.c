@@ -0,0 +1,1600 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#pragma ident	"%Z%%M%	%I%	%E% SMI"
+
+/*
+ * zvold serves a ZFS volume to local clients over a Unix domain socket,
+ * speaking the fixed-newstyle NBD protocol, so that it can be attached
+ * with nbd-client(8) or driven directly by a benchmark.  It runs entirely
+ * in userland on top of libzpool, which makes it a convenient harness for
+ * measuring the DMU's I/O paths without a kernel in the way.
+ *
+ * Each connection has a receive thread that parses requests and keeps
+ * as many of them in flight as the client sends:
+ *
+ * - READs take a reader range lock and are issued with dmu_read_async();
+ *   the reply is sent from the completion callback.  A READ whose range
+ *   is busy waits for it on the range taskq, not in the receive thread.
+ *
+ * - WRITEs and TRIMs are queued for the sync threads, which take a
+ *   writer range lock for each, put as many queued requests as will fit
+ *   into a single transaction, log the writes to the ZIL the way zvol
+ *   does, and reply once the transaction has been committed.
+ *
+ * - FLUSH, and WRITEs with the FUA flag, commit the ZIL on the flush
+ *   taskq before replying, so any write acknowledged before a FLUSH was
+ *   sent is on stable storage when the FLUSH is acknowledged.
+ *
+ * TRIM is mapped to dmu_free_range().  Like zvol, zvold only logs
+ * TX_WRITE records: a TRIM lost in a crash merely leaves the old data in
+ * place, which is all that TRIM promises.
+ *
+ * The pool is found through the cache file, and must not be imported by
+ * the kernel while zvold has it open.
+ *
+ * With -b, zvold is instead a client of a zvold already serving the
+ * socket: it runs 64K sequential and 4K random writes and reads against
+ * it, each for a fixed time with a fixed number of requests in flight,
+ * and prints their throughput and latency.
+ *
+ * On SIGINT or SIGTERM zvold stops accepting connections, drains the ones
+ * it has and prints per-command statistics in the style of fio.  Both
+ * signals are blocked in every thread and taken by a thread of their own
+ * with sigwait(), so no libzpool thread is ever interrupted by them; a
+ * second one kills zvold outright.
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/dmu.h>
+#include <sys/dmu_tx.h>
+#include <sys/zap.h>
+#include <sys/zil.h>
+#include <sys/zio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <pthread.h>
+
+#define	ZVOL_OBJ		1ULL
+#define	ZVOL_ZAP_OBJ		2ULL
+
+#define	NBD_MAGIC		0x4e42444d41474943ULL	/* "NBDMAGIC" */
+#define	NBD_OPTS_MAGIC		0x49484156454f5054ULL	/* "IHAVEOPT" */
+#define	NBD_REP_MAGIC		0x0003e889045565a9ULL
+#define	NBD_REQUEST_MAGIC	0x25609513
+#define	NBD_REPLY_MAGIC		0x67446698
+
+#define	NBD_FLAG_FIXED_NEWSTYLE	0x1	/* handshake flags */
+#define	NBD_FLAG_NO_ZEROES	0x2
+
+#define	NBD_FLAG_HAS_FLAGS	0x1	/* transmission flags */
+#define	NBD_FLAG_READ_ONLY	0x2
+#define	NBD_FLAG_SEND_FLUSH	0x4
+#define	NBD_FLAG_SEND_FUA	0x8
+#define	NBD_FLAG_SEND_TRIM	0x20
+
+#define	NBD_OPT_EXPORT_NAME	1
+#define	NBD_OPT_ABORT		2
+#define	NBD_OPT_GO		7
+#define	NBD_OPT_MAXLEN		4096
+
+#define	NBD_REP_ACK		1
+#define	NBD_REP_INFO		3
+#define	NBD_REP_ERR_UNSUP	0x80000001
+#define	NBD_INFO_EXPORT		0
+
+#define	NBD_CMD_READ		0
+#define	NBD_CMD_WRITE		1
+#define	NBD_CMD_DISC		2
+#define	NBD_CMD_FLUSH		3
+#define	NBD_CMD_TRIM		4
+#define	NBD_CMD_TYPES		5
+
+#define	NBD_CMD_FLAG_FUA	0x1
+
+/* NBD errors are Linux errno values, whatever the local ones are */
+#define	NBD_EPERM		1
+#define	NBD_EIO			5
+#define	NBD_ENOMEM		12
+#define	NBD_EINVAL		22
+#define	NBD_ENOSPC		28
+
+#define	ZVOLD_REQUEST_SIZE	28
+#define	ZVOLD_REPLY_SIZE	16
+#define	ZVOLD_LAT_BUCKETS	40	/* log2(usec) latency histogram */
+
+/*
+ * zvold_read_chunk is the most of a READ handed to dmu_read_async() at
+ * once; it must be a power of two no smaller than the volume block size.
+ * zvold_batch_max and zvold_batch_bytes bound how many queued requests,
+ * and how much written data, go into one transaction.
+ */
+uint64_t zvold_read_chunk = 1ULL << 20;
+int zvold_batch_max = 64;
+uint64_t zvold_batch_bytes = 8ULL << 20;
+uint32_t zvold_max_request = 32U << 20;
+ssize_t zvold_immediate_write_sz = 32768;
+
+/*
+ * A range held for reading or writing.  zfs_range_lock() needs a znode
+ * and is kernel-only, so zvold keeps its own list with the same
+ * semantics; at most one range per outstanding request is ever held.
+ */
+typedef struct zvold_range {
+	list_node_t	zr_node;
+	uint64_t	zr_off;
+	uint64_t	zr_len;
+	boolean_t	zr_writer;
+} zvold_range_t;
+
+typedef struct zvold_conn {
+	list_node_t	zc_node;
+	int		zc_fd;
+	kmutex_t	zc_lock;	/* serializes replies */
+	kcondvar_t	zc_cv;
+	int		zc_pending;	/* requests not yet replied to */
+	boolean_t	zc_dead;	/* a reply could not be sent */
+} zvold_conn_t;
+
+typedef struct zvold_io {
+	list_node_t	zi_node;	/* on the sync queue */
+	zvold_conn_t	*zi_conn;
+	uint16_t	zi_flags;
+	uint16_t	zi_type;
+	uint8_t		zi_handle[8];
+	uint64_t	zi_off;
+	uint32_t	zi_len;
+	char		*zi_data;
+	int		zi_error;
+	kmutex_t	zi_lock;	/* protects zi_pending, zi_error */
+	int		zi_pending;	/* READ pieces still outstanding */
+	zvold_range_t	zi_range;
+	hrtime_t	zi_start;
+} zvold_io_t;
+
+/*
+ * zgd_t is what dmu_sync() hands back to the done callback; ours carries
+ * a zvold range instead of an rl_t.
+ */
+typedef struct zvold_zgd {
+	zgd_t		zz_zgd;
+	zvold_range_t	zz_range;
+} zvold_zgd_t;
+
+typedef struct zvold_stat {
+	uint64_t	zs_ops;
+	uint64_t	zs_bytes;
+	uint64_t	zs_errors;
+	hrtime_t	zs_lat_total;
+	hrtime_t	zs_lat_min;
+	hrtime_t	zs_lat_max;
+	uint64_t	zs_lat_hist[ZVOLD_LAT_BUCKETS];
+} zvold_stat_t;
+
+static char *cmdname;
+static char *zvold_name;
+static char *zvold_socket;
+static boolean_t zvold_readonly;
+static boolean_t zvold_client;		/* -b: benchmark a running zvold */
+static int zvold_bench_qdepth = 32;
+static uint64_t zvold_bench_time = 10;	/* seconds per benchmark */
+static int zvold_sync_threads = 4;
+static int zvold_verbose;
+
+static objset_t *zvold_os;
+static zilog_t *zvold_zilog;
+static uint64_t zvold_volsize;
+static uint64_t zvold_volblocksize;
+static uint64_t zvold_txg_assign;
+
+static kmutex_t zvold_range_lock;
+static kcondvar_t zvold_range_cv;
+static list_t zvold_ranges;
+
+static kmutex_t zvold_sync_lock;
+static kcondvar_t zvold_sync_cv;
+static list_t zvold_sync_queue;
+static int zvold_sync_running;
+static boolean_t zvold_sync_exit;
+static taskq_t *zvold_flush_taskq;
+static taskq_t *zvold_range_taskq;	/* READs waiting for their range */
+
+static kmutex_t zvold_conn_lock;
+static kcondvar_t zvold_conn_cv;
+static list_t zvold_conns;
+
+static kmutex_t zvold_stat_lock;
+static zvold_stat_t zvold_stats[NBD_CMD_TYPES];
+static const char *zvold_stat_names[NBD_CMD_TYPES] = {
+	"read", "write", "disc", "flush", "trim"
+};
+static hrtime_t zvold_start;
+
+static sigset_t zvold_sigs;		/* SIGINT and SIGTERM */
+static int zvold_lfd = -1;		/* the listening socket */
+static volatile boolean_t zvold_exiting;
+
+static void
+fatal(int do_perror, char *message, ...)
+{
+	va_list args;
+	int save_errno = errno;
+
+	(void) fflush(stdout);
+
+	(void) fprintf(stderr, "%s: ", cmdname);
+	va_start(args, message);
+	(void) vfprintf(stderr, message, args);
+	va_end(args);
+	if (do_perror)
+		(void) fprintf(stderr, ": %s", strerror(save_errno));
+	(void) fprintf(stderr, "\n");
+	exit(1);
+}
+
+static void
+usage(boolean_t requested)
+{
+	FILE *fp = requested ? stdout : stderr;
+
+	(void) fprintf(fp, "Usage: %s [-rv] [-w sync_threads (default: %d)] "
+	    "-s socket pool/volume\n"
+	    "       %s -b [-q queue_depth (default: %d)] "
+	    "[-T seconds_per_test (default: %llu)] -s socket\n",
+	    cmdname, zvold_sync_threads, cmdname, zvold_bench_qdepth,
+	    (u_longlong_t)zvold_bench_time);
+	exit(requested ? 0 : 1);
+}
+
+/*
+ * NBD is big-endian on the wire.
+ */
+static void
+zvold_put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void
+zvold_put32(uint8_t *p, uint32_t v)
+{
+	zvold_put16(p, v >> 16);
+	zvold_put16(p + 2, v);
+}
+
+static void
+zvold_put64(uint8_t *p, uint64_t v)
+{
+	zvold_put32(p, v >> 32);
+	zvold_put32(p + 4, v);
+}
+
+static uint16_t
+zvold_get16(const uint8_t *p)
+{
+	return ((p[0] << 8) | p[1]);
+}
+
+static uint32_t
+zvold_get32(const uint8_t *p)
+{
+	return (((uint32_t)zvold_get16(p) << 16) | zvold_get16(p + 2));
+}
+
+static uint64_t
+zvold_get64(const uint8_t *p)
+{
+	return (((uint64_t)zvold_get32(p) << 32) | zvold_get32(p + 4));
+}
+
+static int
+zvold_readn(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len != 0) {
+		n = read(fd, p, len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (n == 0 ? ECONNRESET : errno);
+		p += n;
+		len -= n;
+	}
+	return (0);
+}
+
+static int
+zvold_writen(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len != 0) {
+		n = write(fd, p, len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (n == 0 ? EIO : errno);
+		p += n;
+		len -= n;
+	}
+	return (0);
+}
+
+static uint32_t
+zvold_nbd_error(int error)
+{
+	switch (error) {
+	case 0:
+		return (0);
+	case EROFS:
+	case EPERM:
+		return (NBD_EPERM);
+	case ENOMEM:
+		return (NBD_ENOMEM);
+	case EINVAL:
+		return (NBD_EINVAL);
+	case ENOSPC:
+	case EDQUOT:
+		return (NBD_ENOSPC);
+	default:
+		return (NBD_EIO);
+	}
+}
+
+/*
+ * =========================================================================
+ * Range locks
+ * =========================================================================
+ */
+static boolean_t
+zvold_range_conflicts(zvold_range_t *zr)
+{
+	zvold_range_t *r;
+
+	for (r = list_head(&zvold_ranges); r != NULL;
+	    r = list_next(&zvold_ranges, r)) {
+		if (!zr->zr_writer && !r->zr_writer)
+			continue;
+		if (r->zr_off < zr->zr_off + zr->zr_len &&
+		    zr->zr_off < r->zr_off + r->zr_len)
+			return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
+static void
+zvold_range_enter(zvold_range_t *zr, uint64_t off, uint64_t len,
+    boolean_t writer)
+{
+	zr->zr_off = off;
+	zr->zr_len = len;
+	zr->zr_writer = writer;
+
+	mutex_enter(&zvold_range_lock);
+	while (zvold_range_conflicts(zr))
+		cv_wait(&zvold_range_cv, &zvold_range_lock);
+	list_insert_tail(&zvold_ranges, zr);
+	mutex_exit(&zvold_range_lock);
+}
+
+static boolean_t
+zvold_range_tryenter(zvold_range_t *zr, uint64_t off, uint64_t len,
+    boolean_t writer)
+{
+	boolean_t entered;
+
+	zr->zr_off = off;
+	zr->zr_len = len;
+	zr->zr_writer = writer;
+
+	mutex_enter(&zvold_range_lock);
+	entered = !zvold_range_conflicts(zr);
+	if (entered)
+		list_insert_tail(&zvold_ranges, zr);
+	mutex_exit(&zvold_range_lock);
+
+	return (entered);
+}
+
+static void
+zvold_range_exit(zvold_range_t *zr)
+{
+	mutex_enter(&zvold_range_lock);
+	list_remove(&zvold_ranges, zr);
+	cv_broadcast(&zvold_range_cv);
+	mutex_exit(&zvold_range_lock);
+}
+
+/*
+ * =========================================================================
+ * ZIL
+ * =========================================================================
+ */
+
+/*
+ * Replay a TX_WRITE ZIL transaction that didn't get committed
+ * after a system failure
+ */
+/* ARGSUSED */
+static int
+zvold_replay_write(void *arg, lr_write_t *lr, boolean_t byteswap)
+{
+	char *data = (char *)(lr + 1);	/* data follows lr_write_t */
+	dmu_tx_t *tx;
+	int error;
+
+	if (byteswap)
+		byteswap_uint64_array(lr, sizeof (*lr));
+
+	tx = dmu_tx_create(zvold_os);
+	dmu_tx_hold_write(tx, ZVOL_OBJ, lr->lr_offset, lr->lr_length);
+	error = dmu_tx_assign(tx, zvold_txg_assign);
+	if (error) {
+		dmu_tx_abort(tx);
+	} else {
+		dmu_write(zvold_os, ZVOL_OBJ, lr->lr_offset, lr->lr_length,
+		    data, tx);
+		dmu_tx_commit(tx);
+	}
+
+	return (error);
+}
+
+/* ARGSUSED */
+static int
+zvold_replay_err(void *arg, lr_t *lr, boolean_t byteswap)
+{
+	return (ENOTSUP);
+}
+
+zil_replay_func_t *zvold_replay_vector[TX_MAX_TYPE] = {
+	zvold_replay_err,	/* 0 no such transaction type */
+	zvold_replay_err,	/* TX_CREATE */
+	zvold_replay_err,	/* TX_MKDIR */
+	zvold_replay_err,	/* TX_MKXATTR */
+	zvold_replay_err,	/* TX_SYMLINK */
+	zvold_replay_err,	/* TX_REMOVE */
+	zvold_replay_err,	/* TX_RMDIR */
+	zvold_replay_err,	/* TX_LINK */
+	zvold_replay_err,	/* TX_RENAME */
+	zvold_replay_write,	/* TX_WRITE */
+	zvold_replay_err,	/* TX_TRUNCATE */
+	zvold_replay_err,	/* TX_SETATTR */
+	zvold_replay_err,	/* TX_ACL */
+};
+
+static void
+zvold_get_done(dmu_buf_t *db, void *arg)
+{
+	zvold_zgd_t *zzgd = arg;
+
+	dmu_buf_rele(db, zzgd);
+	zvold_range_exit(&zzgd->zz_range);
+	zil_add_vdev(zzgd->zz_zgd.zgd_zilog,
+	    DVA_GET_VDEV(BP_IDENTITY(zzgd->zz_zgd.zgd_bp)));
+	kmem_free(zzgd, sizeof (zvold_zgd_t));
+}
+
+/*
+ * Get data to generate a TX_WRITE intent log record; see zvol_get_data().
+ */
+/* ARGSUSED */
+static int
+zvold_get_data(void *arg, lr_write_t *lr, char *buf, zio_t *zio)
+{
+	zvold_zgd_t *zzgd;
+	dmu_buf_t *db;
+	uint64_t boff;
+	int error;
+
+	ASSERT(zio);
+	ASSERT(lr->lr_length != 0);
+
+	if (buf != NULL)	/* immediate write */
+		return (dmu_read(zvold_os, ZVOL_OBJ, lr->lr_offset,
+		    lr->lr_length, buf));
+
+	zzgd = kmem_alloc(sizeof (zvold_zgd_t), KM_SLEEP);
+	zzgd->zz_zgd.zgd_zilog = zvold_zilog;
+	zzgd->zz_zgd.zgd_bp = &lr->lr_blkptr;
+	zzgd->zz_zgd.zgd_rl = NULL;
+
+	/*
+	 * Keep the block from changing while dmu_sync() writes it out and
+	 * checksums it.
+	 */
+	boff = P2ALIGN_TYPED(lr->lr_offset, zvold_volblocksize, uint64_t);
+	zvold_range_enter(&zzgd->zz_range, boff, zvold_volblocksize, B_FALSE);
+
+	VERIFY(0 == dmu_buf_hold(zvold_os, ZVOL_OBJ, lr->lr_offset, zzgd,
+	    &db));
+	error = dmu_sync(zio, db, &lr->lr_blkptr,
+	    lr->lr_common.lrc_txg, zvold_get_done, zzgd);
+	if (error == 0)
+		zil_add_vdev(zvold_zilog,
+		    DVA_GET_VDEV(BP_IDENTITY(&lr->lr_blkptr)));
+	/* zvold_get_done() finishes up once dmu_sync()'s write is done */
+	if (error == EINPROGRESS)
+		return (0);
+	dmu_buf_rele(db, zzgd);
+	zvold_range_exit(&zzgd->zz_range);
+	kmem_free(zzgd, sizeof (zvold_zgd_t));
+	return (error);
+}
+
+static void
+zvold_log_write(dmu_tx_t *tx, uint64_t off, uint64_t len)
+{
+	uint64_t blocksize = zvold_volblocksize;
+	lr_write_t *lr;
+
+	while (len) {
+		uint64_t nbytes = MIN(len, blocksize - P2PHASE(off, blocksize));
+		itx_t *itx = zil_itx_create(TX_WRITE, sizeof (*lr));
+
+		itx->itx_wr_state = nbytes > zvold_immediate_write_sz ?
+		    WR_INDIRECT : WR_NEED_COPY;
+		itx->itx_private = NULL;
+		lr = (lr_write_t *)&itx->itx_lr;
+		lr->lr_foid = ZVOL_OBJ;
+		lr->lr_offset = off;
+		lr->lr_length = nbytes;
+		lr->lr_blkoff = off - P2ALIGN_TYPED(off, blocksize, uint64_t);
+		BP_ZERO(&lr->lr_blkptr);
+
+		(void) zil_itx_assign(zvold_zilog, itx, tx);
+		len -= nbytes;
+		off += nbytes;
+	}
+}
+
+/*
+ * =========================================================================
+ * Request completion
+ * =========================================================================
+ */
+static zvold_io_t *
+zvold_io_alloc(zvold_conn_t *zc)
+{
+	zvold_io_t *zi = kmem_zalloc(sizeof (zvold_io_t), KM_SLEEP);
+
+	mutex_init(&zi->zi_lock, NULL, MUTEX_DEFAULT, NULL);
+	zi->zi_conn = zc;
+	zi->zi_start = gethrtime();
+
+	mutex_enter(&zc->zc_lock);
+	zc->zc_pending++;
+	mutex_exit(&zc->zc_lock);
+
+	return (zi);
+}
+
+static void
+zvold_io_free(zvold_io_t *zi)
+{
+	if (zi->zi_data != NULL)
+		kmem_free(zi->zi_data, zi->zi_len);
+	mutex_destroy(&zi->zi_lock);
+	kmem_free(zi, sizeof (zvold_io_t));
+}
+
+static void
+zvold_stat_add(zvold_stat_t *zs, hrtime_t lat, uint64_t bytes, int error)
+{
+	int b = MIN(highbit(lat / 1000), ZVOLD_LAT_BUCKETS - 1);
+
+	if (zs->zs_ops == 0 || lat < zs->zs_lat_min)
+		zs->zs_lat_min = lat;
+	if (lat > zs->zs_lat_max)
+		zs->zs_lat_max = lat;
+	zs->zs_ops++;
+	zs->zs_lat_total += lat;
+	zs->zs_lat_hist[b]++;
+	if (error != 0)
+		zs->zs_errors++;
+	else
+		zs->zs_bytes += bytes;
+}
+
+static void
+zvold_stat_update(zvold_io_t *zi)
+{
+	hrtime_t lat = gethrtime() - zi->zi_start;
+
+	if (zi->zi_type >= NBD_CMD_TYPES)
+		return;
+
+	mutex_enter(&zvold_stat_lock);
+	zvold_stat_add(&zvold_stats[zi->zi_type], lat,
+	    zi->zi_type == NBD_CMD_FLUSH ? 0 : zi->zi_len, zi->zi_error);
+	mutex_exit(&zvold_stat_lock);
+}
+
+/*
+ * Send the reply for a request and free it.  Replies from the different
+ * completion paths are serialized by the connection lock.
+ */
+static void
+zvold_reply(zvold_io_t *zi)
+{
+	zvold_conn_t *zc = zi->zi_conn;
+	uint8_t hdr[ZVOLD_REPLY_SIZE];
+
+	zvold_stat_update(zi);
+
+	zvold_put32(hdr, NBD_REPLY_MAGIC);
+	zvold_put32(hdr + 4, zvold_nbd_error(zi->zi_error));
+	bcopy(zi->zi_handle, hdr + 8, sizeof (zi->zi_handle));
+
+	mutex_enter(&zc->zc_lock);
+	if (!zc->zc_dead &&
+	    (zvold_writen(zc->zc_fd, hdr, sizeof (hdr)) != 0 ||
+	    (zi->zi_type == NBD_CMD_READ && zi->zi_error == 0 &&
+	    zvold_writen(zc->zc_fd, zi->zi_data, zi->zi_len) != 0))) {
+		zc->zc_dead = B_TRUE;
+		(void) shutdown(zc->zc_fd, SHUT_RDWR);
+	}
+	zvold_io_free(zi);
+	if (--zc->zc_pending == 0)
+		cv_broadcast(&zc->zc_cv);
+	mutex_exit(&zc->zc_lock);
+}
+
+static void
+zvold_flush(void *arg)
+{
+	zvold_io_t *zi = arg;
+
+	if (!zil_disable)
+		zil_commit(zvold_zilog, UINT64_MAX, ZVOL_OBJ);
+	zvold_reply(zi);
+}
+
+/*
+ * READs are split at zvold_read_chunk boundaries.  Since the chunk is a
+ * multiple of the block size, the buffers each piece gets back cover
+ * only that piece, so copying their overlap with the request copies
+ * every byte exactly once.
+ */
+static void
+zvold_read_piece_done(zvold_io_t *zi, int err)
+{
+	boolean_t last;
+
+	mutex_enter(&zi->zi_lock);
+	if (zi->zi_error == 0)
+		zi->zi_error = err;
+	last = (--zi->zi_pending == 0);
+	mutex_exit(&zi->zi_lock);
+
+	if (last) {
+		zvold_range_exit(&zi->zi_range);
+		zvold_reply(zi);
+	}
+}
+
+static void
+zvold_read_done(dmu_read_req_t *req, int err, dmu_buf_t **dbp, int numbufs,
+    void *arg)
+{
+	zvold_io_t *zi = arg;
+	uint64_t end = zi->zi_off + zi->zi_len;
+	int i;
+
+	for (i = 0; i < numbufs; i++) {
+		dmu_buf_t *db = dbp[i];
+		uint64_t s = MAX(db->db_offset, zi->zi_off);
+		uint64_t e = MIN(db->db_offset + db->db_size, end);
+
+		if (s < e)
+			bcopy((char *)db->db_data + (s - db->db_offset),
+			    zi->zi_data + (s - zi->zi_off), e - s);
+	}
+	dmu_read_async_rele(req);
+	zvold_read_piece_done(zi, err);
+}
+
+static void
+zvold_read_issue(zvold_io_t *zi)
+{
+	uint64_t off = zi->zi_off;
+	uint64_t end = zi->zi_off + zi->zi_len;
+	dmu_read_req_t *req;
+
+	/* hold one piece ourselves so the reply can't go out early */
+	zi->zi_pending = 1;
+	while (off < end) {
+		uint64_t next = MIN(P2ROUNDUP(off + 1, zvold_read_chunk), end);
+		int err;
+
+		mutex_enter(&zi->zi_lock);
+		zi->zi_pending++;
+		mutex_exit(&zi->zi_lock);
+		err = dmu_read_async(zvold_os, ZVOL_OBJ, off, next - off, 0,
+		    zvold_read_done, zi, &req);
+		if (err != 0)
+			zvold_read_piece_done(zi, err);
+		off = next;
+	}
+	zvold_read_piece_done(zi, 0);
+}
+
+static void
+zvold_read_wait(void *arg)
+{
+	zvold_io_t *zi = arg;
+
+	zvold_range_enter(&zi->zi_range, zi->zi_off, zi->zi_len, B_FALSE);
+	zvold_read_issue(zi);
+}
+
+/*
+ * A READ that overlaps a write in progress waits on the range taskq, so
+ * that the receive thread can go on reading the requests behind it.
+ */
+static void
+zvold_read(zvold_io_t *zi)
+{
+	if (zvold_range_tryenter(&zi->zi_range, zi->zi_off, zi->zi_len,
+	    B_FALSE))
+		zvold_read_issue(zi);
+	else
+		(void) taskq_dispatch(zvold_range_taskq, zvold_read_wait, zi,
+		    TQ_SLEEP);
+}
+
+/*
+ * =========================================================================
+ * Sync threads
+ * =========================================================================
+ */
+static void
+zvold_sync_batch(list_t *batch)
+{
+	uint64_t chunk = DMU_MAX_ACCESS >> 1;
+	dmu_tx_t *tx;
+	zvold_io_t *zi;
+	uint64_t off;
+	int error;
+
+	tx = dmu_tx_create(zvold_os);
+	for (zi = list_head(batch); zi != NULL; zi = list_next(batch, zi)) {
+		if (zi->zi_type == NBD_CMD_TRIM) {
+			dmu_tx_hold_free(tx, ZVOL_OBJ, zi->zi_off, zi->zi_len);
+			continue;
+		}
+		for (off = 0; off < zi->zi_len; off += chunk)
+			dmu_tx_hold_write(tx, ZVOL_OBJ, zi->zi_off + off,
+			    MIN(chunk, zi->zi_len - off));
+	}
+
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error) {
+		dmu_tx_abort(tx);
+	} else {
+		for (zi = list_head(batch); zi != NULL;
+		    zi = list_next(batch, zi)) {
+			if (zi->zi_type == NBD_CMD_TRIM) {
+				zi->zi_error = dmu_free_range(zvold_os,
+				    ZVOL_OBJ, zi->zi_off, zi->zi_len, tx);
+				continue;
+			}
+			for (off = 0; off < zi->zi_len; off += chunk)
+				dmu_write(zvold_os, ZVOL_OBJ, zi->zi_off + off,
+				    MIN(chunk, zi->zi_len - off),
+				    zi->zi_data + off, tx);
+			zvold_log_write(tx, zi->zi_off, zi->zi_len);
+		}
+		dmu_tx_commit(tx);
+	}
+
+	/*
+	 * Drop the ranges before any ZIL commit: zvold_get_data() may need
+	 * them for dmu_sync().
+	 */
+	while ((zi = list_head(batch)) != NULL) {
+		list_remove(batch, zi);
+		zvold_range_exit(&zi->zi_range);
+		if (zi->zi_error == 0)
+			zi->zi_error = error;
+		if (zi->zi_error == 0 && (zi->zi_flags & NBD_CMD_FLAG_FUA))
+			(void) taskq_dispatch(zvold_flush_taskq, zvold_flush,
+			    zi, TQ_SLEEP);
+		else
+			zvold_reply(zi);
+	}
+}
+
+static void
+zvold_sync_thread(void *arg)
+{
+	list_t batch;
+	zvold_io_t *zi;
+	uint64_t bytes;
+	int n;
+
+	list_create(&batch, sizeof (zvold_io_t), offsetof(zvold_io_t, zi_node));
+
+	mutex_enter(&zvold_sync_lock);
+	for (;;) {
+		while (list_is_empty(&zvold_sync_queue) && !zvold_sync_exit)
+			cv_wait(&zvold_sync_cv, &zvold_sync_lock);
+		if (list_is_empty(&zvold_sync_queue))
+			break;
+
+		/*
+		 * Take requests in arrival order; a TRIM copies no data, so
+		 * it doesn't count against zvold_batch_bytes.  The batch
+		 * ends at the first request whose range is busy, since it
+		 * may be busy because of this very batch; if that is the
+		 * first request, wait for its range with no other held.
+		 */
+		bytes = 0;
+		n = 0;
+		while ((zi = list_head(&zvold_sync_queue)) != NULL &&
+		    n < zvold_batch_max) {
+			uint64_t len = zi->zi_type == NBD_CMD_WRITE ?
+			    zi->zi_len : 0;
+
+			if (n != 0 && bytes + len > zvold_batch_bytes)
+				break;
+			if (!zvold_range_tryenter(&zi->zi_range, zi->zi_off,
+			    zi->zi_len, B_TRUE)) {
+				if (n != 0)
+					break;
+				list_remove(&zvold_sync_queue, zi);
+				mutex_exit(&zvold_sync_lock);
+				zvold_range_enter(&zi->zi_range, zi->zi_off,
+				    zi->zi_len, B_TRUE);
+				mutex_enter(&zvold_sync_lock);
+			} else {
+				list_remove(&zvold_sync_queue, zi);
+			}
+			list_insert_tail(&batch, zi);
+			bytes += len;
+			n++;
+		}
+		mutex_exit(&zvold_sync_lock);
+
+		zvold_sync_batch(&batch);
+
+		mutex_enter(&zvold_sync_lock);
+	}
+	zvold_sync_running--;
+	cv_broadcast(&zvold_sync_cv);
+	mutex_exit(&zvold_sync_lock);
+
+	list_destroy(&batch);
+	thread_exit();
+}
+
+static void
+zvold_sync_enqueue(zvold_io_t *zi)
+{
+	mutex_enter(&zvold_sync_lock);
+	list_insert_tail(&zvold_sync_queue, zi);
+	cv_signal(&zvold_sync_cv);
+	mutex_exit(&zvold_sync_lock);
+}
+
+/*
+ * =========================================================================
+ * Connections
+ * =========================================================================
+ */
+static int
+zvold_opt_reply(int fd, uint32_t opt, uint32_t type, const void *data,
+    uint32_t len)
+{
+	uint8_t hdr[20];
+	int error;
+
+	zvold_put64(hdr, NBD_REP_MAGIC);
+	zvold_put32(hdr + 8, opt);
+	zvold_put32(hdr + 12, type);
+	zvold_put32(hdr + 16, len);
+	error = zvold_writen(fd, hdr, sizeof (hdr));
+	if (error == 0 && len != 0)
+		error = zvold_writen(fd, data, len);
+	return (error);
+}
+
+/*
+ * Negotiate the (single, unnamed) export.  Clients that ask for anything
+ * beyond NBD_OPT_GO or NBD_OPT_EXPORT_NAME are told it's unsupported, and
+ * fall back to one of those.
+ */
+static int
+zvold_handshake(zvold_conn_t *zc)
+{
+	uint8_t buf[12 + 124];
+	uint8_t opt[16];
+	uint8_t *data;
+	uint32_t cflags, option, len;
+	uint16_t tflags;
+	int error;
+
+	tflags = NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH |
+	    NBD_FLAG_SEND_FUA | NBD_FLAG_SEND_TRIM;
+	if (zvold_readonly)
+		tflags |= NBD_FLAG_READ_ONLY;
+
+	zvold_put64(buf, NBD_MAGIC);
+	zvold_put64(buf + 8, NBD_OPTS_MAGIC);
+	zvold_put16(buf + 16, NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES);
+	if ((error = zvold_writen(zc->zc_fd, buf, 18)) != 0 ||
+	    (error = zvold_readn(zc->zc_fd, buf, 4)) != 0)
+		return (error);
+	cflags = zvold_get32(buf);
+
+	data = kmem_alloc(NBD_OPT_MAXLEN, KM_SLEEP);
+	for (;;) {
+		if ((error = zvold_readn(zc->zc_fd, opt, sizeof (opt))) != 0)
+			break;
+		option = zvold_get32(opt + 8);
+		len = zvold_get32(opt + 12);
+		if (zvold_get64(opt) != NBD_OPTS_MAGIC ||
+		    len > NBD_OPT_MAXLEN) {
+			error = EPROTO;
+			break;
+		}
+		if ((error = zvold_readn(zc->zc_fd, data, len)) != 0)
+			break;
+
+		if (option == NBD_OPT_EXPORT_NAME) {
+			bzero(buf, sizeof (buf));
+			zvold_put64(buf, zvold_volsize);
+			zvold_put16(buf + 8, tflags);
+			error = zvold_writen(zc->zc_fd, buf,
+			    (cflags & NBD_FLAG_NO_ZEROES) ? 10 : sizeof (buf));
+			break;
+		} else if (option == NBD_OPT_GO) {
+			zvold_put16(buf, NBD_INFO_EXPORT);
+			zvold_put64(buf + 2, zvold_volsize);
+			zvold_put16(buf + 10, tflags);
+			if ((error = zvold_opt_reply(zc->zc_fd, option,
+			    NBD_REP_INFO, buf, 12)) == 0)
+				error = zvold_opt_reply(zc->zc_fd, option,
+				    NBD_REP_ACK, NULL, 0);
+			break;
+		} else if (option == NBD_OPT_ABORT) {
+			(void) zvold_opt_reply(zc->zc_fd, option, NBD_REP_ACK,
+			    NULL, 0);
+			error = ECONNABORTED;
+			break;
+		} else if ((error = zvold_opt_reply(zc->zc_fd, option,
+		    NBD_REP_ERR_UNSUP, NULL, 0)) != 0) {
+			break;
+		}
+	}
+	kmem_free(data, NBD_OPT_MAXLEN);
+
+	return (error);
+}
+
+/*
+ * Read one request and start it.  Returns nonzero once the connection
+ * should be torn down.
+ */
+static int
+zvold_request(zvold_conn_t *zc)
+{
+	uint8_t hdr[ZVOLD_REQUEST_SIZE];
+	zvold_io_t *zi;
+	uint16_t type;
+	uint32_t len;
+	int error;
+
+	if ((error = zvold_readn(zc->zc_fd, hdr, sizeof (hdr))) != 0)
+		return (error);
+	if (zvold_get32(hdr) != NBD_REQUEST_MAGIC)
+		return (EPROTO);
+	type = zvold_get16(hdr + 6);
+	len = zvold_get32(hdr + 24);
+	if (type == NBD_CMD_DISC)
+		return (ECONNRESET);
+	/* we couldn't even skip the payload of an oversized WRITE */
+	if ((type == NBD_CMD_READ || type == NBD_CMD_WRITE) &&
+	    len > zvold_max_request)
+		return (EPROTO);
+
+	zi = zvold_io_alloc(zc);
+	zi->zi_flags = zvold_get16(hdr + 4);
+	zi->zi_type = type;
+	bcopy(hdr + 8, zi->zi_handle, sizeof (zi->zi_handle));
+	zi->zi_off = zvold_get64(hdr + 16);
+	zi->zi_len = len;
+
+	switch (zi->zi_type) {
+	case NBD_CMD_READ:
+	case NBD_CMD_WRITE:
+	case NBD_CMD_TRIM:
+		if (zi->zi_type != NBD_CMD_TRIM && zi->zi_len != 0)
+			zi->zi_data = kmem_alloc(zi->zi_len, KM_SLEEP);
+		if (zi->zi_type == NBD_CMD_WRITE &&
+		    (error = zvold_readn(zc->zc_fd, zi->zi_data,
+		    zi->zi_len)) != 0) {
+			mutex_enter(&zc->zc_lock);
+			zc->zc_dead = B_TRUE;	/* torn request; no reply */
+			mutex_exit(&zc->zc_lock);
+			zvold_reply(zi);
+			return (error);
+		}
+
+		if (zi->zi_off > zvold_volsize ||
+		    zi->zi_len > zvold_volsize - zi->zi_off)
+			zi->zi_error = EINVAL;
+		else if (zvold_readonly && zi->zi_type != NBD_CMD_READ)
+			zi->zi_error = EROFS;
+
+		if (zi->zi_error != 0 || zi->zi_len == 0)
+			zvold_reply(zi);
+		else if (zi->zi_type == NBD_CMD_READ)
+			zvold_read(zi);
+		else
+			zvold_sync_enqueue(zi);
+		break;
+
+	case NBD_CMD_FLUSH:
+		(void) taskq_dispatch(zvold_flush_taskq, zvold_flush, zi,
+		    TQ_SLEEP);
+		break;
+
+	default:
+		zi->zi_error = EINVAL;
+		zvold_reply(zi);
+		break;
+	}
+
+	return (0);
+}
+
+static void
+zvold_conn_thread(void *arg)
+{
+	zvold_conn_t *zc = arg;
+	int error;
+
+	if ((error = zvold_handshake(zc)) == 0) {
+		while ((error = zvold_request(zc)) == 0)
+			continue;
+	}
+	if (zvold_verbose && error != ECONNRESET)
+		(void) fprintf(stderr, "%s: connection %d: %s\n", cmdname,
+		    zc->zc_fd, strerror(error));
+
+	mutex_enter(&zc->zc_lock);
+	while (zc->zc_pending != 0)
+		cv_wait(&zc->zc_cv, &zc->zc_lock);
+	mutex_exit(&zc->zc_lock);
+
+	mutex_enter(&zvold_conn_lock);
+	list_remove(&zvold_conns, zc);
+	cv_broadcast(&zvold_conn_cv);
+	mutex_exit(&zvold_conn_lock);
+
+	(void) close(zc->zc_fd);
+	mutex_destroy(&zc->zc_lock);
+	cv_destroy(&zc->zc_cv);
+	kmem_free(zc, sizeof (zvold_conn_t));
+	thread_exit();
+}
+
+/*
+ * =========================================================================
+ * Setup and teardown
+ * =========================================================================
+ */
+static void
+zvold_open(void)
+{
+	dmu_object_info_t doi;
+	int mode = DS_MODE_PRIMARY;
+	int error;
+
+	if (zvold_readonly)
+		mode |= DS_MODE_READONLY;
+	error = dmu_objset_open(zvold_name, DMU_OST_ZVOL, mode, &zvold_os);
+	if (error)
+		fatal(0, "can't open '%s': %s", zvold_name, strerror(error));
+
+	error = zap_lookup(zvold_os, ZVOL_ZAP_OBJ, "size", 8, 1,
+	    &zvold_volsize);
+	if (error == 0)
+		error = dmu_object_info(zvold_os, ZVOL_OBJ, &doi);
+	if (error)
+		fatal(0, "can't read '%s': %s", zvold_name, strerror(error));
+	zvold_volblocksize = doi.doi_data_block_size;
+	if (zvold_read_chunk < zvold_volblocksize)
+		zvold_read_chunk = zvold_volblocksize;
+
+	zvold_zilog = zil_open(zvold_os, zvold_get_data);
+	if (!zvold_readonly)
+		zil_replay(zvold_os, NULL, &zvold_txg_assign,
+		    zvold_replay_vector);
+}
+
+static void
+zvold_close(void)
+{
+	zil_close(zvold_zilog);
+	dmu_objset_close(zvold_os);
+}
+
+static void
+zvold_sockaddr(struct sockaddr_un *addr)
+{
+	if (strlen(zvold_socket) >= sizeof (addr->sun_path))
+		fatal(0, "socket path too long: %s", zvold_socket);
+
+	bzero(addr, sizeof (*addr));
+	addr->sun_family = AF_UNIX;
+	(void) strcpy(addr->sun_path, zvold_socket);
+}
+
+static int
+zvold_listen(void)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	zvold_sockaddr(&addr);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		fatal(1, "socket");
+	(void) unlink(zvold_socket);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof (addr)) == -1)
+		fatal(1, "bind(%s)", zvold_socket);
+	if (listen(fd, SOMAXCONN) == -1)
+		fatal(1, "listen(%s)", zvold_socket);
+
+	return (fd);
+}
+
+/*
+ * Wait for SIGINT or SIGTERM, then get the main thread out of accept().
+ * Shutting the listening socket down does that on most systems; for the
+ * rest, a connection is made to it too, which the main thread drops
+ * once it sees zvold_exiting.  The main thread closes the socket, under
+ * zvold_conn_lock so that it can't do so before the shutdown().
+ */
+/* ARGSUSED */
+static void
+zvold_signal_thread(void *arg)
+{
+	struct sockaddr_un addr;
+	int fd, sig;
+
+	while (sigwait(&zvold_sigs, &sig) != 0)
+		continue;
+
+	mutex_enter(&zvold_conn_lock);
+	zvold_exiting = B_TRUE;
+	(void) shutdown(zvold_lfd, SHUT_RDWR);
+	mutex_exit(&zvold_conn_lock);
+
+	zvold_sockaddr(&addr);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) != -1) {
+		(void) connect(fd, (struct sockaddr *)&addr, sizeof (addr));
+		(void) close(fd);
+	}
+
+	/*
+	 * The next signal takes its default action, ending a drain that
+	 * is stuck.
+	 */
+	(void) pthread_sigmask(SIG_UNBLOCK, &zvold_sigs, NULL);
+	for (;;)
+		(void) pause();
+}
+
+/*
+ * Latencies are only kept as a log2 histogram, so the percentiles are
+ * the upper bounds of the buckets they fall in.
+ */
+static uint64_t
+zvold_percentile(zvold_stat_t *zs, int permille)
+{
+	uint64_t want = (zs->zs_ops * permille + 999) / 1000;
+	uint64_t seen = 0;
+	int b;
+
+	for (b = 0; b < ZVOLD_LAT_BUCKETS - 1; b++) {
+		seen += zs->zs_lat_hist[b];
+		if (seen >= want)
+			break;
+	}
+	return (1ULL << b);
+}
+
+static void
+zvold_print_stat(const char *name, zvold_stat_t *zs, hrtime_t elapsed)
+{
+	(void) printf("  %s: IOPS=%llu, BW=%lluKiB/s "
+	    "(%llu ios, %llu bytes, %llu errors)\n", name,
+	    (u_longlong_t)(zs->zs_ops * NANOSEC / elapsed),
+	    (u_longlong_t)(zs->zs_bytes * NANOSEC / elapsed >> 10),
+	    (u_longlong_t)zs->zs_ops, (u_longlong_t)zs->zs_bytes,
+	    (u_longlong_t)zs->zs_errors);
+	(void) printf("    lat (usec): min=%llu, max=%llu, avg=%llu, "
+	    "p50<=%llu, p99<=%llu, p99.9<=%llu\n",
+	    (u_longlong_t)(zs->zs_lat_min / 1000),
+	    (u_longlong_t)(zs->zs_lat_max / 1000),
+	    (u_longlong_t)(zs->zs_lat_total / zs->zs_ops / 1000),
+	    (u_longlong_t)zvold_percentile(zs, 500),
+	    (u_longlong_t)zvold_percentile(zs, 990),
+	    (u_longlong_t)zvold_percentile(zs, 999));
+}
+
+static void
+zvold_print_stats(void)
+{
+	hrtime_t elapsed = MAX(gethrtime() - zvold_start, 1);
+	int t;
+
+	(void) printf("%s: %s: %llu msec\n", cmdname, zvold_name,
+	    (u_longlong_t)(elapsed / 1000000));
+
+	for (t = 0; t < NBD_CMD_TYPES; t++) {
+		if (zvold_stats[t].zs_ops != 0)
+			zvold_print_stat(zvold_stat_names[t], &zvold_stats[t],
+			    elapsed);
+	}
+}
+
+/*
+ * =========================================================================
+ * Benchmark client
+ * =========================================================================
+ */
+typedef struct zvold_bench {
+	const char	*zb_name;
+	uint16_t	zb_type;
+	uint32_t	zb_len;
+	boolean_t	zb_random;
+} zvold_bench_t;
+
+/*
+ * The sequential write goes first and sets the span the others use, so
+ * that the reads find data rather than holes.
+ */
+static const zvold_bench_t zvold_benches[] = {
+	{ "seqwrite-64k",	NBD_CMD_WRITE,	64 << 10,	B_FALSE },
+	{ "seqread-64k",	NBD_CMD_READ,	64 << 10,	B_FALSE },
+	{ "randwrite-4k",	NBD_CMD_WRITE,	4 << 10,	B_TRUE },
+	{ "randread-4k",	NBD_CMD_READ,	4 << 10,	B_TRUE },
+};
+
+#define	ZVOLD_BENCHES	(sizeof (zvold_benches) / sizeof (zvold_bench_t))
+
+static int
+zvold_bench_connect(uint64_t *sizep, uint16_t *flagsp)
+{
+	struct sockaddr_un addr;
+	uint8_t buf[10 + 124];
+	uint16_t hflags;
+	int fd;
+
+	zvold_sockaddr(&addr);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		fatal(1, "socket");
+	if (connect(fd, (struct sockaddr *)&addr, sizeof (addr)) == -1)
+		fatal(1, "connect(%s)", zvold_socket);
+
+	if ((errno = zvold_readn(fd, buf, 18)) != 0)
+		fatal(1, "handshake");
+	hflags = zvold_get16(buf + 16);
+	if (zvold_get64(buf) != NBD_MAGIC ||
+	    zvold_get64(buf + 8) != NBD_OPTS_MAGIC ||
+	    !(hflags & NBD_FLAG_FIXED_NEWSTYLE))
+		fatal(0, "%s: not a fixed-newstyle NBD server", zvold_socket);
+
+	zvold_put32(buf, NBD_FLAG_FIXED_NEWSTYLE |
+	    (hflags & NBD_FLAG_NO_ZEROES));
+	zvold_put64(buf + 4, NBD_OPTS_MAGIC);
+	zvold_put32(buf + 12, NBD_OPT_EXPORT_NAME);
+	zvold_put32(buf + 16, 0);
+	if ((errno = zvold_writen(fd, buf, 20)) != 0 ||
+	    (errno = zvold_readn(fd, buf,
+	    (hflags & NBD_FLAG_NO_ZEROES) ? 10 : sizeof (buf))) != 0)
+		fatal(1, "handshake");
+	*sizep = zvold_get64(buf);
+	*flagsp = zvold_get16(buf + 8);
+
+	return (fd);
+}
+
+/*
+ * Keep zvold_bench_qdepth requests of one kind in flight on the
+ * connection for zvold_bench_time seconds, then wait for the last of
+ * them.  Sequential requests wrap around at *spanp; a sequential write
+ * sets *spanp to how far it got.
+ */
+static void
+zvold_bench_run(int fd, const zvold_bench_t *zb, uint64_t *spanp)
+{
+	uint8_t hdr[ZVOLD_REQUEST_SIZE];
+	zvold_stat_t zs;
+	hrtime_t *start, begin, stop;
+	uint64_t off = 0, end = 0, slot;
+	uint64_t blocks = *spanp / zb->zb_len;
+	int *idle, nidle, q, error;
+	char *buf;
+
+	bzero(&zs, sizeof (zs));
+	start = kmem_alloc(zvold_bench_qdepth * sizeof (hrtime_t), KM_SLEEP);
+	idle = kmem_alloc(zvold_bench_qdepth * sizeof (int), KM_SLEEP);
+	for (q = 0; q < zvold_bench_qdepth; q++)
+		idle[q] = q;
+	nidle = zvold_bench_qdepth;
+	buf = kmem_alloc(zb->zb_len, KM_SLEEP);
+	(void) random_get_pseudo_bytes((uint8_t *)buf, zb->zb_len);
+
+	begin = gethrtime();
+	stop = begin + zvold_bench_time * NANOSEC;
+	for (;;) {
+		while (nidle != 0 && gethrtime() < stop) {
+			if (zb->zb_random) {
+				off = ((uint64_t)random() << 31 | random()) %
+				    blocks * zb->zb_len;
+			} else if (off + zb->zb_len > *spanp) {
+				off = 0;
+			}
+			slot = idle[--nidle];
+			zvold_put32(hdr, NBD_REQUEST_MAGIC);
+			zvold_put16(hdr + 4, 0);
+			zvold_put16(hdr + 6, zb->zb_type);
+			zvold_put64(hdr + 8, slot);
+			zvold_put64(hdr + 16, off);
+			zvold_put32(hdr + 24, zb->zb_len);
+			start[slot] = gethrtime();
+			error = zvold_writen(fd, hdr, sizeof (hdr));
+			if (error == 0 && zb->zb_type == NBD_CMD_WRITE)
+				error = zvold_writen(fd, buf, zb->zb_len);
+			if ((errno = error) != 0)
+				fatal(1, "%s: send", zb->zb_name);
+			if (!zb->zb_random) {
+				off += zb->zb_len;
+				end = MAX(end, off);
+			}
+		}
+		if (nidle == zvold_bench_qdepth)
+			break;
+
+		if ((errno = zvold_readn(fd, hdr, ZVOLD_REPLY_SIZE)) != 0)
+			fatal(1, "%s: receive", zb->zb_name);
+		slot = zvold_get64(hdr + 8);
+		if (zvold_get32(hdr) != NBD_REPLY_MAGIC ||
+		    slot >= zvold_bench_qdepth)
+			fatal(0, "%s: bad reply", zb->zb_name);
+		if (zb->zb_type == NBD_CMD_READ && zvold_get32(hdr + 4) == 0 &&
+		    (errno = zvold_readn(fd, buf, zb->zb_len)) != 0)
+			fatal(1, "%s: receive", zb->zb_name);
+		zvold_stat_add(&zs, gethrtime() - start[slot], zb->zb_len,
+		    zvold_get32(hdr + 4));
+		idle[nidle++] = (int)slot;
+	}
+
+	if (zs.zs_ops != 0)
+		zvold_print_stat(zb->zb_name, &zs,
+		    MAX(gethrtime() - begin, 1));
+	if (zb->zb_type == NBD_CMD_WRITE && !zb->zb_random)
+		*spanp = end;
+
+	kmem_free(buf, zb->zb_len);
+	kmem_free(idle, zvold_bench_qdepth * sizeof (int));
+	kmem_free(start, zvold_bench_qdepth * sizeof (hrtime_t));
+}
+
+/*
+ * Run each of zvold_benches against the zvold serving zvold_socket, in
+ * the same fio-like format as the server's statistics.  The writes are
+ * skipped for a read-only export, and the reads then cover the whole
+ * volume.
+ */
+static void
+zvold_bench(void)
+{
+	const zvold_bench_t *zb;
+	uint8_t hdr[ZVOLD_REQUEST_SIZE];
+	uint64_t size, span;
+	uint16_t flags;
+	int fd;
+
+	fd = zvold_bench_connect(&size, &flags);
+	span = size;
+	(void) printf("%s: %s: %llu bytes, queue depth %d, %llu sec each\n",
+	    cmdname, zvold_socket, (u_longlong_t)size, zvold_bench_qdepth,
+	    (u_longlong_t)zvold_bench_time);
+
+	for (zb = zvold_benches; zb < &zvold_benches[ZVOLD_BENCHES]; zb++) {
+		if (zb->zb_type == NBD_CMD_WRITE &&
+		    (flags & NBD_FLAG_READ_ONLY))
+			continue;
+		if (span < zb->zb_len)
+			fatal(0, "%s: volume too small", zb->zb_name);
+		zvold_bench_run(fd, zb, &span);
+	}
+
+	bzero(hdr, sizeof (hdr));
+	zvold_put32(hdr, NBD_REQUEST_MAGIC);
+	zvold_put16(hdr + 6, NBD_CMD_DISC);
+	(void) zvold_writen(fd, hdr, sizeof (hdr));
+	(void) close(fd);
+}
+
+int
+main(int argc, char **argv)
+{
+	zvold_conn_t *zc;
+	int c, fd, t;
+
+	cmdname = argv[0];
+
+	while ((c = getopt(argc, argv, "bq:rs:T:vw:h")) != -1) {
+		switch (c) {
+		case 'b':
+			zvold_client = B_TRUE;
+			break;
+		case 'q':
+			zvold_bench_qdepth = MAX(1, atoi(optarg));
+			break;
+		case 'T':
+			zvold_bench_time = MAX(1, strtoull(optarg, NULL, 0));
+			break;
+		case 'r':
+			zvold_readonly = B_TRUE;
+			break;
+		case 's':
+			zvold_socket = optarg;
+			break;
+		case 'v':
+			zvold_verbose++;
+			break;
+		case 'w':
+			zvold_sync_threads = MAX(1, atoi(optarg));
+			break;
+		case 'h':
+			usage(B_TRUE);
+			break;
+		default:
+			usage(B_FALSE);
+			break;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (zvold_client) {
+		if (argc != 0 || zvold_socket == NULL)
+			usage(B_FALSE);
+		(void) signal(SIGPIPE, SIG_IGN);
+		zvold_bench();
+		return (0);
+	}
+	if (argc != 1 || zvold_socket == NULL)
+		usage(B_FALSE);
+	zvold_name = argv[0];
+
+	/*
+	 * Block the signals before kernel_init() so that every thread it
+	 * and we start inherits the mask; zvold_signal_thread() takes them.
+	 */
+	(void) signal(SIGPIPE, SIG_IGN);
+	(void) sigemptyset(&zvold_sigs);
+	(void) sigaddset(&zvold_sigs, SIGINT);
+	(void) sigaddset(&zvold_sigs, SIGTERM);
+	if ((errno = pthread_sigmask(SIG_BLOCK, &zvold_sigs, NULL)) != 0)
+		fatal(1, "pthread_sigmask");
+
+	kernel_init(zvold_readonly ? FREAD : FREAD | FWRITE);
+	zvold_open();
+
+	mutex_init(&zvold_range_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zvold_range_cv, NULL, CV_DEFAULT, NULL);
+	list_create(&zvold_ranges, sizeof (zvold_range_t),
+	    offsetof(zvold_range_t, zr_node));
+	mutex_init(&zvold_sync_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zvold_sync_cv, NULL, CV_DEFAULT, NULL);
+	list_create(&zvold_sync_queue, sizeof (zvold_io_t),
+	    offsetof(zvold_io_t, zi_node));
+	mutex_init(&zvold_conn_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&zvold_conn_cv, NULL, CV_DEFAULT, NULL);
+	list_create(&zvold_conns, sizeof (zvold_conn_t),
+	    offsetof(zvold_conn_t, zc_node));
+	mutex_init(&zvold_stat_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	zvold_flush_taskq = taskq_create("zvold_flush", zvold_sync_threads,
+	    minclsyspri, zvold_sync_threads, INT_MAX, TASKQ_PREPOPULATE);
+	zvold_range_taskq = taskq_create("zvold_range", zvold_sync_threads,
+	    minclsyspri, zvold_sync_threads, INT_MAX, TASKQ_PREPOPULATE);
+	zvold_sync_running = zvold_sync_threads;
+	for (t = 0; t < zvold_sync_threads; t++)
+		(void) thread_create(NULL, 0, zvold_sync_thread, NULL, 0,
+		    NULL, TS_RUN, minclsyspri);
+
+	zvold_lfd = zvold_listen();
+	(void) thread_create(NULL, 0, zvold_signal_thread, NULL, 0, NULL,
+	    TS_RUN, minclsyspri);
+	if (zvold_verbose)
+		(void) printf("%s: serving %s (%llu bytes) on %s\n", cmdname,
+		    zvold_name, (u_longlong_t)zvold_volsize, zvold_socket);
+	zvold_start = gethrtime();
+
+	for (;;) {
+		fd = accept(zvold_lfd, NULL, NULL);
+		if (zvold_exiting) {
+			if (fd != -1)
+				(void) close(fd);
+			break;
+		}
+		if (fd == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			fatal(1, "accept");
+		}
+		zc = kmem_zalloc(sizeof (zvold_conn_t), KM_SLEEP);
+		zc->zc_fd = fd;
+		mutex_init(&zc->zc_lock, NULL, MUTEX_DEFAULT, NULL);
+		cv_init(&zc->zc_cv, NULL, CV_DEFAULT, NULL);
+
+		mutex_enter(&zvold_conn_lock);
+		list_insert_tail(&zvold_conns, zc);
+		mutex_exit(&zvold_conn_lock);
+		(void) thread_create(NULL, 0, zvold_conn_thread, zc, 0,
+		    NULL, TS_RUN, minclsyspri);
+	}
+	mutex_enter(&zvold_conn_lock);
+	(void) close(zvold_lfd);
+	zvold_lfd = -1;
+	mutex_exit(&zvold_conn_lock);
+	(void) unlink(zvold_socket);
+
+	/*
+	 * Stop reading new requests, and let what's in flight finish.
+	 */
+	mutex_enter(&zvold_conn_lock);
+	for (zc = list_head(&zvold_conns); zc != NULL;
+	    zc = list_next(&zvold_conns, zc))
+		(void) shutdown(zc->zc_fd, SHUT_RD);
+	while (!list_is_empty(&zvold_conns))
+		cv_wait(&zvold_conn_cv, &zvold_conn_lock);
+	mutex_exit(&zvold_conn_lock);
+
+	mutex_enter(&zvold_sync_lock);
+	zvold_sync_exit = B_TRUE;
+	cv_broadcast(&zvold_sync_cv);
+	while (zvold_sync_running != 0)
+		cv_wait(&zvold_sync_cv, &zvold_sync_lock);
+	mutex_exit(&zvold_sync_lock);
+	taskq_destroy(zvold_flush_taskq);
+	taskq_destroy(zvold_range_taskq);
+
+	zvold_close();
+	zvold_print_stats();
+	kernel_fini();
+
+	return (0);
+}
@@ -132,12 +132,26 @@
 static int i_get_value_size(data_type_t type, const void *data, uint_t nelem);
 static int nvlist_add_common(nvlist_t *nvl, const char *name, data_type_t type,
     uint_t nelem, const void *data);
+static void nvb_arena_free(nvpriv_t *priv);
 
 #define	NV_STAT_EMBEDDED	0x1
+#define	NV_STAT_BORROWED	0x2
 #define	EMBEDDED_NVL(nvp)	((nvlist_t *)(void *)NVP_VALUE(nvp))
 #define	EMBEDDED_NVL_ARRAY(nvp)	((nvlist_t **)(void *)NVP_VALUE(nvp))
 
 #define	NVP_VALOFF(nvp)	(NV_ALIGN(sizeof (nvpair_t) + (nvp)->nvp_name_sz))
+
+/*
+ * Pairs built by nvlist_xunpack_borrowed() may hold a pointer into the
+ * caller's packed buffer in place of their value.  Such pairs are marked
+ * in nvp_reserve, and NVP_DATA() returns the address of the value data
+ * for both kinds of pair.
+ */
+#define	NVP_BORROWED		0x1
+#define	NVP_DATA(nvp)		(((nvp)->nvp_reserve & NVP_BORROWED) ? \
+				*(char **)(void *)NVP_VALUE(nvp) : NVP_VALUE(nvp))
+#define	NVL_BORROWED(nvl)	\
+	(((nvpriv_t *)(uintptr_t)(nvl)->nvl_priv)->nvp_stat & NV_STAT_BORROWED)
 #define	NVPAIR2I_NVP(nvp) \
 	((i_nvp_t *)((size_t)(nvp) - offsetof(i_nvp_t, nvi_nvp)))
 
@@ -511,7 +525,7 @@ nvlist_copy_pairs(nvlist_t *snvl, nvlist_t *dnvl)
 		int err;
 
 		if ((err = nvlist_add_common(dnvl, NVP_NAME(nvp), NVP_TYPE(nvp),
-		    NVP_NELEM(nvp), NVP_VALUE(nvp))) != 0)
+		    NVP_NELEM(nvp), NVP_DATA(nvp))) != 0)
 			return (err);
 	}
 
@@ -556,6 +570,16 @@ nvlist_free(nvlist_t *nvl)
 	    (priv = (nvpriv_t *)(uintptr_t)nvl->nvl_priv) == NULL)
 		return;
 
+	/*
+	 * A borrowed nvlist and all of its embedded lists live in a
+	 * single arena which is released with the top level list.
+	 */
+	if (priv->nvp_stat & NV_STAT_BORROWED) {
+		if (!(priv->nvp_stat & NV_STAT_EMBEDDED))
+			nvb_arena_free(priv);
+		return;
+	}
+
 	/*
 	 * Unpacked nvlist are linked through i_nvp_t
 	 */
@@ -641,6 +665,9 @@ nvlist_remove_all(nvlist_t *nvl, const char *name)
 	    (priv = (nvpriv_t *)(uintptr_t)nvl->nvl_priv) == NULL)
 		return (EINVAL);
 
+	if (priv->nvp_stat & NV_STAT_BORROWED)
+		return (ENOTSUP);
+
 	curr = priv->nvp_list;
 	while (curr != NULL) {
 		nvpair_t *nvp = &curr->nvi_nvp;
@@ -672,6 +699,9 @@ nvlist_remove(nvlist_t *nvl, const char *name, data_type_t type)
 	    (priv = (nvpriv_t *)(uintptr_t)nvl->nvl_priv) == NULL)
 		return (EINVAL);
 
+	if (priv->nvp_stat & NV_STAT_BORROWED)
+		return (ENOTSUP);
+
 	curr = priv->nvp_list;
 	while (curr != NULL) {
 		nvpair_t *nvp = &curr->nvi_nvp;
@@ -844,6 +874,9 @@ nvlist_add_common(nvlist_t *nvl, const char *name,
 	if (name == NULL || nvl == NULL || nvl->nvl_priv == 0)
 		return (EINVAL);
 
+	if (NVL_BORROWED(nvl))
+		return (ENOTSUP);
+
 	if (nelem != 0 && data == NULL)
 		return (EINVAL);
 
@@ -1185,7 +1218,7 @@ nvpair_value_common(nvpair_t *nvp, data_type_t type, uint_t *nelem, void *data)
 	case DATA_TYPE_HRTIME:
 		if (data == NULL)
 			return (EINVAL);
-		bcopy(NVP_VALUE(nvp), data,
+		bcopy(NVP_DATA(nvp), data,
 		    (size_t)i_get_value_size(type, NULL, 1));
 		if (nelem != NULL)
 			*nelem = 1;
@@ -1195,7 +1228,7 @@ nvpair_value_common(nvpair_t *nvp, data_type_t type, uint_t *nelem, void *data)
 	case DATA_TYPE_STRING:
 		if (data == NULL)
 			return (EINVAL);
-		*(void **)data = (void *)NVP_VALUE(nvp);
+		*(void **)data = (void *)NVP_DATA(nvp);
 		if (nelem != NULL)
 			*nelem = 1;
 		break;
@@ -1215,7 +1248,7 @@ nvpair_value_common(nvpair_t *nvp, data_type_t type, uint_t *nelem, void *data)
 		if (nelem == NULL || data == NULL)
 			return (EINVAL);
 		if ((*nelem = NVP_NELEM(nvp)) != 0)
-			*(void **)data = (void *)NVP_VALUE(nvp);
+			*(void **)data = (void *)NVP_DATA(nvp);
 		else
 			*(void **)data = NULL;
 		break;
@@ -1646,7 +1679,7 @@ nvlist_add_nvpair(nvlist_t *nvl, nvpair_t *nvp)
 		return (EINVAL);
 
 	return (nvlist_add_common(nvl, NVP_NAME(nvp), NVP_TYPE(nvp),
-	    NVP_NELEM(nvp), NVP_VALUE(nvp)));
+	    NVP_NELEM(nvp), NVP_DATA(nvp)));
 }
 
 /*
@@ -1761,6 +1794,9 @@ nvs_decode_pairs(nvstream_t *nvs, nvlist_t *nvl)
 			return (err);
 		}
 
+		/* nvp_reserve is not part of the packed format */
+		nvp->nvp_reserve = 0;
+
 		if (i_validate_nvpair(nvp) != 0) {
 			nvpair_free(nvp);
 			nvp_buf_free(nvl, nvp);
@@ -1936,6 +1972,21 @@ nvlist_common(nvlist_t *nvl, char *buf, size_t *buflen, int encoding,
 	    (nvs.nvs_priv = (nvpriv_t *)(uintptr_t)nvl->nvl_priv) == NULL)
 		return (EINVAL);
 
+	/*
+	 * The pairs of a borrowed nvlist do not have the layout the
+	 * encoders expect, so size and encode a private copy instead.
+	 */
+	if (nvs_op != NVS_OP_DECODE &&
+	    (nvs.nvs_priv->nvp_stat & NV_STAT_BORROWED)) {
+		nvlist_t *copy;
+
+		if ((err = nvlist_xdup(nvl, &copy, nvs.nvs_priv->nvp_nva)) != 0)
+			return (err);
+		err = nvlist_common(copy, buf, buflen, encoding, nvs_op);
+		nvlist_free(copy);
+		return (err);
+	}
+
 	nvs.nvs_op = nvs_op;
 
 	/*
@@ -2479,6 +2530,365 @@ nvs_native(nvstream_t *nvs, nvlist_t *nvl, char *buf, size_t *buflen)
 	return (err);
 }
 
+/*
+ * Borrowed native decoding
+ *
+ * nvlist_xunpack_borrowed() decodes a natively encoded buffer without
+ * copying the bulk of its contents.  The pair index (nvpriv_t, nvlist_t
+ * and i_nvp_t headers for the list and all embedded lists) is built in a
+ * single arena allocation sized by a first, validating pass over the
+ * buffer.  Names and scalar values are copied into the index; string
+ * values, the strings of string arrays and naturally aligned numeric
+ * arrays are left in the caller's buffer and referenced from the index.
+ *
+ * The resulting nvlist is read-only: additions and removals fail with
+ * ENOTSUP.  Sizing and packing it works, but goes through a private copy.
+ */
+typedef struct {
+	size_t		nvba_size;	/* size of the whole arena */
+	nvpriv_t	nvba_priv;	/* priv of the top level list */
+	nvlist_t	nvba_nvl;	/* top level list */
+} nvb_arena_t;
+
+typedef struct {
+	char		*nb_curr;	/* current position in packed buffer */
+	char		*nb_end;	/* first byte past the packed buffer */
+	char		*nb_arena;	/* arena, NULL while sizing */
+	size_t		nb_size;	/* arena bytes claimed so far */
+	nv_alloc_t	*nb_nva;	/* allocator of the arena */
+} nvs_borrow_t;
+
+static void
+nvb_arena_free(nvpriv_t *priv)
+{
+	nvb_arena_t *arena = (nvb_arena_t *)(void *)
+	    ((char *)priv - offsetof(nvb_arena_t, nvba_priv));
+
+	nv_mem_free(priv, arena, arena->nvba_size);
+}
+
+/*
+ * Claim size bytes of the arena.  Returns NULL during the sizing pass.
+ */
+static void *
+nvb_claim(nvs_borrow_t *nb, size_t size)
+{
+	void *p = NULL;
+
+	if (nb->nb_arena != NULL)
+		p = nb->nb_arena + nb->nb_size;
+	nb->nb_size += NV_ALIGN(size);
+
+	return (p);
+}
+
+/*
+ * Return the length of the string at str, or -1 if it is not
+ * terminated before end.
+ */
+static int
+nvb_strlen(const char *str, const char *end)
+{
+	const char *s;
+
+	for (s = str; s < end; s++)
+		if (*s == '\0')
+			return (s - str);
+
+	return (-1);
+}
+
+static int nvb_decode_pairs(nvs_borrow_t *, nvlist_t *);
+
+/*
+ * Decode the embedded list whose packed nvlist_t header is at packed
+ * into emb.  Its pairs follow at the current stream position.
+ */
+static int
+nvb_decode_embedded(nvs_borrow_t *nb, const char *packed, nvlist_t *emb)
+{
+	nvlist_t hdr;
+	nvpriv_t *priv;
+
+	bcopy(packed, &hdr, sizeof (nvlist_t));
+	if (hdr.nvl_version != NV_VERSION)
+		return (ENOTSUP);
+
+	priv = nvb_claim(nb, sizeof (nvpriv_t));
+	if (emb != NULL) {
+		nv_priv_init(priv, nb->nb_nva,
+		    NV_STAT_EMBEDDED | NV_STAT_BORROWED);
+		nvlist_init(emb, hdr.nvl_nvflag, priv);
+	}
+
+	return (nvb_decode_pairs(nb, emb));
+}
+
+static int
+nvb_decode_nvpair(nvs_borrow_t *nb, nvlist_t *nvl)
+{
+	char *packed = nb->nb_curr;
+	char *value, *vend, *ref = NULL;
+	nvpair_t hdr, *nvp = NULL;
+	i_nvp_t *rec;
+	int value_sz, slot_sz, i, err;
+
+	bcopy(packed, &hdr, sizeof (nvpair_t));
+
+	if (hdr.nvp_name_sz <= 0 ||
+	    hdr.nvp_size < NVP_SIZE_CALC(hdr.nvp_name_sz, 0) ||
+	    packed[sizeof (nvpair_t) + hdr.nvp_name_sz - 1] != '\0' ||
+	    strlen(packed + sizeof (nvpair_t)) != hdr.nvp_name_sz - 1)
+		return (EFAULT);
+
+	if ((value_sz = i_get_value_size(NVP_TYPE(&hdr), NULL,
+	    NVP_NELEM(&hdr))) < 0 ||
+	    NVP_SIZE_CALC(hdr.nvp_name_sz, value_sz) > hdr.nvp_size)
+		return (EFAULT);
+
+	value = packed + NVP_VALOFF(&hdr);
+	vend = packed + hdr.nvp_size;
+
+	/*
+	 * Work out what the index has to hold in place of the value:
+	 * either a pointer into the packed buffer, or the value itself.
+	 */
+	switch (NVP_TYPE(&hdr)) {
+	case DATA_TYPE_STRING:
+		if (nvb_strlen(value, vend) < 0)
+			return (EFAULT);
+		ref = value;
+		slot_sz = sizeof (char *);
+		break;
+
+	case DATA_TYPE_STRING_ARRAY: {
+		char *str = value + value_sz;
+
+		for (i = 0; i < NVP_NELEM(&hdr); i++) {
+			int len;
+
+			if ((len = nvb_strlen(str, vend)) < 0)
+				return (EFAULT);
+			str += len + 1;
+		}
+		slot_sz = value_sz;	/* the pointer array only */
+		break;
+	}
+
+	case DATA_TYPE_BOOLEAN_ARRAY:
+	case DATA_TYPE_BYTE_ARRAY:
+	case DATA_TYPE_INT8_ARRAY:
+	case DATA_TYPE_UINT8_ARRAY:
+	case DATA_TYPE_INT16_ARRAY:
+	case DATA_TYPE_UINT16_ARRAY:
+	case DATA_TYPE_INT32_ARRAY:
+	case DATA_TYPE_UINT32_ARRAY:
+	case DATA_TYPE_INT64_ARRAY:
+	case DATA_TYPE_UINT64_ARRAY:
+		/*
+		 * Arrays which are not naturally aligned in the buffer are
+		 * copied, so that callers may index them directly.
+		 */
+		if (NVP_NELEM(&hdr) != 0 && ((uintptr_t)value &
+		    (value_sz / NVP_NELEM(&hdr) - 1)) == 0) {
+			ref = value;
+			slot_sz = sizeof (char *);
+		} else {
+			slot_sz = value_sz;
+		}
+		break;
+
+	default:
+		slot_sz = value_sz;
+		break;
+	}
+
+	rec = nvb_claim(nb, offsetof(i_nvp_t, nvi_nvp) +
+	    NVP_SIZE_CALC(hdr.nvp_name_sz, slot_sz));
+
+	if (nvl != NULL) {
+		nvp = &rec->nvi_nvp;
+		nvp->nvp_size = NVP_SIZE_CALC(hdr.nvp_name_sz, slot_sz);
+		nvp->nvp_name_sz = hdr.nvp_name_sz;
+		nvp->nvp_value_elem = NVP_NELEM(&hdr);
+		nvp->nvp_type = NVP_TYPE(&hdr);
+		bcopy(packed + sizeof (nvpair_t), NVP_NAME(nvp),
+		    hdr.nvp_name_sz);
+
+		if (ref != NULL) {
+			nvp->nvp_reserve = NVP_BORROWED;
+			*(char **)(void *)NVP_VALUE(nvp) = ref;
+		} else if (NVP_TYPE(nvp) == DATA_TYPE_STRING_ARRAY) {
+			char **strp = (void *)NVP_VALUE(nvp);
+			char *str = value + value_sz;
+
+			for (i = 0; i < NVP_NELEM(nvp); i++) {
+				strp[i] = str;
+				str += strlen(str) + 1;
+			}
+		} else if (NVP_TYPE(nvp) != DATA_TYPE_NVLIST &&
+		    NVP_TYPE(nvp) != DATA_TYPE_NVLIST_ARRAY) {
+			bcopy(value, NVP_VALUE(nvp), value_sz);
+		}
+
+		if (i_validate_nvpair_value(NVP_TYPE(nvp), NVP_NELEM(nvp),
+		    NVP_DATA(nvp)) != 0)
+			return (EFAULT);
+	}
+
+	/* embedded lists follow the pair in the stream */
+	nb->nb_curr = vend;
+
+	switch (NVP_TYPE(&hdr)) {
+	case DATA_TYPE_NVLIST:
+		if ((err = nvb_decode_embedded(nb, value,
+		    nvp != NULL ? EMBEDDED_NVL(nvp) : NULL)) != 0)
+			return (err);
+		break;
+
+	case DATA_TYPE_NVLIST_ARRAY: {
+		size_t len = NVP_NELEM(&hdr) * sizeof (uint64_t);
+		nvlist_t **nvlp = NULL;
+		nvlist_t *embedded = NULL;
+
+		if (nvp != NULL) {
+			nvlp = EMBEDDED_NVL_ARRAY(nvp);
+			embedded = (nvlist_t *)((uintptr_t)nvlp + len);
+		}
+
+		for (i = 0; i < NVP_NELEM(&hdr); i++) {
+			if ((err = nvb_decode_embedded(nb,
+			    value + len + i * sizeof (nvlist_t),
+			    embedded)) != 0)
+				return (err);
+			if (nvlp != NULL)
+				nvlp[i] = embedded++;
+		}
+		break;
+	}
+
+	default:
+		break;
+	}
+
+	if (nvp != NULL)
+		nvp_buf_link(nvl, nvp);
+
+	return (0);
+}
+
+/*
+ * Decode the pairs of one list up to and including its end mark.
+ * nvl is NULL during the sizing pass.
+ */
+static int
+nvb_decode_pairs(nvs_borrow_t *nb, nvlist_t *nvl)
+{
+	int32_t len;
+	int err;
+
+	for (;;) {
+		if (nb->nb_curr + sizeof (int32_t) > nb->nb_end)
+			return (EFAULT);
+		bcopy(nb->nb_curr, &len, sizeof (int32_t));
+
+		if (len == 0) {
+			nb->nb_curr += sizeof (int32_t);
+			return (0);
+		}
+
+		if (len < 0 || len < NVP_SIZE_CALC(1, 0) ||
+		    len > nb->nb_end - nb->nb_curr)
+			return (EFAULT);
+
+		if ((err = nvb_decode_nvpair(nb, nvl)) != 0)
+			return (err);
+	}
+}
+
+/*
+ * Unpack a natively encoded buf into an nvlist_t that borrows its string
+ * and array storage from buf.  The caller must keep buf allocated and
+ * unmodified until the nvlist has been released with nvlist_free(), and
+ * must not modify the returned list.  Buffers in any other encoding, or
+ * from a host of different endianness, are rejected with ENOTSUP.
+ */
+/*ARGSUSED1*/
+int
+nvlist_unpack_borrowed(char *buf, size_t buflen, nvlist_t **nvlp, int kmflag)
+{
+#if defined(_KERNEL) && !defined(_BOOT)
+	return (nvlist_xunpack_borrowed(buf, buflen, nvlp,
+	    (kmflag == KM_SLEEP ? nv_alloc_sleep : nv_alloc_nosleep)));
+#else
+	return (nvlist_xunpack_borrowed(buf, buflen, nvlp, nv_alloc_nosleep));
+#endif
+}
+
+int
+nvlist_xunpack_borrowed(char *buf, size_t buflen, nvlist_t **nvlp,
+    nv_alloc_t *nva)
+{
+	nvs_header_t *nvh = (void *)buf;
+	nvs_borrow_t nb;
+	nvb_arena_t *arena;
+	nvpriv_t tmp;
+	int32_t version;
+	uint32_t nvflag;
+	char *pairs;
+	int err;
+#ifdef	_LITTLE_ENDIAN
+	int host_endian = 1;
+#else
+	int host_endian = 0;
+#endif	/* _LITTLE_ENDIAN */
+
+	if (nvlp == NULL || buf == NULL || nva == NULL ||
+	    buflen < sizeof (nvs_header_t) + 2 * sizeof (int32_t))
+		return (EINVAL);
+
+	if (nvh->nvh_encoding != NV_ENCODE_NATIVE ||
+	    nvh->nvh_endian != host_endian)
+		return (ENOTSUP);
+
+	pairs = buf + sizeof (nvs_header_t);
+	bcopy(pairs, &version, sizeof (int32_t));
+	bcopy(pairs + sizeof (int32_t), &nvflag, sizeof (uint32_t));
+	if (version != NV_VERSION)
+		return (ENOTSUP);
+	pairs += 2 * sizeof (int32_t);
+
+	/* first pass: validate the buffer and size the arena */
+	bzero(&nb, sizeof (nb));
+	nb.nb_curr = pairs;
+	nb.nb_end = buf + buflen;
+	nb.nb_size = NV_ALIGN(sizeof (nvb_arena_t));
+	nb.nb_nva = nva;
+	if ((err = nvb_decode_pairs(&nb, NULL)) != 0)
+		return (err);
+
+	nv_priv_init(&tmp, nva, 0);
+	if ((arena = nv_mem_zalloc(&tmp, nb.nb_size)) == NULL)
+		return (ENOMEM);
+
+	arena->nvba_size = nb.nb_size;
+	nv_priv_init(&arena->nvba_priv, nva, NV_STAT_BORROWED);
+	nvlist_init(&arena->nvba_nvl, nvflag, &arena->nvba_priv);
+
+	/* second pass: build the index */
+	nb.nb_curr = pairs;
+	nb.nb_arena = (char *)arena;
+	nb.nb_size = NV_ALIGN(sizeof (nvb_arena_t));
+	if ((err = nvb_decode_pairs(&nb, &arena->nvba_nvl)) != 0) {
+		nv_mem_free(&tmp, arena, arena->nvba_size);
+		return (err);
+	}
+	ASSERT(nb.nb_size == arena->nvba_size);
+
+	*nvlp = &arena->nvba_nvl;
+	return (0);
+}
+
 /*
  * XDR encoding functions
  *
@@ -270,6 +270,7 @@ get_stats(zfs_handle_t *zhp)
 	zfs_cmd_t zc = { 0 };
 	libzfs_handle_t *hdl = zhp->zfs_hdl;
 	nvlist_t *allprops, *userprops;
+	char *propbuf;
 
 	(void) strlcpy(zc.zc_name, zhp->zfs_name, sizeof (zc.zc_name));
 
@@ -292,7 +293,11 @@ get_stats(zfs_handle_t *zhp)
 
 	(void) strlcpy(zhp->zfs_root, zc.zc_value, sizeof (zhp->zfs_root));
 
-	if (zcmd_read_dst_nvlist(hdl, &zc, &allprops) != 0) {
+	/*
+	 * zfs_props is only ever read, so it can reference the packed
+	 * buffer directly instead of copying every property out of it.
+	 */
+	if (zcmd_borrow_dst_nvlist(hdl, &zc, &allprops, &propbuf) != 0) {
 		zcmd_free_nvlists(&zc);
 		return (-1);
 	}
@@ -301,18 +306,36 @@ get_stats(zfs_handle_t *zhp)
 
 	if ((userprops = process_user_props(zhp, allprops)) == NULL) {
 		nvlist_free(allprops);
+		free(propbuf);
 		return (-1);
 	}
 
 	nvlist_free(zhp->zfs_props);
+	free(zhp->zfs_props_buf);
 	nvlist_free(zhp->zfs_user_props);
+	nvlist_free(zhp->zfs_props_filter);
 
 	zhp->zfs_props = allprops;
+	zhp->zfs_props_buf = propbuf;
 	zhp->zfs_user_props = userprops;
+	zhp->zfs_props_filter = NULL;
 
 	return (0);
 }
 
+/*
+ * Handles built from a filtered ZFS_IOC_LIST_BATCH only carry the properties
+ * that were asked for.  Returns B_TRUE if 'propname' may be missing from
+ * zfs_props only because of that, in which case the caller should fetch the
+ * complete set before concluding that the property has its default value.
+ */
+static boolean_t
+props_incomplete(zfs_handle_t *zhp, const char *propname)
+{
+	return (zhp->zfs_props_filter != NULL &&
+	    nvlist_lookup_boolean(zhp->zfs_props_filter, propname) != 0);
+}
+
 /*
  * Refresh the properties currently stored in the handle.
  */
@@ -322,6 +345,29 @@ zfs_refresh_properties(zfs_handle_t *zhp)
 	(void) get_stats(zhp);
 }
 
+/*
+ * Determine the high-level type of a handle from its objset statistics.
+ */
+static void
+set_dataset_type(zfs_handle_t *zhp)
+{
+	if (zhp->zfs_dmustats.dds_type == DMU_OST_ZVOL)
+		zhp->zfs_head_type = ZFS_TYPE_VOLUME;
+	else if (zhp->zfs_dmustats.dds_type == DMU_OST_ZFS)
+		zhp->zfs_head_type = ZFS_TYPE_FILESYSTEM;
+	else
+		abort();
+
+	if (zhp->zfs_dmustats.dds_is_snapshot)
+		zhp->zfs_type = ZFS_TYPE_SNAPSHOT;
+	else if (zhp->zfs_dmustats.dds_type == DMU_OST_ZVOL)
+		zhp->zfs_type = ZFS_TYPE_VOLUME;
+	else if (zhp->zfs_dmustats.dds_type == DMU_OST_ZFS)
+		zhp->zfs_type = ZFS_TYPE_FILESYSTEM;
+	else
+		abort();	/* we should never see any other types */
+}
+
 /*
  * Makes a handle from the given dataset name.  Used by zfs_open() and
  * zfs_iter_* to create child handles on the fly.
@@ -399,26 +445,69 @@ top:
 	 * We've managed to open the dataset and gather statistics.  Determine
 	 * the high-level type.
 	 */
-	if (zhp->zfs_dmustats.dds_type == DMU_OST_ZVOL)
-		zhp->zfs_head_type = ZFS_TYPE_VOLUME;
-	else if (zhp->zfs_dmustats.dds_type == DMU_OST_ZFS)
-		zhp->zfs_head_type = ZFS_TYPE_FILESYSTEM;
-	else
-		abort();
-
-	if (zhp->zfs_dmustats.dds_is_snapshot)
-		zhp->zfs_type = ZFS_TYPE_SNAPSHOT;
-	else if (zhp->zfs_dmustats.dds_type == DMU_OST_ZVOL)
-		zhp->zfs_type = ZFS_TYPE_VOLUME;
-	else if (zhp->zfs_dmustats.dds_type == DMU_OST_ZFS)
-		zhp->zfs_type = ZFS_TYPE_FILESYSTEM;
-	else
-		abort();	/* we should never see any other types */
+	set_dataset_type(zhp);
 
 	zhp->zfs_hdl->libzfs_log_str = logstr;
 	return (zhp);
 }
 
+/*
+ * Makes a handle from one entry of a ZFS_IOC_LIST_BATCH result, without
+ * going back to the kernel.  'filter' is the property list the batch was
+ * requested with, if any.  Inconsistent datasets need the cleanup done by
+ * make_dataset_handle(), so they take the slow path.  If memory runs out,
+ * the error is reported and errno is left set to ENOMEM.
+ */
+static zfs_handle_t *
+make_dataset_handle_batch(libzfs_handle_t *hdl, const char *path,
+    nvlist_t *entry, const char *altroot, nvlist_t *filter)
+{
+	zfs_handle_t *zhp;
+	uchar_t *stats;
+	uint_t statslen;
+	nvlist_t *props;
+
+	if (nvlist_lookup_byte_array(entry, ZFS_LIST_BATCH_STATS, &stats,
+	    &statslen) != 0 || statslen != sizeof (dmu_objset_stats_t) ||
+	    nvlist_lookup_nvlist(entry, ZFS_LIST_BATCH_PROPS, &props) != 0 ||
+	    ((dmu_objset_stats_t *)stats)->dds_inconsistent)
+		return (make_dataset_handle(hdl, path));
+
+	if ((zhp = zfs_alloc(hdl, sizeof (zfs_handle_t))) == NULL) {
+		errno = ENOMEM;
+		return (NULL);
+	}
+
+	zhp->zfs_hdl = hdl;
+	(void) strlcpy(zhp->zfs_name, path, sizeof (zhp->zfs_name));
+	(void) strlcpy(zhp->zfs_root, altroot, sizeof (zhp->zfs_root));
+	bcopy(stats, &zhp->zfs_dmustats, sizeof (zhp->zfs_dmustats));
+
+	if (nvlist_dup(props, &zhp->zfs_props, 0) != 0) {
+		(void) no_memory(hdl);
+		goto nomem;
+	}
+
+	if (filter != NULL &&
+	    nvlist_dup(filter, &zhp->zfs_props_filter, 0) != 0) {
+		(void) no_memory(hdl);
+		goto nomem;
+	}
+
+	if ((zhp->zfs_user_props = process_user_props(zhp,
+	    zhp->zfs_props)) == NULL)
+		goto nomem;
+
+	set_dataset_type(zhp);
+
+	return (zhp);
+
+nomem:
+	zfs_close(zhp);
+	errno = ENOMEM;
+	return (NULL);
+}
+
 /*
  * Opens the given snapshot, filesystem, or volume.   The 'types'
  * argument is a mask of acceptable types.  The function will print an
@@ -470,7 +559,9 @@ zfs_close(zfs_handle_t *zhp)
 	if (zhp->zfs_mntopts)
 		free(zhp->zfs_mntopts);
 	nvlist_free(zhp->zfs_props);
+	free(zhp->zfs_props_buf);
 	nvlist_free(zhp->zfs_user_props);
+	nvlist_free(zhp->zfs_props_filter);
 	free(zhp);
 }
 
@@ -2070,6 +2161,11 @@ getprop_uint64(zfs_handle_t *zhp, zfs_prop_t prop, char **source)
 	uint64_t value;
 
 	*source = NULL;
+	if (nvlist_lookup_nvlist(zhp->zfs_props,
+	    zfs_prop_to_name(prop), &nv) != 0 &&
+	    props_incomplete(zhp, zfs_prop_to_name(prop)))
+		(void) get_stats(zhp);
+
 	if (nvlist_lookup_nvlist(zhp->zfs_props,
 	    zfs_prop_to_name(prop), &nv) == 0) {
 		verify(nvlist_lookup_uint64(nv, ZFS_PROP_VALUE, &value) == 0);
@@ -2089,6 +2185,11 @@ getprop_string(zfs_handle_t *zhp, zfs_prop_t prop, char **source)
 	char *value;
 
 	*source = NULL;
+	if (nvlist_lookup_nvlist(zhp->zfs_props,
+	    zfs_prop_to_name(prop), &nv) != 0 &&
+	    props_incomplete(zhp, zfs_prop_to_name(prop)))
+		(void) get_stats(zhp);
+
 	if (nvlist_lookup_nvlist(zhp->zfs_props,
 	    zfs_prop_to_name(prop), &nv) == 0) {
 		verify(nvlist_lookup_string(nv, ZFS_PROP_VALUE, &value) == 0);
@@ -2165,6 +2266,7 @@ get_numeric_property(zfs_handle_t *zhp, zfs_prop_t prop, zfs_source_t *src,
 
 		search.mnt_special = (char *)zhp->zfs_name;
 		search.mnt_fstype = MNTTYPE_ZFS;
+		(void) pthread_mutex_lock(&zhp->zfs_hdl->libzfs_mnt_lock);
 #ifndef __APPLE__
 		rewind(mnttab);
 #endif /*!__APPLE__*/
@@ -2172,9 +2274,13 @@ get_numeric_property(zfs_handle_t *zhp, zfs_prop_t prop, zfs_source_t *src,
 		if (getmntany(mnttab, &entry, &search) == 0) {
 			zhp->zfs_mntopts = zfs_strdup(zhp->zfs_hdl,
 				entry.mnt_mntopts);
-			if (zhp->zfs_mntopts == NULL)
+			if (zhp->zfs_mntopts == NULL) {
+				(void) pthread_mutex_unlock(
+				    &zhp->zfs_hdl->libzfs_mnt_lock);
 				return (-1);
+			}
 		}
+		(void) pthread_mutex_unlock(&zhp->zfs_hdl->libzfs_mnt_lock);
 
 		zhp->zfs_mntcheck = B_TRUE;
 	}
@@ -2548,6 +2654,125 @@ zfs_get_type(const zfs_handle_t *zhp)
 	return (zhp->zfs_type);
 }
 
+/*
+ * Limit the properties gathered for each dataset returned by
+ * zfs_iter_filesystems() and zfs_iter_snapshots() to the names in 'props'
+ * (boolean entries), or gather them all if 'props' is NULL.  This only saves
+ * work; a handle asked for any other property will fetch it on demand.
+ */
+int
+zfs_iter_set_props(libzfs_handle_t *hdl, nvlist_t *props)
+{
+	nvlist_t *copy = NULL;
+
+	if (props != NULL && nvlist_dup(props, &copy, 0) != 0)
+		return (no_memory(hdl));
+
+	nvlist_free(hdl->libzfs_list_props);
+	hdl->libzfs_list_props = copy;
+	return (0);
+}
+
+/*
+ * Iterate over the children or snapshots of a dataset using
+ * ZFS_IOC_LIST_BATCH, which returns many datasets along with their
+ * properties in each call.  Callers must check libzfs_no_list_batch first;
+ * it is set by libzfs_init() when the kernel doesn't implement the ioctl.
+ */
+static int
+zfs_iter_batch(zfs_handle_t *zhp, uint64_t flags, zfs_iter_f func,
+    void *data)
+{
+	libzfs_handle_t *hdl = zhp->zfs_hdl;
+	zfs_cmd_t zc = { 0 };
+	nvlist_t *filter = NULL;
+	nvlist_t *batch, *entry;
+	nvpair_t *elem;
+	zfs_handle_t *nzhp;
+	int ret = 0;
+	int error = 0;
+
+	/*
+	 * Keep our own copy of the filter, as 'func' may well change it.
+	 */
+	if (hdl->libzfs_list_props != NULL) {
+		if (nvlist_dup(hdl->libzfs_list_props, &filter, 0) != 0)
+			return (no_memory(hdl));
+		if (zcmd_write_src_nvlist(hdl, &zc, filter, NULL) != 0) {
+			nvlist_free(filter);
+			return (-1);
+		}
+	}
+
+	if (zcmd_alloc_dst_nvlist(hdl, &zc, 0) != 0) {
+		zcmd_free_nvlists(&zc);
+		nvlist_free(filter);
+		return (-1);
+	}
+
+	(void) strlcpy(zc.zc_name, zhp->zfs_name, sizeof (zc.zc_name));
+	zc.zc_obj = flags;
+
+	for (;;) {
+		if (ioctl(hdl->libzfs_fd, ZFS_IOC_LIST_BATCH, &zc) != 0) {
+			error = errno;
+			if (error == ENOMEM &&
+			    zcmd_expand_dst_nvlist(hdl, &zc) == 0)
+				continue;
+			break;
+		}
+
+		if (zcmd_read_dst_nvlist(hdl, &zc, &batch) != 0) {
+			ret = -1;
+			break;
+		}
+
+		for (elem = nvlist_next_nvpair(batch, NULL); elem != NULL;
+		    elem = nvlist_next_nvpair(batch, elem)) {
+			verify(nvpair_value_nvlist(elem, &entry) == 0);
+
+			/*
+			 * Running out of memory has already been reported
+			 * and ends the iteration.  Silently ignore other
+			 * errors, as the only plausible explanation is that
+			 * the pool has since been removed.
+			 */
+			if ((nzhp = make_dataset_handle_batch(hdl,
+			    nvpair_name(elem), entry, zc.zc_value,
+			    filter)) == NULL) {
+				if (errno != ENOMEM)
+					continue;
+				ret = -1;
+				break;
+			}
+
+			if ((ret = func(nzhp, data)) != 0)
+				break;
+		}
+
+		nvlist_free(batch);
+		if (ret != 0)
+			break;
+	}
+
+	zcmd_free_nvlists(&zc);
+	nvlist_free(filter);
+
+	if (ret != 0)
+		return (ret);
+
+	/*
+	 * An errno value of ESRCH indicates normal completion.  If ENOENT is
+	 * returned, then the underlying dataset has been removed since we
+	 * obtained the handle.
+	 */
+	if (error != ESRCH && error != ENOENT)
+		return (zfs_standard_error(hdl, error,
+		    dgettext(TEXT_DOMAIN, "cannot iterate filesystems")));
+
+	return (0);
+}
+
 /*
  * Iterate over all child filesystems
  */
@@ -2558,6 +2783,9 @@ zfs_iter_filesystems(zfs_handle_t *zhp, zfs_iter_f func, void *data)
 	zfs_handle_t *nzhp;
 	int ret;
 
+	if (!zhp->zfs_hdl->libzfs_no_list_batch)
+		return (zfs_iter_batch(zhp, 0, func, data));
+
 	for ((void) strlcpy(zc.zc_name, zhp->zfs_name, sizeof (zc.zc_name));
 	    ioctl(zhp->zfs_hdl->libzfs_fd, ZFS_IOC_DATASET_LIST_NEXT, &zc) == 0;
 	    (void) strlcpy(zc.zc_name, zhp->zfs_name, sizeof (zc.zc_name))) {
@@ -2601,6 +2829,10 @@ zfs_iter_snapshots(zfs_handle_t *zhp, zfs_iter_f func, void *data)
 	zfs_handle_t *nzhp;
 	int ret;
 
+	if (!zhp->zfs_hdl->libzfs_no_list_batch)
+		return (zfs_iter_batch(zhp, ZFS_LIST_BATCH_SNAPSHOTS, func,
+		    data));
+
 	for ((void) strlcpy(zc.zc_name, zhp->zfs_name, sizeof (zc.zc_name));
 	    ioctl(zhp->zfs_hdl->libzfs_fd, ZFS_IOC_SNAPSHOT_LIST_NEXT,
 	    &zc) == 0;
@@ -3427,6 +3659,119 @@ zfs_snapshot(libzfs_handle_t *hdl, const char *path, boolean_t recursive)
 	return (ret);
 }
 
+/*
+ * Applies batch operation 'op' to every dataset named in 'names' (all in
+ * one pool) with a single ioctl.  The kernel commits the operations in as
+ * few txgs as it can, and each one succeeds or fails on its own.  If any
+ * of them failed, -1 is returned.  If 'errors' is not NULL it is then set
+ * to an nvlist mapping each failed name to its errno, and reporting those
+ * failures is left to the caller; otherwise the first one is reported
+ * here.  Errors that stop the whole batch are always reported here.
+ */
+int
+zfs_batch(libzfs_handle_t *hdl, zfs_batch_op_t op, nvlist_t *names,
+    nvlist_t **errors, const char *errbuf)
+{
+	zfs_cmd_t zc = { 0 };
+	nvlist_t *errlist = NULL;
+	nvpair_t *elem;
+	int32_t err;
+	size_t len;
+
+	if (errors != NULL)
+		*errors = NULL;
+
+	if ((elem = nvlist_next_nvpair(names, NULL)) == NULL)
+		return (0);
+
+	(void) strlcpy(zc.zc_name, nvpair_name(elem), sizeof (zc.zc_name));
+	zc.zc_name[strcspn(zc.zc_name, "/@")] = '\0';
+	zc.zc_cookie = op;
+
+	if (zcmd_write_src_nvlist(hdl, &zc, names, &len) != 0)
+		return (-1);
+
+	/*
+	 * The operations have been done by the time the kernel finds out
+	 * that the error list does not fit, so make sure it always does:
+	 * it can name no more datasets than we passed in.
+	 */
+	if (zcmd_alloc_dst_nvlist(hdl, &zc, len * 2 + 1024) != 0) {
+		zcmd_free_nvlists(&zc);
+		return (-1);
+	}
+
+	if (zfs_ioctl(hdl, ZFS_IOC_BATCH, &zc) != 0) {
+		switch (errno) {
+		case EXDEV:
+			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+			    "datasets must all be in the same pool"));
+			(void) zfs_error(hdl, EZFS_CROSSTARGET, errbuf);
+			break;
+
+		default:
+			(void) zfs_standard_error(hdl, errno, errbuf);
+			break;
+		}
+		zcmd_free_nvlists(&zc);
+		return (-1);
+	}
+
+	if (zc.zc_nvlist_dst_size == 0) {
+		zcmd_free_nvlists(&zc);
+		return (0);
+	}
+
+	if (zcmd_read_dst_nvlist(hdl, &zc, &errlist) != 0) {
+		zcmd_free_nvlists(&zc);
+		return (-1);
+	}
+	zcmd_free_nvlists(&zc);
+
+	if (errors != NULL) {
+		*errors = errlist;
+		return (-1);
+	}
+
+	elem = nvlist_next_nvpair(errlist, NULL);
+	verify(nvpair_value_int32(elem, &err) == 0);
+	(void) zfs_standard_error(hdl, err, errbuf);
+	nvlist_free(errlist);
+	return (-1);
+}
+
+/*
+ * Takes every snapshot named in 'snaps' (an nvlist of full "fs@snap"
+ * names, all in one pool) as one ZFS_BATCH_SNAPSHOT batch; see
+ * zfs_batch().  Unlike zfs_snapshot(), no device links are created for
+ * snapshots of volumes.
+ */
+int
+zfs_snapshot_batch(libzfs_handle_t *hdl, nvlist_t *snaps, nvlist_t **errors)
+{
+	nvpair_t *elem;
+	char errbuf[1024];
+
+	if (errors != NULL)
+		*errors = NULL;
+
+	for (elem = nvlist_next_nvpair(snaps, NULL); elem != NULL;
+	    elem = nvlist_next_nvpair(snaps, elem)) {
+		if (!zfs_validate_name(hdl, nvpair_name(elem),
+		    ZFS_TYPE_SNAPSHOT)) {
+			(void) snprintf(errbuf, sizeof (errbuf),
+			    dgettext(TEXT_DOMAIN, "cannot snapshot '%s'"),
+			    nvpair_name(elem));
+			return (zfs_error(hdl, EZFS_INVALIDNAME, errbuf));
+		}
+	}
+
+	(void) snprintf(errbuf, sizeof (errbuf), dgettext(TEXT_DOMAIN,
+	    "cannot create snapshots"));
+
+	return (zfs_batch(hdl, ZFS_BATCH_SNAPSHOT, snaps, errors, errbuf));
+}
+
 /*
  * Dumps a backup of the given snapshot (incremental from fromsnap if it's not
  * NULL) to the file descriptor specified by outfd.
@@ -4385,6 +4730,11 @@ zvol_remove_link(libzfs_handle_t *hdl, const char *dataset)
 	return (0);
 }
 
+/*
+ * For a handle made while iterating with a property filter, only the user
+ * properties named in the filter are present.  A caller that needs every
+ * one, as zfs_expand_proplist() does for 'all', must refresh it first.
+ */
 nvlist_t *
 zfs_get_user_props(zfs_handle_t *zhp)
 {
@@ -4611,6 +4961,11 @@ zfs_expand_proplist(zfs_handle_t *zhp, zfs_proplist_t **plp)
 	if (zfs_expand_proplist_common(hdl, plp, ZFS_TYPE_ANY) != 0)
 		return (-1);
 
+	/*
+	 * 'all' needs every user property, not just the prefetched ones.
+	 */
+	if ((*plp)->pl_all && zhp->zfs_props_filter != NULL)
+		(void) get_stats(zhp);
 	userprops = zfs_get_user_props(zhp);
 
 	entry = *plp;
@@ -40,6 +40,7 @@
 
 #include <libuutil.h>
 #include <libzfs.h>
+#include <pthread.h>
 #ifndef __APPLE__
 #include <libshare.h>
 #endif
@@ -62,8 +63,18 @@ struct libzfs_handle {
 	char *libzfs_log_str;
 	int libzfs_printerr;
 	void *libzfs_sharehdl; /* libshare handle */
+	nvlist_t *libzfs_list_props; /* properties fetched while iterating */
+	boolean_t libzfs_no_list_batch; /* don't use ZFS_IOC_LIST_BATCH */
+	int libzfs_mount_threads; /* see zfs_foreach_mountpoint() */
+	pthread_mutex_t libzfs_mnt_lock; /* mnttab and errors while mounting */
 };
 
+/*
+ * Default number of filesystems zfs_foreach_mountpoint() mounts at once;
+ * ZFS_MOUNT_THREADS in the environment overrides it.
+ */
+#define	MOUNT_THREADS_DEFAULT	16
+
 struct zfs_handle {
 	libzfs_handle_t *zfs_hdl;
 	char zfs_name[ZFS_MAXNAMELEN];
@@ -71,6 +82,8 @@ struct zfs_handle {
 	zfs_type_t zfs_head_type; /* type excluding snapshot */
 	dmu_objset_stats_t zfs_dmustats;
 	nvlist_t *zfs_props;
+	char *zfs_props_buf;	/* storage borrowed by zfs_props, or NULL */
+	nvlist_t *zfs_props_filter; /* if set, zfs_props holds only these */
 	nvlist_t *zfs_user_props;
 	boolean_t zfs_mntcheck;
 	char *zfs_mntopts;
@@ -127,6 +140,8 @@ int zcmd_alloc_dst_nvlist(libzfs_handle_t *, zfs_cmd_t *, size_t);
 int zcmd_write_src_nvlist(libzfs_handle_t *, zfs_cmd_t *, nvlist_t *, size_t *);
 int zcmd_expand_dst_nvlist(libzfs_handle_t *, zfs_cmd_t *);
 int zcmd_read_dst_nvlist(libzfs_handle_t *, zfs_cmd_t *, nvlist_t **);
+int zcmd_borrow_dst_nvlist(libzfs_handle_t *, zfs_cmd_t *, nvlist_t **,
+    char **);
 void zcmd_free_nvlists(zfs_cmd_t *);
 
 int changelist_prefix(prop_changelist_t *);
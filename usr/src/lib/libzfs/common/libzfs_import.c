@@ -52,6 +52,8 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
 
 #include <sys/vdev_impl.h>
 
@@ -700,29 +702,24 @@ label_offset(uint64_t size, int l)
 }
 
 /*
- * Given a file descriptor, read the label information and return an nvlist
- * describing the configuration, if there is one.
+ * Return the size of the device, aligned to the label size, or -1ULL if it
+ * cannot be determined.
  */
-int
-zpool_read_label(int fd, nvlist_t **config)
+static uint64_t
+label_device_size(int fd)
 {
 #if _DARWIN_FEATURE_64_BIT_INODE
 	struct stat statbuf;
 #else
 	struct stat64 statbuf;
 #endif
-	int l;
-	vdev_label_t *label;
-	uint64_t state, txg, size;
-
-	*config = NULL;
 
 #if _DARWIN_FEATURE_64_BIT_INODE
 	if (fstat(fd, &statbuf) == -1)
 #else
-	if (fstat64(fd, &statbuf) == -1)		
+	if (fstat64(fd, &statbuf) == -1)
 #endif
-		return (0);
+		return (-1ULL);
 /*
  * OSX fstat on a block device will return an st_size of 0 instead of
  * the actual size of the device.  So we need to ioctl directly to the disk
@@ -730,10 +727,8 @@ zpool_read_label(int fd, nvlist_t **config)
  */
 #ifdef __APPLE__
 	  if (S_ISBLK(statbuf.st_mode)) {
-		if ((statbuf.st_size = get_disk_size(fd)) == -1) {
-			statbuf.st_size = 0;
-			return (0);
-		}
+		if ((statbuf.st_size = get_disk_size(fd)) == -1)
+			return (-1ULL);
 	  }
 
 	/*
@@ -743,7 +738,40 @@ zpool_read_label(int fd, nvlist_t **config)
 	* at the end of the disk
 	*/
 #endif
-	size = P2ALIGN_TYPED(statbuf.st_size, sizeof (vdev_label_t), uint64_t);
+	return (P2ALIGN_TYPED(statbuf.st_size, sizeof (vdev_label_t), uint64_t));
+}
+
+/*
+ * Where a label was found, and the block tails of every label that was
+ * examined on the way.  The tails carry the label checksum, so they change
+ * whenever the label contents do; the label cache uses them to validate
+ * its entries without reading whole labels.
+ */
+typedef struct label_result {
+	uint64_t		lr_size;	/* aligned device size */
+	int			lr_label;	/* VDEV_LABELS if none */
+	zio_block_tail_t	lr_tail[VDEV_LABELS];
+} label_result_t;
+
+/*
+ * Given a file descriptor, read the label information and return an nvlist
+ * describing the configuration, if there is one.  Labels are read in order
+ * and the first valid one is used.
+ */
+static int
+read_label(int fd, nvlist_t **config, label_result_t *lr)
+{
+	int l;
+	vdev_label_t *label;
+	uint64_t state, txg, size;
+
+	*config = NULL;
+	bzero(lr, sizeof (label_result_t));
+	lr->lr_label = VDEV_LABELS;
+
+	if ((size = label_device_size(fd)) == -1ULL)
+		return (0);
+	lr->lr_size = size;
 
 	if ((label = malloc(sizeof (vdev_label_t))) == NULL)
 		return (-1);
@@ -753,6 +781,8 @@ zpool_read_label(int fd, nvlist_t **config)
 		    label_offset(size, l)) != sizeof (vdev_label_t))
 			continue;
 
+		lr->lr_tail[l] = label->vl_vdev_phys.vp_zbt;
+
 		if (nvlist_unpack(label->vl_vdev_phys.vp_nvlist,
 		    sizeof (label->vl_vdev_phys.vp_nvlist), config, 0) != 0)
 			continue;
@@ -771,6 +801,7 @@ zpool_read_label(int fd, nvlist_t **config)
 		}
 
 		free(label);
+		lr->lr_label = l;
 		return (0);
 	}
 
@@ -779,6 +810,360 @@ zpool_read_label(int fd, nvlist_t **config)
 	return (0);
 }
 
+int
+zpool_read_label(int fd, nvlist_t **config)
+{
+	label_result_t lr;
+
+	return (read_label(fd, config, &lr));
+}
+
+/*
+ * Label scanning for zpool_find_import().
+ *
+ * Hosts with hundreds of devices spend most of an import reading labels,
+ * so candidate devices are first collected from the search directories and
+ * then handed to a small pool of threads that read their labels
+ * concurrently.  Results are gathered per device and fed to add_config() in
+ * directory order afterwards, so the outcome does not depend on scheduling.
+ *
+ * Results are also remembered in ZPOOL_LABEL_CACHE, keyed by path.  An entry
+ * is reused when the device's devid, size and mtime are unchanged and the
+ * block tails of the labels it covers still match, which costs one sector
+ * read per label instead of a full 256K label read.  Each scan only updates
+ * the entries of the directories it searched, and the file is rewritten
+ * only when one of them changed.
+ */
+#define	LABEL_SCAN_THREADS	16
+
+#define	LC_DEVID	"devid"
+#define	LC_MTIME	"mtime"
+#define	LC_SIZE		"size"
+#define	LC_LABEL	"label"
+#define	LC_TAILS	"tails"
+#define	LC_CONFIG	"config"
+
+#define	LC_TAIL_WORDS	(sizeof (zio_block_tail_t) / sizeof (uint64_t))
+
+typedef struct label_slot {
+	char		*ls_path;
+	uint64_t	ls_mtime;
+	nvlist_t	*ls_config;	/* label config, if any */
+	nvlist_t	*ls_entry;	/* label cache entry */
+	boolean_t	ls_cached;	/* ls_entry came from the cache */
+	int		ls_error;
+} label_slot_t;
+
+typedef struct label_scan {
+	pthread_mutex_t	lsc_lock;
+	label_slot_t	*lsc_slots;
+	int		lsc_count;
+	int		lsc_next;
+	nvlist_t	*lsc_cache;	/* previous results */
+	char		**lsc_dirs;	/* directories searched */
+	int		lsc_ndirs;
+} label_scan_t;
+
+/*
+ * Read the tail of the vdev_phys_t of label l.  Only the last sector is
+ * read, so that this works on devices that require aligned I/O.
+ */
+static int
+read_label_tail(int fd, uint64_t size, int l, zio_block_tail_t *zbt)
+{
+	char sector[DEV_BSIZE];
+	uint64_t offset = label_offset(size, l) +
+	    offsetof(vdev_label_t, vl_vdev_phys) + sizeof (vdev_phys_t) -
+	    sizeof (sector);
+
+	if (pread(fd, sector, sizeof (sector), offset) != sizeof (sector))
+		return (-1);
+
+	bcopy(sector + sizeof (sector) - sizeof (zio_block_tail_t), zbt,
+	    sizeof (zio_block_tail_t));
+	return (0);
+}
+
+/*
+ * Returns B_TRUE if the cached entry still describes the labels on fd.
+ */
+static boolean_t
+label_cache_valid(int fd, label_slot_t *ls, const char *devid,
+    nvlist_t *entry)
+{
+	uint64_t mtime, size, label, *tails;
+	char *cdevid;
+	uint_t ntails;
+	zio_block_tail_t zbt;
+	int l, nlabels;
+
+	if (nvlist_lookup_uint64(entry, LC_MTIME, &mtime) != 0 ||
+	    nvlist_lookup_uint64(entry, LC_SIZE, &size) != 0 ||
+	    nvlist_lookup_uint64(entry, LC_LABEL, &label) != 0 ||
+	    nvlist_lookup_uint64_array(entry, LC_TAILS, &tails,
+	    &ntails) != 0)
+		return (B_FALSE);
+
+	if (mtime != ls->ls_mtime || label > VDEV_LABELS ||
+	    ntails != VDEV_LABELS * LC_TAIL_WORDS)
+		return (B_FALSE);
+
+	if (nvlist_lookup_string(entry, LC_DEVID, &cdevid) != 0)
+		cdevid = NULL;
+	if ((devid == NULL) != (cdevid == NULL) ||
+	    (devid != NULL && strcmp(devid, cdevid) != 0))
+		return (B_FALSE);
+
+	/*
+	 * A label found at index n was preceded by n unusable ones; all of
+	 * them must be unchanged for the result to still hold.
+	 */
+	if (size == 0 || size != label_device_size(fd))
+		return (B_FALSE);
+
+	nlabels = (label == VDEV_LABELS) ? VDEV_LABELS : label + 1;
+	for (l = 0; l < nlabels; l++) {
+		if (read_label_tail(fd, size, l, &zbt) != 0 ||
+		    bcmp(&zbt, &tails[l * LC_TAIL_WORDS], sizeof (zbt)) != 0)
+			return (B_FALSE);
+	}
+
+	return (B_TRUE);
+}
+
+/*
+ * Read the label of a single device, from the label cache if possible, and
+ * record the result in its slot.
+ */
+static void
+label_scan_one(label_scan_t *lsc, label_slot_t *ls)
+{
+	nvlist_t *entry, *config;
+	label_result_t lr;
+	char *devid;
+	int fd;
+
+	if ((fd = open64(ls->ls_path, O_RDONLY)) < 0)
+		return;
+
+	devid = get_devid(ls->ls_path);
+
+	if (lsc->lsc_cache != NULL &&
+	    nvlist_lookup_nvlist(lsc->lsc_cache, ls->ls_path, &entry) == 0 &&
+	    label_cache_valid(fd, ls, devid, entry)) {
+		(void) close(fd);
+		if (devid != NULL)
+			devid_str_free(devid);
+		if (nvlist_dup(entry, &ls->ls_entry, 0) != 0 ||
+		    (nvlist_lookup_nvlist(entry, LC_CONFIG, &config) == 0 &&
+		    nvlist_dup(config, &ls->ls_config, 0) != 0))
+			ls->ls_error = ENOMEM;
+		ls->ls_cached = B_TRUE;
+		return;
+	}
+
+	if (read_label(fd, &ls->ls_config, &lr) != 0) {
+		(void) close(fd);
+		if (devid != NULL)
+			devid_str_free(devid);
+		ls->ls_error = ENOMEM;
+		return;
+	}
+	(void) close(fd);
+
+	if (nvlist_alloc(&entry, NV_UNIQUE_NAME, 0) != 0 ||
+	    (devid != NULL &&
+	    nvlist_add_string(entry, LC_DEVID, devid) != 0) ||
+	    nvlist_add_uint64(entry, LC_MTIME, ls->ls_mtime) != 0 ||
+	    nvlist_add_uint64(entry, LC_SIZE, lr.lr_size) != 0 ||
+	    nvlist_add_uint64(entry, LC_LABEL, lr.lr_label) != 0 ||
+	    nvlist_add_uint64_array(entry, LC_TAILS, (uint64_t *)lr.lr_tail,
+	    VDEV_LABELS * LC_TAIL_WORDS) != 0 ||
+	    (ls->ls_config != NULL &&
+	    nvlist_add_nvlist(entry, LC_CONFIG, ls->ls_config) != 0)) {
+		nvlist_free(entry);
+		entry = NULL;
+	}
+	ls->ls_entry = entry;
+
+	if (devid != NULL)
+		devid_str_free(devid);
+}
+
+static void *
+label_scan_thread(void *arg)
+{
+	label_scan_t *lsc = arg;
+	int i;
+
+	for (;;) {
+		(void) pthread_mutex_lock(&lsc->lsc_lock);
+		i = lsc->lsc_next++;
+		(void) pthread_mutex_unlock(&lsc->lsc_lock);
+
+		if (i >= lsc->lsc_count)
+			break;
+
+		label_scan_one(lsc, &lsc->lsc_slots[i]);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Read the labels of all slots, with at most LABEL_SCAN_THREADS devices
+ * being read at any one time.  The calling thread is one of the readers,
+ * so one fewer thread is created.
+ */
+static void
+label_scan(label_scan_t *lsc)
+{
+	pthread_t tids[LABEL_SCAN_THREADS - 1];
+	int t, nthreads;
+
+	nthreads = MIN(lsc->lsc_count, LABEL_SCAN_THREADS) - 1;
+	for (t = 0; t < nthreads; t++) {
+		if (pthread_create(&tids[t], NULL, label_scan_thread,
+		    lsc) != 0)
+			break;
+	}
+	nthreads = t;
+
+	/*
+	 * If no thread could be created we still make progress here.
+	 */
+	(void) label_scan_thread(lsc);
+
+	for (t = 0; t < nthreads; t++)
+		(void) pthread_join(tids[t], NULL);
+}
+
+static nvlist_t *
+label_cache_read(void)
+{
+	struct stat statbuf;
+	nvlist_t *cache = NULL;
+	char *buf;
+	int fd;
+
+	if ((fd = open(ZPOOL_LABEL_CACHE, O_RDONLY)) < 0)
+		return (NULL);
+
+	if (fstat(fd, &statbuf) == 0 && statbuf.st_size > 0 &&
+	    (buf = malloc(statbuf.st_size)) != NULL) {
+		if (read(fd, buf, statbuf.st_size) != statbuf.st_size ||
+		    nvlist_unpack(buf, statbuf.st_size, &cache, 0) != 0)
+			cache = NULL;
+		free(buf);
+	}
+
+	(void) close(fd);
+	return (cache);
+}
+
+/*
+ * Returns B_TRUE if 'path' names an entry directly within one of the
+ * directories this scan searched.
+ */
+static boolean_t
+label_scan_searched(label_scan_t *lsc, const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	int i;
+
+	if (slash == NULL)
+		return (B_FALSE);
+
+	for (i = 0; i < lsc->lsc_ndirs; i++) {
+		if (strlen(lsc->lsc_dirs[i]) == (size_t)(slash - path) &&
+		    strncmp(lsc->lsc_dirs[i], path, slash - path) == 0)
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Merge the results of this scan into the label cache read at its start:
+ * entries for the devices that were read are replaced, and entries for
+ * devices that have gone from the searched directories are dropped.  The
+ * cache is only rewritten if that changed anything.  Failure to write the
+ * cache is not an error; the next scan simply reads every label.
+ */
+static void
+label_cache_write(label_scan_t *lsc)
+{
+	nvlist_t *cache = lsc->lsc_cache;
+	nvlist_t *found;
+	nvpair_t *elem, *next;
+	boolean_t changed = B_FALSE;
+	char *buf = NULL;
+	size_t len;
+	int i, fd;
+
+	if (cache == NULL) {
+		if (nvlist_alloc(&cache, NV_UNIQUE_NAME, 0) != 0)
+			return;
+		lsc->lsc_cache = cache;
+	}
+
+	if (nvlist_alloc(&found, NV_UNIQUE_NAME, 0) != 0)
+		return;
+
+	for (i = 0; i < lsc->lsc_count; i++) {
+		label_slot_t *ls = &lsc->lsc_slots[i];
+
+		if (nvlist_add_boolean(found, ls->ls_path) != 0) {
+			nvlist_free(found);
+			return;
+		}
+
+		if (ls->ls_cached)
+			continue;
+
+		if (ls->ls_entry != NULL) {
+			if (nvlist_add_nvlist(cache, ls->ls_path,
+			    ls->ls_entry) != 0) {
+				nvlist_free(found);
+				return;
+			}
+			changed = B_TRUE;
+		} else if (nvlist_remove_all(cache, ls->ls_path) == 0) {
+			changed = B_TRUE;
+		}
+	}
+
+	for (elem = nvlist_next_nvpair(cache, NULL); elem != NULL;
+	    elem = next) {
+		next = nvlist_next_nvpair(cache, elem);
+		if (label_scan_searched(lsc, nvpair_name(elem)) &&
+		    nvlist_lookup_boolean(found, nvpair_name(elem)) != 0) {
+			(void) nvlist_remove_all(cache, nvpair_name(elem));
+			changed = B_TRUE;
+		}
+	}
+	nvlist_free(found);
+
+	if (!changed)
+		return;
+
+	if (nvlist_pack(cache, &buf, &len, NV_ENCODE_XDR, 0) == 0) {
+		if ((fd = open(ZPOOL_LABEL_CACHE_TMP,
+		    O_WRONLY | O_CREAT | O_TRUNC, 0600)) >= 0) {
+			if (write(fd, buf, len) == (ssize_t)len &&
+			    fsync(fd) == 0) {
+				(void) close(fd);
+				(void) rename(ZPOOL_LABEL_CACHE_TMP,
+				    ZPOOL_LABEL_CACHE);
+			} else {
+				(void) close(fd);
+				(void) unlink(ZPOOL_LABEL_CACHE_TMP);
+			}
+		}
+		free(buf);
+	}
+}
+
 /*
  * Given a list of directories to search, find all pools stored on disk.  This
  * includes partial pools which are not available to import.  If no args are
@@ -796,13 +1181,15 @@ zpool_find_import(libzfs_handle_t *hdl, int argc, char **argv)
 #else
 	struct stat64 statbuf;
 #endif
-	nvlist_t *ret = NULL, *config;
+	nvlist_t *ret = NULL;
 #ifdef __APPLE__
 	static char *default_dir = "/dev";
 #else
 	static char *default_dir = "/dev/dsk";
 #endif
-	int fd;
+	label_scan_t lsc = { 0 };
+	label_slot_t *ls;
+	int nslots = 0;
 	pool_list_t pools = { 0 };
 	pool_entry_t *pe, *penext;
 	vdev_entry_t *ve, *venext;
@@ -816,9 +1203,8 @@ zpool_find_import(libzfs_handle_t *hdl, int argc, char **argv)
 	}
 
 	/*
-	 * Go through and read the label configuration information from every
-	 * possible device, organizing the information according to pool GUID
-	 * and toplevel GUID.
+	 * Go through and collect every possible device, then read the label
+	 * configuration information from all of them at once.
 	 */
 	for (i = 0; i < argc; i++) {
 		if (argv[i][0] != '/') {
@@ -836,9 +1222,6 @@ zpool_find_import(libzfs_handle_t *hdl, int argc, char **argv)
 			goto error;
 		}
 
-		/*
-		 * This is not MT-safe, but we have no MT consumers of libzfs
-		 */
 		while ((dp = readdir64(dirp)) != NULL) {
 
 			(void) snprintf(path, sizeof (path), "%s/%s",
@@ -872,29 +1255,71 @@ zpool_find_import(libzfs_handle_t *hdl, int argc, char **argv)
 			    bcmp(path, "/dev/disk", 9) != 0)
 				continue;
 #endif /*__APPLE__*/
-			if ((fd = open64(path, O_RDONLY)) < 0)
-				continue;
-
-			if ((zpool_read_label(fd, &config)) != 0) {
-				(void) close(fd);
-				(void) no_memory(hdl);
-				goto error;
+			if (lsc.lsc_count == nslots) {
+				nslots = nslots ? nslots * 2 : 64;
+				if ((ls = realloc(lsc.lsc_slots,
+				    nslots * sizeof (label_slot_t))) == NULL) {
+					(void) no_memory(hdl);
+					goto error;
+				}
+				lsc.lsc_slots = ls;
 			}
 
-			(void) close(fd);
-
-			if (config != NULL)
-				if (add_config(hdl, &pools, path, config) != 0)
-					goto error;
+			ls = &lsc.lsc_slots[lsc.lsc_count];
+			bzero(ls, sizeof (label_slot_t));
+			ls->ls_mtime = statbuf.st_mtime;
+			if ((ls->ls_path = zfs_strdup(hdl, path)) == NULL)
+				goto error;
+			lsc.lsc_count++;
 		}
 
 		(void) closedir(dirp);
 		dirp = NULL;
 	}
 
+	(void) pthread_mutex_init(&lsc.lsc_lock, NULL);
+	lsc.lsc_cache = label_cache_read();
+	lsc.lsc_dirs = argv;
+	lsc.lsc_ndirs = argc;
+	label_scan(&lsc);
+	(void) pthread_mutex_destroy(&lsc.lsc_lock);
+
+	/*
+	 * Organize the configurations according to pool GUID and toplevel
+	 * GUID, in the order the devices were found.  add_config() takes
+	 * ownership of each config.
+	 */
+	for (i = 0; i < lsc.lsc_count; i++) {
+		ls = &lsc.lsc_slots[i];
+
+		if (ls->ls_error != 0) {
+			(void) no_memory(hdl);
+			goto error;
+		}
+
+		if (ls->ls_config != NULL) {
+			nvlist_t *config = ls->ls_config;
+
+			ls->ls_config = NULL;
+			if (add_config(hdl, &pools, ls->ls_path, config) != 0)
+				goto error;
+		}
+	}
+
+	label_cache_write(&lsc);
+
 	ret = get_configs(hdl, &pools);
 
 error:
+	for (i = 0; i < lsc.lsc_count; i++) {
+		ls = &lsc.lsc_slots[i];
+		nvlist_free(ls->ls_config);
+		nvlist_free(ls->ls_entry);
+		free(ls->ls_path);
+	}
+	free(lsc.lsc_slots);
+	nvlist_free(lsc.lsc_cache);
+
 	for (pe = pools.pools; pe != NULL; pe = penext) {
 		penext = pe->pe_next;
 		for (ve = pe->pe_vdevs; ve != NULL; ve = venext) {
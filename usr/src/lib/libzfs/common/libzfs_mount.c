@@ -59,6 +59,9 @@
  *
  * 	zpool_enable_datasets()
  * 	zpool_disable_datasets()
+ *
+ * zfs_foreach_mountpoint() runs a function over a set of datasets in
+ * mountpoint order, mounting independent subtrees in parallel.
  */
 
 #include <dirent.h>
@@ -68,6 +71,7 @@
 #include <errno.h>
 #include <libgen.h>
 #include <libintl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <strings.h>
@@ -202,14 +206,22 @@ is_mounted(libzfs_handle_t *zfs_hdl, const char *special, char **where)
 	search.mnt_special = (char *)special;
 	search.mnt_fstype = MNTTYPE_ZFS;
 
+	/*
+	 * Both the mnttab stream and getmntinfo()'s buffer are shared by
+	 * every thread of zfs_foreach_mountpoint().
+	 */
+	(void) pthread_mutex_lock(&zfs_hdl->libzfs_mnt_lock);
 #ifndef __APPLE__
 	rewind(zfs_hdl->libzfs_mnttab);
 #endif
-	if (getmntany(zfs_hdl->libzfs_mnttab, &entry, &search) != 0)
+	if (getmntany(zfs_hdl->libzfs_mnttab, &entry, &search) != 0) {
+		(void) pthread_mutex_unlock(&zfs_hdl->libzfs_mnt_lock);
 		return (B_FALSE);
+	}
 
 	if (where != NULL)
 		*where = zfs_strdup(zfs_hdl, entry.mnt_mountp);
+	(void) pthread_mutex_unlock(&zfs_hdl->libzfs_mnt_lock);
 
 	return (B_TRUE);
 }
@@ -269,6 +281,24 @@ struct zfs_mount_args {
 
 #endif
 
+/*
+ * Report a failed mount.  The description and the message are set on the
+ * handle in two steps, so mounts running in parallel take a lock.
+ */
+static int
+mount_error(libzfs_handle_t *hdl, const char *desc, const char *what)
+{
+	int ret;
+
+	(void) pthread_mutex_lock(&hdl->libzfs_mnt_lock);
+	zfs_error_aux(hdl, "%s", desc);
+	ret = zfs_error_fmt(hdl, EZFS_MOUNTFAILED,
+	    dgettext(TEXT_DOMAIN, "cannot mount '%s'"), what);
+	(void) pthread_mutex_unlock(&hdl->libzfs_mnt_lock);
+
+	return (ret);
+}
+
 /*
  * Mount the given filesystem.
  */
@@ -296,11 +326,8 @@ zfs_mount(zfs_handle_t *zhp, const char *options, int flags)
 	/* Create the directory if it doesn't already exist */
 	if (lstat(mountpoint, &buf) != 0) {
 		if (mkdirp(mountpoint, 0755) != 0) {
-			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
-			    "failed to create mountpoint"));
-			return (zfs_error_fmt(hdl, EZFS_MOUNTFAILED,
-			    dgettext(TEXT_DOMAIN, "cannot mount '%s'"),
-			    mountpoint));
+			return (mount_error(hdl, dgettext(TEXT_DOMAIN,
+			    "failed to create mountpoint"), mountpoint));
 		}
 #ifdef __APPLE__
 		/*
@@ -323,10 +350,8 @@ zfs_mount(zfs_handle_t *zhp, const char *options, int flags)
 	if ((flags & MS_OVERLAY) == 0 &&
 	    strstr(mntopts, MNTOPT_REMOUNT) == NULL &&
 	    !dir_is_empty(mountpoint)) {
-		zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
-		    "directory is not empty"));
-		return (zfs_error_fmt(hdl, EZFS_MOUNTFAILED,
-		    dgettext(TEXT_DOMAIN, "cannot mount '%s'"), mountpoint));
+		return (mount_error(hdl, dgettext(TEXT_DOMAIN,
+		    "directory is not empty"), mountpoint));
 	}
 #endif /*!__APPLE__*/
 
@@ -340,24 +365,24 @@ zfs_mount(zfs_handle_t *zhp, const char *options, int flags)
 	if (mount(zfs_get_name(zhp), mountpoint, MS_OPTIONSTR | flags,
 	    MNTTYPE_ZFS, NULL, 0, mntopts, sizeof (mntopts)) != 0) {
 #endif
+		const char *desc;
+
 		/*
 		 * Generic errors are nasty, but there are just way too many
 		 * from mount(), and they're well-understood.  We pick a few
 		 * common ones to improve upon.
 		 */
 		if (errno == EBUSY) {
-			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
-			    "mountpoint or dataset is busy"));
+			desc = dgettext(TEXT_DOMAIN,
+			    "mountpoint or dataset is busy");
 		} else if (errno == EPERM) {
-			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
-			    "Insufficient privileges"));
+			desc = dgettext(TEXT_DOMAIN,
+			    "Insufficient privileges");
 		} else {
-			zfs_error_aux(hdl, strerror(errno));
+			desc = strerror(errno);
 		}
 
-		return (zfs_error_fmt(hdl, EZFS_MOUNTFAILED,
-		    dgettext(TEXT_DOMAIN, "cannot mount '%s'"),
-		    zhp->zfs_name));
+		return (mount_error(hdl, desc, zhp->zfs_name));
 	}
 #ifdef __APPLE__
 	/*
@@ -1010,6 +1035,278 @@ zfs_unshare_iscsi(zfs_handle_t *zhp)
 	return (0);
 }
 
+/*
+ * Parallel mounting.  A filesystem can be mounted once the filesystem
+ * whose mountpoint contains its own has been, so the datasets are sorted
+ * with mountpoint_cmp(), which places every mountpoint after its
+ * ancestors and before any unrelated path, and mounting a dataset makes
+ * its immediate descendants runnable.  Datasets without a mountpoint
+ * path (volumes, "legacy", "none") sort last and depend on nothing.
+ * Up to libzfs_mount_threads threads take runnable datasets from a
+ * stack, so independent subtrees are mounted concurrently.
+ */
+typedef struct mount_entry {
+	zfs_handle_t	*me_zhp;
+	char		*me_mountpoint;	/* NULL if not a path */
+	int		me_error;	/* what the function returned */
+} mount_entry_t;
+
+typedef struct mount_state {
+	pthread_mutex_t	ms_lock;
+	pthread_cond_t	ms_cv;
+	mount_entry_t	*ms_entries;
+	size_t		ms_count;
+	size_t		*ms_ready;	/* runnable, not yet started */
+	size_t		ms_nready;
+	size_t		ms_active;	/* started, not yet finished */
+	zfs_iter_f	ms_func;
+	void		*ms_data;
+} mount_state_t;
+
+/*
+ * Compare mountpoints as strings in which '/' sorts before every other
+ * character, so that "/a/b" comes before "/a b" and the mountpoints
+ * below "/a" immediately follow it.
+ */
+static int
+mountpoint_cmp(const void *a, const void *b)
+{
+	const mount_entry_t *mea = a;
+	const mount_entry_t *meb = b;
+	const char *pa = mea->me_mountpoint;
+	const char *pb = meb->me_mountpoint;
+	int ca, cb;
+
+	if (pa == NULL || pb == NULL) {
+		if (pa != NULL)
+			return (-1);
+		if (pb != NULL)
+			return (1);
+		return (strcmp(zfs_get_name(mea->me_zhp),
+		    zfs_get_name(meb->me_zhp)));
+	}
+
+	while (*pa != '\0' && *pa == *pb) {
+		pa++;
+		pb++;
+	}
+
+	ca = (*pa == '/') ? 1 : (*pa == '\0') ? 0 : (unsigned char)*pa + 1;
+	cb = (*pb == '/') ? 1 : (*pb == '\0') ? 0 : (unsigned char)*pb + 1;
+
+	return (ca - cb);
+}
+
+/*
+ * Returns true if me must wait for parent to be mounted: its mountpoint
+ * is the same as, or below, parent's.
+ */
+static boolean_t
+mount_is_below(const mount_entry_t *parent, const mount_entry_t *me)
+{
+	const char *pp = parent->me_mountpoint;
+	size_t len;
+
+	if (pp == NULL || me->me_mountpoint == NULL)
+		return (B_FALSE);
+
+	len = strlen(pp);
+	if (strncmp(pp, me->me_mountpoint, len) != 0)
+		return (B_FALSE);
+
+	return (me->me_mountpoint[len] == '\0' ||
+	    me->me_mountpoint[len] == '/' || pp[len - 1] == '/');
+}
+
+/*
+ * Returns the index just past the last entry that depends on entry i.
+ */
+static size_t
+mount_subtree_end(mount_state_t *ms, size_t i)
+{
+	size_t j;
+
+	for (j = i + 1; j < ms->ms_count; j++) {
+		if (!mount_is_below(&ms->ms_entries[i], &ms->ms_entries[j]))
+			break;
+	}
+
+	return (j);
+}
+
+/*
+ * Make runnable the entries in [first, end) that depend on nothing else
+ * in that range.  Called with ms_lock held.
+ */
+static void
+mount_make_ready(mount_state_t *ms, size_t first, size_t end)
+{
+	while (first < end) {
+		ms->ms_ready[ms->ms_nready++] = first;
+		first = mount_subtree_end(ms, first);
+	}
+}
+
+static void *
+mount_thread(void *arg)
+{
+	mount_state_t *ms = arg;
+	mount_entry_t *me;
+	size_t i;
+
+	(void) pthread_mutex_lock(&ms->ms_lock);
+	for (;;) {
+		while (ms->ms_nready == 0 && ms->ms_active != 0)
+			(void) pthread_cond_wait(&ms->ms_cv, &ms->ms_lock);
+		if (ms->ms_nready == 0)
+			break;
+
+		i = ms->ms_ready[--ms->ms_nready];
+		ms->ms_active++;
+		(void) pthread_mutex_unlock(&ms->ms_lock);
+
+		me = &ms->ms_entries[i];
+		me->me_error = ms->ms_func(me->me_zhp, ms->ms_data);
+
+		(void) pthread_mutex_lock(&ms->ms_lock);
+		ms->ms_active--;
+		mount_make_ready(ms, i + 1, mount_subtree_end(ms, i));
+		(void) pthread_cond_broadcast(&ms->ms_cv);
+	}
+	(void) pthread_mutex_unlock(&ms->ms_lock);
+
+	return (NULL);
+}
+
+/*
+ * Build the sorted mount_entry_t array for the given datasets.  Returns
+ * NULL if out of memory.
+ */
+static mount_entry_t *
+mount_entries_alloc(libzfs_handle_t *hdl, zfs_handle_t **handles,
+    size_t num)
+{
+	char mountpoint[ZFS_MAXPROPLEN];
+	mount_entry_t *entries;
+	size_t i;
+
+	if ((entries = zfs_alloc(hdl, MAX(num, 1) *
+	    sizeof (mount_entry_t))) == NULL)
+		return (NULL);
+
+	for (i = 0; i < num; i++) {
+		entries[i].me_zhp = handles[i];
+		if (zfs_get_type(handles[i]) != ZFS_TYPE_FILESYSTEM ||
+		    zfs_prop_get(handles[i], ZFS_PROP_MOUNTPOINT, mountpoint,
+		    sizeof (mountpoint), NULL, NULL, 0, B_FALSE) != 0 ||
+		    mountpoint[0] != '/')
+			continue;
+		if ((entries[i].me_mountpoint =
+		    zfs_strdup(hdl, mountpoint)) == NULL) {
+			while (i-- > 0)
+				free(entries[i].me_mountpoint);
+			free(entries);
+			return (NULL);
+		}
+	}
+
+	qsort(entries, num, sizeof (mount_entry_t), mountpoint_cmp);
+
+	return (entries);
+}
+
+static void
+mount_entries_free(mount_entry_t *entries, size_t num)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++)
+		free(entries[i].me_mountpoint);
+	free(entries);
+}
+
+/*
+ * Call func on every entry, never before the entries it depends on have
+ * finished.  With parallel set, up to libzfs_mount_threads calls run at
+ * once; otherwise the entries are visited in order.
+ */
+static void
+mount_entries_run(libzfs_handle_t *hdl, mount_entry_t *entries, size_t num,
+    zfs_iter_f func, void *data, boolean_t parallel)
+{
+	mount_state_t ms = { 0 };
+	pthread_t *tids = NULL;
+	int t, nthreads;
+	size_t i;
+
+	nthreads = parallel ? (int)MIN((size_t)hdl->libzfs_mount_threads,
+	    num) : 1;
+	if (nthreads <= 1 ||
+	    (ms.ms_ready = calloc(num, sizeof (size_t))) == NULL ||
+	    (tids = calloc(nthreads, sizeof (pthread_t))) == NULL) {
+		free(ms.ms_ready);
+		for (i = 0; i < num; i++)
+			entries[i].me_error = func(entries[i].me_zhp, data);
+		return;
+	}
+
+	(void) pthread_mutex_init(&ms.ms_lock, NULL);
+	(void) pthread_cond_init(&ms.ms_cv, NULL);
+	ms.ms_entries = entries;
+	ms.ms_count = num;
+	ms.ms_func = func;
+	ms.ms_data = data;
+	mount_make_ready(&ms, 0, num);
+
+	/*
+	 * The calling thread is one of the workers, so this makes progress
+	 * even if no thread can be created.
+	 */
+	for (t = 0; t < nthreads - 1; t++) {
+		if (pthread_create(&tids[t], NULL, mount_thread, &ms) != 0)
+			break;
+	}
+	nthreads = t;
+
+	(void) mount_thread(&ms);
+
+	for (t = 0; t < nthreads; t++)
+		(void) pthread_join(tids[t], NULL);
+
+	(void) pthread_cond_destroy(&ms.ms_cv);
+	(void) pthread_mutex_destroy(&ms.ms_lock);
+	free(tids);
+	free(ms.ms_ready);
+}
+
+/*
+ * Call func on each of the given datasets such that a dataset is only
+ * visited after every dataset whose mountpoint contains its own, i.e. in
+ * an order in which they can be mounted.  The handles are left sorted by
+ * mountpoint.  If parallel is set, func is called from up to
+ * libzfs_mount_threads threads at once and must be thread safe;
+ * zfs_mount() and zfs_is_mounted() are, libshare is not.  Returns -1,
+ * having reported the error, if func could not be called at all because
+ * we ran out of memory; func's own results are left to func to collect.
+ */
+int
+zfs_foreach_mountpoint(libzfs_handle_t *hdl, zfs_handle_t **handles,
+    size_t num, zfs_iter_f func, void *data, boolean_t parallel)
+{
+	mount_entry_t *entries;
+	size_t i;
+
+	if ((entries = mount_entries_alloc(hdl, handles, num)) == NULL)
+		return (-1);
+
+	for (i = 0; i < num; i++)
+		handles[i] = entries[i].me_zhp;
+
+	mount_entries_run(hdl, entries, num, func, data, parallel);
+	mount_entries_free(entries, num);
+	return (0);
+}
+
 typedef struct mount_cbdata {
 	zfs_handle_t	**cb_datasets;
 	int 		cb_used;
@@ -1043,31 +1340,17 @@ mount_cb(zfs_handle_t *zhp, void *data)
 	return (zfs_iter_children(zhp, mount_cb, cbp));
 }
 
+typedef struct enable_cbdata {
+	const char	*ecb_mntopts;
+	int		ecb_flags;
+} enable_cbdata_t;
+
 static int
-dataset_cmp(const void *a, const void *b)
+enable_mount_cb(zfs_handle_t *zhp, void *data)
 {
-	zfs_handle_t **za = (zfs_handle_t **)a;
-	zfs_handle_t **zb = (zfs_handle_t **)b;
-	char mounta[MAXPATHLEN];
-	char mountb[MAXPATHLEN];
-	boolean_t gota, gotb;
-
-	if ((gota = (zfs_get_type(*za) == ZFS_TYPE_FILESYSTEM)) != 0)
-		verify(zfs_prop_get(*za, ZFS_PROP_MOUNTPOINT, mounta,
-		    sizeof (mounta), NULL, NULL, 0, B_FALSE) == 0);
-	if ((gotb = (zfs_get_type(*zb) == ZFS_TYPE_FILESYSTEM)) != 0)
-		verify(zfs_prop_get(*zb, ZFS_PROP_MOUNTPOINT, mountb,
-		    sizeof (mountb), NULL, NULL, 0, B_FALSE) == 0);
-
-	if (gota && gotb)
-		return (strcmp(mounta, mountb));
-
-	if (gota)
-		return (-1);
-	if (gotb)
-		return (1);
+	enable_cbdata_t *ecb = data;
 
-	return (strcmp(zfs_get_name(a), zfs_get_name(b)));
+	return (zfs_mount(zhp, ecb->ecb_mntopts, ecb->ecb_flags));
 }
 
 /*
@@ -1075,18 +1358,20 @@ dataset_cmp(const void *a, const void *b)
  * datasets within the pool are currently mounted.  Because users can create
  * complicated nested hierarchies of mountpoints, we first gather all the
  * datasets and mountpoints within the pool, and sort them by mountpoint.  Once
- * we have the list of all filesystems, we iterate over them in order and mount
- * and/or share each one.
+ * we have the list of all filesystems, we mount them with
+ * mount_entries_run(), independent subtrees in parallel, and then share the
+ * ones that mounted in order.
  */
 //#pragma weak zpool_mount_datasets = zpool_enable_datasets
 int
 zpool_enable_datasets(zpool_handle_t *zhp, const char *mntopts, int flags)
 {
 	mount_cbdata_t cb = { 0 };
+	enable_cbdata_t ecb;
 	libzfs_handle_t *hdl = zhp->zpool_hdl;
+	mount_entry_t *entries;
 	zfs_handle_t *zfsp;
 	int i, ret = -1;
-	int *good;
 
 	/*
 	 * Gather all datasets within the pool.
@@ -1105,38 +1390,34 @@ zpool_enable_datasets(zpool_handle_t *zhp, const char *mntopts, int flags)
 		goto out;
 
 	/*
-	 * Sort the datasets by mountpoint.
+	 * Sort the datasets by mountpoint and mount them all, keeping
+	 * track of which ones succeeded or failed.
 	 */
-	qsort(cb.cb_datasets, cb.cb_used, sizeof (void *), dataset_cmp);
+	if ((entries = mount_entries_alloc(hdl, cb.cb_datasets,
+	    cb.cb_used)) == NULL)
+		goto out;
+
+	ecb.ecb_mntopts = mntopts;
+	ecb.ecb_flags = flags;
+	mount_entries_run(hdl, entries, cb.cb_used, enable_mount_cb, &ecb,
+	    B_TRUE);
 
-	/*
-	 * And mount all the datasets, keeping track of which ones
-	 * succeeded or failed. By using zfs_alloc(), the good pointer
-	 * will always be non-NULL.
-	 */
-	good = zfs_alloc(zhp->zpool_hdl, cb.cb_used * sizeof (int));
-	ret = 0;
-	for (i = 0; i < cb.cb_used; i++) {
-		if (zfs_mount(cb.cb_datasets[i], mntopts, flags) != 0)
-			ret = -1;
-		else
-			good[i] = 1;
-	}
 	/*
 	 * Then share all the ones that need to be shared. This needs
 	 * to be a separate pass in order to avoid excessive reloading
-	 * of the configuration. Good should never be NULL since
-	 * zfs_alloc is supposed to exit if memory isn't available.
+	 * of the configuration, and libshare isn't thread safe.
 	 */
 #ifndef __APPLE__
 	zfs_uninit_libshare(hdl);
 #endif
+	ret = 0;
 	for (i = 0; i < cb.cb_used; i++) {
-		if (good[i] && zfs_share(cb.cb_datasets[i]) != 0)
+		if (entries[i].me_error != 0 ||
+		    zfs_share(entries[i].me_zhp) != 0)
 			ret = -1;
 	}
 
-	free(good);
+	mount_entries_free(entries, cb.cb_used);
 
 out:
 	for (i = 0; i < cb.cb_used; i++)
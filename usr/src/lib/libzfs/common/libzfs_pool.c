@@ -1989,6 +1989,48 @@ zpool_get_history(zpool_handle_t *zhp, nvlist_t **nvhisp)
 	return (err);
 }
 
+/*
+ * Retrieve the recent txg sync statistics of a pool.  The nvlist holds the
+ * number of txgs synced since the pool was opened, an array of txg_stat_t
+ * records (oldest first) and the sync and quiesce time histograms; see
+ * the ZPOOL_TXG_HISTORY_* names in <sys/fs/zfs.h>.
+ */
+int
+zpool_get_txg_history(zpool_handle_t *zhp, nvlist_t **nvp)
+{
+	zfs_cmd_t zc = { 0 };
+	libzfs_handle_t *hdl = zhp->zpool_hdl;
+
+	(void) strlcpy(zc.zc_name, zhp->zpool_name, sizeof (zc.zc_name));
+
+	if (zcmd_alloc_dst_nvlist(hdl, &zc, 0) != 0)
+		return (-1);
+
+	while (ioctl(hdl->libzfs_fd, ZFS_IOC_POOL_TXG_HISTORY, &zc) != 0) {
+		if (errno == ENOMEM) {
+			if (zcmd_expand_dst_nvlist(hdl, &zc) != 0) {
+				zcmd_free_nvlists(&zc);
+				return (-1);
+			}
+		} else {
+			zcmd_free_nvlists(&zc);
+			return (zpool_standard_error_fmt(hdl, errno,
+			    dgettext(TEXT_DOMAIN,
+			    "cannot get txg history for '%s'"),
+			    zhp->zpool_name));
+		}
+	}
+
+	if (zcmd_read_dst_nvlist(hdl, &zc, nvp) != 0) {
+		zcmd_free_nvlists(&zc);
+		return (-1);
+	}
+
+	zcmd_free_nvlists(&zc);
+
+	return (0);
+}
+
 void
 zpool_obj_to_path(zpool_handle_t *zhp, uint64_t dsobj, uint64_t obj,
     char *pathname, size_t len)
@@ -540,6 +540,16 @@ libzfs_print_on_error(libzfs_handle_t *hdl, boolean_t printerr)
 	hdl->libzfs_printerr = printerr;
 }
 
+/*
+ * Set how many filesystems zfs_foreach_mountpoint() may mount at once;
+ * 1 or less mounts them one at a time.
+ */
+void
+libzfs_set_mount_threads(libzfs_handle_t *hdl, int nthreads)
+{
+	hdl->libzfs_mount_threads = nthreads < 1 ? 1 : nthreads;
+}
+
 #ifdef __APPLE__
 
 #define KEXT_LOAD_COMMAND	"/sbin/kextload"
@@ -634,10 +644,12 @@ libzfs_handle_t *
 libzfs_init(void)
 {
 	libzfs_handle_t *hdl;
+	char *env;
 #ifdef __APPLE__
 	struct vfsconf vfc;
 	struct stat sb;
 	int loaded;
+	int ioc_count = 0;
 
 	/* Attempt to load zfs kext if its not already loaded. */
 	if (getvfsbyname("zfs", &vfc) != 0) {
@@ -673,6 +685,28 @@ libzfs_init(void)
 		return (NULL);
 	}
 
+#ifdef __APPLE__
+	/*
+	 * Older kernels index their ioctl table without checking the command
+	 * number, so an ioctl they don't implement must never be issued.  A
+	 * kernel too old to report how many it implements has none of the
+	 * optional ones.
+	 */
+	if (getvfsbyname("zfs", &vfc) == 0) {
+		int mib[3] = { CTL_VFS, 0, ZFS_SYSCTL_IOC_COUNT };
+		size_t len = sizeof (ioc_count);
+
+		mib[1] = vfc.vfc_typenum;
+		if (sysctl(mib, 3, &ioc_count, &len, NULL, 0) != 0)
+			ioc_count = 0;
+	}
+	hdl->libzfs_no_list_batch =
+	    (ZFS_IOC_NUM(ZFS_IOC_LIST_BATCH) >= ioc_count);
+#endif
+	/* for comparing against the one-at-a-time listing */
+	if (getenv("ZFS_NO_LIST_BATCH") != NULL)
+		hdl->libzfs_no_list_batch = B_TRUE;
+
 #ifndef __APPLE__
 	if ((hdl->libzfs_mnttab = fopen(MNTTAB, "r")) == NULL) {
 		(void) close(hdl->libzfs_fd);
@@ -683,6 +717,12 @@ libzfs_init(void)
 
 	hdl->libzfs_sharetab = fopen("/etc/dfs/sharetab", "r");
 
+	(void) pthread_mutex_init(&hdl->libzfs_mnt_lock, NULL);
+	if ((env = getenv("ZFS_MOUNT_THREADS")) != NULL)
+		libzfs_set_mount_threads(hdl, atoi(env));
+	else
+		hdl->libzfs_mount_threads = MOUNT_THREADS_DEFAULT;
+
 	zfs_prop_init();
 
 	return (hdl);
@@ -701,7 +741,9 @@ libzfs_fini(libzfs_handle_t *hdl)
 #endif
 	if (hdl->libzfs_log_str)
 		(void) free(hdl->libzfs_log_str);
+	nvlist_free(hdl->libzfs_list_props);
 	namespace_clear(hdl);
+	(void) pthread_mutex_destroy(&hdl->libzfs_mnt_lock);
 	free(hdl);
 }
 
@@ -871,6 +913,39 @@ zcmd_read_dst_nvlist(libzfs_handle_t *hdl, zfs_cmd_t *zc, nvlist_t **nvlp)
 	return (0);
 }
 
+/*
+ * Like zcmd_read_dst_nvlist(), but the returned nvlist is read-only and
+ * references the packed buffer rather than copying it.  Ownership of the
+ * buffer passes to the caller through bufp; it must be freed, after the
+ * nvlist, with free().  A buffer that can't be borrowed from (one in a
+ * foreign encoding) is unpacked by copying instead, and *bufp is then
+ * NULL.  Returns 0 or an errno, which is also left in errno.
+ */
+int
+zcmd_borrow_dst_nvlist(libzfs_handle_t *hdl, zfs_cmd_t *zc, nvlist_t **nvlp,
+    char **bufp)
+{
+	char *buf = (void *)(uintptr_t)zc->zc_nvlist_dst;
+	int error;
+
+	error = nvlist_unpack_borrowed(buf, zc->zc_nvlist_dst_size, nvlp, 0);
+	if (error == ENOTSUP) {
+		*bufp = NULL;
+		if (zcmd_read_dst_nvlist(hdl, zc, nvlp) != 0)
+			return (errno = ENOMEM);
+		return (0);
+	}
+	if (error != 0) {
+		if (error == ENOMEM)
+			(void) no_memory(hdl);
+		return (errno = error);
+	}
+
+	zc->zc_nvlist_dst = 0;
+	*bufp = buf;
+	return (0);
+}
+
 static void
 zfs_print_prop_headers(libzfs_get_cbdata_t *cbp)
 {
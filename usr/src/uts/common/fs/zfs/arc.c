@@ -116,9 +116,11 @@
 #include <sys/spa.h>
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
+#include <sys/zio_compress.h>
 #include <sys/zfs_context.h>
 #include <sys/arc.h>
 #include <sys/refcount.h>
+#include <sys/zcounter.h>
 #ifdef _KERNEL
 #include <sys/vmsystm.h>
 #include <vm/anon.h>
@@ -158,6 +160,18 @@ uint64_t zfs_arc_max;
 uint64_t zfs_arc_min;
 uint64_t zfs_arc_meta_limit = 0;
 
+/*
+ * When zfs_arc_compressed is set, compressed data blocks read from disk
+ * keep their on-disk (compressed) copy in the hdr.  Eviction then only
+ * drops the decompressed buffers, and a later read of the ghost hdr is
+ * satisfied by decompressing the kept copy instead of going to disk.
+ * Decompressed copies of such blocks may take up at most
+ * zfs_arc_decompressed_pct percent of the cache; the rest of it holds
+ * them in compressed form.
+ */
+int zfs_arc_compressed = 0;
+int zfs_arc_decompressed_pct = 25;
+
 /*
  * Note that buffers can be in one of 5 states:
  *	ARC_anon	- anonymous (discussed below)
@@ -214,6 +228,9 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_recycle_miss;
 	kstat_named_t arcstat_mutex_miss;
 	kstat_named_t arcstat_evict_skip;
+	kstat_named_t arcstat_evict_prefetch_unread;
+	kstat_named_t arcstat_compressed_hits;
+	kstat_named_t arcstat_decompress_errors;
 	kstat_named_t arcstat_hash_elements;
 	kstat_named_t arcstat_hash_elements_max;
 	kstat_named_t arcstat_hash_collisions;
@@ -224,6 +241,9 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_c_min;
 	kstat_named_t arcstat_c_max;
 	kstat_named_t arcstat_size;
+	kstat_named_t arcstat_compressed_size;
+	kstat_named_t arcstat_uncompressed_size;
+	kstat_named_t arcstat_decompressed_size;
 } arc_stats_t;
 
 static arc_stats_t arc_stats = {
@@ -245,6 +265,9 @@ static arc_stats_t arc_stats = {
 	{ "recycle_miss",		KSTAT_DATA_UINT64 },
 	{ "mutex_miss",			KSTAT_DATA_UINT64 },
 	{ "evict_skip",			KSTAT_DATA_UINT64 },
+	{ "evict_prefetch_unread",	KSTAT_DATA_UINT64 },
+	{ "compressed_hits",		KSTAT_DATA_UINT64 },
+	{ "decompress_errors",		KSTAT_DATA_UINT64 },
 	{ "hash_elements",		KSTAT_DATA_UINT64 },
 	{ "hash_elements_max",		KSTAT_DATA_UINT64 },
 	{ "hash_collisions",		KSTAT_DATA_UINT64 },
@@ -254,16 +277,36 @@ static arc_stats_t arc_stats = {
 	{ "c",				KSTAT_DATA_UINT64 },
 	{ "c_min",			KSTAT_DATA_UINT64 },
 	{ "c_max",			KSTAT_DATA_UINT64 },
-	{ "size",			KSTAT_DATA_UINT64 }
+	{ "size",			KSTAT_DATA_UINT64 },
+	{ "compressed_size",		KSTAT_DATA_UINT64 },
+	{ "uncompressed_size",		KSTAT_DATA_UINT64 },
+	{ "decompressed_size",		KSTAT_DATA_UINT64 }
 };
 
 #define	ARCSTAT(stat)	(arc_stats.stat.value.ui64)
 
+/*
+ * The event counters at the front of arc_stats, up to but not including
+ * arcstat_hash_elements, are bumped from every CPU on every ARC access,
+ * so they are kept in a sharded zcounter set and only summed into the
+ * kstat when it is read.  The remaining statistics are either read back
+ * by the ARC itself or are updated rarely, and live in the kstat.
+ */
+#define	ARCSTAT_INDEX(stat)	ZCOUNTER_KSTAT_INDEX(arc_stats_t, stat)
+#define	ARCSTAT_NCOUNTERS	ARCSTAT_INDEX(arcstat_hash_elements)
+
+static zcounter_set_t arc_counters;
+
 #define	ARCSTAT_INCR(stat, val) \
-	atomic_add_64(&arc_stats.stat.value.ui64, (val));
+	zcounter_add(&arc_counters, ARCSTAT_INDEX(stat), (val));
 
 #define	ARCSTAT_BUMP(stat) 	ARCSTAT_INCR(stat, 1)
-#define	ARCSTAT_BUMPDOWN(stat)	ARCSTAT_INCR(stat, -1)
+
+#define	ARCSTAT_ATOMIC_INCR(stat, val) \
+	atomic_add_64(&arc_stats.stat.value.ui64, (val));
+
+#define	ARCSTAT_ATOMIC_BUMP(stat)	ARCSTAT_ATOMIC_INCR(stat, 1)
+#define	ARCSTAT_ATOMIC_BUMPDOWN(stat)	ARCSTAT_ATOMIC_INCR(stat, -1)
 
 #define	ARCSTAT_MAX(stat, val) {					\
 	uint64_t m;							\
@@ -310,15 +353,31 @@ static arc_state_t	*arc_mfu_ghost;
  * the possibility of inconsistency by having shadow copies of the variables,
  * while still allowing the code to be readable.
  */
-#define	arc_size	ARCSTAT(arcstat_size)	/* actual total arc size */
 #define	arc_p		ARCSTAT(arcstat_p)	/* target size of MRU */
 #define	arc_c		ARCSTAT(arcstat_c)	/* target size of cache */
 #define	arc_c_min	ARCSTAT(arcstat_c_min)	/* min target cache size */
 #define	arc_c_max	ARCSTAT(arcstat_c_max)	/* max target cache size */
 
+/*
+ * arc_size and arc_meta_used change on every buffer allocation and free,
+ * and are compared against their limits just as often, so they are kept
+ * as approximate sharded counters.  Either may be off by up to
+ * ZCOUNTER_SHARDS * ARC_SIZE_BATCH bytes, which is small next to
+ * arc_c_min; arcstat_size is filled in from arc_size when the kstat is
+ * read.
+ */
+#define	ARC_SIZE_BATCH	SPA_MAXBLOCKSIZE
+
+#define	arc_size	zcounter_approx_value(&arc_size_counter)
+#define	arc_meta_used	zcounter_approx_value(&arc_meta_counter)
+
+#define	ARC_SIZE_INCR(delta) \
+	zcounter_approx_add(&arc_size_counter, (delta))
+
 static int		arc_no_grow;	/* Don't try to grow cache size */
 static uint64_t		arc_tempreserve;
-static uint64_t		arc_meta_used;
+static zcounter_approx_t arc_size_counter;
+static zcounter_approx_t arc_meta_counter;
 static uint64_t		arc_meta_limit;
 static uint64_t		arc_meta_max = 0;
 
@@ -363,6 +422,11 @@ struct arc_buf_hdr {
 	arc_callback_t		*b_acb;
 	kcondvar_t		b_cv;
 
+	/* compressed copy of the block, protected by hash lock */
+	void			*b_cdata;
+	uint64_t		b_psize;
+	uint8_t			b_compress;
+
 	/* immutable */
 	arc_buf_contents_t	b_type;
 	uint64_t		b_size;
@@ -386,10 +450,19 @@ static void arc_get_data_buf(arc_buf_t *buf);
 static void arc_access(arc_buf_hdr_t *buf, kmutex_t *hash_lock);
 static int arc_evict_needed(arc_buf_contents_t type);
 static void arc_evict_ghost(arc_state_t *state, int64_t bytes);
+static void arc_hdr_free_cdata(arc_buf_hdr_t *hdr);
 
 #define	GHOST_STATE(state)	\
 	((state) == arc_mru_ghost || (state) == arc_mfu_ghost)
 
+/*
+ * Ghost hdrs are charged their logical size, unless they still hold
+ * a compressed copy of the block, in which case they are charged the
+ * space that copy takes up.
+ */
+#define	HDR_GHOST_SIZE(hdr)	\
+	((hdr)->b_cdata != NULL ? (hdr)->b_psize : (hdr)->b_size)
+
 /*
  * Private ARC flags.  These flags are private ARC only flags that will show up
  * in b_flags in the arc_hdr_buf_t.  Some flags are publicly declared, and can
@@ -519,14 +592,14 @@ buf_hash_insert(arc_buf_hdr_t *buf, kmutex_t **lockp)
 
 	/* collect some hash table performance data */
 	if (i > 0) {
-		ARCSTAT_BUMP(arcstat_hash_collisions);
+		ARCSTAT_ATOMIC_BUMP(arcstat_hash_collisions);
 		if (i == 1)
-			ARCSTAT_BUMP(arcstat_hash_chains);
+			ARCSTAT_ATOMIC_BUMP(arcstat_hash_chains);
 
 		ARCSTAT_MAX(arcstat_hash_chain_max, i);
 	}
 
-	ARCSTAT_BUMP(arcstat_hash_elements);
+	ARCSTAT_ATOMIC_BUMP(arcstat_hash_elements);
 	ARCSTAT_MAXSTAT(arcstat_hash_elements);
 
 	return (NULL);
@@ -551,11 +624,11 @@ buf_hash_remove(arc_buf_hdr_t *buf)
 	buf->b_flags &= ~ARC_IN_HASH_TABLE;
 
 	/* collect some hash table performance data */
-	ARCSTAT_BUMPDOWN(arcstat_hash_elements);
+	ARCSTAT_ATOMIC_BUMPDOWN(arcstat_hash_elements);
 
 	if (buf_hash_table.ht_table[idx] &&
 	    buf_hash_table.ht_table[idx]->b_hash_next == NULL)
-		ARCSTAT_BUMPDOWN(arcstat_hash_chains);
+		ARCSTAT_ATOMIC_BUMPDOWN(arcstat_hash_chains);
 }
 
 /*
@@ -755,7 +828,7 @@ add_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 		if (GHOST_STATE(ab->b_state)) {
 			ASSERT3U(ab->b_datacnt, ==, 0);
 			ASSERT3P(ab->b_buf, ==, NULL);
-			delta = ab->b_size;
+			delta = HDR_GHOST_SIZE(ab);
 		}
 		ASSERT(delta > 0);
 		ASSERT3U(*size, >=, delta);
@@ -809,6 +882,16 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 
 	from_delta = to_delta = ab->b_datacnt * ab->b_size;
 
+	/*
+	 * Ghost elements have a ghost size.  If prefetching out of the
+	 * ghost cache we will have a non-null datacnt, but the ghost state
+	 * was still only charged the ghost size.
+	 */
+	if (GHOST_STATE(old_state))
+		from_delta = HDR_GHOST_SIZE(ab);
+	if (GHOST_STATE(new_state))
+		to_delta = HDR_GHOST_SIZE(ab);
+
 	/*
 	 * If this buffer is evictable, transfer it from the
 	 * old state list to the new state list.
@@ -824,15 +907,8 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 			ASSERT(list_link_active(&ab->b_arc_node));
 			list_remove(&old_state->arcs_list[ab->b_type], ab);
 
-			/*
-			 * If prefetching out of the ghost cache,
-			 * we will have a non-null datacnt.
-			 */
-			if (GHOST_STATE(old_state) && ab->b_datacnt == 0) {
-				/* ghost elements have a ghost size */
-				ASSERT(ab->b_buf == NULL);
-				from_delta = ab->b_size;
-			}
+			ASSERT(!GHOST_STATE(old_state) ||
+			    ab->b_datacnt > 0 || ab->b_buf == NULL);
 			ASSERT3U(*size, >=, from_delta);
 			atomic_add_64(size, -from_delta);
 			
@@ -848,12 +924,7 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 
 			list_insert_head(&new_state->arcs_list[ab->b_type], ab);
 
-			/* ghost elements have a ghost size */
-			if (GHOST_STATE(new_state)) {
-				ASSERT(ab->b_datacnt == 0);
-				ASSERT(ab->b_buf == NULL);
-				to_delta = ab->b_size;
-			}
+			ASSERT(!GHOST_STATE(new_state) || ab->b_buf == NULL);
 			atomic_add_64(size, to_delta);
 
 			if (use_mutex)
@@ -879,19 +950,15 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 void
 arc_space_consume(uint64_t space)
 {
-	atomic_add_64(&arc_meta_used, space);
-	atomic_add_64(&arc_size, space);
+	zcounter_approx_add(&arc_meta_counter, space);
+	ARC_SIZE_INCR(space);
 }
 
 void
 arc_space_return(uint64_t space)
 {
-	ASSERT(arc_meta_used >= space);
-	if (arc_meta_max < arc_meta_used)
-		arc_meta_max = arc_meta_used;
-	atomic_add_64(&arc_meta_used, -space);
-	ASSERT(arc_size >= space);
-	atomic_add_64(&arc_size, -space);
+	zcounter_approx_add(&arc_meta_counter, -(int64_t)space);
+	ARC_SIZE_INCR(-(int64_t)space);
 }
 
 void *
@@ -899,7 +966,7 @@ arc_data_buf_alloc(uint64_t size)
 {
 	if (arc_evict_needed(ARC_BUFC_DATA))
 		cv_signal(&arc_reclaim_thr_cv);
-	atomic_add_64(&arc_size, size);
+	ARC_SIZE_INCR(size);
 	return (zio_data_buf_alloc(size));
 }
 
@@ -907,8 +974,69 @@ void
 arc_data_buf_free(void *buf, uint64_t size)
 {
 	zio_data_buf_free(buf, size);
-	ASSERT(arc_size >= size);
-	atomic_add_64(&arc_size, -size);
+	ARC_SIZE_INCR(-(int64_t)size);
+}
+
+/*
+ * Take over the compressed copy of a block that zio_read() kept for us
+ * (see ZIO_FLAG_KEEP_COMPRESSED) and attach it to the hdr.
+ */
+static void
+arc_hdr_set_cdata(arc_buf_hdr_t *hdr, zio_t *zio)
+{
+	ASSERT(!GHOST_STATE(hdr->b_state));
+	ASSERT(zio->io_cdata != NULL);
+
+	if (hdr->b_cdata != NULL)
+		arc_hdr_free_cdata(hdr);
+
+	hdr->b_cdata = zio->io_cdata;
+	hdr->b_psize = zio->io_csize;
+	hdr->b_compress = BP_GET_COMPRESS(zio->io_bp);
+	zio->io_cdata = NULL;
+
+	ARC_SIZE_INCR(hdr->b_psize);
+	ARCSTAT_ATOMIC_INCR(arcstat_compressed_size, hdr->b_psize);
+	ARCSTAT_ATOMIC_INCR(arcstat_uncompressed_size, hdr->b_size);
+	ARCSTAT_ATOMIC_INCR(arcstat_decompressed_size,
+	    hdr->b_size * hdr->b_datacnt);
+}
+
+static void
+arc_hdr_free_cdata(arc_buf_hdr_t *hdr)
+{
+	ASSERT(hdr->b_cdata != NULL);
+	ASSERT(!GHOST_STATE(hdr->b_state));
+
+	ARCSTAT_ATOMIC_INCR(arcstat_decompressed_size,
+	    -(int64_t)(hdr->b_size * hdr->b_datacnt));
+	ARCSTAT_ATOMIC_INCR(arcstat_uncompressed_size, -hdr->b_size);
+	ARCSTAT_ATOMIC_INCR(arcstat_compressed_size, -hdr->b_psize);
+	ARC_SIZE_INCR(-(int64_t)hdr->b_psize);
+
+	zio_buf_free(hdr->b_cdata, hdr->b_psize);
+	hdr->b_cdata = NULL;
+	hdr->b_psize = 0;
+	hdr->b_compress = 0;
+}
+
+/*
+ * Fill in the data of a ghost hdr's new buffer from its compressed copy.
+ */
+static int
+arc_hdr_decompress(arc_buf_hdr_t *hdr, arc_buf_t *buf, blkptr_t *bp,
+    arc_byteswap_func_t *swap)
+{
+	ASSERT(hdr->b_cdata != NULL);
+
+	if (zio_decompress_data(hdr->b_compress, hdr->b_cdata,
+	    hdr->b_psize, buf->b_data, hdr->b_size) != 0) {
+		ARCSTAT_BUMP(arcstat_decompress_errors);
+		return (EIO);
+	}
+	if (BP_SHOULD_BYTESWAP(bp) && swap)
+		swap(buf->b_data, hdr->b_size);
+	return (0);
 }
 
 arc_buf_t *
@@ -941,6 +1069,33 @@ arc_buf_alloc(spa_t *spa, int size, void *tag, arc_buf_contents_t type)
 	return (buf);
 }
 
+static char *arc_onloan_tag = "onloan";
+
+/*
+ * Lend an anonymous data buffer to a caller, who will fill it and then
+ * either give it to a dbuf (see dbuf_assign_arcbuf()) or hand it back
+ * with arc_return_buf() and free it.
+ */
+arc_buf_t *
+arc_loan_buf(spa_t *spa, int size)
+{
+	return (arc_buf_alloc(spa, size, arc_onloan_tag, ARC_BUFC_DATA));
+}
+
+/*
+ * Take back a loaned buffer, transferring its reference to 'tag'.
+ */
+void
+arc_return_buf(arc_buf_t *buf, void *tag)
+{
+	arc_buf_hdr_t *hdr = buf->b_hdr;
+
+	ASSERT3P(hdr->b_state, ==, arc_anon);
+	ASSERT(buf->b_data != NULL);
+	(void) refcount_add(&hdr->b_refcnt, tag);
+	(void) refcount_remove(&hdr->b_refcnt, arc_onloan_tag);
+}
+
 static arc_buf_t *
 arc_buf_clone(arc_buf_t *from)
 {
@@ -1019,7 +1174,7 @@ arc_buf_destroy(arc_buf_t *buf, boolean_t recycle, boolean_t all)
 			} else {
 				ASSERT(type == ARC_BUFC_DATA);
 				zio_data_buf_free(buf->b_data, size);
-				atomic_add_64(&arc_size, -size);
+				ARC_SIZE_INCR(-(int64_t)size);
 			}
 #ifdef __APPLE__
 			if (arc_size > arc_c_peak)
@@ -1037,6 +1192,8 @@ arc_buf_destroy(arc_buf_t *buf, boolean_t recycle, boolean_t all)
 		}
 		ASSERT3U(state->arcs_size, >=, size);
 		atomic_add_64(&state->arcs_size, -size);
+		if (buf->b_hdr->b_cdata != NULL)
+			ARCSTAT_ATOMIC_INCR(arcstat_decompressed_size, -size);
 		buf->b_data = NULL;
 		ASSERT(buf->b_hdr->b_datacnt > 0);
 		buf->b_hdr->b_datacnt -= 1;
@@ -1071,6 +1228,8 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 		hdr->b_birth = 0;
 		hdr->b_cksum0 = 0;
 	}
+	if (hdr->b_cdata != NULL)
+		arc_hdr_free_cdata(hdr);
 	while (hdr->b_buf) {
 		arc_buf_t *buf = hdr->b_buf;
 
@@ -1141,6 +1300,33 @@ arc_buf_free(arc_buf_t *buf, void *tag)
 	}
 }
 
+/*
+ * Evict a block that only ARC_UNCACHED readers have used, now that the
+ * last of them is done with it, just as arc_evict() would have.
+ */
+static void
+arc_hdr_uncache(arc_buf_hdr_t *hdr, kmutex_t *hash_lock)
+{
+	arc_state_t *evicted_state;
+
+	ASSERT(MUTEX_HELD(hash_lock));
+	ASSERT(refcount_is_zero(&hdr->b_refcnt));
+	ASSERT(hdr->b_datacnt == 1 && hdr->b_buf->b_efunc == NULL);
+	ASSERT(hdr->b_state == arc_mru || hdr->b_state == arc_mfu);
+
+	evicted_state =
+	    (hdr->b_state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
+
+	arc_buf_destroy(hdr->b_buf, FALSE, TRUE);
+	if (hdr->b_cdata != NULL)
+		arc_hdr_free_cdata(hdr);
+	ASSERT(hdr->b_datacnt == 0);
+	arc_change_state(evicted_state, hdr, hash_lock);
+	ASSERT(HDR_IN_HASH_TABLE(hdr));
+	hdr->b_flags = ARC_IN_HASH_TABLE;
+	DTRACE_PROBE1(arc__evict, arc_buf_hdr_t *, hdr);
+}
+
 int
 arc_buf_remove_ref(arc_buf_t *buf, void* tag)
 {
@@ -1164,6 +1350,9 @@ arc_buf_remove_ref(arc_buf_t *buf, void* tag)
 	} else if (no_callback) {
 		ASSERT(hdr->b_buf == buf && buf->b_next == NULL);
 		hdr->b_flags |= ARC_BUF_AVAILABLE;
+		if ((hdr->b_flags & ARC_UNCACHED) &&
+		    refcount_is_zero(&hdr->b_refcnt))
+			arc_hdr_uncache(hdr, hash_lock);
 	}
 	ASSERT(no_callback || hdr->b_datacnt > 1 ||
 	    refcount_is_zero(&hdr->b_refcnt));
@@ -1185,13 +1374,15 @@ arc_buf_size(arc_buf_t *buf)
  * - return the data block from this buffer rather than freeing it.
  * This flag is used by callers that are trying to make space for a
  * new buffer in a full arc cache.
+ * If the compressed flag is set, only evict buffers whose hdr holds a
+ * compressed copy of the block.
  */
 static void *
 arc_evict(arc_state_t *state, int64_t bytes, boolean_t recycle,
-    arc_buf_contents_t type)
+    arc_buf_contents_t type, boolean_t compressed)
 {
 	arc_state_t *evicted_state;
-	uint64_t bytes_evicted = 0, skipped = 0, missed = 0;
+	uint64_t bytes_evicted = 0, skipped = 0, missed = 0, unread = 0;
 	arc_buf_hdr_t *ab, *ab_prev = NULL;
 	list_t *list = &state->arcs_list[type];
 	kmutex_t *hash_lock;
@@ -1207,6 +1398,8 @@ arc_evict(arc_state_t *state, int64_t bytes, boolean_t recycle,
 
 	for (ab = list_tail(list); ab; ab = ab_prev) {
 		ab_prev = list_prev(list, ab);
+		if (compressed && ab->b_cdata == NULL)
+			continue;
 		/* prefetch buffers have a minimum lifespan */
 		if (HDR_IO_IN_PROGRESS(ab) ||
 		    (ab->b_flags & (ARC_PREFETCH|ARC_INDIRECT) &&
@@ -1223,6 +1416,9 @@ arc_evict(arc_state_t *state, int64_t bytes, boolean_t recycle,
 		if (have_lock || mutex_tryenter(hash_lock)) {
 			ASSERT3U(refcount_count(&ab->b_refcnt), ==, 0);
 			ASSERT(ab->b_datacnt > 0);
+			/* prefetched, but never read on demand */
+			if (ab->b_flags & ARC_PREFETCH)
+				unread += ab->b_size;
 			while (ab->b_buf) {
 				arc_buf_t *buf = ab->b_buf;
 				if (buf->b_data) {
@@ -1274,6 +1470,9 @@ arc_evict(arc_state_t *state, int64_t bytes, boolean_t recycle,
 	if (missed)
 		ARCSTAT_INCR(arcstat_mutex_miss, missed);
 
+	if (unread)
+		ARCSTAT_INCR(arcstat_evict_prefetch_unread, unread);
+
 	/*
 	 * We have just evicted some date into the ghost state, make
 	 * sure we also adjust the ghost state size if necessary.
@@ -1332,7 +1531,7 @@ top:
 			arc_change_state(arc_anon, ab, hash_lock);
 			mutex_exit(hash_lock);
 			ARCSTAT_BUMP(arcstat_deleted);
-			bytes_deleted += ab->b_size;
+			bytes_deleted += HDR_GHOST_SIZE(ab);
 			arc_hdr_destroy(ab);
 			DTRACE_PROBE1(arc__delete, arc_buf_hdr_t *, ab);
 			if (bytes >= 0 && bytes_deleted >= bytes)
@@ -1370,19 +1569,41 @@ arc_adjust(void)
 {
 	int64_t top_sz, mru_over, arc_over, todelete;
 
+	/*
+	 * Keep the decompressed copies of blocks that are also cached in
+	 * compressed form within their share of the cache.  Evicting them
+	 * leaves the compressed copy behind in the ghost hdr.
+	 */
+	if (zfs_arc_compressed) {
+		int64_t dec_over = ARCSTAT(arcstat_decompressed_size) -
+		    arc_c / 100 * zfs_arc_decompressed_pct;
+
+		if (dec_over > 0 && arc_mru->arcs_lsize[ARC_BUFC_DATA] > 0) {
+			(void) arc_evict(arc_mru, dec_over, FALSE,
+			    ARC_BUFC_DATA, TRUE);
+			dec_over = ARCSTAT(arcstat_decompressed_size) -
+			    arc_c / 100 * zfs_arc_decompressed_pct;
+		}
+		if (dec_over > 0 && arc_mfu->arcs_lsize[ARC_BUFC_DATA] > 0)
+			(void) arc_evict(arc_mfu, dec_over, FALSE,
+			    ARC_BUFC_DATA, TRUE);
+	}
+
 	top_sz = arc_anon->arcs_size + arc_mru->arcs_size;
 
 	if (top_sz > arc_p && arc_mru->arcs_lsize[ARC_BUFC_DATA] > 0) {
 		int64_t toevict =
 		    MIN(arc_mru->arcs_lsize[ARC_BUFC_DATA], top_sz - arc_p);
-		(void) arc_evict(arc_mru, toevict, FALSE, ARC_BUFC_DATA);
+		(void) arc_evict(arc_mru, toevict, FALSE, ARC_BUFC_DATA,
+		    FALSE);
 		top_sz = arc_anon->arcs_size + arc_mru->arcs_size;
 	}
 
 	if (top_sz > arc_p && arc_mru->arcs_lsize[ARC_BUFC_METADATA] > 0) {
 		int64_t toevict =
 		    MIN(arc_mru->arcs_lsize[ARC_BUFC_METADATA], top_sz - arc_p);
-		(void) arc_evict(arc_mru, toevict, FALSE, ARC_BUFC_METADATA);
+		(void) arc_evict(arc_mru, toevict, FALSE, ARC_BUFC_METADATA,
+		    FALSE);
 		top_sz = arc_anon->arcs_size + arc_mru->arcs_size;
 	}
 
@@ -1402,7 +1623,7 @@ arc_adjust(void)
 			int64_t toevict =
 			    MIN(arc_mfu->arcs_lsize[ARC_BUFC_DATA], arc_over);
 			(void) arc_evict(arc_mfu, toevict, FALSE,
-			    ARC_BUFC_DATA);
+			    ARC_BUFC_DATA, FALSE);
 			arc_over = arc_size - arc_c;
 		}
 
@@ -1412,7 +1633,7 @@ arc_adjust(void)
 			    MIN(arc_mfu->arcs_lsize[ARC_BUFC_METADATA],
 			    arc_over);
 			(void) arc_evict(arc_mfu, toevict, FALSE,
-			    ARC_BUFC_METADATA);
+			    ARC_BUFC_METADATA, FALSE);
 		}
 
 		tbl_over = arc_size + arc_mru_ghost->arcs_size +
@@ -1422,6 +1643,19 @@ arc_adjust(void)
 			todelete = MIN(arc_mfu_ghost->arcs_size, tbl_over);
 			arc_evict_ghost(arc_mfu_ghost, todelete);
 		}
+
+		/*
+		 * Compressed copies held by ghost hdrs take up real space;
+		 * if evicting buffers was not enough, drop the oldest ones.
+		 */
+		if (ARCSTAT(arcstat_compressed_size) > 0 &&
+		    (arc_over = arc_size - arc_c) > 0) {
+			if (arc_mru_ghost->arcs_size > 0)
+				arc_evict_ghost(arc_mru_ghost, arc_over);
+			if ((arc_over = arc_size - arc_c) > 0 &&
+			    arc_mfu_ghost->arcs_size > 0)
+				arc_evict_ghost(arc_mfu_ghost, arc_over);
+		}
 	}
 }
 
@@ -1454,13 +1688,13 @@ void
 arc_flush(void)
 {
 	while (list_head(&arc_mru->arcs_list[ARC_BUFC_DATA]))
-		(void) arc_evict(arc_mru, -1, FALSE, ARC_BUFC_DATA);
+		(void) arc_evict(arc_mru, -1, FALSE, ARC_BUFC_DATA, FALSE);
 	while (list_head(&arc_mru->arcs_list[ARC_BUFC_METADATA]))
-		(void) arc_evict(arc_mru, -1, FALSE, ARC_BUFC_METADATA);
+		(void) arc_evict(arc_mru, -1, FALSE, ARC_BUFC_METADATA, FALSE);
 	while (list_head(&arc_mfu->arcs_list[ARC_BUFC_DATA]))
-		(void) arc_evict(arc_mfu, -1, FALSE, ARC_BUFC_DATA);
+		(void) arc_evict(arc_mfu, -1, FALSE, ARC_BUFC_DATA, FALSE);
 	while (list_head(&arc_mfu->arcs_list[ARC_BUFC_METADATA]))
-		(void) arc_evict(arc_mfu, -1, FALSE, ARC_BUFC_METADATA);
+		(void) arc_evict(arc_mfu, -1, FALSE, ARC_BUFC_METADATA, FALSE);
 
 	arc_evict_ghost(arc_mru_ghost, -1);
 	arc_evict_ghost(arc_mfu_ghost, -1);
@@ -1745,8 +1979,16 @@ arc_adapt(int bytes, arc_state_t *state)
 static int
 arc_evict_needed(arc_buf_contents_t type)
 {
-	if (type == ARC_BUFC_METADATA && arc_meta_used >= arc_meta_limit)
-		return (1);
+	if (type == ARC_BUFC_METADATA) {
+		uint64_t meta_used = arc_meta_used;
+		uint64_t m;
+
+		while (meta_used > (m = arc_meta_max) &&
+		    atomic_cas_64(&arc_meta_max, m, meta_used) != m)
+			continue;
+		if (meta_used >= arc_meta_limit)
+			return (1);
+	}
 #ifndef __APPLE__
 #ifdef _KERNEL
 	/*
@@ -1809,7 +2051,7 @@ arc_get_data_buf(arc_buf_t *buf)
 		} else {
 			ASSERT(type == ARC_BUFC_DATA);
 			buf->b_data = zio_data_buf_alloc(size);
-			atomic_add_64(&arc_size, size);
+			ARC_SIZE_INCR(size);
 		}
 #ifdef __APPLE__
 		if (arc_size > arc_c_peak)
@@ -1837,14 +2079,15 @@ arc_get_data_buf(arc_buf_t *buf)
 		state =  (arc_mru->arcs_lsize[type] > 0 &&
 		    mfu_space > arc_mfu->arcs_size) ? arc_mru : arc_mfu;
 	}
-	if ((buf->b_data = arc_evict(state, size, TRUE, type)) == NULL) {
+	buf->b_data = arc_evict(state, size, TRUE, type, FALSE);
+	if (buf->b_data == NULL) {
 		if (type == ARC_BUFC_METADATA) {
 			buf->b_data = zio_buf_alloc(size);
 			arc_space_consume(size);
 		} else {
 			ASSERT(type == ARC_BUFC_DATA);
 			buf->b_data = zio_data_buf_alloc(size);
-			atomic_add_64(&arc_size, size);
+			ARC_SIZE_INCR(size);
 		}
 #ifdef __APPLE__
 		if (arc_size > arc_c_peak)
@@ -1854,6 +2097,9 @@ arc_get_data_buf(arc_buf_t *buf)
 	}
 	ASSERT(buf->b_data != NULL);
 out:
+	if (buf->b_hdr->b_cdata != NULL)
+		ARCSTAT_ATOMIC_INCR(arcstat_decompressed_size, size);
+
 	/*
 	 * Update the state size.  Note that ghost states have a
 	 * "ghost size" and so don't need to be updated.
@@ -2085,6 +2331,10 @@ arc_read_done(zio_t *zio)
 			zio->io_error = EIO;
 	}
 
+	/* keep the compressed copy of the block, if zio_read() saved it */
+	if (zio->io_cdata != NULL && zio->io_error == 0 && hash_lock != NULL)
+		arc_hdr_set_cdata(hdr, zio);
+
 	/*
 	 * Broadcast before we drop the hash_lock to avoid the possibility
 	 * that the hdr (and hence the cv) might be freed before we get to
@@ -2169,6 +2419,13 @@ top:
 
 		*arc_flags |= ARC_CACHED;
 
+		/*
+		 * Somebody other than an ARC_UNCACHED reader wants this
+		 * block, so keep it.
+		 */
+		if (!(*arc_flags & ARC_UNCACHED))
+			hdr->b_flags &= ~ARC_UNCACHED;
+
 		if (HDR_IO_IN_PROGRESS(hdr)) {
 
 			if (*arc_flags & ARC_WAIT) {
@@ -2264,6 +2521,8 @@ top:
 			}
 			if (BP_GET_LEVEL(bp) > 0)
 				hdr->b_flags |= ARC_INDIRECT;
+			if (*arc_flags & ARC_UNCACHED)
+				hdr->b_flags |= ARC_UNCACHED;
 		} else {
 			/* this block is in the ghost cache */
 			ASSERT(GHOST_STATE(hdr->b_state));
@@ -2276,6 +2535,8 @@ top:
 				hdr->b_flags |= ARC_PREFETCH;
 			else
 				add_reference(hdr, hash_lock, private);
+			if (*arc_flags & ARC_UNCACHED)
+				hdr->b_flags |= ARC_UNCACHED;
 			buf = kmem_cache_alloc(buf_cache, KM_SLEEP);
 			buf->b_hdr = hdr;
 			buf->b_data = NULL;
@@ -2287,6 +2548,30 @@ top:
 			ASSERT(hdr->b_datacnt == 0);
 			hdr->b_datacnt = 1;
 
+			/*
+			 * If the hdr still holds the compressed block, we
+			 * can satisfy the read without any I/O.
+			 */
+			if (hdr->b_cdata != NULL &&
+			    arc_hdr_decompress(hdr, buf, bp, swap) == 0) {
+				*arc_flags |= ARC_CACHED;
+				if (done == NULL)
+					hdr->b_flags |= ARC_BUF_AVAILABLE;
+				arc_cksum_compute(buf);
+				DTRACE_PROBE1(arc__hit, arc_buf_hdr_t *, hdr);
+				arc_access(hdr, hash_lock);
+				mutex_exit(hash_lock);
+				ARCSTAT_BUMP(arcstat_hits);
+				ARCSTAT_BUMP(arcstat_compressed_hits);
+				ARCSTAT_CONDSTAT(!(hdr->b_flags & ARC_PREFETCH),
+				    demand, prefetch,
+				    hdr->b_type != ARC_BUFC_METADATA,
+				    data, metadata, hits);
+
+				if (done)
+					done(NULL, buf, private);
+				return (0);
+			}
 		}
 
 		acb = kmem_zalloc(sizeof (arc_callback_t), KM_SLEEP);
@@ -2318,6 +2603,10 @@ top:
 		    demand, prefetch, hdr->b_type != ARC_BUFC_METADATA,
 		    data, metadata, misses);
 
+		if (zfs_arc_compressed && hdr->b_type == ARC_BUFC_DATA &&
+		    BP_GET_COMPRESS(bp) != ZIO_COMPRESS_OFF)
+			flags |= ZIO_FLAG_KEEP_COMPRESSED;
+
 		rzio = zio_read(pio, spa, bp, buf->b_data, size,
 		    arc_read_done, buf, priority, flags, zb);
 
@@ -2526,6 +2815,8 @@ arc_release(arc_buf_t *buf, void *tag)
 			atomic_add_64(size, -hdr->b_size);
 		}
 		hdr->b_datacnt -= 1;
+		if (hdr->b_cdata != NULL)
+			ARCSTAT_ATOMIC_INCR(arcstat_decompressed_size, -blksz);
 		arc_cksum_verify(buf);
 
 		mutex_exit(hash_lock);
@@ -2547,6 +2838,8 @@ arc_release(arc_buf_t *buf, void *tag)
 		ASSERT(refcount_count(&hdr->b_refcnt) == 1);
 		ASSERT(!list_link_active(&hdr->b_arc_node));
 		ASSERT(!HDR_IO_IN_PROGRESS(hdr));
+		if (hdr->b_cdata != NULL)
+			arc_hdr_free_cdata(hdr);
 		arc_change_state(arc_anon, hdr, hash_lock);
 		hdr->b_arc_access = 0;
 		mutex_exit(hash_lock);
@@ -2816,6 +3109,17 @@ arc_tempreserve_space(uint64_t tempreserve)
 	return (0);
 }
 
+static int
+arc_kstat_update(kstat_t *ksp, int rw)
+{
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	ARCSTAT(arcstat_size) = arc_size;
+
+	return (zcounter_kstat_update(ksp, rw));
+}
+
 void
 arc_init(void)
 {
@@ -2888,7 +3192,6 @@ arc_init(void)
 	arc_mru_ghost = &ARC_mru_ghost;
 	arc_mfu = &ARC_mfu;
 	arc_mfu_ghost = &ARC_mfu_ghost;
-	arc_size = 0;
 
 	mutex_init(&arc_anon->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&arc_mru->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
@@ -2913,6 +3216,10 @@ arc_init(void)
 	list_create(&arc_mfu_ghost->arcs_list[ARC_BUFC_DATA],
 	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
 
+	zcounter_set_create(&arc_counters, ARCSTAT_NCOUNTERS);
+	zcounter_approx_create(&arc_size_counter, ARC_SIZE_BATCH);
+	zcounter_approx_create(&arc_meta_counter, ARC_SIZE_BATCH);
+
 	buf_init();
 
 	arc_thread_exit = 0;
@@ -2925,6 +3232,8 @@ arc_init(void)
 
 	if (arc_ksp != NULL) {
 		arc_ksp->ks_data = &arc_stats;
+		arc_ksp->ks_private = &arc_counters;
+		arc_ksp->ks_update = arc_kstat_update;
 		kstat_install(arc_ksp);
 	}
 
@@ -2952,6 +3261,10 @@ arc_fini(void)
 		arc_ksp = NULL;
 	}
 
+	zcounter_set_destroy(&arc_counters);
+	zcounter_approx_destroy(&arc_size_counter);
+	zcounter_approx_destroy(&arc_meta_counter);
+
 	mutex_destroy(&arc_eviction_mtx);
 	mutex_destroy(&arc_reclaim_thr_lock);
 	cv_destroy(&arc_reclaim_thr_cv);
@@ -171,20 +171,18 @@ dmu_bonus_hold(objset_t *os, uint64_t object, void *tag, dmu_buf_t **dbp)
 }
 
 /*
- * Note: longer-term, we should modify all of the dmu_buf_*() interfaces
- * to take a held dnode rather than <os, object> -- the lookup is wasteful,
- * and can induce severe lock contention when writing to several files
- * whose dnodes are in the same block.
+ * Hold the dbufs covering [offset, offset + length) of the dnode and, if
+ * 'read' is set, start reading the uncached ones as children of 'zio'.
+ * Dbufs that some other thread is already reading are not waited for;
+ * see dmu_buf_wait_array().
  */
 static int
-dmu_buf_hold_array_by_dnode(dnode_t *dn, uint64_t offset,
-    uint64_t length, int read, void *tag, int *numbufsp, dmu_buf_t ***dbpp)
+dmu_buf_hold_array_start(dnode_t *dn, uint64_t offset, uint64_t length,
+    int read, void *tag, zio_t *zio, int *numbufsp, dmu_buf_t ***dbpp)
 {
 	dmu_buf_t **dbp;
 	uint64_t blkid, nblks, i;
 	uint32_t flags;
-	int err;
-	zio_t *zio;
 
 	ASSERT(length <= DMU_MAX_ACCESS);
 
@@ -205,20 +203,19 @@ dmu_buf_hold_array_by_dnode(dnode_t *dn, uint64_t offset,
 			    os_dsl_dataset->ds_object,
 			    (longlong_t)dn->dn_object, dn->dn_datablksz,
 			    (longlong_t)offset, (longlong_t)length);
+			rw_exit(&dn->dn_struct_rwlock);
 			return (EIO);
 		}
 		nblks = 1;
 	}
 	dbp = kmem_zalloc(sizeof (dmu_buf_t *) * nblks, KM_SLEEP);
 
-	zio = zio_root(dn->dn_objset->os_spa, NULL, NULL, TRUE);
 	blkid = dbuf_whichblock(dn, offset);
 	for (i = 0; i < nblks; i++) {
 		dmu_buf_impl_t *db = dbuf_hold(dn, blkid+i, tag);
 		if (db == NULL) {
 			rw_exit(&dn->dn_struct_rwlock);
 			dmu_buf_rele_array(dbp, nblks, tag);
-			zio_nowait(zio);
 			return (EIO);
 		}
 		/* initiate async i/o */
@@ -231,32 +228,68 @@ dmu_buf_hold_array_by_dnode(dnode_t *dn, uint64_t offset,
 	}
 	rw_exit(&dn->dn_struct_rwlock);
 
-	/* wait for async i/o */
-	err = zio_wait(zio);
+	*numbufsp = nblks;
+	*dbpp = dbp;
+	return (0);
+}
+
+/*
+ * Wait for reads of the held dbufs that other threads had in progress.
+ */
+static int
+dmu_buf_wait_array(dmu_buf_t **dbp, int numbufs)
+{
+	int i, err = 0;
+
+	for (i = 0; i < numbufs && err == 0; i++) {
+		dmu_buf_impl_t *db = (dmu_buf_impl_t *)dbp[i];
+		mutex_enter(&db->db_mtx);
+		while (db->db_state == DB_READ ||
+		    db->db_state == DB_FILL)
+			cv_wait(&db->db_changed, &db->db_mtx);
+		if (db->db_state == DB_UNCACHED)
+			err = EIO;
+		mutex_exit(&db->db_mtx);
+	}
+	return (err);
+}
+
+/*
+ * Note: longer-term, we should modify all of the dmu_buf_*() interfaces
+ * to take a held dnode rather than <os, object> -- the lookup is wasteful,
+ * and can induce severe lock contention when writing to several files
+ * whose dnodes are in the same block.
+ */
+static int
+dmu_buf_hold_array_by_dnode(dnode_t *dn, uint64_t offset,
+    uint64_t length, int read, void *tag, int *numbufsp, dmu_buf_t ***dbpp)
+{
+	dmu_buf_t **dbp;
+	int numbufs;
+	int err;
+	zio_t *zio;
+
+	zio = zio_root(dn->dn_objset->os_spa, NULL, NULL, TRUE);
+	err = dmu_buf_hold_array_start(dn, offset, length, read, tag, zio,
+	    &numbufs, &dbp);
 	if (err) {
-		dmu_buf_rele_array(dbp, nblks, tag);
+		zio_nowait(zio);
 		return (err);
 	}
 
+	/* wait for async i/o */
+	err = zio_wait(zio);
+
 	/* wait for other io to complete */
-	if (read) {
-		for (i = 0; i < nblks; i++) {
-			dmu_buf_impl_t *db = (dmu_buf_impl_t *)dbp[i];
-			mutex_enter(&db->db_mtx);
-			while (db->db_state == DB_READ ||
-			    db->db_state == DB_FILL)
-				cv_wait(&db->db_changed, &db->db_mtx);
-			if (db->db_state == DB_UNCACHED)
-				err = EIO;
-			mutex_exit(&db->db_mtx);
-			if (err) {
-				dmu_buf_rele_array(dbp, nblks, tag);
-				return (err);
-			}
-		}
+	if (err == 0 && read)
+		err = dmu_buf_wait_array(dbp, numbufs);
+
+	if (err) {
+		dmu_buf_rele_array(dbp, numbufs, tag);
+		return (err);
 	}
 
-	*numbufsp = nblks;
+	*numbufsp = numbufs;
 	*dbpp = dbp;
 	return (0);
 }
@@ -435,6 +468,265 @@ dmu_read(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
 	return (err);
 }
 
+arc_buf_t *
+dmu_request_arcbuf(objset_t *os, int size)
+{
+	return (arc_loan_buf(os->os->os_spa, size));
+}
+
+void
+dmu_return_arcbuf(arc_buf_t *buf)
+{
+	arc_return_buf(buf, FTAG);
+	VERIFY(arc_buf_remove_ref(buf, FTAG) == 1);
+}
+
+/*
+ * If the buffer covers exactly the block at 'offset', it becomes that
+ * block's new contents without being copied; otherwise its data is
+ * written the usual way.  Either way the buffer is consumed.
+ */
+void
+dmu_assign_arcbuf(objset_t *os, uint64_t object, uint64_t offset,
+    arc_buf_t *buf, dmu_tx_t *tx)
+{
+	dnode_t *dn;
+	dmu_buf_impl_t *db;
+	uint32_t blksz = (uint32_t)arc_buf_size(buf);
+	uint64_t blkid;
+
+	VERIFY(dnode_hold(os->os, object, FTAG, &dn) == 0);
+
+	rw_enter(&dn->dn_struct_rwlock, RW_READER);
+	blkid = dbuf_whichblock(dn, offset);
+	VERIFY((db = dbuf_hold(dn, blkid, FTAG)) != NULL);
+	rw_exit(&dn->dn_struct_rwlock);
+
+	if (offset == db->db.db_offset && blksz == db->db.db_size) {
+		dbuf_assign_arcbuf(db, buf, tx);
+		dbuf_rele(db, FTAG);
+	} else {
+		dbuf_rele(db, FTAG);
+		dmu_write(os, object, offset, blksz, buf->b_data, tx);
+		dmu_return_arcbuf(buf);
+	}
+	dnode_rele(dn, FTAG);
+}
+
+/*
+ * Asynchronous reads.  dmu_read_async() holds the dbufs covering the
+ * range, starts reading the uncached ones and returns; once they have
+ * all arrived, the callback is run from the dmu_read_async taskq with
+ * the filled buffers.  The request, and the holds on its buffers, stay
+ * valid until the caller passes it to dmu_read_async_rele().
+ *
+ * At most zfs_read_async_max requests, covering at most
+ * zfs_read_async_max_bytes, may be outstanding (issued and not yet
+ * released) at once, which bounds the memory the interface can pin
+ * down.  A single request larger than the byte limit is still let
+ * through when nothing else is outstanding.
+ *
+ * A callback may issue further reads, but it must not wait for a slot:
+ * the slots it would wait for may only be released by callbacks queued
+ * behind it on the same taskq.  Reads issued from a callback therefore
+ * fail with EAGAIN at the limit, as if DMU_READ_NOWAIT had been given.
+ */
+int zfs_read_async_max = 256;
+uint64_t zfs_read_async_max_bytes = 64 << 20;
+int zfs_read_async_threads = 8;
+
+struct dmu_read_req {
+	kmutex_t		drr_lock;
+	dnode_t			*drr_dn;
+	dmu_buf_t		**drr_dbp;
+	int			drr_numbufs;
+	uint64_t		drr_size;
+	int			drr_err;
+	boolean_t		drr_cancelled;
+	boolean_t		drr_done;
+	dmu_read_done_func_t	*drr_func;
+	void			*drr_arg;
+};
+
+static taskq_t *dmu_read_taskq;
+static kmutex_t dmu_read_async_lock;
+static kcondvar_t dmu_read_async_cv;
+static int dmu_read_async_count;
+static uint64_t dmu_read_async_bytes;
+static int dmu_read_async_nthreads;
+static kthread_t **dmu_read_async_cbthreads;	/* running a callback */
+
+/*
+ * Note that the current thread is (or is no longer) running a callback.
+ * There are only as many such threads as there are taskq threads.
+ */
+static void
+dmu_read_async_set_callback(kthread_t *from, kthread_t *to)
+{
+	int i;
+
+	mutex_enter(&dmu_read_async_lock);
+	for (i = 0; i < dmu_read_async_nthreads; i++) {
+		if (dmu_read_async_cbthreads[i] == from)
+			break;
+	}
+	VERIFY(i < dmu_read_async_nthreads);
+	dmu_read_async_cbthreads[i] = to;
+	mutex_exit(&dmu_read_async_lock);
+}
+
+static boolean_t
+dmu_read_async_in_callback(void)
+{
+	int i;
+
+	ASSERT(MUTEX_HELD(&dmu_read_async_lock));
+
+	for (i = 0; i < dmu_read_async_nthreads; i++) {
+		if (dmu_read_async_cbthreads[i] == curthread)
+			return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
+static void
+dmu_read_async_finish(void *arg)
+{
+	dmu_read_req_t *req = arg;
+	int err = req->drr_err;
+
+	/* the zio is done, but another thread may still be filling a dbuf */
+	if (err == 0 && !req->drr_cancelled)
+		err = dmu_buf_wait_array(req->drr_dbp, req->drr_numbufs);
+
+	mutex_enter(&req->drr_lock);
+	if (req->drr_cancelled)
+		err = ECANCELED;
+	req->drr_err = err;
+	req->drr_done = B_TRUE;
+	mutex_exit(&req->drr_lock);
+
+	if (err != 0 && req->drr_dbp != NULL) {
+		dmu_buf_rele_array(req->drr_dbp, req->drr_numbufs, req);
+		req->drr_dbp = NULL;
+		req->drr_numbufs = 0;
+	}
+	dnode_rele(req->drr_dn, req);
+	req->drr_dn = NULL;
+
+	dmu_read_async_set_callback(NULL, curthread);
+	req->drr_func(req, err, req->drr_dbp, req->drr_numbufs, req->drr_arg);
+	dmu_read_async_set_callback(curthread, NULL);
+}
+
+static void
+dmu_read_async_done(zio_t *zio)
+{
+	dmu_read_req_t *req = zio->io_private;
+
+	if (req->drr_err == 0)
+		req->drr_err = zio->io_error;
+
+	(void) taskq_dispatch(dmu_read_taskq, dmu_read_async_finish, req,
+	    TQ_SLEEP);
+}
+
+/*
+ * Read [offset, offset + size) of the object asynchronously; 'size' may
+ * be at most DMU_MAX_ACCESS / 2.  Returns EAGAIN if the outstanding
+ * requests are at their limit and DMU_READ_NOWAIT is given or we are
+ * called from a callback; otherwise waits for requests to be released.
+ * Errors reading the blocks are reported to the callback, which is
+ * called exactly once.
+ */
+int
+dmu_read_async(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
+    int flags, dmu_read_done_func_t *func, void *arg, dmu_read_req_t **reqp)
+{
+	dmu_read_req_t *req;
+	dnode_t *dn;
+	zio_t *zio;
+	int err;
+
+	if (size == 0 || size > DMU_MAX_ACCESS / 2)
+		return (EINVAL);
+
+	mutex_enter(&dmu_read_async_lock);
+	while (dmu_read_async_count >= zfs_read_async_max ||
+	    (dmu_read_async_count != 0 &&
+	    dmu_read_async_bytes + size > zfs_read_async_max_bytes)) {
+		if ((flags & DMU_READ_NOWAIT) ||
+		    dmu_read_async_in_callback()) {
+			mutex_exit(&dmu_read_async_lock);
+			return (EAGAIN);
+		}
+		cv_wait(&dmu_read_async_cv, &dmu_read_async_lock);
+	}
+	dmu_read_async_count++;
+	dmu_read_async_bytes += size;
+	mutex_exit(&dmu_read_async_lock);
+
+	req = kmem_zalloc(sizeof (dmu_read_req_t), KM_SLEEP);
+	mutex_init(&req->drr_lock, NULL, MUTEX_DEFAULT, NULL);
+	req->drr_size = size;
+	req->drr_func = func;
+	req->drr_arg = arg;
+
+	err = dnode_hold(os->os, object, req, &dn);
+	if (err) {
+		dmu_read_async_rele(req);
+		return (err);
+	}
+	req->drr_dn = dn;
+
+	zio = zio_root(dn->dn_objset->os_spa, dmu_read_async_done, req,
+	    ZIO_FLAG_CANFAIL);
+	req->drr_err = dmu_buf_hold_array_start(dn, offset, size, TRUE, req,
+	    zio, &req->drr_numbufs, &req->drr_dbp);
+
+	*reqp = req;
+	zio_nowait(zio);
+	return (0);
+}
+
+/*
+ * Cancel a request.  If its callback has not run yet, it will be called
+ * with ECANCELED and no buffers; the I/O itself is left to complete.
+ */
+void
+dmu_read_async_cancel(dmu_read_req_t *req)
+{
+	mutex_enter(&req->drr_lock);
+	if (!req->drr_done)
+		req->drr_cancelled = B_TRUE;
+	mutex_exit(&req->drr_lock);
+}
+
+/*
+ * Release a request whose callback has run, along with its buffers.
+ */
+void
+dmu_read_async_rele(dmu_read_req_t *req)
+{
+	uint64_t size = req->drr_size;
+
+	/* the dnode is released once the request completes */
+	ASSERT(req->drr_dn == NULL);
+
+	if (req->drr_dbp != NULL)
+		dmu_buf_rele_array(req->drr_dbp, req->drr_numbufs, req);
+	mutex_destroy(&req->drr_lock);
+	kmem_free(req, sizeof (dmu_read_req_t));
+
+	mutex_enter(&dmu_read_async_lock);
+	ASSERT(dmu_read_async_count > 0);
+	ASSERT3U(dmu_read_async_bytes, >=, size);
+	dmu_read_async_count--;
+	dmu_read_async_bytes -= size;
+	cv_broadcast(&dmu_read_async_cv);
+	mutex_exit(&dmu_read_async_lock);
+}
+
 void
 dmu_write(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
     const void *buf, dmu_tx_t *tx)
@@ -1077,11 +1369,27 @@ dmu_init(void)
 	dbuf_init();
 	dnode_init();
 	arc_init();
+	zfetch_init();
+	mutex_init(&dmu_read_async_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&dmu_read_async_cv, NULL, CV_DEFAULT, NULL);
+	dmu_read_async_nthreads = zfs_read_async_threads;
+	dmu_read_async_cbthreads = kmem_zalloc(dmu_read_async_nthreads *
+	    sizeof (kthread_t *), KM_SLEEP);
+	dmu_read_taskq = taskq_create("dmu_read_async",
+	    dmu_read_async_nthreads, minclsyspri, dmu_read_async_nthreads,
+	    INT_MAX, TASKQ_PREPOPULATE);
 }
 
 void
 dmu_fini(void)
 {
+	taskq_destroy(dmu_read_taskq);
+	ASSERT(dmu_read_async_count == 0);
+	kmem_free(dmu_read_async_cbthreads, dmu_read_async_nthreads *
+	    sizeof (kthread_t *));
+	cv_destroy(&dmu_read_async_cv);
+	mutex_destroy(&dmu_read_async_lock);
+	zfetch_fini();
 	arc_fini();
 	dnode_fini();
 	dbuf_fini();
@@ -29,58 +29,126 @@
 #include <sys/dmu_objset.h>
 #include <sys/dmu_tx.h>
 #include <sys/dnode.h>
+#include <sys/zcounter.h>
+
+/*
+ * Claim the next chunk of object numbers for an allocation slot.
+ */
+static uint64_t
+dmu_object_alloc_chunk(objset_impl_t *osi, boolean_t *restarted)
+{
+	uint64_t L2_dnode_count = DNODES_PER_BLOCK <<
+	    (osi->os_meta_dnode->dn_indblkshift - SPA_BLKPTRSHIFT);
+	uint64_t object;
+
+	mutex_enter(&osi->os_obj_lock);
+	object = osi->os_obj_next;
+	/*
+	 * Each time we polish off an L2 bp worth of dnodes
+	 * (2^13 objects), move to another L2 bp that's still
+	 * reasonably sparse (at most 1/4 full).  Look from the
+	 * beginning once, but after that keep looking from here.
+	 * If we can't find one, just keep going from here.
+	 */
+	if (P2PHASE(object, L2_dnode_count) == 0) {
+		uint64_t offset = *restarted ? object << DNODE_SHIFT : 0;
+		int error = dnode_next_offset(osi->os_meta_dnode,
+		    B_TRUE, &offset, 2, DNODES_PER_BLOCK >> 2, 0);
+		*restarted = B_TRUE;
+		if (error == 0) {
+			object = P2ALIGN(offset >> DNODE_SHIFT,
+			    DMU_OBJ_ALLOC_CHUNK);
+		}
+	}
+	osi->os_obj_next = object + DMU_OBJ_ALLOC_CHUNK;
+	mutex_exit(&osi->os_obj_lock);
+
+	return (object);
+}
+
+static void
+dmu_object_prefetch_chunk(objset_t *os, uint64_t chunk)
+{
+	uint64_t object;
+
+	for (object = chunk; object < chunk + DMU_OBJ_ALLOC_CHUNK;
+	    object += DNODES_PER_BLOCK)
+		dmu_prefetch(os, MAX(object, 1), 0, 0);
+}
 
 uint64_t
 dmu_object_alloc(objset_t *os, dmu_object_type_t ot, int blocksize,
     dmu_object_type_t bonustype, int bonuslen, dmu_tx_t *tx)
 {
 	objset_impl_t *osi = os->os;
-	uint64_t object;
-	uint64_t L2_dnode_count = DNODES_PER_BLOCK <<
-	    (osi->os_meta_dnode->dn_indblkshift - SPA_BLKPTRSHIFT);
+	dmu_obj_alloc_t *oa;
+	uint64_t object, ahead, end, next;
 	dnode_t *dn = NULL;
-	int restarted = B_FALSE;
+	boolean_t restarted = B_FALSE;
+
+	oa = &osi->os_obj_alloc[zcounter_shard() % DMU_OBJ_ALLOC_SLOTS];
 
-	mutex_enter(&osi->os_obj_lock);
 	for (;;) {
-		object = osi->os_obj_next;
-		/*
-		 * Each time we polish off an L2 bp worth of dnodes
-		 * (2^13 objects), move to another L2 bp that's still
-		 * reasonably sparse (at most 1/4 full).  Look from the
-		 * beginning once, but after that keep looking from here.
-		 * If we can't find one, just keep going from here.
-		 */
-		if (P2PHASE(object, L2_dnode_count) == 0) {
-			uint64_t offset = restarted ? object << DNODE_SHIFT : 0;
-			int error = dnode_next_offset(osi->os_meta_dnode,
-			    B_TRUE, &offset, 2, DNODES_PER_BLOCK >> 2, 0);
-			restarted = B_TRUE;
-			if (error == 0)
-				object = offset >> DNODE_SHIFT;
+		ahead = -1ULL;
+
+		mutex_enter(&oa->oa_lock);
+		if (oa->oa_next == oa->oa_end) {
+			/*
+			 * Move on to the chunk we claimed (and started
+			 * reading in) last time, and claim the one after.
+			 */
+			if (!oa->oa_have_ahead) {
+				oa->oa_ahead = dmu_object_alloc_chunk(osi,
+				    &restarted);
+			}
+			oa->oa_next = oa->oa_ahead;
+			oa->oa_end = oa->oa_next + DMU_OBJ_ALLOC_CHUNK;
+			oa->oa_ahead = dmu_object_alloc_chunk(osi, &restarted);
+			oa->oa_have_ahead = B_TRUE;
+			ahead = oa->oa_ahead;
 		}
-		osi->os_obj_next = ++object;
+		object = oa->oa_next++;
+		end = oa->oa_end;
+		mutex_exit(&oa->oa_lock);
+
+		if (ahead != -1ULL)
+			dmu_object_prefetch_chunk(os, ahead);
+
+		if (object == DMU_META_DNODE_OBJECT)
+			continue;
 
 		/*
+		 * Chunks can overlap objects that are already allocated,
+		 * or are being allocated from another slot's chunk, so
+		 * the dnode must be both free and unheld to be ours.
+		 *
 		 * XXX We should check for an i/o error here and return
 		 * up to our caller.  Actually we should pre-read it in
 		 * dmu_tx_assign(), but there is currently no mechanism
 		 * to do so.
 		 */
-		(void) dnode_hold_impl(os->os, object, DNODE_MUST_BE_FREE,
-		    FTAG, &dn);
+		(void) dnode_hold_impl(os->os, object,
+		    DNODE_MUST_BE_FREE | DNODE_MUST_BE_UNHELD, FTAG, &dn);
 		if (dn)
 			break;
 
-		if (dmu_object_next(os, &object, B_TRUE, 0) == 0)
-			osi->os_obj_next = object - 1;
+		/*
+		 * Skip ahead to the next free dnode, or past the end of the
+		 * chunk if there is none left in it, unless the slot has
+		 * moved on to another chunk in the meantime.
+		 */
+		next = object;
+		if (dmu_object_next(os, &next, B_TRUE, 0) == 0) {
+			mutex_enter(&oa->oa_lock);
+			if (oa->oa_end == end && next > oa->oa_next)
+				oa->oa_next = MIN(next, end);
+			mutex_exit(&oa->oa_lock);
+		}
 	}
 
 	dnode_allocate(dn, ot, blocksize, 0, bonustype, bonuslen, tx);
 	dnode_rele(dn, FTAG);
 
-	mutex_exit(&osi->os_obj_lock);
-
 	dmu_tx_add_new_object(tx, os, object);
 	return (object);
 }
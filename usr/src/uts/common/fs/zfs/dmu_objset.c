@@ -246,6 +246,10 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 
 	mutex_init(&osi->os_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&osi->os_obj_lock, NULL, MUTEX_DEFAULT, NULL);
+	for (i = 0; i < DMU_OBJ_ALLOC_SLOTS; i++) {
+		mutex_init(&osi->os_obj_alloc[i].oa_lock, NULL,
+		    MUTEX_DEFAULT, NULL);
+	}
 
 	osi->os_meta_dnode = dnode_special_open(osi,
 	    &osi->os_phys->os_meta_dnode, DMU_META_DNODE_OBJECT);
@@ -389,6 +393,8 @@ dmu_objset_evict(dsl_dataset_t *ds, void *arg)
 	VERIFY(arc_buf_remove_ref(osi->os_phys_buf, &osi->os_phys_buf) == 1);
 	mutex_destroy(&osi->os_lock);
 	mutex_destroy(&osi->os_obj_lock);
+	for (i = 0; i < DMU_OBJ_ALLOC_SLOTS; i++)
+		mutex_destroy(&osi->os_obj_alloc[i].oa_lock);
 	kmem_free(osi, sizeof (objset_impl_t));
 }
 
@@ -717,6 +723,122 @@ out:
 	return (err);
 }
 
+static int
+dmu_objset_snapshot_batch_one(dsl_sync_task_group_t *dstg, char *name)
+{
+	dmu_objset_stats_t stat;
+	objset_t *os;
+	char fsname[MAXNAMELEN];
+	char *atp;
+	int err;
+
+	atp = strchr(name, '@');
+	if (atp == NULL || atp - name >= sizeof (fsname))
+		return (EINVAL);
+	(void) strlcpy(fsname, name, atp - name + 1);
+
+	err = dmu_objset_open(fsname, DMU_OST_ANY, DS_MODE_STANDARD, &os);
+	if (err != 0)
+		return (err);
+
+	dmu_objset_fast_stat(os, &stat);
+	if (stat.dds_inconsistent) {
+		dmu_objset_close(os);
+		return (EBUSY);
+	}
+
+	/* See dmu_objset_snapshot_one(). */
+	err = zil_suspend(dmu_objset_zil(os));
+	if (err == 0) {
+		dsl_sync_task_create(dstg, dsl_dataset_snapshot_check,
+		    dsl_dataset_snapshot_sync, os, atp + 1, 3);
+	} else {
+		dmu_objset_close(os);
+	}
+
+	return (err);
+}
+
+/*
+ * Take every snapshot named in 'snaps' (full "fs@snap" names) in as few
+ * txgs as possible.  The snapshots are independent: one that cannot be
+ * taken does not keep the others from being taken.  The error for each
+ * snapshot that was not taken is added to 'errlist' under its name, and
+ * the last such error is returned.  All the snapshots must be in one
+ * pool, or EXDEV is returned and nothing is done.
+ */
+int
+dmu_objset_snapshot_batch(nvlist_t *snaps, nvlist_t *errlist)
+{
+	dsl_sync_task_group_t *dstg;
+	dsl_sync_task_t *dst;
+	nvpair_t *pair, *first;
+	spa_t *spa;
+	char *name;
+	size_t poollen;
+	int err, rv = 0;
+
+	if ((first = nvlist_next_nvpair(snaps, NULL)) == NULL)
+		return (0);
+
+	poollen = strcspn(nvpair_name(first), "/@");
+	for (pair = first; pair; pair = nvlist_next_nvpair(snaps, pair)) {
+		name = nvpair_name(pair);
+		if (strcspn(name, "/@") != poollen ||
+		    strncmp(name, nvpair_name(first), poollen) != 0)
+			return (EXDEV);
+	}
+
+	err = spa_open(nvpair_name(first), &spa, FTAG);
+	if (err) {
+		for (pair = first; pair && errlist != NULL;
+		    pair = nvlist_next_nvpair(snaps, pair))
+			VERIFY(nvlist_add_int32(errlist, nvpair_name(pair),
+			    err) == 0);
+		return (err);
+	}
+
+	dstg = dsl_sync_task_group_create_independent(spa_get_dsl(spa));
+
+	for (pair = first; pair; pair = nvlist_next_nvpair(snaps, pair)) {
+		name = nvpair_name(pair);
+		if ((err = dmu_objset_snapshot_batch_one(dstg, name)) != 0) {
+			if (errlist != NULL)
+				VERIFY(nvlist_add_int32(errlist, name,
+				    err) == 0);
+			rv = err;
+		}
+	}
+
+	err = 0;
+	if (list_head(&dstg->dstg_tasks) != NULL)
+		err = dsl_sync_task_group_wait(dstg);
+
+	for (dst = list_head(&dstg->dstg_tasks); dst;
+	    dst = list_next(&dstg->dstg_tasks, dst)) {
+		objset_t *os = dst->dst_arg1;
+
+		if (dst->dst_done ? dst->dst_err : err) {
+			char snapname[MAXNAMELEN];
+
+			rv = dst->dst_done ? dst->dst_err : err;
+			dmu_objset_name(os, snapname);
+			(void) strlcat(snapname, "@", sizeof (snapname));
+			(void) strlcat(snapname, dst->dst_arg2,
+			    sizeof (snapname));
+			if (errlist != NULL)
+				VERIFY(nvlist_add_int32(errlist, snapname,
+				    rv) == 0);
+		}
+		zil_resume(dmu_objset_zil(os));
+		dmu_objset_close(os);
+	}
+
+	dsl_sync_task_group_destroy(dstg);
+	spa_close(spa, FTAG);
+	return (rv);
+}
+
 static void
 dmu_objset_sync_dnodes(list_t *list, dmu_tx_t *tx)
 {
@@ -738,6 +860,123 @@ dmu_objset_sync_dnodes(list_t *list, dmu_tx_t *tx)
 	}
 }
 
+/*
+ * Completion state shared by the workers of one parallel dnode sync.
+ * It lives on the heap rather than the waiter's stack: a worker may
+ * still be inside mutex_exit() when the waiter wakes up, so whichever
+ * of them drops the last reference frees it.
+ */
+typedef struct dmu_objset_sync_wait {
+	kmutex_t	osw_lock;
+	kcondvar_t	osw_cv;
+	int		osw_pending;	/* workers still syncing */
+	uint64_t	osw_refs;	/* workers plus the waiter */
+} dmu_objset_sync_wait_t;
+
+typedef struct dmu_objset_sync_arg {
+	list_t		osa_list;
+	dmu_tx_t	*osa_tx;
+	dmu_objset_sync_wait_t *osa_wait;
+} dmu_objset_sync_arg_t;
+
+static void
+dmu_objset_sync_wait_rele(dmu_objset_sync_wait_t *osw)
+{
+	if (atomic_add_64_nv(&osw->osw_refs, -1) != 0)
+		return;
+	cv_destroy(&osw->osw_cv);
+	mutex_destroy(&osw->osw_lock);
+	kmem_free(osw, sizeof (dmu_objset_sync_wait_t));
+}
+
+static void
+dmu_objset_sync_dnodes_task(void *arg)
+{
+	dmu_objset_sync_arg_t *osa = arg;
+	dmu_objset_sync_wait_t *osw = osa->osa_wait;
+
+	dmu_objset_sync_dnodes(&osa->osa_list, osa->osa_tx);
+
+	mutex_enter(&osw->osw_lock);
+	if (--osw->osw_pending == 0)
+		cv_broadcast(&osw->osw_cv);
+	mutex_exit(&osw->osw_lock);
+	dmu_objset_sync_wait_rele(osw);
+}
+
+/*
+ * Sync the dirty dnodes on 'list' using the pool's sync taskq.
+ *
+ * By the time we get here the meta-dnode has been synced, so every
+ * dnode block already has its write zio (dr_zio) and each dnode's
+ * writes hang off that zio as children; those zios are not issued
+ * until we return and dmu_objset_sync() walks the meta-dnode's dirty
+ * records, so nothing about the order in which the dnodes themselves
+ * are synced is visible on disk.  The dnodes are split by the dnode
+ * block they live in, so that a worker owns whole dnode blocks and
+ * workers never write into the same block buffer.
+ */
+static void
+dmu_objset_sync_dnodes_parallel(list_t *list, int txgoff, dmu_tx_t *tx)
+{
+	dsl_pool_t *dp = tx->tx_pool;
+	taskq_t *tq = dp->dp_sync_taskq;
+	int nworkers = dp->dp_sync_threads;
+	dmu_objset_sync_arg_t *osa;
+	dmu_objset_sync_wait_t *osw;
+	uint64_t count = 0;
+	dnode_t *dn;
+	int i;
+
+	if (tq == NULL || nworkers < 2) {
+		for (dn = list_head(list); dn; dn = list_next(list, dn))
+			count++;
+		dmu_objset_sync_dnodes(list, tx);
+		dsl_pool_sync_dnodes_stat(dp, count, B_FALSE);
+		return;
+	}
+
+	osa = kmem_zalloc(nworkers * sizeof (dmu_objset_sync_arg_t), KM_SLEEP);
+	for (i = 0; i < nworkers; i++) {
+		list_create(&osa[i].osa_list, sizeof (dnode_t),
+		    offsetof(dnode_t, dn_dirty_link[txgoff]));
+	}
+	while (dn = list_head(list)) {
+		list_remove(list, dn);
+		i = (dn->dn_object >> DNODES_PER_BLOCK_SHIFT) % nworkers;
+		list_insert_tail(&osa[i].osa_list, dn);
+		count++;
+	}
+
+	if (count < (uint64_t)dp->dp_sync_min_dnodes) {
+		for (i = 0; i < nworkers; i++)
+			dmu_objset_sync_dnodes(&osa[i].osa_list, tx);
+		dsl_pool_sync_dnodes_stat(dp, count, B_FALSE);
+	} else {
+		osw = kmem_alloc(sizeof (dmu_objset_sync_wait_t), KM_SLEEP);
+		mutex_init(&osw->osw_lock, NULL, MUTEX_DEFAULT, NULL);
+		cv_init(&osw->osw_cv, NULL, CV_DEFAULT, NULL);
+		osw->osw_pending = nworkers;
+		osw->osw_refs = nworkers + 1;
+		for (i = 0; i < nworkers; i++) {
+			osa[i].osa_tx = tx;
+			osa[i].osa_wait = osw;
+			(void) taskq_dispatch(tq, dmu_objset_sync_dnodes_task,
+			    &osa[i], TQ_SLEEP);
+		}
+		mutex_enter(&osw->osw_lock);
+		while (osw->osw_pending != 0)
+			cv_wait(&osw->osw_cv, &osw->osw_lock);
+		mutex_exit(&osw->osw_lock);
+		dmu_objset_sync_wait_rele(osw);
+		dsl_pool_sync_dnodes_stat(dp, count, B_TRUE);
+	}
+
+	for (i = 0; i < nworkers; i++)
+		list_destroy(&osa[i].osa_list);
+	kmem_free(osa, nworkers * sizeof (dmu_objset_sync_arg_t));
+}
+
 /* ARGSUSED */
 static void
 ready(zio_t *zio, arc_buf_t *abuf, void *arg)
@@ -828,8 +1067,15 @@ dmu_objset_sync(objset_impl_t *os, zio_t *pio, dmu_tx_t *tx)
 
 	txgoff = tx->tx_txg & TXG_MASK;
 
+	/*
+	 * Freed dnodes are still synced from this thread; the dirty
+	 * dnodes are spread over the pool's sync taskq.
+	 */
 	dmu_objset_sync_dnodes(&os->os_free_dnodes[txgoff], tx);
-	dmu_objset_sync_dnodes(&os->os_dirty_dnodes[txgoff], tx);
+	while (list_head(&os->os_dirty_dnodes[txgoff]) != NULL) {
+		dmu_objset_sync_dnodes_parallel(&os->os_dirty_dnodes[txgoff],
+		    txgoff, tx);
+	}
 
 	list = &os->os_meta_dnode->dn_dirty_records[txgoff];
 	while (dr = list_head(list)) {
@@ -684,11 +684,57 @@ restore_freeobjects(struct restorearg *ra, objset_t *os,
 	return (0);
 }
 
+/*
+ * Like restore_read(), but read the next 'len' bytes of the stream into
+ * 'data' rather than into the staging buffer.  Whatever is already
+ * staged is copied out; the rest is read from the stream directly.
+ */
+static int
+restore_read_into(struct restorearg *ra, void *data, int len)
+{
+	int done = MIN(ra->buflen - ra->bufoff, len);
+
+	ASSERT3U(len % 8, ==, 0);
+
+	bcopy(ra->buf + ra->bufoff, data, done);
+	ra->bufoff += done;
+
+	while (done < len) {
+		ssize_t resid;
+
+#ifdef __APPLE__
+		ra->err = vn_rdwr(UIO_READ, ra->vp,
+		    (caddr_t)data + done, len - done,
+		    ra->voff, UIO_SYSSPACE, IO_APPEND,
+		    RLIM64_INFINITY, CRED(), &resid);
+#else
+		ra->err = vn_rdwr(UIO_READ, ra->vp,
+		    (caddr_t)data + done, len - done,
+		    ra->voff, UIO_SYSSPACE, FAPPEND,
+		    RLIM64_INFINITY, CRED(), &resid);
+#endif
+		ra->voff += len - done - resid;
+		if (resid == len - done)
+			ra->err = EINVAL;
+		if (ra->err)
+			return (ra->err);
+		done = len - resid;
+	}
+
+	if (ra->byteswap)
+		fletcher_4_incremental_byteswap(data, len, &ra->zc);
+	else
+		fletcher_4_incremental_native(data, len, &ra->zc);
+	return (0);
+}
+
 static int
 restore_write(struct restorearg *ra, objset_t *os,
     struct drr_write *drrw)
 {
+	dmu_object_info_t doi;
 	dmu_tx_t *tx;
+	arc_buf_t *abuf = NULL;
 	void *data;
 	int err;
 
@@ -696,26 +742,47 @@ restore_write(struct restorearg *ra, objset_t *os,
 	    drrw->drr_type >= DMU_OT_NUMTYPES)
 		return (EINVAL);
 
-	data = restore_read(ra, drrw->drr_length);
-	if (data == NULL)
-		return (ra->err);
-
-	if (dmu_object_info(os, drrw->drr_object, NULL) != 0)
+	if (dmu_object_info(os, drrw->drr_object, &doi) != 0)
 		return (EINVAL);
 
+	/*
+	 * A record covering exactly one block is read straight into a
+	 * loaned ARC buffer, which then becomes the block's data.
+	 */
+	if (drrw->drr_length == doi.doi_data_block_size &&
+	    P2PHASE(drrw->drr_offset, doi.doi_data_block_size) == 0) {
+		abuf = dmu_request_arcbuf(os, drrw->drr_length);
+		if (restore_read_into(ra, abuf->b_data,
+		    drrw->drr_length) != 0) {
+			dmu_return_arcbuf(abuf);
+			return (ra->err);
+		}
+		data = abuf->b_data;
+	} else {
+		data = restore_read(ra, drrw->drr_length);
+		if (data == NULL)
+			return (ra->err);
+	}
+
 	tx = dmu_tx_create(os);
 
 	dmu_tx_hold_write(tx, drrw->drr_object,
 	    drrw->drr_offset, drrw->drr_length);
 	err = dmu_tx_assign(tx, TXG_WAIT);
 	if (err) {
+		if (abuf != NULL)
+			dmu_return_arcbuf(abuf);
 		dmu_tx_abort(tx);
 		return (err);
 	}
 	if (ra->byteswap)
 		dmu_ot[drrw->drr_type].ot_byteswap(data, drrw->drr_length);
-	dmu_write(os, drrw->drr_object,
-	    drrw->drr_offset, drrw->drr_length, data, tx);
+	if (abuf != NULL)
+		dmu_assign_arcbuf(os, drrw->drr_object, drrw->drr_offset,
+		    abuf, tx);
+	else
+		dmu_write(os, drrw->drr_object,
+		    drrw->drr_offset, drrw->drr_length, data, tx);
 	dmu_tx_commit(tx);
 	return (0);
 }
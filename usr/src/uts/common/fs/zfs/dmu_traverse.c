@@ -42,6 +42,23 @@
 	(DVA_EQUAL(BP_IDENTITY(b1), BP_IDENTITY(b2)) &&	\
 	(b1)->blk_birth == (b2)->blk_birth)
 
+/*
+ * Number of blocks to read ahead of the traversal cursor.  Whenever the
+ * cursor reads a block, up to this many of its successors in the parent
+ * are prefetched into the ARC, as are the top-level blocks of the
+ * dnodes following the current one.  The cursor itself still visits
+ * blocks one at a time and in bookmark order; it just finds them in the
+ * ARC.  Zero disables read-ahead.
+ *
+ * Traversal reads blocks once, so both the read-ahead and the cursor
+ * read with ARC_UNCACHED: a block that wasn't already cached is dropped
+ * again as soon as the cursor has copied it, unless somebody else used
+ * it in the meantime.  Only read-ahead the cursor never consumes (at
+ * most zfs_traverse_prefetch blocks per level when a traversal stops
+ * early) is left for normal eviction.
+ */
+int zfs_traverse_prefetch = 32;
+
 /*
  * Compare two bookmarks.
  *
@@ -307,6 +324,112 @@ traverse_callback(traverse_handle_t *th, zseg_t *zseg, traverse_blk_cache_t *bc)
 	return (th->th_func(bc, th->th_spa, th->th_arg));
 }
 
+static arc_byteswap_func_t *
+traverse_byteswap(blkptr_t *bp, int level)
+{
+	return (level > 0 ? byteswap_uint64_array :
+	    dmu_ot[BP_GET_TYPE(bp)].ot_byteswap);
+}
+
+static void
+traverse_prefetch_bp(traverse_handle_t *th, blkptr_t *bp, uint64_t objset,
+    uint64_t object, int level, uint64_t blkid)
+{
+	uint32_t aflags = ARC_NOWAIT | ARC_PREFETCH | ARC_UNCACHED;
+	zbookmark_t zb;
+
+	SET_BOOKMARK(&zb, objset, object, level, blkid);
+
+	(void) arc_read(NULL, th->th_spa, bp, traverse_byteswap(bp, level),
+	    NULL, NULL, ZIO_PRIORITY_ASYNC_READ,
+	    th->th_zio_flags | ZIO_FLAG_CANFAIL | ZIO_FLAG_SPECULATIVE,
+	    &aflags, &zb);
+	th->th_prefetches++;
+}
+
+/*
+ * The cursor is about to read bp[first], block 'blkid' at 'level'.
+ * Prefetch the blocks after it in the same parent that the cursor will
+ * visit next, continuing from wherever the previous call left off.
+ */
+static void
+traverse_prefetch(traverse_handle_t *th, zseg_t *zseg, int depth,
+    blkptr_t *bp, int nbp, int first, int level, uint64_t blkid)
+{
+	zbookmark_t *zb = &zseg->seg_start;
+	zbookmark_t *pzb = &th->th_prefetched[depth][level];
+	int i, start, end;
+
+	if (zfs_traverse_prefetch == 0 ||
+	    th->th_cache[depth][level].bc_data == NULL)
+		return;
+
+	start = first + 1;
+	end = MIN(nbp, first + 1 + zfs_traverse_prefetch);
+
+	if (pzb->zb_objset == zb->zb_objset &&
+	    pzb->zb_object == zb->zb_object &&
+	    pzb->zb_level == level && pzb->zb_blkid >= blkid &&
+	    pzb->zb_blkid - blkid < end - first)
+		start = first + (pzb->zb_blkid - blkid) + 1;
+
+	if (start >= end)
+		return;
+
+	for (i = start; i < end; i++) {
+		if (bp[i].blk_birth <= zseg->seg_mintxg || BP_IS_HOLE(&bp[i]))
+			continue;
+		traverse_prefetch_bp(th, &bp[i], zb->zb_objset,
+		    zb->zb_object, level, blkid + (i - first));
+	}
+
+	SET_BOOKMARK(pzb, zb->zb_objset, zb->zb_object, level,
+	    blkid + (end - 1 - first));
+}
+
+/*
+ * The cursor has reached dnode 'idx' of the dnode block 'dnp'.  Prefetch
+ * the top-level blocks of the dnodes after it, so that objects which
+ * need only a block or two each don't cost a synchronous read apiece.
+ */
+static void
+traverse_prefetch_dnodes(traverse_handle_t *th, uint64_t objset,
+    dnode_phys_t *dnp, uint64_t blkid, int idx, uint64_t mintxg)
+{
+	zbookmark_t *pzb = &th->th_prefetched_dnode;
+	uint64_t object;
+	int i, j, end;
+
+	if (zfs_traverse_prefetch == 0)
+		return;
+
+	end = MIN(DNODES_PER_BLOCK, idx + 1 + zfs_traverse_prefetch);
+
+	for (i = idx + 1; i < end; i++) {
+		dnode_phys_t *dn = &dnp[i];
+		int level = dn->dn_nlevels - 1;
+
+		object = blkid * DNODES_PER_BLOCK + i;
+
+		if (pzb->zb_objset == objset && pzb->zb_object >= object)
+			continue;
+
+		if (dn->dn_type == DMU_OT_NONE ||
+		    th->th_cache[ZB_DN_CACHE][level].bc_data == NULL)
+			continue;
+
+		for (j = 0; j < dn->dn_nblkptr; j++) {
+			blkptr_t *bp = &dn->dn_blkptr[j];
+
+			if (bp->blk_birth <= mintxg || BP_IS_HOLE(bp))
+				continue;
+			traverse_prefetch_bp(th, bp, objset, object, level, j);
+		}
+	}
+
+	SET_BOOKMARK(pzb, objset, blkid * DNODES_PER_BLOCK + end - 1, 0, 0);
+}
+
 static int
 traverse_read(traverse_handle_t *th, traverse_blk_cache_t *bc, blkptr_t *bp,
 	dnode_phys_t *dnp)
@@ -334,6 +457,24 @@ traverse_read(traverse_handle_t *th, traverse_blk_cache_t *bc, blkptr_t *bp,
 
 	if (compare_bookmark(zb, &th->th_noread, dnp, 0) == 0) {
 		error = EIO;
+	} else if (zfs_traverse_prefetch != 0) {
+		uint32_t aflags = ARC_WAIT | ARC_UNCACHED;
+
+		/*
+		 * The block may already be on its way into the ARC from a
+		 * prefetch, so read it through the ARC to share that I/O.
+		 * Dropping our reference evicts it again if only the
+		 * traversal wanted it.
+		 */
+		error = arc_read(NULL, th->th_spa, bp,
+		    traverse_byteswap(bp, zb->zb_level), arc_bcopy_func,
+		    bc->bc_data, ZIO_PRIORITY_SYNC_READ, th->th_zio_flags,
+		    &aflags, zb);
+
+		if (aflags & ARC_CACHED)
+			th->th_arc_hits++;
+		else
+			th->th_reads++;
 	} else if (arc_tryread(th->th_spa, bp, bc->bc_data) == 0) {
 		error = 0;
 		th->th_arc_hits++;
@@ -343,8 +484,7 @@ traverse_read(traverse_handle_t *th, traverse_blk_cache_t *bc, blkptr_t *bp,
 		    th->th_zio_flags | ZIO_FLAG_DONT_CACHE, zb));
 
 		if (BP_SHOULD_BYTESWAP(bp) && error == 0)
-			(zb->zb_level > 0 ? byteswap_uint64_array :
-			    dmu_ot[BP_GET_TYPE(bp)].ot_byteswap)(bc->bc_data,
+			traverse_byteswap(bp, zb->zb_level)(bc->bc_data,
 			    BP_GET_LSIZE(bp));
 		th->th_reads++;
 	}
@@ -401,6 +541,8 @@ find_block(traverse_handle_t *th, zseg_t *zseg, dnode_phys_t *dnp, int depth)
 		SET_BOOKMARK(&bc->bc_bookmark, zb->zb_objset, zb->zb_object,
 		    level, blkid);
 
+		traverse_prefetch(th, zseg, depth, bp, nbp, i, level, blkid);
+
 		if (rc = traverse_read(th, bc, bp + i, dnp)) {
 			if (rc != EAGAIN) {
 				SET_BOOKMARK_LB(zb, level, blkid);
@@ -451,6 +593,10 @@ get_dnode(traverse_handle_t *th, uint64_t objset, dnode_phys_t *mdn,
 				if (object >= *objectp &&
 				    dnp[i].dn_type != DMU_OT_NONE &&
 				    (type == -1 || dnp[i].dn_type == type)) {
+					if (depth == ZB_MDN_CACHE)
+						traverse_prefetch_dnodes(th,
+						    objset, dnp, zb->zb_blkid,
+						    i, txg);
 					*objectp = object;
 					*dnpp = &dnp[i];
 					return (0);
@@ -818,6 +964,30 @@ traverse_add_objset(traverse_handle_t *th, uint64_t mintxg, uint64_t maxtxg,
 		    objset, 0, -1, 0);
 }
 
+/*
+ * Add the objects [sobject, eobject] of an objset.  Object 0 includes the
+ * objset_phys_t and intent log, so a set of ranges covering 0 through
+ * ZB_MAXOBJECT visits exactly what traverse_add_objset() would.  This lets
+ * a large objset be split across several traversal handles.  Only supported
+ * for pre-order traversal.
+ */
+void
+traverse_add_objects(traverse_handle_t *th, uint64_t mintxg, uint64_t maxtxg,
+    uint64_t objset, uint64_t sobject, uint64_t eobject)
+{
+	ASSERT(th->th_advance & ADVANCE_PRE);
+	ASSERT(sobject <= eobject);
+
+	if (sobject == 0)
+		traverse_add_segment(th, mintxg, maxtxg,
+		    objset, 0, -1, 0,
+		    objset, eobject, 0, ZB_MAXBLKID);
+	else
+		traverse_add_segment(th, mintxg, maxtxg,
+		    objset, sobject, ZB_MAXLEVEL, 0,
+		    objset, eobject, 0, ZB_MAXBLKID);
+}
+
 void
 traverse_add_pool(traverse_handle_t *th, uint64_t mintxg, uint64_t maxtxg)
 {
@@ -846,6 +1016,7 @@ traverse_init(spa_t *spa, blkptr_cb_t func, void *arg, int advance,
 	th->th_advance = advance;
 	th->th_lastcb.zb_level = ZB_NO_LEVEL;
 	th->th_noread.zb_level = ZB_NO_LEVEL;
+	th->th_prefetched_dnode.zb_level = ZB_NO_LEVEL;
 	th->th_zio_flags = zio_flags;
 
 	list_create(&th->th_seglist, sizeof (zseg_t),
@@ -857,6 +1028,7 @@ traverse_init(spa_t *spa, blkptr_cb_t func, void *arg, int advance,
 			    l != 0 || d != ZB_DN_CACHE)
 				th->th_cache[d][l].bc_data =
 				    zio_buf_alloc(SPA_MAXBLOCKSIZE);
+			th->th_prefetched[d][l].zb_level = ZB_NO_LEVEL;
 		}
 	}
 
@@ -882,9 +1054,10 @@ traverse_fini(traverse_handle_t *th)
 
 	list_destroy(&th->th_seglist);
 
-	dprintf("%llu hit, %llu ARC, %llu IO, %llu cb, %llu sync, %llu again\n",
-	    th->th_hits, th->th_arc_hits, th->th_reads, th->th_callbacks,
-	    th->th_syncs, th->th_restarts);
+	dprintf("%llu hit, %llu ARC, %llu IO, %llu prefetch, %llu cb, "
+	    "%llu sync, %llu again\n",
+	    th->th_hits, th->th_arc_hits, th->th_reads, th->th_prefetches,
+	    th->th_callbacks, th->th_syncs, th->th_restarts);
 
 	kmem_free(th, sizeof (*th));
 }
@@ -45,9 +45,58 @@ uint32_t	zfetch_max_streams = 8;
 uint32_t	zfetch_min_sec_reap = 2;
 /* max number of blocks to fetch at a time */
 uint32_t	zfetch_block_cap = 256;
+/* max bytes of prefetch distance, summed over all streams */
+uint64_t	zfetch_max_bytes = 64ULL << 20;
 /* number of bytes in a array_read at which we stop prefetching (1Mb) */
 uint64_t	zfetch_array_rd_sz = 1024 * 1024;
 
+/*
+ * Each stream's prefetch distance (zst_cap) doubles every time a read
+ * finds its block already prefetched, and halves every time a read finds
+ * that a block we prefetched has since been evicted from the ARC unread.
+ * A stream that keeps losing its prefetches at the minimum distance is
+ * torn down.  The distances of all streams are charged against
+ * zfetch_max_bytes, and a stream is not allowed to grow past it.
+ */
+typedef struct zfetch_stats {
+	kstat_named_t zfetchstat_hits;
+	kstat_named_t zfetchstat_misses;
+	kstat_named_t zfetchstat_colinear_hits;
+	kstat_named_t zfetchstat_stride_hits;
+	kstat_named_t zfetchstat_ramp_ups;
+	kstat_named_t zfetchstat_backoffs;
+	kstat_named_t zfetchstat_budget_limited;
+	kstat_named_t zfetchstat_wasted_bytes;
+	kstat_named_t zfetchstat_window_bytes;
+	kstat_named_t zfetchstat_streams_resets;
+	kstat_named_t zfetchstat_reclaim_successes;
+	kstat_named_t zfetchstat_reclaim_failures;
+} zfetch_stats_t;
+
+static zfetch_stats_t zfetch_stats = {
+	{ "hits",			KSTAT_DATA_UINT64 },
+	{ "misses",			KSTAT_DATA_UINT64 },
+	{ "colinear_hits",		KSTAT_DATA_UINT64 },
+	{ "stride_hits",		KSTAT_DATA_UINT64 },
+	{ "ramp_ups",			KSTAT_DATA_UINT64 },
+	{ "backoffs",			KSTAT_DATA_UINT64 },
+	{ "budget_limited",		KSTAT_DATA_UINT64 },
+	{ "wasted_bytes",		KSTAT_DATA_UINT64 },
+	{ "window_bytes",		KSTAT_DATA_UINT64 },
+	{ "streams_resets",		KSTAT_DATA_UINT64 },
+	{ "reclaim_successes",		KSTAT_DATA_UINT64 },
+	{ "reclaim_failures",		KSTAT_DATA_UINT64 }
+};
+
+#define	ZFETCHSTAT(stat)	(zfetch_stats.stat.value.ui64)
+
+#define	ZFETCHSTAT_INCR(stat, val) \
+	atomic_add_64(&zfetch_stats.stat.value.ui64, (val));
+
+#define	ZFETCHSTAT_BUMP(stat)	ZFETCHSTAT_INCR(stat, 1)
+
+static kstat_t *zfetch_ksp;
+
 /* forward decls for static routines */
 static int		dmu_zfetch_colinear(zfetch_t *, zstream_t *);
 static void		dmu_zfetch_dofetch(zfetch_t *, zstream_t *);
@@ -57,6 +106,11 @@ static int		dmu_zfetch_find(zfetch_t *, zstream_t *, int);
 static int		dmu_zfetch_stream_insert(zfetch_t *, zstream_t *);
 static zstream_t	*dmu_zfetch_stream_reclaim(zfetch_t *);
 static void		dmu_zfetch_stream_remove(zfetch_t *, zstream_t *);
+static void		dmu_zfetch_stream_rampup(zfetch_t *, zstream_t *);
+static int		dmu_zfetch_stream_backoff(zfetch_t *, zstream_t *,
+			    uint64_t);
+static int		dmu_zfetch_stream_setcap(zfetch_t *, zstream_t *,
+			    uint64_t);
 static int		dmu_zfetch_streams_equal(zstream_t *, zstream_t *);
 
 /*
@@ -153,7 +207,26 @@ dmu_zfetch_dofetch(zfetch_t *zf, zstream_t *zs)
 	uint64_t	blocks_fetched;
 
 	zs->zst_stride = MAX((int64_t)zs->zst_stride, zs->zst_len);
-	zs->zst_cap = MIN(zfetch_block_cap, 2 * zs->zst_cap);
+
+	/*
+	 * A forward sequential stream simply keeps zst_cap blocks ahead
+	 * of the reader, so that backing off actually shortens the
+	 * distance instead of still fetching zst_len blocks at a time.
+	 */
+	if (zs->zst_stride == zs->zst_len &&
+	    zs->zst_direction == ZFETCH_FORWARD) {
+		prefetch_tail = MAX(zs->zst_ph_offset,
+		    zs->zst_offset + zs->zst_len);
+		prefetch_limit = zs->zst_offset + zs->zst_len + zs->zst_cap;
+
+		if (prefetch_tail < prefetch_limit) {
+			prefetch_tail += dmu_zfetch_fetch(zf->zf_dnode,
+			    prefetch_tail, prefetch_limit - prefetch_tail);
+		}
+		zs->zst_ph_offset = prefetch_tail;
+		zs->zst_last = lbolt;
+		return;
+	}
 
 	prefetch_tail = MAX((int64_t)zs->zst_ph_offset,
 	    (int64_t)(zs->zst_offset + zs->zst_stride));
@@ -274,7 +347,7 @@ dmu_zfetch_find(zfetch_t *zf, zstream_t *zh, int prefetched)
 {
 	zstream_t	*zs;
 	int64_t		diff;
-	int		reset = !prefetched;
+	int		reset = 0;
 	int		rc = 0;
 
 	if (zh == NULL)
@@ -318,14 +391,23 @@ top:
 		 */
 		if (zh->zst_offset == zs->zst_offset + zs->zst_len) {
 
-			reset = !prefetched && zs->zst_len > 1;
-
 			mutex_enter(&zs->zst_lock);
 
 			if (zh->zst_offset != zs->zst_offset + zs->zst_len) {
 				mutex_exit(&zs->zst_lock);
 				goto top;
 			}
+
+			/*
+			 * If we already issued a prefetch for this block and
+			 * it still missed, the ARC evicted it unread.
+			 */
+			if (prefetched)
+				dmu_zfetch_stream_rampup(zf, zs);
+			else if (zh->zst_offset < zs->zst_ph_offset)
+				reset = dmu_zfetch_stream_backoff(zf, zs,
+				    zh->zst_len);
+
 			zs->zst_len += zh->zst_len;
 			diff = zs->zst_len - zfetch_block_cap;
 			if (diff > 0) {
@@ -343,8 +425,6 @@ top:
 		} else if (zh->zst_offset == zs->zst_offset - zh->zst_len) {
 			/* backwards sequential access */
 
-			reset = !prefetched && zs->zst_len > 1;
-
 			mutex_enter(&zs->zst_lock);
 
 			if (zh->zst_offset != zs->zst_offset - zh->zst_len) {
@@ -352,6 +432,12 @@ top:
 				goto top;
 			}
 
+			if (prefetched)
+				dmu_zfetch_stream_rampup(zf, zs);
+			else if (zs->zst_len > 1)
+				reset = dmu_zfetch_stream_backoff(zf, zs,
+				    zh->zst_len);
+
 			zs->zst_offset = zs->zst_offset > zh->zst_len ?
 			    zs->zst_offset - zh->zst_len : 0;
 			zs->zst_ph_offset = zs->zst_ph_offset > zh->zst_len ?
@@ -381,6 +467,19 @@ top:
 				goto top;
 			}
 
+			/*
+			 * Only a stride dmu_zfetch_dofetch() has already
+			 * issued can have been evicted unread; it walks
+			 * zst_ph_offset past each one it issues.
+			 */
+			ZFETCHSTAT_BUMP(zfetchstat_stride_hits);
+			if (prefetched)
+				dmu_zfetch_stream_rampup(zf, zs);
+			else if (zs->zst_offset + zs->zst_stride <
+			    zs->zst_ph_offset)
+				reset = dmu_zfetch_stream_backoff(zf, zs,
+				    zh->zst_len);
+
 			zs->zst_offset += zs->zst_stride;
 			zs->zst_direction = ZFETCH_FORWARD;
 
@@ -398,6 +497,14 @@ top:
 				goto top;
 			}
 
+			ZFETCHSTAT_BUMP(zfetchstat_stride_hits);
+			if (prefetched)
+				dmu_zfetch_stream_rampup(zf, zs);
+			else if (zs->zst_offset + zs->zst_stride <
+			    zs->zst_ph_offset)
+				reset = dmu_zfetch_stream_backoff(zf, zs,
+				    zh->zst_len);
+
 			zs->zst_offset = zs->zst_offset > zs->zst_stride ?
 			    zs->zst_offset - zs->zst_stride : 0;
 			zs->zst_ph_offset = (zs->zst_ph_offset >
@@ -414,6 +521,7 @@ top:
 			zstream_t *remove = zs;
 
 			rc = 0;
+			ZFETCHSTAT_BUMP(zfetchstat_streams_resets);
 			mutex_exit(&zs->zst_lock);
 			rw_exit(&zf->zf_rwlock);
 			rw_enter(&zf->zf_rwlock, RW_WRITER);
@@ -458,6 +566,7 @@ dmu_zfetch_rele(zfetch_t *zf)
 		zs_next = list_next(&zf->zf_stream, zs);
 
 		list_remove(&zf->zf_stream, zs);
+		ZFETCHSTAT_INCR(zfetchstat_window_bytes, -zs->zst_bytes);
 		mutex_destroy(&zs->zst_lock);
 		kmem_free(zs, sizeof (zstream_t));
 	}
@@ -521,8 +630,10 @@ dmu_zfetch_stream_reclaim(zfetch_t *zf)
 		dmu_zfetch_stream_remove(zf, zs);
 		mutex_destroy(&zs->zst_lock);
 		bzero(zs, sizeof (zstream_t));
+		ZFETCHSTAT_BUMP(zfetchstat_reclaim_successes);
 	} else {
 		zf->zf_alloc_fail++;
+		ZFETCHSTAT_BUMP(zfetchstat_reclaim_failures);
 	}
 	rw_exit(&zf->zf_rwlock);
 
@@ -540,6 +651,70 @@ dmu_zfetch_stream_remove(zfetch_t *zf, zstream_t *zs)
 
 	list_remove(&zf->zf_stream, zs);
 	zf->zf_stream_cnt--;
+
+	ZFETCHSTAT_INCR(zfetchstat_window_bytes, -zs->zst_bytes);
+	zs->zst_bytes = 0;
+}
+
+/*
+ * Set the prefetch distance of a stream, charging the difference against
+ * zfetch_max_bytes.  Growth beyond the budget is refused; the budget is
+ * checked without a lock, so concurrent streams may overshoot it slightly.
+ */
+static int
+dmu_zfetch_stream_setcap(zfetch_t *zf, zstream_t *zs, uint64_t cap)
+{
+	uint64_t	bytes = cap << zf->zf_dnode->dn_datablkshift;
+
+	if (bytes > zs->zst_bytes && ZFETCHSTAT(zfetchstat_window_bytes) +
+	    bytes - zs->zst_bytes > zfetch_max_bytes) {
+		ZFETCHSTAT_BUMP(zfetchstat_budget_limited);
+		return (0);
+	}
+
+	ZFETCHSTAT_INCR(zfetchstat_window_bytes, bytes - zs->zst_bytes);
+	zs->zst_bytes = bytes;
+	zs->zst_cap = cap;
+
+	return (1);
+}
+
+/*
+ * A read found its block already prefetched: fetch further ahead.
+ */
+static void
+dmu_zfetch_stream_rampup(zfetch_t *zf, zstream_t *zs)
+{
+	ASSERT(MUTEX_HELD(&zs->zst_lock));
+
+	if (zs->zst_cap >= zfetch_block_cap)
+		return;
+
+	if (dmu_zfetch_stream_setcap(zf, zs,
+	    MIN(zfetch_block_cap, 2 * zs->zst_cap)))
+		ZFETCHSTAT_BUMP(zfetchstat_ramp_ups);
+}
+
+/*
+ * A read missed on a block this stream had prefetched, so the prefetched
+ * data was evicted before it was used: fetch less far ahead.  Returns
+ * true if the stream is already at its minimum distance and should be
+ * torn down.
+ */
+static int
+dmu_zfetch_stream_backoff(zfetch_t *zf, zstream_t *zs, uint64_t nblks)
+{
+	ASSERT(MUTEX_HELD(&zs->zst_lock));
+
+	ZFETCHSTAT_BUMP(zfetchstat_backoffs);
+	ZFETCHSTAT_INCR(zfetchstat_wasted_bytes,
+	    nblks << zf->zf_dnode->dn_datablkshift);
+
+	if (zs->zst_cap <= 1)
+		return (1);
+
+	(void) dmu_zfetch_stream_setcap(zf, zs, zs->zst_cap / 2);
+	return (0);
 }
 
 static int
@@ -597,11 +772,17 @@ dmu_zfetch(zfetch_t *zf, uint64_t offset, uint64_t size, int prefetched)
 	    P2ALIGN(offset, blksz)) >> blkshft;
 
 	fetched = dmu_zfetch_find(zf, &zst, prefetched);
-	if (!fetched) {
+	if (fetched) {
+		ZFETCHSTAT_BUMP(zfetchstat_hits);
+	} else {
 		fetched = dmu_zfetch_colinear(zf, &zst);
+		if (fetched)
+			ZFETCHSTAT_BUMP(zfetchstat_colinear_hits);
 	}
 
 	if (!fetched) {
+		ZFETCHSTAT_BUMP(zfetchstat_misses);
+
 		newstream = dmu_zfetch_stream_reclaim(zf);
 
 		/*
@@ -634,9 +815,12 @@ dmu_zfetch(zfetch_t *zf, uint64_t offset, uint64_t size, int prefetched)
 		newstream->zst_stride = zst.zst_len;
 		newstream->zst_ph_offset = zst.zst_len + zst.zst_offset;
 		newstream->zst_cap = zst.zst_len;
+		newstream->zst_bytes = zst.zst_len << blkshft;
 		newstream->zst_direction = ZFETCH_FORWARD;
 		newstream->zst_last = lbolt;
 
+		ZFETCHSTAT_INCR(zfetchstat_window_bytes, newstream->zst_bytes);
+
 		mutex_init(&newstream->zst_lock, NULL, MUTEX_DEFAULT, NULL);
 
 		rw_enter(&zf->zf_rwlock, RW_WRITER);
@@ -644,8 +828,32 @@ dmu_zfetch(zfetch_t *zf, uint64_t offset, uint64_t size, int prefetched)
 		rw_exit(&zf->zf_rwlock);
 
 		if (!inserted) {
+			ZFETCHSTAT_INCR(zfetchstat_window_bytes,
+			    -newstream->zst_bytes);
 			mutex_destroy(&newstream->zst_lock);
 			kmem_free(newstream, sizeof (zstream_t));
 		}
 	}
 }
+
+void
+zfetch_init(void)
+{
+	zfetch_ksp = kstat_create("zfs", 0, "zfetchstats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (zfetch_stats) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+
+	if (zfetch_ksp != NULL) {
+		zfetch_ksp->ks_data = &zfetch_stats;
+		kstat_install(zfetch_ksp);
+	}
+}
+
+void
+zfetch_fini(void)
+{
+	if (zfetch_ksp != NULL) {
+		kstat_delete(zfetch_ksp);
+		zfetch_ksp = NULL;
+	}
+}
@@ -569,6 +569,7 @@ dnode_buf_pageout(dmu_buf_t *db, void *arg)
  * errors:
  * EINVAL - invalid object number.
  * EIO - i/o error.
+ * EBUSY - DNODE_MUST_BE_UNHELD and someone else holds the dnode.
  * succeeds even for free dnodes.
  */
 int
@@ -578,6 +579,7 @@ dnode_hold_impl(objset_impl_t *os, uint64_t object, int flag,
 	int epb, idx, err;
 	int drop_struct_lock = FALSE;
 	int type;
+	int64_t holds;
 	uint64_t blk;
 	dnode_t *mdn, *dn;
 	dmu_buf_impl_t *db;
@@ -648,9 +650,24 @@ dnode_hold_impl(objset_impl_t *os, uint64_t object, int flag,
 		dbuf_rele(db, FTAG);
 		return (type == DMU_OT_NONE ? ENOENT : EEXIST);
 	}
-	mutex_exit(&dn->dn_mtx);
+	/*
+	 * DNODE_MUST_BE_UNHELD callers check and take their hold under
+	 * dn_mtx, so at most one of them can win a given dnode.
+	 */
+	if (flag & DNODE_MUST_BE_UNHELD) {
+		if (!refcount_is_zero(&dn->dn_holds)) {
+			mutex_exit(&dn->dn_mtx);
+			dbuf_rele(db, FTAG);
+			return (EBUSY);
+		}
+		holds = refcount_add(&dn->dn_holds, tag);
+		mutex_exit(&dn->dn_mtx);
+	} else {
+		mutex_exit(&dn->dn_mtx);
+		holds = refcount_add(&dn->dn_holds, tag);
+	}
 
-	if (refcount_add(&dn->dn_holds, tag) == 1)
+	if (holds == 1)
 		dbuf_add_ref(db, dn);
 
 	DNODE_VERIFY(dn);
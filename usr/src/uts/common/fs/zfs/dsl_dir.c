@@ -581,6 +581,8 @@ dsl_dir_sync(dsl_dir_t *dd, dmu_tx_t *tx)
 	ASSERT3U(dd->dd_tempreserved[tx->tx_txg&TXG_MASK], ==, 0);
 	dprintf_dd(dd, "txg=%llu towrite=%lluK\n", tx->tx_txg,
 	    dd->dd_space_towrite[tx->tx_txg&TXG_MASK] / 1024);
+	dd->dd_pool->dp_sync_towrite +=
+	    dd->dd_space_towrite[tx->tx_txg&TXG_MASK];
 	dd->dd_space_towrite[tx->tx_txg&TXG_MASK] = 0;
 	dd->dd_phys->dd_used_bytes = dd->dd_used_bytes;
 	mutex_exit(&dd->dd_lock);
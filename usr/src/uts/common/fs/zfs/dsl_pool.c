@@ -34,9 +34,70 @@
 #include <sys/arc.h>
 #include <sys/zap.h>
 #include <sys/zio.h>
+#include <sys/dnode.h>
+#include <sys/avl.h>
 #include <sys/zfs_context.h>
 #include <sys/fs/zfs.h>
 
+/*
+ * Dirty dnodes of an objset are spread over zfs_sync_threads workers
+ * once there are at least zfs_sync_min_dnodes of them; below that the
+ * dispatch overhead outweighs the gain.  Dirty datasets are synced by
+ * zfs_sync_ds_threads workers, each of which fans its dnodes out to the
+ * dnode workers.  These tunables are sampled when a pool is opened.
+ */
+int zfs_sync_threads = 8;
+int zfs_sync_ds_threads = 4;
+int zfs_sync_min_dnodes = 64;
+
+/*
+ * Opening a pool, and then every dataset in it (zil_claim(), mount -a),
+ * reads the DSL metadata one cold block at a time.  At import,
+ * zfs_import_prefetch_threads workers walk the DSL directory tree ahead
+ * of that and issue speculative reads for what it will need; 0 turns
+ * the walk off.
+ */
+int zfs_import_prefetch_threads = 8;
+
+/*
+ * Cumulative breakdown of where dsl_pool_sync() spends its time, kept
+ * per pool and exported as the zfs:0:<pool>:syncstats kstat.
+ */
+typedef struct dsl_pool_sync_stats {
+	kstat_named_t dpss_txgs;
+	kstat_named_t dpss_datasets;
+	kstat_named_t dpss_datasets_parallel;
+	kstat_named_t dpss_dnodes;
+	kstat_named_t dpss_dnodes_parallel;
+	kstat_named_t dpss_datasets_ns;
+	kstat_named_t dpss_sync_tasks_ns;
+	kstat_named_t dpss_dirty_dirs_ns;
+	kstat_named_t dpss_mos_ns;
+} dsl_pool_sync_stats_t;
+
+static const dsl_pool_sync_stats_t dsl_pool_sync_stats_template = {
+	{ "txgs",			KSTAT_DATA_UINT64 },
+	{ "datasets",			KSTAT_DATA_UINT64 },
+	{ "datasets_parallel",		KSTAT_DATA_UINT64 },
+	{ "dnodes",			KSTAT_DATA_UINT64 },
+	{ "dnodes_parallel",		KSTAT_DATA_UINT64 },
+	{ "datasets_ns",		KSTAT_DATA_UINT64 },
+	{ "sync_tasks_ns",		KSTAT_DATA_UINT64 },
+	{ "dirty_dirs_ns",		KSTAT_DATA_UINT64 },
+	{ "mos_ns",			KSTAT_DATA_UINT64 }
+};
+
+#define	DPSS_INCR(dp, stat, val) \
+	atomic_add_64(&(dp)->dp_sync_stats->stat.value.ui64, (val));
+
+#define	DPSS_BUMP(dp, stat)	DPSS_INCR(dp, stat, 1)
+
+typedef struct dsl_pool_sync_ds_arg {
+	dsl_dataset_t	*dsa_ds;
+	zio_t		*dsa_zio;
+	dmu_tx_t	*dsa_tx;
+} dsl_pool_sync_ds_arg_t;
+
 static int
 dsl_pool_open_mos_dir(dsl_pool_t *dp, dsl_dir_t **ddp)
 {
@@ -73,6 +134,31 @@ dsl_pool_open_impl(spa_t *spa, uint64_t txg)
 	list_create(&dp->dp_synced_objsets, sizeof (dsl_dataset_t),
 	    offsetof(dsl_dataset_t, ds_synced_link));
 
+	dp->dp_sync_threads = zfs_sync_threads;
+	dp->dp_sync_min_dnodes = zfs_sync_min_dnodes;
+	if (dp->dp_sync_threads > 1) {
+		dp->dp_sync_taskq = taskq_create("dp_sync_taskq",
+		    dp->dp_sync_threads, minclsyspri, dp->dp_sync_threads,
+		    INT_MAX, TASKQ_PREPOPULATE);
+	}
+	if (zfs_sync_ds_threads > 1) {
+		dp->dp_sync_ds_taskq = taskq_create("dp_sync_ds_taskq",
+		    zfs_sync_ds_threads, minclsyspri, zfs_sync_ds_threads,
+		    INT_MAX, TASKQ_PREPOPULATE);
+	}
+
+	dp->dp_sync_stats = kmem_alloc(sizeof (dsl_pool_sync_stats_t),
+	    KM_SLEEP);
+	bcopy(&dsl_pool_sync_stats_template, dp->dp_sync_stats,
+	    sizeof (dsl_pool_sync_stats_t));
+	dp->dp_sync_ksp = kstat_create("zfs", 0, spa_name(spa), "syncstats",
+	    KSTAT_TYPE_NAMED, sizeof (dsl_pool_sync_stats_t) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (dp->dp_sync_ksp != NULL) {
+		dp->dp_sync_ksp->ks_data = dp->dp_sync_stats;
+		kstat_install(dp->dp_sync_ksp);
+	}
+
 	return (dp);
 }
 
@@ -117,6 +203,8 @@ out:
 void
 dsl_pool_close(dsl_pool_t *dp)
 {
+	dsl_pool_prefetch_wait(dp);
+
 	/* drop our reference from dsl_pool_open() */
 	if (dp->dp_mos_dir)
 		dsl_dir_close(dp->dp_mos_dir, dp);
@@ -131,12 +219,206 @@ dsl_pool_close(dsl_pool_t *dp)
 	txg_list_destroy(&dp->dp_dirty_dirs);
 	list_destroy(&dp->dp_synced_objsets);
 
+	if (dp->dp_sync_ds_taskq != NULL)
+		taskq_destroy(dp->dp_sync_ds_taskq);
+	if (dp->dp_sync_taskq != NULL)
+		taskq_destroy(dp->dp_sync_taskq);
+
+	if (dp->dp_sync_ksp != NULL)
+		kstat_delete(dp->dp_sync_ksp);
+	kmem_free(dp->dp_sync_stats, sizeof (dsl_pool_sync_stats_t));
+
 	arc_flush();
 	txg_fini(dp);
 	rw_destroy(&dp->dp_config_rwlock);
 	kmem_free(dp, sizeof (dsl_pool_t));
 }
 
+/*
+ * Import-time metadata prefetch.  Each directory is one task: it reads
+ * the directory's bonus buffer and its child directory ZAP, issues
+ * prefetches for the dnodes of its head dataset, property ZAPs and
+ * children, dispatches a task for each child and finally prefetches the
+ * head dataset's objset block.  The dnodes are prefetched in object
+ * order, once per dnode block, so a directory's children (which were
+ * mostly allocated together) cost a handful of sequential reads instead
+ * of one random read each.
+ *
+ * The walk takes no locks: it only reads the MOS, and the caller waits
+ * for it before the pool starts syncing.  Errors just end the walk of
+ * that subtree; the real open will find them again.
+ */
+typedef struct dsl_pool_prefetch_arg {
+	dsl_pool_t	*dpa_dp;
+	uint64_t	dpa_obj;
+} dsl_pool_prefetch_arg_t;
+
+typedef struct dsl_pool_prefetch_obj {
+	avl_node_t	dpo_node;
+	uint64_t	dpo_obj;
+} dsl_pool_prefetch_obj_t;
+
+static int
+dsl_pool_prefetch_compare(const void *x1, const void *x2)
+{
+	const dsl_pool_prefetch_obj_t *dpo1 = x1;
+	const dsl_pool_prefetch_obj_t *dpo2 = x2;
+
+	if (dpo1->dpo_obj < dpo2->dpo_obj)
+		return (-1);
+	if (dpo1->dpo_obj > dpo2->dpo_obj)
+		return (1);
+	return (0);
+}
+
+static void
+dsl_pool_prefetch_add(avl_tree_t *t, uint64_t obj)
+{
+	dsl_pool_prefetch_obj_t *dpo, search;
+	avl_index_t where;
+
+	if (obj == 0)
+		return;
+
+	search.dpo_obj = obj;
+	if (avl_find(t, &search, &where) != NULL)
+		return;
+
+	dpo = kmem_alloc(sizeof (dsl_pool_prefetch_obj_t), KM_SLEEP);
+	dpo->dpo_obj = obj;
+	avl_insert(t, dpo, where);
+}
+
+static void
+dsl_pool_prefetch_dir(void *arg)
+{
+	dsl_pool_prefetch_arg_t *dpa = arg;
+	dsl_pool_t *dp = dpa->dpa_dp;
+	objset_t *mos = dp->dp_meta_objset;
+	uint64_t obj = dpa->dpa_obj;
+	dsl_pool_prefetch_obj_t *dpo;
+	dsl_dir_phys_t dd;
+	dmu_object_info_t doi;
+	zap_cursor_t zc;
+	zap_attribute_t za;
+	avl_tree_t objs, dirs;
+	dmu_buf_t *db;
+	uint64_t lastblk = -1ULL;
+	void *cookie;
+
+	kmem_free(dpa, sizeof (dsl_pool_prefetch_arg_t));
+
+	if (dmu_bonus_hold(mos, obj, FTAG, &db) != 0)
+		return;
+	bcopy(db->db_data, &dd, sizeof (dd));
+	dmu_buf_rele(db, FTAG);
+
+	avl_create(&objs, dsl_pool_prefetch_compare,
+	    sizeof (dsl_pool_prefetch_obj_t),
+	    offsetof(dsl_pool_prefetch_obj_t, dpo_node));
+	avl_create(&dirs, dsl_pool_prefetch_compare,
+	    sizeof (dsl_pool_prefetch_obj_t),
+	    offsetof(dsl_pool_prefetch_obj_t, dpo_node));
+
+	dsl_pool_prefetch_add(&objs, dd.dd_head_dataset_obj);
+	dsl_pool_prefetch_add(&objs, dd.dd_props_zapobj);
+	dsl_pool_prefetch_add(&objs, dd.dd_deleg_zapobj);
+
+	if (dd.dd_child_dir_zapobj != 0 &&
+	    dmu_object_info(mos, dd.dd_child_dir_zapobj, &doi) == 0) {
+		dmu_prefetch(mos, dd.dd_child_dir_zapobj, 0,
+		    (doi.doi_max_block_offset + 1) * doi.doi_data_block_size);
+		for (zap_cursor_init(&zc, mos, dd.dd_child_dir_zapobj);
+		    zap_cursor_retrieve(&zc, &za) == 0;
+		    zap_cursor_advance(&zc)) {
+			if (za.za_integer_length != 8 ||
+			    za.za_num_integers != 1)
+				continue;
+			dsl_pool_prefetch_add(&objs, za.za_first_integer);
+			dsl_pool_prefetch_add(&dirs, za.za_first_integer);
+		}
+		zap_cursor_fini(&zc);
+	}
+
+	cookie = NULL;
+	while ((dpo = avl_destroy_nodes(&objs, &cookie)) != NULL) {
+		if ((dpo->dpo_obj >> DNODES_PER_BLOCK_SHIFT) != lastblk) {
+			lastblk = dpo->dpo_obj >> DNODES_PER_BLOCK_SHIFT;
+			dmu_prefetch(mos, dpo->dpo_obj, 0, 0);
+		}
+		kmem_free(dpo, sizeof (dsl_pool_prefetch_obj_t));
+	}
+	avl_destroy(&objs);
+
+	cookie = NULL;
+	while ((dpo = avl_destroy_nodes(&dirs, &cookie)) != NULL) {
+		dpa = kmem_alloc(sizeof (dsl_pool_prefetch_arg_t), KM_SLEEP);
+		dpa->dpa_dp = dp;
+		dpa->dpa_obj = dpo->dpo_obj;
+		(void) taskq_dispatch(dp->dp_prefetch_taskq,
+		    dsl_pool_prefetch_dir, dpa, TQ_SLEEP);
+		kmem_free(dpo, sizeof (dsl_pool_prefetch_obj_t));
+	}
+	avl_destroy(&dirs);
+
+	if (dd.dd_head_dataset_obj != 0 &&
+	    dmu_bonus_hold(mos, dd.dd_head_dataset_obj, FTAG, &db) == 0) {
+		dsl_dataset_phys_t *ds = db->db_data;
+		blkptr_t bp = ds->ds_bp;
+		uint32_t aflags = ARC_NOWAIT | ARC_PREFETCH;
+		zbookmark_t zb;
+
+		dmu_buf_rele(db, FTAG);
+		if (!BP_IS_HOLE(&bp)) {
+			zb.zb_objset = dd.dd_head_dataset_obj;
+			zb.zb_object = 0;
+			zb.zb_level = -1;
+			zb.zb_blkid = 0;
+			(void) arc_read(NULL, dp->dp_spa, &bp,
+			    dmu_ot[DMU_OT_OBJSET].ot_byteswap, NULL, NULL,
+			    ZIO_PRIORITY_ASYNC_READ,
+			    ZIO_FLAG_CANFAIL | ZIO_FLAG_SPECULATIVE,
+			    &aflags, &zb);
+		}
+	}
+}
+
+/*
+ * Start prefetching the DSL metadata of a pool that has just been
+ * opened.  Must be followed by dsl_pool_prefetch_wait() before the pool
+ * starts syncing; dsl_pool_close() does it too.
+ */
+void
+dsl_pool_prefetch(dsl_pool_t *dp)
+{
+	dsl_pool_prefetch_arg_t *dpa;
+
+	if (zfs_import_prefetch_threads <= 0 || zfs_prefetch_disable ||
+	    dp->dp_prefetch_taskq != NULL)
+		return;
+
+	dp->dp_prefetch_taskq = taskq_create("dp_prefetch_taskq",
+	    zfs_import_prefetch_threads, minclsyspri,
+	    zfs_import_prefetch_threads, INT_MAX, TASKQ_PREPOPULATE);
+
+	dpa = kmem_alloc(sizeof (dsl_pool_prefetch_arg_t), KM_SLEEP);
+	dpa->dpa_dp = dp;
+	dpa->dpa_obj = dp->dp_root_dir_obj;
+	(void) taskq_dispatch(dp->dp_prefetch_taskq,
+	    dsl_pool_prefetch_dir, dpa, TQ_SLEEP);
+}
+
+void
+dsl_pool_prefetch_wait(dsl_pool_t *dp)
+{
+	if (dp->dp_prefetch_taskq == NULL)
+		return;
+
+	taskq_wait(dp->dp_prefetch_taskq);
+	taskq_destroy(dp->dp_prefetch_taskq);
+	dp->dp_prefetch_taskq = NULL;
+}
+
 dsl_pool_t *
 dsl_pool_create(spa_t *spa, uint64_t txg)
 {
@@ -165,6 +447,15 @@ dsl_pool_create(spa_t *spa, uint64_t txg)
 	return (dp);
 }
 
+static void
+dsl_pool_sync_dataset(void *arg)
+{
+	dsl_pool_sync_ds_arg_t *dsa = arg;
+
+	dsl_dataset_sync(dsa->dsa_ds, dsa->dsa_zio, dsa->dsa_tx);
+	kmem_free(dsa, sizeof (dsl_pool_sync_ds_arg_t));
+}
+
 void
 dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 {
@@ -173,27 +464,68 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 	dsl_dir_t *dd;
 	dsl_dataset_t *ds;
 	dsl_sync_task_group_t *dstg;
+	dsl_pool_sync_ds_arg_t *dsa;
 	objset_impl_t *mosi = dp->dp_meta_objset->os;
+	hrtime_t start, now;
 	int err;
 
 	tx = dmu_tx_create_assigned(dp, txg);
 
+	DPSS_BUMP(dp, dpss_txgs);
+	start = gethrtime();
+
+	/*
+	 * The datasets are independent of each other; only the MOS
+	 * blocks they dirty (their dsl_dataset_phys_t and dsl_dir_phys_t
+	 * bonus buffers) are shared, and dbuf_dirty() already copes with
+	 * concurrent callers.  The list bookkeeping stays here in the
+	 * sync thread, the dsl_dataset_sync() calls go to the dataset
+	 * taskq and we wait for all of them before waiting on the zio.
+	 * Only this thread dispatches to that taskq, so taskq_wait()
+	 * waits for exactly our calls.
+	 */
 	zio = zio_root(dp->dp_spa, NULL, NULL, ZIO_FLAG_MUSTSUCCEED);
 	while (ds = txg_list_remove(&dp->dp_dirty_datasets, txg)) {
 		if (!list_link_active(&ds->ds_synced_link))
 			list_insert_tail(&dp->dp_synced_objsets, ds);
 		else
 			dmu_buf_rele(ds->ds_dbuf, ds);
-		dsl_dataset_sync(ds, zio, tx);
+		DPSS_BUMP(dp, dpss_datasets);
+		if (dp->dp_sync_ds_taskq == NULL) {
+			dsl_dataset_sync(ds, zio, tx);
+			continue;
+		}
+		dsa = kmem_alloc(sizeof (dsl_pool_sync_ds_arg_t), KM_SLEEP);
+		dsa->dsa_ds = ds;
+		dsa->dsa_zio = zio;
+		dsa->dsa_tx = tx;
+		DPSS_BUMP(dp, dpss_datasets_parallel);
+		(void) taskq_dispatch(dp->dp_sync_ds_taskq,
+		    dsl_pool_sync_dataset, dsa, TQ_SLEEP);
 	}
+	if (dp->dp_sync_ds_taskq != NULL)
+		taskq_wait(dp->dp_sync_ds_taskq);
 	err = zio_wait(zio);
 	ASSERT(err == 0);
 
+	now = gethrtime();
+	DPSS_INCR(dp, dpss_datasets_ns, now - start);
+	start = now;
+
 	while (dstg = txg_list_remove(&dp->dp_sync_tasks, txg))
 		dsl_sync_task_group_sync(dstg, tx);
+
+	now = gethrtime();
+	DPSS_INCR(dp, dpss_sync_tasks_ns, now - start);
+	start = now;
+
 	while (dd = txg_list_remove(&dp->dp_dirty_dirs, txg))
 		dsl_dir_sync(dd, tx);
 
+	now = gethrtime();
+	DPSS_INCR(dp, dpss_dirty_dirs_ns, now - start);
+	start = now;
+
 	if (list_head(&mosi->os_dirty_dnodes[txg & TXG_MASK]) != NULL ||
 	    list_head(&mosi->os_free_dnodes[txg & TXG_MASK]) != NULL) {
 		zio = zio_root(dp->dp_spa, NULL, NULL, ZIO_FLAG_MUSTSUCCEED);
@@ -204,9 +536,20 @@ dsl_pool_sync(dsl_pool_t *dp, uint64_t txg)
 		spa_set_rootblkptr(dp->dp_spa, &dp->dp_meta_rootbp);
 	}
 
+	DPSS_INCR(dp, dpss_mos_ns, gethrtime() - start);
+
 	dmu_tx_commit(tx);
 }
 
+void
+dsl_pool_sync_dnodes_stat(dsl_pool_t *dp, uint64_t ndnodes,
+    boolean_t parallel)
+{
+	DPSS_INCR(dp, dpss_dnodes, ndnodes);
+	if (parallel)
+		DPSS_INCR(dp, dpss_dnodes_parallel, ndnodes);
+}
+
 void
 dsl_pool_zil_clean(dsl_pool_t *dp)
 {
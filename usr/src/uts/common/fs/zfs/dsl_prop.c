@@ -411,9 +411,10 @@ dsl_prop_set(const char *ddname, const char *propname,
 
 /*
  * Iterate over all properties for this dataset and return them in an nvlist.
+ * If 'filter' is not NULL, only the properties named in it are returned.
  */
 int
-dsl_prop_get_all(objset_t *os, nvlist_t **nvp)
+dsl_prop_get_all(objset_t *os, nvlist_t **nvp, nvlist_t *filter)
 {
 	dsl_dataset_t *ds = os->os->os_dsl_dataset;
 	dsl_dir_t *dd = ds->ds_dir;
@@ -444,6 +445,11 @@ dsl_prop_get_all(objset_t *os, nvlist_t **nvp)
 		    zap_cursor_advance(&zc)) {
 			nvlist_t *propval;
 			zfs_prop_t prop;
+
+			if (filter != NULL &&
+			    nvlist_lookup_boolean(filter, za.za_name) != 0)
+				continue;
+
 			/*
 			 * Skip non-inheritable properties.
 			 */
@@ -55,7 +55,26 @@ dsl_sync_task_group_create(dsl_pool_t *dp)
 	return (dstg);
 }
 
-void
+/*
+ * Create a group whose tasks are independent of one another: each task
+ * succeeds or fails on its own, and its result is left in dst_err.  This
+ * lets a caller commit many unrelated administrative operations (e.g. a
+ * batch of snapshots) in a single txg rather than waiting for a txg per
+ * operation.  A task whose checkfunc returns EAGAIN in syncing context is
+ * carried over to the next txg by dsl_sync_task_group_wait().
+ */
+dsl_sync_task_group_t *
+dsl_sync_task_group_create_independent(dsl_pool_t *dp)
+{
+	dsl_sync_task_group_t *dstg;
+
+	dstg = dsl_sync_task_group_create(dp);
+	dstg->dstg_independent = B_TRUE;
+
+	return (dstg);
+}
+
+dsl_sync_task_t *
 dsl_sync_task_create(dsl_sync_task_group_t *dstg,
     dsl_checkfunc_t *checkfunc, dsl_syncfunc_t *syncfunc,
     void *arg1, void *arg2, int blocks_modified)
@@ -72,6 +91,78 @@ dsl_sync_task_create(dsl_sync_task_group_t *dstg,
 	list_insert_tail(&dstg->dstg_tasks, dst);
 
 	dstg->dstg_space += blocks_modified << DST_AVG_BLKSHIFT;
+
+	return (dst);
+}
+
+static int
+dsl_sync_task_group_wait_independent(dsl_sync_task_group_t *dstg)
+{
+	dmu_tx_t *tx;
+	uint64_t txg;
+	dsl_sync_task_t *dst;
+	int pending;
+
+top:
+	tx = dmu_tx_create_dd(dstg->dstg_pool->dp_mos_dir);
+	VERIFY(0 == dmu_tx_assign(tx, TXG_WAIT));
+
+	txg = dmu_tx_get_txg(tx);
+
+	/*
+	 * Do a preliminary error check.  A task that fails here is
+	 * finished; it does not hold up the rest of the group.
+	 */
+	dstg->dstg_err = 0;
+	pending = 0;
+	rw_enter(&dstg->dstg_pool->dp_config_rwlock, RW_READER);
+	for (dst = list_head(&dstg->dstg_tasks); dst;
+	    dst = list_next(&dstg->dstg_tasks, dst)) {
+		if (dst->dst_done)
+			continue;
+		dst->dst_err = 0;
+#ifdef ZFS_DEBUG
+		/* See dsl_sync_task_group_wait(). */
+		if (spa_get_random(2) == 0) {
+			pending++;
+			continue;
+		}
+#endif
+		dst->dst_err =
+		    dst->dst_checkfunc(dst->dst_arg1, dst->dst_arg2, tx);
+		if (dst->dst_err)
+			dst->dst_done = B_TRUE;
+		else
+			pending++;
+	}
+	rw_exit(&dstg->dstg_pool->dp_config_rwlock);
+
+	if (pending == 0) {
+		dmu_tx_commit(tx);
+		return (0);
+	}
+
+	VERIFY(0 == txg_list_add(&dstg->dstg_pool->dp_sync_tasks, dstg, txg));
+
+	dmu_tx_commit(tx);
+
+	txg_wait_synced(dstg->dstg_pool, txg);
+
+	if (dstg->dstg_err == EAGAIN)
+		goto top;
+	if (dstg->dstg_err)
+		return (dstg->dstg_err);
+
+	/*
+	 * Any task that is not done was told to try again in a later txg.
+	 */
+	for (dst = list_head(&dstg->dstg_tasks); dst;
+	    dst = list_next(&dstg->dstg_tasks, dst)) {
+		if (!dst->dst_done)
+			goto top;
+	}
+
+	return (0);
 }
 
 int
@@ -81,6 +172,9 @@ dsl_sync_task_group_wait(dsl_sync_task_group_t *dstg)
 	uint64_t txg;
 	dsl_sync_task_t *dst;
 
+	if (dstg->dstg_independent)
+		return (dsl_sync_task_group_wait_independent(dstg));
+
 top:
 	tx = dmu_tx_create_dd(dstg->dstg_pool->dp_mos_dir);
 	VERIFY(0 == dmu_tx_assign(tx, TXG_WAIT));
@@ -129,6 +223,7 @@ dsl_sync_task_group_nowait(dsl_sync_task_group_t *dstg, dmu_tx_t *tx)
 {
 	uint64_t txg;
 
+	ASSERT(!dstg->dstg_independent);
 	dstg->dstg_nowaiter = B_TRUE;
 	txg = dmu_tx_get_txg(tx);
 	VERIFY(0 == txg_list_add(&dstg->dstg_pool->dp_sync_tasks, dstg, txg));
@@ -165,10 +260,33 @@ dsl_sync_task_group_sync(dsl_sync_task_group_t *dstg, dmu_tx_t *tx)
 	if (dstg->dstg_err)
 		return;
 
+	rw_enter(&dstg->dstg_pool->dp_config_rwlock, RW_WRITER);
+	if (dstg->dstg_independent) {
+		/*
+		 * Check and execute each task in turn, so that a task sees
+		 * the changes made by the ones before it.  Only a task that
+		 * asked to try again is left for a later txg.
+		 */
+		for (dst = list_head(&dstg->dstg_tasks); dst;
+		    dst = list_next(&dstg->dstg_tasks, dst)) {
+			if (dst->dst_done)
+				continue;
+			dst->dst_err = dst->dst_checkfunc(dst->dst_arg1,
+			    dst->dst_arg2, tx);
+			if (dst->dst_err == EAGAIN)
+				continue;
+			if (dst->dst_err == 0) {
+				dst->dst_syncfunc(dst->dst_arg1, dst->dst_arg2,
+				    dstg->dstg_cr, tx);
+			}
+			dst->dst_done = B_TRUE;
+		}
+		goto out;
+	}
+
 	/*
 	 * Check for errors by calling checkfuncs.
 	 */
-	rw_enter(&dstg->dstg_pool->dp_config_rwlock, RW_WRITER);
 	for (dst = list_head(&dstg->dstg_tasks); dst;
 	    dst = list_next(&dstg->dstg_tasks, dst)) {
 		dst->dst_err =
@@ -187,6 +305,7 @@ dsl_sync_task_group_sync(dsl_sync_task_group_t *dstg, dmu_tx_t *tx)
 			    dstg->dstg_cr, tx);
 		}
 	}
+out:
 	rw_exit(&dstg->dstg_pool->dp_config_rwlock);
 
 	dsl_dir_tempreserve_clear(tr_cookie, tx);
@@ -30,7 +30,7 @@
 #include <sys/zfs_context.h>
 #include <sys/refcount.h>
 
-#if defined(__APPLE__) || defined(DEBUG) || !defined(_KERNEL)
+#ifdef ZFS_REFCOUNT_TRACKING
 
 #ifdef _KERNEL
 int reference_tracking_enable = FALSE; /* runs out of memory too easily */
@@ -198,4 +198,4 @@ refcount_remove(refcount_t *rc, void *holder)
 	return (refcount_remove_many(rc, 1, holder));
 }
 
-#endif /* __APPLE__ || DEBUG || !_KERNEL */
+#endif /* ZFS_REFCOUNT_TRACKING */
@@ -28,38 +28,140 @@
 #include <sys/zfs_context.h>
 #include <sys/refcount.h>
 #include <sys/rprwlock.h>
+#include <sys/zcounter.h>
+
+/*
+ * A re-entrant, reader-priority rwlock.
+ *
+ * Readers (every I/O takes the spa_config_lock as reader) must not all
+ * serialize on one mutex, so read holds are counted in a per-slot
+ * refcount selected by the entering thread.  A writer claims the lock
+ * through rw_wanted, then takes every slot lock and, once all slots are
+ * empty, marks each of them as owned before dropping them; new readers
+ * block on their slot until the writer exits.  Readers are never held
+ * off by a writer that is only waiting, and the writing thread may
+ * re-enter the lock as reader or writer; such holds are kept in
+ * rw_count.
+ */
+
+static int
+rprw_slot(void)
+{
+	return (zcounter_shard() % RPRW_SHARDS);
+}
 
 void
 rprw_init(rprwlock_t *rwl)
 {
+	int i;
+
 	mutex_init(&rwl->rw_lock, NULL, MUTEX_DEFAULT, NULL);
+	rwl->rw_wanted = NULL;
 	rwl->rw_writer = NULL;
 	cv_init(&rwl->rw_cv, NULL, CV_DEFAULT, NULL);
 	refcount_create(&rwl->rw_count);
+
+	for (i = 0; i < RPRW_SHARDS; i++) {
+		rprw_shard_t *rs = &rwl->rw_shard[i];
+
+		mutex_init(&rs->rs_lock, NULL, MUTEX_DEFAULT, NULL);
+		rs->rs_writer = NULL;
+		cv_init(&rs->rs_cv, NULL, CV_DEFAULT, NULL);
+		rs->rs_wwait = 0;
+		refcount_create(&rs->rs_count);
+	}
 }
 
 void
 rprw_destroy(rprwlock_t *rwl)
 {
+	int i;
+
 	mutex_destroy(&rwl->rw_lock);
 	ASSERT(rwl->rw_writer == NULL);
+	ASSERT(rwl->rw_wanted == NULL);
 	cv_destroy(&rwl->rw_cv);
 	refcount_destroy(&rwl->rw_count);
+
+	for (i = 0; i < RPRW_SHARDS; i++) {
+		rprw_shard_t *rs = &rwl->rw_shard[i];
+
+		mutex_destroy(&rs->rs_lock);
+		ASSERT(rs->rs_writer == NULL);
+		cv_destroy(&rs->rs_cv);
+		refcount_destroy(&rs->rs_count);
+	}
 }
 
-void
+int
 rprw_enter_read(rprwlock_t *rwl, void *tag)
 {
-	mutex_enter(&rwl->rw_lock);
+	rprw_shard_t *rs;
+	int slot;
 
-	if (rwl->rw_writer != curthread) {
-		while (rwl->rw_writer != NULL)
-			cv_wait(&rwl->rw_cv, &rwl->rw_lock);
+	/*
+	 * Only this thread can make rw_writer equal to curthread, so the
+	 * unlocked check is safe.
+	 */
+	if (rwl->rw_writer == curthread) {
+		mutex_enter(&rwl->rw_lock);
+		(void) refcount_add(&rwl->rw_count, tag);
+		mutex_exit(&rwl->rw_lock);
+		return (RPRW_SLOT_WRITER);
 	}
 
-	(void) refcount_add(&rwl->rw_count, tag);
+	slot = rprw_slot();
+	rs = &rwl->rw_shard[slot];
+	mutex_enter(&rs->rs_lock);
+	while (rs->rs_writer != NULL)
+		cv_wait(&rs->rs_cv, &rs->rs_lock);
+	(void) refcount_add(&rs->rs_count, tag);
+	mutex_exit(&rs->rs_lock);
 
-	mutex_exit(&rwl->rw_lock);
+	return (slot);
+}
+
+/*
+ * Wait until no slot has readers, then mark every slot as owned by
+ * curthread.  The check and the marking happen with all slot locks
+ * held so that no reader can slip in between.
+ */
+static void
+rprw_drain(rprwlock_t *rwl)
+{
+	rprw_shard_t *rs;
+	int i, busy;
+
+	for (;;) {
+		for (i = 0; i < RPRW_SHARDS; i++)
+			mutex_enter(&rwl->rw_shard[i].rs_lock);
+
+		for (busy = 0; busy < RPRW_SHARDS; busy++) {
+			if (!refcount_is_zero(&rwl->rw_shard[busy].rs_count))
+				break;
+		}
+
+		if (busy == RPRW_SHARDS) {
+			for (i = 0; i < RPRW_SHARDS; i++) {
+				rs = &rwl->rw_shard[i];
+				rs->rs_writer = curthread;
+				mutex_exit(&rs->rs_lock);
+			}
+			return;
+		}
+
+		for (i = 0; i < RPRW_SHARDS; i++) {
+			if (i != busy)
+				mutex_exit(&rwl->rw_shard[i].rs_lock);
+		}
+
+		rs = &rwl->rw_shard[busy];
+		rs->rs_wwait++;
+		while (!refcount_is_zero(&rs->rs_count))
+			cv_wait(&rs->rs_cv, &rs->rs_lock);
+		rs->rs_wwait--;
+		mutex_exit(&rs->rs_lock);
+	}
 }
 
 void
@@ -68,8 +170,14 @@ rprw_enter_write(rprwlock_t *rwl, void *tag)
 	mutex_enter(&rwl->rw_lock);
 
 	if (rwl->rw_writer != curthread) {
-		while (!refcount_is_zero(&rwl->rw_count))
+		while (rwl->rw_wanted != NULL)
 			cv_wait(&rwl->rw_cv, &rwl->rw_lock);
+		rwl->rw_wanted = curthread;
+		mutex_exit(&rwl->rw_lock);
+
+		rprw_drain(rwl);
+
+		mutex_enter(&rwl->rw_lock);
 		rwl->rw_writer = curthread;
 	}
 
@@ -82,36 +190,82 @@ void
 rprw_enter(rprwlock_t *rwl, krw_t rw, void *tag)
 {
 	if (rw == RW_READER)
-		rprw_enter_read(rwl, tag);
+		(void) rprw_enter_read(rwl, tag);
 	else
 		rprw_enter_write(rwl, tag);
 }
 
+/*
+ * Drop a hold taken by this thread.
+ */
 void
 rprw_exit(rprwlock_t *rwl, void *tag)
 {
-	mutex_enter(&rwl->rw_lock);
+	rprw_exit_slot(rwl, rwl->rw_writer == curthread ?
+	    RPRW_SLOT_WRITER : rprw_slot(), tag);
+}
+
+/*
+ * Drop a hold given the slot rprw_enter_read() returned for it, or
+ * RPRW_SLOT_WRITER for a write hold.
+ */
+void
+rprw_exit_slot(rprwlock_t *rwl, int slot, void *tag)
+{
+	rprw_shard_t *rs;
+	int i;
 
-	ASSERT(!refcount_is_zero(&rwl->rw_count));
-	ASSERT(rwl->rw_writer == NULL || curthread == rwl->rw_writer);
-	if (refcount_remove(&rwl->rw_count, tag) == 0) {
-		cv_broadcast(&rwl->rw_cv);
-		rwl->rw_writer = NULL;  /* OK in either case */
+	if (slot == RPRW_SLOT_WRITER) {
+		mutex_enter(&rwl->rw_lock);
+		ASSERT(rwl->rw_writer != NULL);
+		ASSERT(!refcount_is_zero(&rwl->rw_count));
+		if (refcount_remove(&rwl->rw_count, tag) == 0) {
+			for (i = 0; i < RPRW_SHARDS; i++) {
+				rs = &rwl->rw_shard[i];
+				mutex_enter(&rs->rs_lock);
+				rs->rs_writer = NULL;
+				cv_broadcast(&rs->rs_cv);
+				mutex_exit(&rs->rs_lock);
+			}
+			rwl->rw_writer = NULL;
+			rwl->rw_wanted = NULL;
+			cv_broadcast(&rwl->rw_cv);
+		}
+		mutex_exit(&rwl->rw_lock);
+		return;
 	}
 
-	mutex_exit(&rwl->rw_lock);
+	ASSERT3S(slot, >=, 0);
+	ASSERT3S(slot, <, RPRW_SHARDS);
+	rs = &rwl->rw_shard[slot];
+	mutex_enter(&rs->rs_lock);
+
+	ASSERT(!refcount_is_zero(&rs->rs_count));
+	ASSERT(rs->rs_writer == NULL);
+	if (refcount_remove(&rs->rs_count, tag) == 0 && rs->rs_wwait != 0)
+		cv_broadcast(&rs->rs_cv);
+
+	mutex_exit(&rs->rs_lock);
 }
 
 boolean_t
 rprw_held(rprwlock_t *rwl, krw_t rw)
 {
-	boolean_t held;
+	boolean_t held = B_FALSE;
+	int i;
 
 	mutex_enter(&rwl->rw_lock);
-	if (rw == RW_WRITER)
+	if (rw == RW_WRITER) {
 		held = (rwl->rw_writer == curthread);
-	else
-		held = !rwl->rw_writer && !refcount_is_zero(&rwl->rw_count);
+	} else if (rwl->rw_writer == NULL) {
+		for (i = 0; i < RPRW_SHARDS && !held; i++) {
+			rprw_shard_t *rs = &rwl->rw_shard[i];
+
+			mutex_enter(&rs->rs_lock);
+			held = !refcount_is_zero(&rs->rs_count);
+			mutex_exit(&rs->rs_lock);
+		}
+	}
 	mutex_exit(&rwl->rw_lock);
 
 	return (held);
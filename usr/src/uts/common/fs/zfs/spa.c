@@ -623,6 +623,14 @@ spa_load(spa_t *spa, nvlist_t *config, spa_load_state_t state, int mosconfig)
 		return (spa_load(spa, newconfig, state, B_TRUE));
 	}
 
+	/*
+	 * Start reading the DSL metadata in the background; the lookups
+	 * below, zil_claim() and the mounts that follow import all walk it.
+	 * A tryimport only wants the config, so it would just wait for it.
+	 */
+	if (state != SPA_LOAD_TRYIMPORT)
+		dsl_pool_prefetch(spa->spa_dsl_pool);
+
 	if (zap_lookup(spa->spa_meta_objset,
 	    DMU_POOL_DIRECTORY_OBJECT, DMU_POOL_SYNC_BPLIST,
 	    sizeof (uint64_t), 1, &spa->spa_sync_bplist_obj) != 0) {
@@ -784,6 +792,7 @@ spa_load(spa_t *spa, nvlist_t *config, spa_load_state_t state, int mosconfig)
 		    zil_claim, tx, DS_FIND_CHILDREN);
 		dmu_tx_commit(tx);
 
+		dsl_pool_prefetch_wait(spa->spa_dsl_pool);
 		spa->spa_sync_on = B_TRUE;
 		txg_sync_start(spa->spa_dsl_pool);
 
@@ -3036,6 +3045,11 @@ spa_sync(spa_t *spa, uint64_t txg)
 	vdev_t *vd;
 	dmu_tx_t *tx;
 	int dirty_vdevs;
+	txg_stat_t ts;
+	hrtime_t start, t, now;
+
+	start = t = gethrtime();
+	bzero(&ts, sizeof (ts));
 
 	/*
 	 * Lock out configuration changes.
@@ -3080,6 +3094,10 @@ spa_sync(spa_t *spa, uint64_t txg)
 	    !txg_list_empty(&dp->dp_sync_tasks, txg))
 		spa_sync_deferred_frees(spa, txg);
 
+	now = gethrtime();
+	ts.ts_phase_ns[TXG_PHASE_FREES] += now - t;
+	t = now;
+
 	/*
 	 * Iterate to convergence.
 	 */
@@ -3089,15 +3107,32 @@ spa_sync(spa_t *spa, uint64_t txg)
 		spa_sync_config_object(spa, tx);
 		spa_sync_spares(spa, tx);
 		spa_errlog_sync(spa, txg);
+
+		now = gethrtime();
+		ts.ts_phase_ns[TXG_PHASE_MISC] += now - t;
+		t = now;
+
 		dsl_pool_sync(dp, txg);
 
+		now = gethrtime();
+		ts.ts_phase_ns[TXG_PHASE_DSL] += now - t;
+		t = now;
+
 		dirty_vdevs = 0;
 		while (vd = txg_list_remove(&spa->spa_vdev_txg_list, txg)) {
 			vdev_sync(vd, txg);
 			dirty_vdevs++;
 		}
 
+		now = gethrtime();
+		ts.ts_phase_ns[TXG_PHASE_VDEV] += now - t;
+		t = now;
+
 		bplist_sync(bpl, tx);
+
+		now = gethrtime();
+		ts.ts_phase_ns[TXG_PHASE_MISC] += now - t;
+		t = now;
 	} while (dirty_vdevs);
 
 	bplist_close(bpl);
@@ -3131,6 +3166,10 @@ spa_sync(spa_t *spa, uint64_t txg)
 			VERIFY(vdev_config_sync(rvd, txg) == 0);
 	}
 
+	now = gethrtime();
+	ts.ts_phase_ns[TXG_PHASE_CONFIG] += now - t;
+	t = now;
+
 	dmu_tx_commit(tx);
 
 	/*
@@ -3186,6 +3225,34 @@ spa_sync(spa_t *spa, uint64_t txg)
 
 	spa_config_exit(spa, FTAG);
 
+	/*
+	 * Record this txg in the pool's txg history.  The open, quiesce
+	 * and wait times were handed to us by the txg threads; the dirty
+	 * byte count was accumulated by dsl_dir_sync().  Writes are leaf
+	 * vdev writes tagged with this txg, so they include any intent
+	 * log blocks written while it was open.
+	 */
+	now = gethrtime();
+	ts.ts_phase_ns[TXG_PHASE_DONE] += now - t;
+	ts.ts_txg = txg;
+	ts.ts_time = gethrestime_sec();
+	ts.ts_dirty = dp->dp_sync_towrite;
+	dp->dp_sync_towrite = 0;
+	ts.ts_writes = zcounter_value(&spa->spa_txg_iocount,
+	    SPA_TXG_WRITES(txg));
+	zcounter_add(&spa->spa_txg_iocount, SPA_TXG_WRITES(txg),
+	    -ts.ts_writes);
+	ts.ts_written = zcounter_value(&spa->spa_txg_iocount,
+	    SPA_TXG_WRITTEN(txg));
+	zcounter_add(&spa->spa_txg_iocount, SPA_TXG_WRITTEN(txg),
+	    -ts.ts_written);
+	ts.ts_passes = spa->spa_sync_pass;
+	ts.ts_open_ns = dp->dp_tx.tx_syncing_open_ns;
+	ts.ts_quiesce_ns = dp->dp_tx.tx_syncing_quiesce_ns;
+	ts.ts_wait_ns = dp->dp_tx.tx_syncing_wait_ns;
+	ts.ts_sync_ns = now - start;
+	spa_txg_history_add(spa, &ts);
+
 	/*
 	 * If any async tasks have been requested, kick them off.
 	 */
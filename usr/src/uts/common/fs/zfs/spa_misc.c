@@ -152,7 +152,15 @@
  *				RW_WRITER.  At least one reference on the spa_t
  *				must exist.
  *
- *	spa_config_exit()	Release the config lock.
+ *	spa_config_exit()	Release the config lock.  Must be called from
+ *				the thread that acquired it.
+ *
+ *	spa_config_enter_slot()	Acquire the config lock as RW_READER on
+ *				behalf of something that another thread may
+ *				release, such as an I/O.  Returns the slot
+ *				to pass to spa_config_exit_slot().
+ *
+ *	spa_config_exit_slot()	Release a lock taken by spa_config_enter_slot().
  *
  *	spa_config_held()	Returns true if the config lock is currently
  *				held in the given state.
@@ -198,6 +206,12 @@ int zfs_flags = 0;
  */
 int zfs_recover = 0;
 
+/*
+ * Number of recent txgs whose sync statistics each pool keeps; sampled
+ * when the pool is added to the namespace.  0 keeps only the histograms.
+ */
+int zfs_txg_history = 64;
+
 #define	SPA_MINREF	5	/* spa_refcnt for an open-but-idle pool */
 
 /*
@@ -264,6 +278,14 @@ spa_add(const char *name, const char *altroot)
 	mutex_init(&spa->spa_sync_bplist.bpl_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_history_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&spa->spa_props_lock, NULL, MUTEX_DEFAULT, NULL);
+	mutex_init(&spa->spa_txg_hist_lock, NULL, MUTEX_DEFAULT, NULL);
+
+	if (zfs_txg_history > 0) {
+		spa->spa_txg_hist_size = zfs_txg_history;
+		spa->spa_txg_hist = kmem_zalloc(spa->spa_txg_hist_size *
+		    sizeof (txg_stat_t), KM_SLEEP);
+	}
+	zcounter_set_create(&spa->spa_txg_iocount, SPA_TXG_IOCOUNTERS);
 
 	cv_init(&spa->spa_async_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&spa->spa_scrub_cv, NULL, CV_DEFAULT, NULL);
@@ -334,6 +356,13 @@ spa_remove(spa_t *spa)
 	mutex_destroy(&spa->spa_sync_bplist.bpl_lock);
 	mutex_destroy(&spa->spa_history_lock);
 	mutex_destroy(&spa->spa_props_lock);
+	mutex_destroy(&spa->spa_txg_hist_lock);
+
+	if (spa->spa_txg_hist != NULL) {
+		kmem_free(spa->spa_txg_hist,
+		    spa->spa_txg_hist_size * sizeof (txg_stat_t));
+	}
+	zcounter_set_destroy(&spa->spa_txg_iocount);
 
 	kmem_free(spa, sizeof (spa_t));
 }
@@ -555,6 +584,18 @@ spa_config_exit(spa_t *spa, void *tag)
 	rprw_exit(&spa->spa_config_lock, tag);
 }
 
+int
+spa_config_enter_slot(spa_t *spa, void *tag)
+{
+	return (rprw_enter_read(&spa->spa_config_lock, tag));
+}
+
+void
+spa_config_exit_slot(spa_t *spa, int slot, void *tag)
+{
+	rprw_exit_slot(&spa->spa_config_lock, slot, tag);
+}
+
 boolean_t
 spa_config_held(spa_t *spa, krw_t rw)
 {
@@ -646,6 +687,89 @@ spa_vdev_exit(spa_t *spa, vdev_t *vd, uint64_t txg, int error)
 	return (error);
 }
 
+/*
+ * ==========================================================================
+ * SPA txg history functions
+ * ==========================================================================
+ */
+
+static int
+spa_txg_histogram_bucket(uint64_t ns)
+{
+	uint64_t ms = ns / (NANOSEC / MILLISEC);
+	int b = 0;
+
+	while (ms > 1 && b < TXG_HISTOGRAM_BUCKETS - 1) {
+		ms >>= 1;
+		b++;
+	}
+	return (b);
+}
+
+/*
+ * Record the statistics of a txg that has just finished syncing.
+ * Called once per txg from spa_sync(), so the lock is uncontended
+ * except against spa_txg_history_get().
+ */
+void
+spa_txg_history_add(spa_t *spa, const txg_stat_t *ts)
+{
+	mutex_enter(&spa->spa_txg_hist_lock);
+	if (spa->spa_txg_hist_size != 0) {
+		spa->spa_txg_hist[spa->spa_txg_hist_count %
+		    spa->spa_txg_hist_size] = *ts;
+	}
+	spa->spa_txg_hist_count++;
+	spa->spa_txg_sync_hist[spa_txg_histogram_bucket(ts->ts_sync_ns)]++;
+	spa->spa_txg_quiesce_hist[
+	    spa_txg_histogram_bucket(ts->ts_quiesce_ns)]++;
+	mutex_exit(&spa->spa_txg_hist_lock);
+}
+
+/*
+ * Return the txg history as an nvlist: the number of txgs recorded since
+ * the pool was opened, the retained txg_stat_t records oldest first, and
+ * the sync and quiesce time histograms.
+ */
+nvlist_t *
+spa_txg_history_get(spa_t *spa)
+{
+	nvlist_t *nvl;
+	txg_stat_t *ts = NULL;
+	uint64_t sync_hist[TXG_HISTOGRAM_BUCKETS];
+	uint64_t quiesce_hist[TXG_HISTOGRAM_BUCKETS];
+	uint64_t count, n, first, i;
+
+	mutex_enter(&spa->spa_txg_hist_lock);
+	count = spa->spa_txg_hist_count;
+	n = MIN(count, spa->spa_txg_hist_size);
+	first = count - n;
+	if (n != 0) {
+		ts = kmem_alloc(n * sizeof (txg_stat_t), KM_SLEEP);
+		for (i = 0; i < n; i++) {
+			ts[i] = spa->spa_txg_hist[(first + i) %
+			    spa->spa_txg_hist_size];
+		}
+	}
+	bcopy(spa->spa_txg_sync_hist, sync_hist, sizeof (sync_hist));
+	bcopy(spa->spa_txg_quiesce_hist, quiesce_hist, sizeof (quiesce_hist));
+	mutex_exit(&spa->spa_txg_hist_lock);
+
+	VERIFY(nvlist_alloc(&nvl, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+	VERIFY(nvlist_add_uint64(nvl, ZPOOL_TXG_HISTORY_COUNT, count) == 0);
+	VERIFY(nvlist_add_uint64_array(nvl, ZPOOL_TXG_HISTORY_RECORDS,
+	    (uint64_t *)ts, n * sizeof (txg_stat_t) / sizeof (uint64_t)) == 0);
+	VERIFY(nvlist_add_uint64_array(nvl, ZPOOL_TXG_HISTORY_SYNC,
+	    sync_hist, TXG_HISTOGRAM_BUCKETS) == 0);
+	VERIFY(nvlist_add_uint64_array(nvl, ZPOOL_TXG_HISTORY_QUIESCE,
+	    quiesce_hist, TXG_HISTOGRAM_BUCKETS) == 0);
+
+	if (ts != NULL)
+		kmem_free(ts, n * sizeof (txg_stat_t));
+
+	return (nvl);
+}
+
 /*
  * ==========================================================================
  * Miscellaneous functions
@@ -1080,6 +1204,7 @@ spa_init(int mode)
 	unique_init();
 	zio_init();
 	dmu_init();
+	vdev_cache_stat_init();
 	zil_init();
 	zfs_prop_init();
 	spa_config_load();
@@ -1091,6 +1216,7 @@ spa_fini(void)
 	spa_evict_all();
 
 	zil_fini();
+	vdev_cache_stat_fini();
 	dmu_fini();
 	zio_fini();
 	unique_fini();
@@ -64,6 +64,7 @@ struct zbookmark;
 struct spa;
 struct nvlist;
 struct objset_impl;
+struct arc_buf;
 
 typedef struct objset objset_t;
 typedef struct dmu_tx dmu_tx_t;
@@ -173,6 +174,7 @@ int dmu_objset_rename(const char *name, const char *newname, boolean_t recursive
 #endif
 int dmu_objset_rollback(const char *name);
 int dmu_objset_snapshot(char *fsname, char *snapname, boolean_t recursive);
+int dmu_objset_snapshot_batch(struct nvlist *snaps, struct nvlist *errlist);
 int dmu_objset_find(char *name, int func(char *, void *), void *arg,
     int flags);
 void dmu_objset_byteswap(void *buf, size_t size);
@@ -429,8 +431,35 @@ int dmu_free_range(objset_t *os, uint64_t object, uint64_t offset,
  */
 int dmu_read(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
 	void *buf);
+
+/*
+ * Asynchronous reads: see dmu_read_async() for the details.  The callback
+ * gets the request, 0 or an errno, and on success the held buffers
+ * covering the range; these remain valid until dmu_read_async_rele().
+ */
+typedef struct dmu_read_req dmu_read_req_t;
+typedef void dmu_read_done_func_t(dmu_read_req_t *req, int err,
+    dmu_buf_t **dbp, int numbufs, void *arg);
+
+#define	DMU_READ_NOWAIT		0x1	/* fail with EAGAIN if at the limit */
+
+int dmu_read_async(objset_t *os, uint64_t object, uint64_t offset,
+	uint64_t size, int flags, dmu_read_done_func_t *func, void *arg,
+	dmu_read_req_t **reqp);
+void dmu_read_async_cancel(dmu_read_req_t *req);
+void dmu_read_async_rele(dmu_read_req_t *req);
 void dmu_write(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
 	const void *buf, dmu_tx_t *tx);
+
+/*
+ * Zero-copy full-block writes: borrow an ARC buffer the size of one of
+ * the object's blocks, fill it, and hand it to the block at 'offset'
+ * with dmu_assign_arcbuf(), or give it back with dmu_return_arcbuf().
+ */
+struct arc_buf *dmu_request_arcbuf(objset_t *os, int size);
+void dmu_return_arcbuf(struct arc_buf *buf);
+void dmu_assign_arcbuf(objset_t *os, uint64_t object, uint64_t offset,
+    struct arc_buf *buf, dmu_tx_t *tx);
 #ifdef _KERNEL /*XXX NOEL Why?*/
 int dmu_read_uio(objset_t *os, uint64_t object, struct uio *uio, uint64_t size);
 int dmu_write_uio(objset_t *os, uint64_t object, struct uio *uio, uint64_t size,
@@ -64,12 +64,20 @@ extern "C" {
  *    	dsl_dir_rename_sync/w:
  *    	dsl_prop_changed_notify/r:
  *
+ * oa_lock (os_obj_alloc[])
+ *   must be held before:
+ *   	os_obj_lock
+ *   protects oa_next, oa_end, oa_ahead
+ *   held from:
+ *   	dmu_object_alloc: os_obj_lock
+ *
  * os_obj_lock
  *   must be held before:
- *   	everything except dp_config_rwlock
- *   protects os_obj_next
+ *   	everything except dp_config_rwlock and oa_lock
+ *   protects os_obj_next (the next unclaimed chunk)
  *   held from:
- *   	dmu_object_alloc: dn_dbufs_mtx, db_mtx, hash_mutexes, dn_struct_rwlock
+ *   	dmu_object_alloc_chunk: dn_struct_rwlock, dn_dbufs_mtx, db_mtx,
+ *   	    hash_mutexes
  *
  * dn_struct_rwlock
  *   must be held before:
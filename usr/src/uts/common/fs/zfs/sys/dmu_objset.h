@@ -57,6 +57,24 @@ struct objset {
 	int os_mode;
 };
 
+/*
+ * Object numbers are handed out in chunks of DMU_OBJ_ALLOC_CHUNK objects
+ * (a whole number of dnode blocks) to each of DMU_OBJ_ALLOC_SLOTS
+ * allocation slots, so that concurrent creates don't serialize on
+ * os_obj_lock and each slot fills its own dnode blocks.
+ */
+#define	DMU_OBJ_ALLOC_SLOTS	8
+#define	DMU_OBJ_ALLOC_CHUNK	(4 * DNODES_PER_BLOCK)
+
+typedef struct dmu_obj_alloc {
+	kmutex_t oa_lock;
+	uint64_t oa_next;	/* next object in current chunk */
+	uint64_t oa_end;	/* end of current chunk */
+	uint64_t oa_ahead;	/* chunk claimed (and prefetched) next */
+	boolean_t oa_have_ahead;
+	uint8_t oa_pad[64];	/* keep slots on separate cache lines */
+} dmu_obj_alloc_t;
+
 typedef struct objset_impl {
 	/* Immutable: */
 	struct dsl_dataset *os_dsl_dataset;
@@ -80,6 +98,9 @@ typedef struct objset_impl {
 	kmutex_t os_obj_lock;
 	uint64_t os_obj_next;
 
+	/* Each protected by its oa_lock */
+	dmu_obj_alloc_t os_obj_alloc[DMU_OBJ_ALLOC_SLOTS];
+
 	/* Protected by os_lock */
 	kmutex_t os_lock;
 	list_t os_dirty_dnodes[TXG_SIZE];
@@ -94,8 +94,11 @@ struct traverse_handle {
 	uint64_t	th_callbacks;
 	uint64_t	th_syncs;
 	uint64_t	th_restarts;
+	uint64_t	th_prefetches;
 	zbookmark_t	th_noread;
 	zbookmark_t	th_lastcb;
+	zbookmark_t	th_prefetched[ZB_DEPTH][ZB_MAXLEVEL];
+	zbookmark_t	th_prefetched_dnode;
 };
 
 int traverse_dsl_dataset(struct dsl_dataset *ds, uint64_t txg_start,
@@ -109,6 +112,8 @@ void traverse_add_dnode(traverse_handle_t *th,
     uint64_t mintxg, uint64_t maxtxg, uint64_t objset, uint64_t object);
 void traverse_add_objset(traverse_handle_t *th,
     uint64_t mintxg, uint64_t maxtxg, uint64_t objset);
+void traverse_add_objects(traverse_handle_t *th, uint64_t mintxg,
+    uint64_t maxtxg, uint64_t objset, uint64_t sobject, uint64_t eobject);
 void traverse_add_pool(traverse_handle_t *th, uint64_t mintxg, uint64_t maxtxg);
 
 int traverse_more(traverse_handle_t *th);
@@ -45,6 +45,7 @@ extern "C" {
  */
 #define	DNODE_MUST_BE_ALLOCATED	1
 #define	DNODE_MUST_BE_FREE	2
+#define	DNODE_MUST_BE_UNHELD	4	/* fail if anyone else holds it */
 
 /*
  * Fixed constants.
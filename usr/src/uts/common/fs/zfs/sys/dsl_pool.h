@@ -32,6 +32,7 @@
 #include <sys/txg.h>
 #include <sys/txg_impl.h>
 #include <sys/zfs_context.h>
+#include <sys/kstat.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -47,10 +48,18 @@ typedef struct dsl_pool {
 	struct dsl_dir *dp_root_dir;
 	struct dsl_dir *dp_mos_dir;
 	uint64_t dp_root_dir_obj;
+	taskq_t *dp_sync_taskq;		/* dirty dnode sync workers */
+	taskq_t *dp_sync_ds_taskq;	/* dirty dataset sync workers */
+	taskq_t *dp_prefetch_taskq;	/* import-time metadata prefetch */
+	int dp_sync_threads;		/* zfs_sync_threads at open */
+	int dp_sync_min_dnodes;		/* zfs_sync_min_dnodes at open */
+	struct dsl_pool_sync_stats *dp_sync_stats;
+	kstat_t *dp_sync_ksp;
 
 	/* No lock needed - sync context only */
 	blkptr_t dp_meta_rootbp;
 	list_t dp_synced_objsets;
+	uint64_t dp_sync_towrite;	/* bytes dirtied in syncing txg */
 
 	/* Has its own locking */
 	tx_state_t dp_tx;
@@ -74,6 +83,23 @@ void dsl_pool_sync(dsl_pool_t *dp, uint64_t txg);
 void dsl_pool_zil_clean(dsl_pool_t *dp);
 int dsl_pool_sync_context(dsl_pool_t *dp);
 uint64_t dsl_pool_adjustedsize(dsl_pool_t *dp, boolean_t netfree);
+void dsl_pool_sync_dnodes_stat(dsl_pool_t *dp, uint64_t ndnodes,
+    boolean_t parallel);
+void dsl_pool_prefetch(dsl_pool_t *dp);
+void dsl_pool_prefetch_wait(dsl_pool_t *dp);
+
+/*
+ * Number of threads used to sync dirty dnodes and dirty datasets;
+ * 0 syncs everything from the txg sync thread as before.
+ */
+extern int zfs_sync_threads;
+extern int zfs_sync_ds_threads;
+extern int zfs_sync_min_dnodes;
+
+/*
+ * Number of threads walking the DSL tree ahead of pool import; 0 disables.
+ */
+extern int zfs_import_prefetch_threads;
 
 #ifdef	__cplusplus
 }
@@ -59,7 +59,7 @@ int dsl_prop_get(const char *ddname, const char *propname,
     int intsz, int numints, void *buf, char *setpoint);
 int dsl_prop_get_integer(const char *ddname, const char *propname,
     uint64_t *valuep, char *setpoint);
-int dsl_prop_get_all(objset_t *os, nvlist_t **nvp);
+int dsl_prop_get_all(objset_t *os, nvlist_t **nvp, nvlist_t *filter);
 int dsl_prop_get_ds_locked(dsl_dir_t *dd, const char *propname,
     int intsz, int numints, void *buf, char *setpoint);
 
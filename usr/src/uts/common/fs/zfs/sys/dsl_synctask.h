@@ -47,6 +47,7 @@ typedef struct dsl_sync_task {
 	void *dst_arg1;
 	void *dst_arg2;
 	int dst_err;
+	boolean_t dst_done;
 } dsl_sync_task_t;
 
 typedef struct dsl_sync_task_group {
@@ -58,10 +59,13 @@ typedef struct dsl_sync_task_group {
 	int dstg_err;
 	int dstg_space;
 	boolean_t dstg_nowaiter;
+	boolean_t dstg_independent;
 } dsl_sync_task_group_t;
 
 dsl_sync_task_group_t *dsl_sync_task_group_create(struct dsl_pool *dp);
-void dsl_sync_task_create(dsl_sync_task_group_t *dstg,
+dsl_sync_task_group_t *dsl_sync_task_group_create_independent(
+    struct dsl_pool *dp);
+dsl_sync_task_t *dsl_sync_task_create(dsl_sync_task_group_t *dstg,
     dsl_checkfunc_t *, dsl_syncfunc_t *,
     void *arg1, void *arg2, int blocks_modified);
 int dsl_sync_task_group_wait(dsl_sync_task_group_t *dstg);
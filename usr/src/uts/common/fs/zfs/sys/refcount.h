@@ -50,19 +50,25 @@ extern "C" {
  */
 #define	FTAG ((char *)__func__)
 
-#if defined(__APPLE__) || defined(DEBUG) || !defined(_KERNEL)
 /*
- * In Mac OS X we use a mutex to protect access to rc_count.
- * This is due to two things:
- * 1) the fact that there is no native atomic add 64 support on PPC.
- * 2) different behavior of Mac OSX atomic 64 bit add and Solaris
- *    atomic 64 bit add.  See note below.
+ * There are two implementations of refcount_t.  The tracked one keeps a
+ * mutex and, when reference_tracking_enable is set, a list of holders
+ * that is checked on every release; it is what DEBUG kernels and
+ * userland (ztest) use.  Production kernels get a bare counter updated
+ * with atomic_add_64_nv(), so holds and releases take no lock.
  *
- * NOTE: there is support for atomic add on i386 however
- * Mac OSX atomic add will return the number before it was incremented.
- * Solairs atomic add will return the number AFTER it was incremented, 
- * so using atomic add currently will break all ZFS code assumptions.
+ * A build may choose explicitly by defining ZFS_REFCOUNT_TRACKING or
+ * ZFS_REFCOUNT_ATOMIC.  PPC has no 64-bit atomic add (OSAddAtomic64 is
+ * emulated, and isn't atomic across the two words), so it always tracks.
  */
+#if !defined(ZFS_REFCOUNT_TRACKING) && !defined(ZFS_REFCOUNT_ATOMIC)
+#if defined(DEBUG) || !defined(_KERNEL) || \
+	(defined(__APPLE__) && !defined(__i386__) && !defined(__x86_64__))
+#define	ZFS_REFCOUNT_TRACKING
+#endif
+#endif
+
+#ifdef ZFS_REFCOUNT_TRACKING
 typedef struct reference {
 	list_node_t ref_link;
 	void *ref_holder;
@@ -93,7 +99,7 @@ int64_t refcount_remove_many(refcount_t *rc, uint64_t number, void *holder_tag);
 void refcount_init(void);
 void refcount_fini(void);
 
-#else /* __APPLE__ || DEBUG || !_KERNEL */
+#else /* ZFS_REFCOUNT_TRACKING */
 
 typedef struct refcount {
 	uint64_t rc_count;
@@ -109,12 +115,12 @@ typedef struct refcount {
 #define	refcount_add_many(rc, number, holder) \
 	atomic_add_64_nv(&(rc)->rc_count, number)
 #define	refcount_remove_many(rc, number, holder) \
-	atomic_add_64_nv(&(rc)->rc_count, -number)
+	atomic_add_64_nv(&(rc)->rc_count, -(number))
 
 #define	refcount_init()
 #define	refcount_fini()
 
-#endif /* __APPLE__ || DEBUG || !_KERNEL */
+#endif /* ZFS_REFCOUNT_TRACKING */
 
 #ifdef	__cplusplus
 }
@@ -37,19 +37,42 @@
 extern "C" {
 #endif
 
+/*
+ * Read holds are spread over RPRW_SHARDS slots, chosen by the entering
+ * thread.  Each slot is padded so that readers on different slots don't
+ * share a cache line.  rprw_enter_read() returns the slot it used; a
+ * hold that may be dropped by another thread must record it and pass it
+ * to rprw_exit_slot().  rprw_exit() recomputes it, so it is only for
+ * holds dropped by the thread that took them.
+ */
+#define	RPRW_SHARDS	16
+#define	RPRW_SLOT_WRITER	(-1)	/* hold counted in rw_count */
+
+typedef struct rprw_shard {
+	kmutex_t	rs_lock;
+	kthread_t	*rs_writer;	/* active writer, if any */
+	kcondvar_t	rs_cv;
+	int		rs_wwait;	/* writer waiting for drain */
+	refcount_t	rs_count;	/* read holds in this slot */
+	uint8_t		rs_pad[64];
+} rprw_shard_t;
+
 typedef struct rprwlock {
 	kmutex_t	rw_lock;
-	kthread_t	*rw_writer;
+	kthread_t	*rw_wanted;	/* writer draining or active */
+	kthread_t	*rw_writer;	/* active writer */
 	kcondvar_t	rw_cv;
-	refcount_t	rw_count;
+	refcount_t	rw_count;	/* holds taken by the writer */
+	rprw_shard_t	rw_shard[RPRW_SHARDS];
 } rprwlock_t;
 
 void rprw_init(rprwlock_t *rwl);
 void rprw_destroy(rprwlock_t *rwl);
-void rprw_enter_read(rprwlock_t *rwl, void *tag);
+int rprw_enter_read(rprwlock_t *rwl, void *tag);
 void rprw_enter_write(rprwlock_t *rwl, void *tag);
 void rprw_enter(rprwlock_t *rwl, krw_t rw, void *tag);
 void rprw_exit(rprwlock_t *rwl, void *tag);
+void rprw_exit_slot(rprwlock_t *rwl, int slot, void *tag);
 boolean_t rprw_held(rprwlock_t *rwl, krw_t rw);
 #define	RPRW_READ_HELD(x)	rprw_held(x, RW_READER)
 #define	RPRW_WRITE_HELD(x)	rprw_held(x, RW_WRITER)
@@ -397,6 +397,8 @@ extern boolean_t spa_refcount_zero(spa_t *spa);
 /* Pool configuration lock */
 extern void spa_config_enter(spa_t *spa, krw_t rw, void *tag);
 extern void spa_config_exit(spa_t *spa, void *tag);
+extern int spa_config_enter_slot(spa_t *spa, void *tag);
+extern void spa_config_exit_slot(spa_t *spa, int slot, void *tag);
 extern boolean_t spa_config_held(spa_t *spa, krw_t rw);
 
 /* Pool vdev add/remove lock */
@@ -466,6 +468,10 @@ extern int spa_history_log(spa_t *spa, const char *his_buf,
 void spa_history_internal_log(history_internal_events_t event, spa_t *spa,
     dmu_tx_t *tx, cred_t *cr, const char *fmt, ...);
 
+/* txg history */
+extern void spa_txg_history_add(spa_t *spa, const txg_stat_t *ts);
+extern nvlist_t *spa_txg_history_get(spa_t *spa);
+
 /* error handling */
 struct zbookmark;
 struct zio;
@@ -39,6 +39,7 @@
 #include <sys/refcount.h>
 #include <sys/rprwlock.h>
 #include <sys/bplist.h>
+#include <sys/zcounter.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -145,6 +146,13 @@ struct spa {
 	uint64_t	spa_pool_props_object;	/* object for properties */
 	uint64_t	spa_bootfs;		/* default boot filesystem */
 	boolean_t	spa_delegation;		/* delegation on/off */
+	kmutex_t	spa_txg_hist_lock;	/* txg history lock */
+	txg_stat_t	*spa_txg_hist;		/* ring of recent txgs */
+	uint64_t	spa_txg_hist_size;	/* entries in the ring */
+	uint64_t	spa_txg_hist_count;	/* txgs recorded */
+	uint64_t	spa_txg_sync_hist[TXG_HISTOGRAM_BUCKETS];
+	uint64_t	spa_txg_quiesce_hist[TXG_HISTOGRAM_BUCKETS];
+	zcounter_set_t	spa_txg_iocount;	/* leaf writes per txg */
 	/*
 	 * spa_refcnt & spa_config_lock must be the last elements
 	 * because refcount_t changes size based on compilation options.
@@ -155,6 +163,14 @@ struct spa {
 	refcount_t	spa_refcount;		/* number of opens */
 };
 
+/*
+ * Counters in spa_txg_iocount: leaf vdev write I/Os and bytes written
+ * for each open txg.
+ */
+#define	SPA_TXG_WRITES(txg)	((txg) & TXG_MASK)
+#define	SPA_TXG_WRITTEN(txg)	(TXG_SIZE + ((txg) & TXG_MASK))
+#define	SPA_TXG_IOCOUNTERS	(2 * TXG_SIZE)
+
 extern const char *spa_config_dir;
 extern kmutex_t spa_namespace_lock;
 
@@ -68,6 +68,21 @@ typedef struct tx_state {
 	kthread_t	*tx_sync_thread;
 	kthread_t	*tx_quiesce_thread;
 	kthread_t	*tx_timelimit_thread;
+
+	/*
+	 * Timing handed from the quiesce thread to the sync thread along
+	 * with each txg, for the pool's txg history.  tx_open_time is
+	 * only used by the quiesce thread; the rest are protected by
+	 * tx_sync_lock, and the tx_syncing_* copies are stable for the
+	 * duration of spa_sync().
+	 */
+	hrtime_t	tx_open_time;	/* when tx_open_txg was opened */
+	hrtime_t	tx_quiesced_time; /* when tx_quiesced_txg was handed off */
+	uint64_t	tx_quiesced_open_ns;
+	uint64_t	tx_quiesced_quiesce_ns;
+	uint64_t	tx_syncing_open_ns;
+	uint64_t	tx_syncing_quiesce_ns;
+	uint64_t	tx_syncing_wait_ns;
 } tx_state_t;
 
 #ifdef	__cplusplus
@@ -46,6 +46,7 @@ extern boolean_t zfs_nocacheflush;
 #define	VDEV_FAULT_NONE		0
 #define	VDEV_FAULT_RANDOM	1
 #define	VDEV_FAULT_COUNT	2
+#define	VDEV_FAULT_DELAY	3	/* delay each I/O by arg msec */
 
 extern int vdev_open(vdev_t *);
 extern int vdev_validate(vdev_t *);
@@ -69,6 +70,9 @@ extern void vdev_metaslab_fini(vdev_t *vd);
 
 extern void vdev_get_stats(vdev_t *vd, vdev_stat_t *vs);
 extern void vdev_stat_update(zio_t *zio);
+extern void vdev_lat_update(vdev_t *vd, zio_t *zio, vdev_lat_kind_t kind,
+    hrtime_t delta);
+extern void vdev_get_lat_stats(vdev_t *vd, vdev_lat_stat_t *vls);
 extern void vdev_scrub_stat_update(vdev_t *vd, pool_scrub_type_t type,
     boolean_t complete);
 extern int vdev_getspec(spa_t *spa, uint64_t vdev, char **vdev_spec);
@@ -99,6 +103,8 @@ extern void vdev_cache_fini(vdev_t *vd);
 extern int vdev_cache_read(zio_t *zio);
 extern void vdev_cache_write(zio_t *zio);
 extern void vdev_cache_purge(vdev_t *vd);
+extern void vdev_cache_stat_init(void);
+extern void vdev_cache_stat_fini(void);
 
 extern void vdev_queue_init(vdev_t *vd);
 extern void vdev_queue_fini(vdev_t *vd);
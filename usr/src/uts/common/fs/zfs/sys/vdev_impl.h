@@ -36,6 +36,7 @@
 #include <sys/vdev.h>
 #include <sys/dkio.h>
 #include <sys/uberblock_impl.h>
+#include <sys/zcounter.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -86,13 +87,27 @@ struct vdev_cache_entry {
 	avl_node_t	ve_offset_node;
 	avl_node_t	ve_lastused_node;
 	uint32_t	ve_hits;
+	uint32_t	ve_used;
 	uint16_t	ve_missed_update;
 	zio_t		*ve_fill_io;
 };
 
+/*
+ * Recently missed cache regions, used to decide whether a miss shows
+ * enough locality to be worth inflating into a full cache line.
+ */
+#define	VDEV_CACHE_HIST_SIZE	128
+
+typedef struct vdev_cache_hist {
+	uint64_t	vh_region;
+	clock_t		vh_lastmiss;
+} vdev_cache_hist_t;
+
 struct vdev_cache {
 	avl_tree_t	vc_offset_tree;
 	avl_tree_t	vc_lastused_tree;
+	uint64_t	vc_size;
+	vdev_cache_hist_t vc_hist[VDEV_CACHE_HIST_SIZE];
 	kmutex_t	vc_lock;
 };
 
@@ -101,6 +116,7 @@ struct vdev_queue {
 	avl_tree_t	vq_read_tree;
 	avl_tree_t	vq_write_tree;
 	avl_tree_t	vq_pending_tree;
+	uint64_t	vq_last_offset;	/* end of last issued I/O */
 	kmutex_t	vq_lock;
 };
 
@@ -128,6 +144,8 @@ struct vdev {
 	space_map_t	vdev_dtl_map;	/* dirty time log in-core state	*/
 	space_map_t	vdev_dtl_scrub;	/* DTL for scrub repair writes	*/
 	vdev_stat_t	vdev_stat;	/* virtual device statistics	*/
+	zcounter_set_t	vdev_iocount;	/* vs_ops and vs_bytes		*/
+	zcounter_set_t	vdev_lat;	/* latency histograms (leaves)	*/
 
 	/*
 	 * Top-level vdev state.
@@ -171,6 +189,7 @@ struct vdev {
 	uint64_t	vdev_not_present; /* not present during import	*/
 	hrtime_t	vdev_last_try;	/* last reopen time		*/
 	boolean_t	vdev_nowritecache; /* true if flushwritecache failed */
+	boolean_t	vdev_nonrot;	/* non-rotational (no seek cost) */
 	uint64_t	vdev_unspare;	/* unspare when resilvering done */
 	boolean_t	vdev_checkremove; /* temporary online test	*/
 	boolean_t	vdev_forcefault; /* force online fault		*/
@@ -186,6 +205,27 @@ struct vdev {
 	kmutex_t	vdev_stat_lock;	/* vdev_stat			*/
 };
 
+/*
+ * The I/O counts in vdev_stat are updated on every I/O completion, so
+ * they are kept in the sharded vdev_iocount rather than under
+ * vdev_stat_lock; vdev_get_stats() fills them in.
+ */
+#define	VDEV_IOCOUNT_OPS(t)	(t)
+#define	VDEV_IOCOUNT_BYTES(t)	(ZIO_TYPES + (t))
+#define	VDEV_IOCOUNTERS		(2 * ZIO_TYPES)
+
+/*
+ * Leaf vdevs keep their latency histograms in the sharded vdev_lat, one
+ * counter per vdev_lat_stat_t bucket in array order, so that I/O
+ * completions on different threads rarely touch the same cache lines;
+ * vdev_get_lat_stats() adds them up.
+ */
+#define	VDEV_LAT_INDEX(t, c, k, b)	\
+	((((t) * VDEV_LAT_CLASSES + (c)) * VDEV_LAT_KINDS + (k)) * \
+	VDEV_LAT_BUCKETS + (b))
+#define	VDEV_LAT_COUNTERS	\
+	(sizeof (vdev_lat_stat_t) / sizeof (uint64_t))
+
 #define	VDEV_SKIP_SIZE		(8 << 10)
 #define	VDEV_BOOT_HEADER_SIZE	(8 << 10)
 #define	VDEV_PHYS_SIZE		(112 << 10)
@@ -262,6 +262,29 @@ uint64_t zap_cursor_serialize(zap_cursor_t *zc);
 void zap_cursor_init_serialized(zap_cursor_t *zc, objset_t *ds,
     uint64_t zapobj, uint64_t serialized);
 
+/*
+ * Readahead of the objects named by a zapobj's entries, for a reader
+ * that walks it with a cursor and then reads each entry's object (as a
+ * readdir does); see zap_ra_init().
+ */
+#define	ZAP_RA_BLKS	8	/* recently prefetched dnode blocks */
+
+typedef struct zap_ra {
+	zap_cursor_t	zr_zc;		/* lookahead cursor */
+	zap_attribute_t	zr_za;
+	objset_t	*zr_os;
+	uint32_t	zr_window;	/* entries to keep in flight */
+	uint32_t	zr_ahead;	/* entries issued past the reader */
+	boolean_t	zr_eof;
+	int		zr_rotor;
+	uint64_t	zr_blks[ZAP_RA_BLKS];
+} zap_ra_t;
+
+zap_ra_t *zap_ra_init(objset_t *os, uint64_t zapobj, uint64_t serialized,
+    uint32_t window);
+void zap_ra_advance(zap_ra_t *ra);
+void zap_ra_fini(zap_ra_t *ra);
+
 
 #define	ZAP_HISTOGRAM_SIZE 10
 
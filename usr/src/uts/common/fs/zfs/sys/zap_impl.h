@@ -150,7 +150,9 @@ typedef struct zap {
 
 			/*
 			 * zap_num_entries_mtx protects
-			 * zap_num_entries
+			 * zap_num_entries, and zap_freeblk and
+			 * zap_num_leafs while leaves are being split
+			 * under a reader hold on zap_rwlock
 			 */
 			kmutex_t zap_num_entries_mtx;
 			int zap_block_shift;
@@ -0,0 +1,92 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_SYS_ZCOUNTER_H
+#define	_SYS_ZCOUNTER_H
+
+#pragma ident	"%Z%%M%	%I%	%E% SMI"
+
+#include <sys/zfs_context.h>
+#include <sys/kstat.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sharded statistics counters.
+ *
+ * A zcounter set is an array of 64-bit counters, replicated once per shard.
+ * An update only touches the shard picked for the current thread, so
+ * concurrent updaters rarely share a cache line; the value of a counter is
+ * the sum over all shards, and is only computed when somebody asks for it.
+ * This suits counters that are bumped on every I/O but only read when the
+ * statistics are looked at.
+ *
+ * A counter may be decremented, and a counter that was read can be reset
+ * without losing concurrent updates by adding back the negated value.
+ *
+ * Counters that are also read on hot paths, such as the ARC size, use a
+ * zcounter_approx_t instead: each shard accumulates a local delta and
+ * folds it into a shared total once it reaches zca_batch in either
+ * direction.  Reading is a single load, and the total is off by less
+ * than ZCOUNTER_SHARDS * zca_batch.
+ */
+#define	ZCOUNTER_SHARDS		16
+#define	ZCOUNTER_ALIGN		64
+
+typedef struct zcounter_set {
+	uint64_t	*zcs_shard;	/* ZCOUNTER_SHARDS * zcs_stride */
+	void		*zcs_buf;	/* allocation backing zcs_shard */
+	size_t		zcs_bufsize;
+	uint32_t	zcs_count;	/* counters per shard */
+	uint32_t	zcs_stride;	/* uint64_t's per shard */
+} zcounter_set_t;
+
+typedef struct zcounter_approx {
+	int64_t		zca_total;	/* folded shard deltas */
+	int64_t		zca_batch;	/* fold a shard at this magnitude */
+	zcounter_set_t	zca_delta;	/* per-shard deltas not yet folded */
+} zcounter_approx_t;
+
+/*
+ * Index of a kstat_named_t within a structure of them, for sets whose
+ * counters back the leading members of a named kstat.
+ */
+#define	ZCOUNTER_KSTAT_INDEX(type, member) \
+	(offsetof(type, member) / sizeof (kstat_named_t))
+
+extern uint32_t zcounter_shard(void);
+extern void zcounter_set_create(zcounter_set_t *zcs, uint32_t count);
+extern void zcounter_set_destroy(zcounter_set_t *zcs);
+extern void zcounter_add(zcounter_set_t *zcs, uint32_t idx, int64_t delta);
+extern uint64_t zcounter_value(zcounter_set_t *zcs, uint32_t idx);
+extern int zcounter_kstat_update(kstat_t *ksp, int rw);
+extern void zcounter_approx_create(zcounter_approx_t *zca, int64_t batch);
+extern void zcounter_approx_destroy(zcounter_approx_t *zca);
+extern void zcounter_approx_add(zcounter_approx_t *zca, int64_t delta);
+extern uint64_t zcounter_approx_value(zcounter_approx_t *zca);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_ZCOUNTER_H */
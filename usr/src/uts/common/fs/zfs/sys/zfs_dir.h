@@ -32,6 +32,7 @@
 #pragma ident	"%Z%%M%	%I%	%E% SMI"
 
 #include <sys/dmu.h>
+#include <sys/zap.h>
 #include <sys/zfs_znode.h>
 
 #ifdef	__cplusplus
@@ -78,6 +79,10 @@ extern int zfs_sticky_remove_access(znode_t *, znode_t *, cred_t *cr);
 extern int zfs_get_xattrdir(znode_t *, vnode_t **, cred_t *, int);
 extern int zfs_make_xattrdir(znode_t *, vattr_t *, vnode_t **, cred_t *);
 
+extern int zfs_dir_ra_window;
+
+extern zap_ra_t *zfs_dir_ra_init(znode_t *, uint64_t);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -119,6 +119,15 @@ typedef struct zinject_record {
 #define	ZINJECT_FLUSH_ARC	0x2
 #define	ZINJECT_UNLOAD_SPA	0x4
 
+/*
+ * ZFS_IOC_LIST_BATCH flags (zc_obj) and the names of the members of each
+ * returned entry.
+ */
+#define	ZFS_LIST_BATCH_SNAPSHOTS	0x1
+#define	ZFS_LIST_BATCH_MAX		1024
+#define	ZFS_LIST_BATCH_STATS		"stats"
+#define	ZFS_LIST_BATCH_PROPS		"props"
+
 typedef struct zfs_share {
 	uint64_t	z_exportdata;
 	uint64_t	z_sharedata;
@@ -164,6 +173,7 @@ extern int zfs_secpolicy_rename_perms(const char *from,
 extern int zfs_secpolicy_destroy_perms(const char *name, cred_t *cr);
 extern int zfs_busy(void);
 extern int zfs_unmount_snap(char *, void *);
+extern int zfs_ioc_count(void);
 
 #endif	/* _KERNEL */
 
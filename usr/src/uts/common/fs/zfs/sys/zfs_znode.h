@@ -341,6 +341,7 @@ extern void	zfs_zinactive(znode_t *);
 extern int	zfs_attach_vnode(znode_t *zp);
 extern int	zfs_zget_sans_vnode(zfsvfs_t *, uint64_t, znode_t **);
 extern uint32_t	zfs_getbsdflags(znode_t *zp);
+extern uint32_t	zfs_phys_getbsdflags(znode_phys_t *pzp);
 extern void	zfs_setbsdflags(znode_t *zp, uint32_t bsdflags);
 #endif
 extern void	zfs_znode_delete(znode_t *, dmu_tx_t *);
@@ -144,6 +144,7 @@ enum zio_compress {
 #define	ZIO_FLAG_USER			0x20000
 
 #define	ZIO_FLAG_METADATA		0x40000
+#define	ZIO_FLAG_KEEP_COMPRESSED	0x80000
 
 #define	ZIO_FLAG_GANG_INHERIT		\
 	(ZIO_FLAG_CANFAIL |		\
@@ -227,6 +228,8 @@ struct zio {
 	/* Data represented by this I/O */
 	void		*io_data;
 	uint64_t	io_size;
+	void		*io_cdata;	/* kept compressed data, if any */
+	uint64_t	io_csize;
 
 	/* Stuff for the vdev stack */
 	vdev_t		*io_vd;
@@ -234,6 +237,8 @@ struct zio {
 	uint64_t	io_offset;
 	uint64_t	io_deadline;
 	uint64_t	io_timestamp;
+	hrtime_t	io_queue_time;	/* entered the vdev queue */
+	hrtime_t	io_issue_time;	/* issued to the device */
 	avl_node_t	io_offset_node;
 	avl_node_t	io_deadline_node;
 	avl_tree_t	*io_vdev_tree;
@@ -242,6 +247,7 @@ struct zio {
 
 	/* Internal pipeline state */
 	int		io_flags;
+	int		io_config_slot;	/* for ZIO_FLAG_CONFIG_GRABBED */
 	enum zio_type	io_type;
 	enum zio_stage	io_stage;
 	uint8_t		io_stalled;
@@ -60,6 +60,7 @@ txg_init(dsl_pool_t *dp, uint64_t txg)
 	mutex_init(&tx->tx_sync_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	tx->tx_open_txg = txg;
+	tx->tx_open_time = gethrtime();
 }
 
 /*
@@ -303,6 +304,9 @@ txg_sync_thread(dsl_pool_t *dp)
 		txg = tx->tx_quiesced_txg;
 		tx->tx_quiesced_txg = 0;
 		tx->tx_syncing_txg = txg;
+		tx->tx_syncing_open_ns = tx->tx_quiesced_open_ns;
+		tx->tx_syncing_quiesce_ns = tx->tx_quiesced_quiesce_ns;
+		tx->tx_syncing_wait_ns = gethrtime() - tx->tx_quiesced_time;
 		cv_broadcast(&tx->tx_quiesce_more_cv);
 		rw_exit(&tx->tx_suspend);
 
@@ -330,6 +334,7 @@ txg_quiesce_thread(dsl_pool_t *dp)
 
 	for (;;) {
 		uint64_t txg;
+		hrtime_t start;
 
 		/*
 		 * We quiesce when there's someone waiting on us.
@@ -351,6 +356,7 @@ txg_quiesce_thread(dsl_pool_t *dp)
 		    txg, tx->tx_quiesce_txg_waiting,
 		    tx->tx_sync_txg_waiting);
 		mutex_exit(&tx->tx_sync_lock);
+		start = gethrtime();
 		txg_quiesce(dp, txg);
 		mutex_enter(&tx->tx_sync_lock);
 
@@ -359,6 +365,10 @@ txg_quiesce_thread(dsl_pool_t *dp)
 		 */
 		dprintf("quiesce done, handing off txg %llu\n", txg);
 		tx->tx_quiesced_txg = txg;
+		tx->tx_quiesced_time = gethrtime();
+		tx->tx_quiesced_open_ns = start - tx->tx_open_time;
+		tx->tx_quiesced_quiesce_ns = tx->tx_quiesced_time - start;
+		tx->tx_open_time = start;
 		cv_broadcast(&tx->tx_sync_more_cv);
 		cv_broadcast(&tx->tx_quiesce_done_cv);
 	}
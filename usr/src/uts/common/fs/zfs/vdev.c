@@ -32,6 +32,7 @@
 #include <sys/spa_impl.h>
 #include <sys/dmu.h>
 #include <sys/dmu_tx.h>
+#include <sys/dnode.h>
 #include <sys/vdev_impl.h>
 #include <sys/uberblock_impl.h>
 #include <sys/metaslab.h>
@@ -319,6 +320,9 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 	txg_list_create(&vd->vdev_dtl_list,
 	    offsetof(struct vdev, vdev_dtl_node));
 	vd->vdev_stat.vs_timestamp = gethrtime();
+	zcounter_set_create(&vd->vdev_iocount, VDEV_IOCOUNTERS);
+	if (ops->vdev_op_leaf)
+		zcounter_set_create(&vd->vdev_lat, VDEV_LAT_COUNTERS);
 	vdev_queue_init(vd);
 	vdev_cache_init(vd);
 
@@ -541,6 +545,9 @@ vdev_free(vdev_t *vd)
 	vdev_queue_fini(vd);
 	vdev_cache_fini(vd);
 
+	if (vd->vdev_ops->vdev_op_leaf)
+		zcounter_set_destroy(&vd->vdev_lat);
+
 	if (vd->vdev_path)
 		spa_strfree(vd->vdev_path);
 	if (vd->vdev_devid)
@@ -561,6 +568,7 @@ vdev_free(vdev_t *vd)
 	mutex_exit(&vd->vdev_dtl_lock);
 	mutex_destroy(&vd->vdev_dtl_lock);
 	mutex_destroy(&vd->vdev_stat_lock);
+	zcounter_set_destroy(&vd->vdev_iocount);
 
 	if (vd == spa->spa_root_vdev)
 		spa->spa_root_vdev = NULL;
@@ -724,6 +732,7 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 	uint64_t m;
 	uint64_t oldc = vd->vdev_ms_count;
 	uint64_t newc = vd->vdev_asize >> vd->vdev_ms_shift;
+	uint64_t *objs = NULL, lastblk = -1ULL;
 	metaslab_t **mspp;
 	int error;
 
@@ -752,19 +761,42 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 	vd->vdev_ms = mspp;
 	vd->vdev_ms_count = newc;
 
+	/*
+	 * When loading, read the whole metaslab array at once and prefetch
+	 * the space map dnodes, one request per dnode block, rather than
+	 * taking a cold read for each metaslab in turn.
+	 */
+	if (txg == 0 && newc > oldc) {
+		objs = kmem_zalloc((newc - oldc) * sizeof (uint64_t), KM_SLEEP);
+		error = dmu_read(mos, vd->vdev_ms_array,
+		    oldc * sizeof (uint64_t), (newc - oldc) * sizeof (uint64_t),
+		    objs);
+		if (error) {
+			kmem_free(objs, (newc - oldc) * sizeof (uint64_t));
+			return (error);
+		}
+		for (m = oldc; m < newc; m++) {
+			uint64_t object = objs[m - oldc];
+			if (object != 0 &&
+			    (object >> DNODES_PER_BLOCK_SHIFT) != lastblk) {
+				lastblk = object >> DNODES_PER_BLOCK_SHIFT;
+				dmu_prefetch(mos, object, 0, 0);
+			}
+		}
+	}
+
 	for (m = oldc; m < newc; m++) {
 		space_map_obj_t smo = { 0, 0, 0 };
 		if (txg == 0) {
-			uint64_t object = 0;
-			error = dmu_read(mos, vd->vdev_ms_array,
-			    m * sizeof (uint64_t), sizeof (uint64_t), &object);
-			if (error)
-				return (error);
+			uint64_t object = objs[m - oldc];
 			if (object != 0) {
 				dmu_buf_t *db;
 				error = dmu_bonus_hold(mos, object, FTAG, &db);
-				if (error)
+				if (error) {
+					kmem_free(objs,
+					    (newc - oldc) * sizeof (uint64_t));
 					return (error);
+				}
 				ASSERT3U(db->db_size, >=, sizeof (smo));
 				bcopy(db->db_data, &smo, sizeof (smo));
 				ASSERT3U(smo.smo_object, ==, object);
@@ -775,6 +807,9 @@ vdev_metaslab_init(vdev_t *vd, uint64_t txg)
 		    m << vd->vdev_ms_shift, 1ULL << vd->vdev_ms_shift, txg);
 	}
 
+	if (objs != NULL)
+		kmem_free(objs, (newc - oldc) * sizeof (uint64_t));
+
 	return (0);
 }
 
@@ -1722,6 +1757,10 @@ vdev_error_inject(vdev_t *vd, zio_t *zio)
 			vd->vdev_fault_mode = VDEV_FAULT_NONE;
 		error = EIO;
 		break;
+
+	case VDEV_FAULT_DELAY:
+		delay(MAX(1, vd->vdev_fault_arg * hz / 1000));
+		break;
 	}
 
 	return (error);
@@ -1743,6 +1782,13 @@ vdev_get_stats(vdev_t *vd, vdev_stat_t *vs)
 	vs->vs_rsize = vdev_get_rsize(vd);
 	mutex_exit(&vd->vdev_stat_lock);
 
+	for (t = 0; t < ZIO_TYPES; t++) {
+		vs->vs_ops[t] = zcounter_value(&vd->vdev_iocount,
+		    VDEV_IOCOUNT_OPS(t));
+		vs->vs_bytes[t] = zcounter_value(&vd->vdev_iocount,
+		    VDEV_IOCOUNT_BYTES(t));
+	}
+
 	/*
 	 * If we're getting stats on the root vdev, aggregate the I/O counts
 	 * over all top-level vdevs (i.e. the direct children of the root).
@@ -1752,11 +1798,14 @@ vdev_get_stats(vdev_t *vd, vdev_stat_t *vs)
 			vdev_t *cvd = rvd->vdev_child[c];
 			vdev_stat_t *cvs = &cvd->vdev_stat;
 
-			mutex_enter(&vd->vdev_stat_lock);
 			for (t = 0; t < ZIO_TYPES; t++) {
-				vs->vs_ops[t] += cvs->vs_ops[t];
-				vs->vs_bytes[t] += cvs->vs_bytes[t];
+				vs->vs_ops[t] += zcounter_value(
+				    &cvd->vdev_iocount, VDEV_IOCOUNT_OPS(t));
+				vs->vs_bytes[t] += zcounter_value(
+				    &cvd->vdev_iocount, VDEV_IOCOUNT_BYTES(t));
 			}
+
+			mutex_enter(&vd->vdev_stat_lock);
 			vs->vs_read_errors += cvs->vs_read_errors;
 			vs->vs_write_errors += cvs->vs_write_errors;
 			vs->vs_checksum_errors += cvs->vs_checksum_errors;
@@ -1767,6 +1816,72 @@ vdev_get_stats(vdev_t *vd, vdev_stat_t *vs)
 	}
 }
 
+/*
+ * Count one queue wait or device service time in the histograms of a
+ * leaf vdev.
+ */
+void
+vdev_lat_update(vdev_t *vd, zio_t *zio, vdev_lat_kind_t kind, hrtime_t delta)
+{
+	uint64_t us;
+	int t, c, b;
+
+	if (!vd->vdev_ops->vdev_op_leaf)
+		return;
+
+	if (zio->io_type == ZIO_TYPE_READ)
+		t = VDEV_LAT_READ;
+	else if (zio->io_type == ZIO_TYPE_WRITE)
+		t = VDEV_LAT_WRITE;
+	else
+		return;
+
+	if (zio->io_priority == 0)
+		c = VDEV_LAT_SYNC;
+	else if (zio->io_priority < ZIO_PRIORITY_RESILVER)
+		c = VDEV_LAT_ASYNC;
+	else
+		c = VDEV_LAT_SCRUB;
+
+	us = delta > 0 ? delta / (NANOSEC / MICROSEC) : 0;
+	for (b = 0; us > 1 && b < VDEV_LAT_BUCKETS - 1; b++)
+		us >>= 1;
+
+	zcounter_add(&vd->vdev_lat, VDEV_LAT_INDEX(t, c, kind, b), 1);
+}
+
+/*
+ * Sum the latency histograms of a vdev: the shards of a leaf, or the
+ * leaves below an interior vdev.
+ */
+void
+vdev_get_lat_stats(vdev_t *vd, vdev_lat_stat_t *vls)
+{
+	uint64_t *dst = (uint64_t *)vls;
+	int n = VDEV_LAT_COUNTERS;
+	int c, i;
+
+	bzero(vls, sizeof (vdev_lat_stat_t));
+
+	if (vd->vdev_ops->vdev_op_leaf) {
+		for (i = 0; i < n; i++)
+			dst[i] = zcounter_value(&vd->vdev_lat, i);
+		return;
+	}
+
+	for (c = 0; c < vd->vdev_children; c++) {
+		vdev_lat_stat_t *cvls;
+		uint64_t *src;
+
+		cvls = kmem_alloc(sizeof (vdev_lat_stat_t), KM_SLEEP);
+		vdev_get_lat_stats(vd->vdev_child[c], cvls);
+		src = (uint64_t *)cvls;
+		for (i = 0; i < n; i++)
+			dst[i] += src[i];
+		kmem_free(cvls, sizeof (vdev_lat_stat_t));
+	}
+}
+
 void
 vdev_stat_update(zio_t *zio)
 {
@@ -1779,10 +1894,19 @@ vdev_stat_update(zio_t *zio)
 
 	if (zio->io_error == 0) {
 		if (!(flags & ZIO_FLAG_IO_BYPASS)) {
-			mutex_enter(&vd->vdev_stat_lock);
-			vs->vs_ops[type]++;
-			vs->vs_bytes[type] += zio->io_size;
-			mutex_exit(&vd->vdev_stat_lock);
+			zcounter_add(&vd->vdev_iocount, VDEV_IOCOUNT_OPS(type),
+			    1);
+			zcounter_add(&vd->vdev_iocount,
+			    VDEV_IOCOUNT_BYTES(type), zio->io_size);
+		}
+		if (type == ZIO_TYPE_WRITE && txg != 0 &&
+		    vd->vdev_ops->vdev_op_leaf) {
+			spa_t *spa = zio->io_spa;
+
+			zcounter_add(&spa->spa_txg_iocount,
+			    SPA_TXG_WRITES(txg), 1);
+			zcounter_add(&spa->spa_txg_iocount,
+			    SPA_TXG_WRITTEN(txg), zio->io_size);
 		}
 		if ((flags & ZIO_FLAG_IO_REPAIR) &&
 		    zio->io_delegate_list == NULL) {
@@ -29,6 +29,7 @@
 #include <sys/spa.h>
 #include <sys/vdev_impl.h>
 #include <sys/zio.h>
+#include <sys/zcounter.h>
 
 /*
  * Virtual device read-ahead caching.
@@ -40,12 +41,14 @@
  * reads into a single 128k read followed by 255 cache hits; this reduces
  * latency dramatically.  In the worst case, it can turn an isolated 512-byte
  * read into a 128k read, which doesn't affect latency all that much but is
- * terribly wasteful of bandwidth.  A more intelligent version of the cache
- * could keep track of access patterns and not do read-ahead unless it sees
- * at least two temporally close I/Os to the same region.  Currently, only
- * metadata I/O is inflated.  A futher enhancement could take advantage of
- * more semantic information about the I/O.  And it could use something
- * faster than an AVL tree; that was chosen solely for convenience.
+ * terribly wasteful of bandwidth.  To avoid the worst case, each vdev keeps
+ * a small history of recently missed regions, and a miss is only inflated
+ * if the same region or the one immediately before it was missed within
+ * the last zfs_vdev_cache_window_ms; an isolated read goes to disk as-is.
+ * Currently, only metadata I/O is inflated.  A futher enhancement could
+ * take advantage of more semantic information about the I/O.  And it could
+ * use something faster than an AVL tree; that was chosen solely for
+ * convenience.
  *
  * There are five cache operations: allocate, fill, read, write, evict.
  *
@@ -61,7 +64,14 @@
  * (4) Write.  Update cache contents after write completion.
  *
  * (5) Evict.  When allocating a new entry, we evict the oldest (LRU) entry
- *     if the total cache size exceeds zfs_vdev_cache_size.
+ *     if the total cache size exceeds the vdev's current limit, vc_size.
+ *
+ * Each vdev's limit starts at zfs_vdev_cache_size and adapts to how useful
+ * its cache is: if the LRU entry was hit again after it was filled, the
+ * cache grows by one line instead of evicting it; if it never was, the
+ * cache shrinks by one line, down to zfs_vdev_cache_size_min.  Growth is
+ * capped at zfs_vdev_cache_size_total split evenly across all leaf vdevs,
+ * so the total memory used scales with the number of vdevs.
  */
 
 /*
@@ -70,15 +80,61 @@
 /*
  * All i/os smaller than zfs_vdev_cache_max will be turned into
  * 1<<zfs_vdev_cache_bshift byte reads by the vdev_cache (aka software
- * track buffer.  At most zfs_vdev_cache_size bytes will be kept in each
- * vdev's vdev_cache.
+ * track buffer.  Each vdev's vdev_cache starts out holding at most
+ * zfs_vdev_cache_size bytes, and adapts between zfs_vdev_cache_size_min
+ * and its share of zfs_vdev_cache_size_total.  Setting zfs_vdev_cache_size
+ * to zero disables the cache.  Setting zfs_vdev_cache_window_ms to zero
+ * inflates every metadata miss.
  */
 int zfs_vdev_cache_max = 1<<14;
 int zfs_vdev_cache_size = 10ULL << 20;
+int zfs_vdev_cache_size_min = 1ULL << 20;
+uint64_t zfs_vdev_cache_size_total = 256ULL << 20;
 int zfs_vdev_cache_bshift = 16;
+int zfs_vdev_cache_window_ms = 1000;
 
 #define	VCBS (1 << zfs_vdev_cache_bshift)
 
+/*
+ * Number of leaf vdevs sharing zfs_vdev_cache_size_total.
+ */
+static uint32_t vdev_cache_nleaves;
+
+typedef struct vdev_cache_stats {
+	kstat_named_t vcs_delegations;
+	kstat_named_t vcs_hits;
+	kstat_named_t vcs_misses;
+	kstat_named_t vcs_inflations;
+	kstat_named_t vcs_inflations_skipped;
+	kstat_named_t vcs_evictions;
+	kstat_named_t vcs_wasted_bytes;
+	kstat_named_t vcs_grows;
+	kstat_named_t vcs_shrinks;
+} vdev_cache_stats_t;
+
+static vdev_cache_stats_t vdev_cache_stats = {
+	{ "delegations",		KSTAT_DATA_UINT64 },
+	{ "hits",			KSTAT_DATA_UINT64 },
+	{ "misses",			KSTAT_DATA_UINT64 },
+	{ "inflations",			KSTAT_DATA_UINT64 },
+	{ "inflations_skipped",		KSTAT_DATA_UINT64 },
+	{ "evictions",			KSTAT_DATA_UINT64 },
+	{ "wasted_bytes",		KSTAT_DATA_UINT64 },
+	{ "grows",			KSTAT_DATA_UINT64 },
+	{ "shrinks",			KSTAT_DATA_UINT64 }
+};
+
+static zcounter_set_t vdev_cache_counters;
+
+#define	VCSTAT_INDEX(stat)	ZCOUNTER_KSTAT_INDEX(vdev_cache_stats_t, stat)
+
+#define	VCSTAT_INCR(stat, val) \
+	zcounter_add(&vdev_cache_counters, VCSTAT_INDEX(stat), (val));
+
+#define	VCSTAT_BUMP(stat)	VCSTAT_INCR(stat, 1)
+
+static kstat_t *vdev_cache_ksp;
+
 static int
 vdev_cache_offset_compare(const void *a1, const void *a2)
 {
@@ -123,12 +179,31 @@ vdev_cache_evict(vdev_cache_t *vc, vdev_cache_entry_t *ve)
 	    vc, ve->ve_offset, ve->ve_lastused, lbolt - ve->ve_lastused,
 	    ve->ve_hits, ve->ve_missed_update);
 
+	/*
+	 * Whatever part of the line was never handed back to a reader
+	 * was read from disk for nothing.
+	 */
+	VCSTAT_BUMP(vcs_evictions);
+	VCSTAT_INCR(vcs_wasted_bytes, VCBS - ve->ve_used);
+
 	avl_remove(&vc->vc_lastused_tree, ve);
 	avl_remove(&vc->vc_offset_tree, ve);
 	zio_buf_free(ve->ve_data, VCBS);
 	kmem_free(ve, sizeof (vdev_cache_entry_t));
 }
 
+/*
+ * The most a single vdev's cache may grow to.
+ */
+static uint64_t
+vdev_cache_size_max(void)
+{
+	uint32_t nleaves = MAX(vdev_cache_nleaves, 1);
+
+	return (MAX(zfs_vdev_cache_size_total / nleaves,
+	    (uint64_t)zfs_vdev_cache_size));
+}
+
 /*
  * Allocate an entry in the cache.  At the point we don't have the data,
  * we're just creating a placeholder so that multiple threads don't all
@@ -147,18 +222,38 @@ vdev_cache_allocate(zio_t *zio)
 		return (NULL);
 
 	/*
-	 * If adding a new entry would exceed the cache size,
-	 * evict the oldest entry (LRU).
+	 * If adding a new entry would exceed the cache size, either grow
+	 * the cache (if the oldest entry proved useful) or evict the oldest
+	 * entry (LRU), shrinking the cache if that entry was never reused.
+	 * An entry that earned a grow moves to the MRU end with its hits
+	 * reset, so it must be reused again before it can earn another;
+	 * once the cache is at its maximum size it is evicted like any
+	 * other.
 	 */
 	if ((avl_numnodes(&vc->vc_lastused_tree) << zfs_vdev_cache_bshift) >
-	    zfs_vdev_cache_size) {
+	    vc->vc_size) {
 		ve = avl_first(&vc->vc_lastused_tree);
 		if (ve->ve_fill_io != NULL) {
 			dprintf("can't evict in %p, still filling\n", vc);
 			return (NULL);
 		}
 		ASSERT(ve->ve_hits != 0);
-		vdev_cache_evict(vc, ve);
+		if (ve->ve_hits > 1 && vc->vc_size + VCBS <=
+		    vdev_cache_size_max()) {
+			vc->vc_size += VCBS;
+			VCSTAT_BUMP(vcs_grows);
+			avl_remove(&vc->vc_lastused_tree, ve);
+			ve->ve_lastused = lbolt;
+			ve->ve_hits = 1;
+			avl_add(&vc->vc_lastused_tree, ve);
+		} else {
+			if (ve->ve_hits == 1 && vc->vc_size >=
+			    (uint64_t)zfs_vdev_cache_size_min + VCBS) {
+				vc->vc_size -= VCBS;
+				VCSTAT_BUMP(vcs_shrinks);
+			}
+			vdev_cache_evict(vc, ve);
+		}
 	}
 
 	ve = kmem_zalloc(sizeof (vdev_cache_entry_t), KM_SLEEP);
@@ -187,6 +282,7 @@ vdev_cache_hit(vdev_cache_t *vc, vdev_cache_entry_t *ve, zio_t *zio)
 	}
 
 	ve->ve_hits++;
+	ve->ve_used = MIN(ve->ve_used + zio->io_size, VCBS);
 	bcopy(ve->ve_data + cache_phase, zio->io_data, zio->io_size);
 }
 
@@ -235,6 +331,37 @@ vdev_cache_fill(zio_t *zio)
 	}
 }
 
+/*
+ * Record a miss on the given region and report whether it, or the region
+ * just before it, was also missed recently enough to suggest locality.
+ */
+static boolean_t
+vdev_cache_locality(vdev_cache_t *vc, uint64_t region)
+{
+	clock_t window = ((clock_t)zfs_vdev_cache_window_ms * hz) / 1000;
+	clock_t now = lbolt;
+	vdev_cache_hist_t *vh, *pvh;
+	boolean_t local;
+
+	ASSERT(MUTEX_HELD(&vc->vc_lock));
+
+	if (zfs_vdev_cache_window_ms == 0)
+		return (B_TRUE);
+
+	vh = &vc->vc_hist[region % VDEV_CACHE_HIST_SIZE];
+	pvh = &vc->vc_hist[(region - 1) % VDEV_CACHE_HIST_SIZE];
+
+	local = (vh->vh_lastmiss != 0 && vh->vh_region == region &&
+	    now - vh->vh_lastmiss <= window) ||
+	    (pvh->vh_lastmiss != 0 && pvh->vh_region == region - 1 &&
+	    now - pvh->vh_lastmiss <= window);
+
+	vh->vh_region = region;
+	vh->vh_lastmiss = now;
+
+	return (local);
+}
+
 /*
  * Read data from the cache.  Returns 0 on cache hit, errno on a miss.
  */
@@ -279,22 +406,32 @@ vdev_cache_read(zio_t *zio)
 			fio->io_delegate_list = zio;
 			zio_vdev_io_bypass(zio);
 			mutex_exit(&vc->vc_lock);
+			VCSTAT_BUMP(vcs_delegations);
 			return (0);
 		}
 
 		vdev_cache_hit(vc, ve, zio);
 		zio_vdev_io_bypass(zio);
+		VCSTAT_BUMP(vcs_hits);
 
 		mutex_exit(&vc->vc_lock);
 		zio_next_stage(zio);
 		return (0);
 	}
 
+	VCSTAT_BUMP(vcs_misses);
+
 	if (!(zio->io_flags & ZIO_FLAG_METADATA)) {
 		mutex_exit(&vc->vc_lock);
 		return (EINVAL);
 	}
 
+	if (!vdev_cache_locality(vc, cache_offset >> zfs_vdev_cache_bshift)) {
+		mutex_exit(&vc->vc_lock);
+		VCSTAT_BUMP(vcs_inflations_skipped);
+		return (ENOENT);
+	}
+
 	ve = vdev_cache_allocate(zio);
 
 	if (ve == NULL) {
@@ -302,6 +439,8 @@ vdev_cache_read(zio_t *zio)
 		return (ENOMEM);
 	}
 
+	VCSTAT_BUMP(vcs_inflations);
+
 	fio = zio_vdev_child_io(zio, NULL, zio->io_vd, cache_offset,
 	    ve->ve_data, VCBS, ZIO_TYPE_READ, ZIO_PRIORITY_CACHE_FILL,
 	    ZIO_FLAG_DONT_CACHE | ZIO_FLAG_DONT_PROPAGATE |
@@ -376,6 +515,10 @@ vdev_cache_init(vdev_t *vd)
 
 	mutex_init(&vc->vc_lock, NULL, MUTEX_DEFAULT, NULL);
 
+	vc->vc_size = zfs_vdev_cache_size;
+	if (vd->vdev_ops->vdev_op_leaf)
+		atomic_add_32(&vdev_cache_nleaves, 1);
+
 	avl_create(&vc->vc_offset_tree, vdev_cache_offset_compare,
 	    sizeof (vdev_cache_entry_t),
 	    offsetof(struct vdev_cache_entry, ve_offset_node));
@@ -392,8 +535,40 @@ vdev_cache_fini(vdev_t *vd)
 
 	vdev_cache_purge(vd);
 
+	if (vd->vdev_ops->vdev_op_leaf)
+		atomic_add_32(&vdev_cache_nleaves, -1);
+
 	avl_destroy(&vc->vc_offset_tree);
 	avl_destroy(&vc->vc_lastused_tree);
 
 	mutex_destroy(&vc->vc_lock);
 }
+
+void
+vdev_cache_stat_init(void)
+{
+	zcounter_set_create(&vdev_cache_counters,
+	    sizeof (vdev_cache_stats) / sizeof (kstat_named_t));
+
+	vdev_cache_ksp = kstat_create("zfs", 0, "vdev_cache_stats", "misc",
+	    KSTAT_TYPE_NAMED, sizeof (vdev_cache_stats) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+
+	if (vdev_cache_ksp != NULL) {
+		vdev_cache_ksp->ks_data = &vdev_cache_stats;
+		vdev_cache_ksp->ks_private = &vdev_cache_counters;
+		vdev_cache_ksp->ks_update = zcounter_kstat_update;
+		kstat_install(vdev_cache_ksp);
+	}
+}
+
+void
+vdev_cache_stat_fini(void)
+{
+	if (vdev_cache_ksp != NULL) {
+		kstat_delete(vdev_cache_ksp);
+		vdev_cache_ksp = NULL;
+	}
+
+	zcounter_set_destroy(&vdev_cache_counters);
+}
@@ -159,6 +159,21 @@ vdev_disk_open(vdev_t *vd, uint64_t *psize, uint64_t *ashift)
 	 * try again.
 	 */
 	vd->vdev_nowritecache = B_FALSE;
+
+	/*
+	 * Solid-state devices have no seek penalty, which changes how
+	 * mirrors pick the child to read from.
+	 */
+	vd->vdev_nonrot = B_FALSE;
+#ifdef DKIOCISSOLIDSTATE
+	{
+		uint32_t ssd = 0;
+
+		if (VNOP_IOCTL(devvp, DKIOCISSOLIDSTATE, (caddr_t)&ssd, 0,
+		    context) == 0)
+			vd->vdev_nonrot = (ssd != 0);
+	}
+#endif
 	vd->vdev_tsd = dvd;
 	dvd->vd_devvp = devvp;
 out:
@@ -264,9 +264,17 @@ vdev_config_generate(spa_t *spa, vdev_t *vd, boolean_t getstats,
 
 	if (getstats) {
 		vdev_stat_t vs;
+		vdev_lat_stat_t *vls;
+
 		vdev_get_stats(vd, &vs);
 		VERIFY(nvlist_add_uint64_array(nv, ZPOOL_CONFIG_STATS,
 		    (uint64_t *)&vs, sizeof (vs) / sizeof (uint64_t)) == 0);
+
+		vls = kmem_alloc(sizeof (vdev_lat_stat_t), KM_SLEEP);
+		vdev_get_lat_stats(vd, vls);
+		VERIFY(nvlist_add_uint64_array(nv, ZPOOL_CONFIG_LATENCY,
+		    (uint64_t *)vls, sizeof (*vls) / sizeof (uint64_t)) == 0);
+		kmem_free(vls, sizeof (vdev_lat_stat_t));
 	}
 
 	if (!vd->vdev_ops->vdev_op_leaf) {
@@ -53,6 +53,21 @@ typedef struct mirror_map {
 
 int vdev_mirror_shift = 21;
 
+/*
+ * Read balancing.  With vdev_mirror_balance set, reads go to the usable
+ * child with the lowest cost rather than simply the first usable one
+ * after mm_preferred.  A child's cost is its queued and pending I/O
+ * count times vdev_mirror_pending_cost (vdev_mirror_nonrot_pending_cost
+ * for solid-state devices), plus vdev_mirror_seek_cost if it is a
+ * rotational leaf and the read is more than vdev_mirror_seek_near bytes
+ * from where its last I/O ended.  Ties still go to mm_preferred first.
+ */
+int vdev_mirror_balance = 1;
+int vdev_mirror_pending_cost = 2;
+int vdev_mirror_nonrot_pending_cost = 1;
+int vdev_mirror_seek_cost = 5;
+uint64_t vdev_mirror_seek_near = 1ULL << 20;
+
 static mirror_map_t *
 vdev_mirror_map_alloc(zio_t *zio)
 {
@@ -203,7 +218,46 @@ vdev_mirror_repair_done(zio_t *zio)
 }
 
 /*
- * Try to find a child whose DTL doesn't contain the block we want to read.
+ * The cost of reading from a mirror child; see vdev_mirror_balance.
+ * Only leaves have a queue worth looking at, so interior children (the
+ * halves of a replacing or spare vdev, or the top-level vdevs holding
+ * ditto blocks) are all equally cheap.  The queue is sampled without
+ * vq_lock; a stale value only makes the choice slightly worse.
+ * vq_last_offset is a physical offset, so unless the read already is
+ * one, the child's offset is moved past the front labels to compare.
+ */
+static int
+vdev_mirror_child_cost(zio_t *zio, mirror_child_t *mc)
+{
+	vdev_t *vd = mc->mc_vd;
+	vdev_queue_t *vq = &vd->vdev_queue;
+	uint64_t offset, last, dist;
+	int cost;
+
+	if (!vd->vdev_ops->vdev_op_leaf)
+		return (0);
+
+	cost = (avl_numnodes(&vq->vq_pending_tree) +
+	    avl_numnodes(&vq->vq_deadline_tree)) *
+	    (vd->vdev_nonrot ? vdev_mirror_nonrot_pending_cost :
+	    vdev_mirror_pending_cost);
+
+	if (!vd->vdev_nonrot) {
+		offset = mc->mc_offset;
+		if (!(zio->io_flags & ZIO_FLAG_PHYSICAL))
+			offset += VDEV_LABEL_START_SIZE;
+		last = vq->vq_last_offset;
+		dist = offset > last ? offset - last : last - offset;
+		if (dist > vdev_mirror_seek_near)
+			cost += vdev_mirror_seek_cost;
+	}
+
+	return (cost);
+}
+
+/*
+ * Try to find a child whose DTL doesn't contain the block we want to read,
+ * preferring the cheapest such child if vdev_mirror_balance is set.
  * If we can't, try the read on any vdev we haven't already tried.
  */
 static int
@@ -212,7 +266,8 @@ vdev_mirror_child_select(zio_t *zio)
 	mirror_map_t *mm = zio->io_vsd;
 	mirror_child_t *mc;
 	uint64_t txg = zio->io_txg;
-	int i, c;
+	int i, c, cost;
+	int best = -1, best_cost = INT_MAX;
 
 	ASSERT(zio->io_bp == NULL || zio->io_bp->blk_birth == txg);
 
@@ -233,12 +288,23 @@ vdev_mirror_child_select(zio_t *zio)
 			mc->mc_skipped = 1;
 			continue;
 		}
-		if (!vdev_dtl_contains(&mc->mc_vd->vdev_dtl_map, txg, 1))
-			return (c);
+		if (!vdev_dtl_contains(&mc->mc_vd->vdev_dtl_map, txg, 1)) {
+			if (!vdev_mirror_balance || mm->mm_replacing)
+				return (c);
+			cost = vdev_mirror_child_cost(zio, mc);
+			if (cost < best_cost) {
+				best = c;
+				best_cost = cost;
+			}
+			continue;
+		}
 		mc->mc_error = ESTALE;
 		mc->mc_skipped = 1;
 	}
 
+	if (best != -1)
+		return (best);
+
 	/*
 	 * Every device is either missing or has this txg in its DTL.
 	 * Look for any child we haven't already tried before giving up.
@@ -181,6 +181,7 @@ vdev_queue_io_to_issue(vdev_queue_t *vq, uint64_t pending_limit,
 	zio_t *fio, *lio, *aio, *dio;
 	avl_tree_t *tree;
 	uint64_t size;
+	hrtime_t now;
 
 	ASSERT(MUTEX_HELD(&vq->vq_lock));
 
@@ -191,6 +192,7 @@ vdev_queue_io_to_issue(vdev_queue_t *vq, uint64_t pending_limit,
 		return (NULL);
 
 	fio = lio = avl_first(&vq->vq_deadline_tree);
+	now = gethrtime();
 
 	tree = fio->io_vdev_tree;
 	size = fio->io_size;
@@ -232,11 +234,15 @@ vdev_queue_io_to_issue(vdev_queue_t *vq, uint64_t pending_limit,
 				bcopy(dio->io_data, buf + offset, dio->io_size);
 			offset += dio->io_size;
 			vdev_queue_io_remove(vq, dio);
+			vdev_lat_update(dio->io_vd, dio, VDEV_LAT_QUEUE,
+			    now - dio->io_queue_time);
 			zio_vdev_io_bypass(dio);
 			nagg++;
 		}
+		aio->io_issue_time = now;
 
 		ASSERT(offset == size);
+		vq->vq_last_offset = fio->io_offset + size;
 
 		dprintf("%5s  T=%llu  off=%8llx  agg=%3d  "
 		    "old=%5llx  new=%5llx\n",
@@ -251,6 +257,10 @@ vdev_queue_io_to_issue(vdev_queue_t *vq, uint64_t pending_limit,
 
 	ASSERT(fio->io_vdev_tree == tree);
 	vdev_queue_io_remove(vq, fio);
+	vq->vq_last_offset = fio->io_offset + fio->io_size;
+	vdev_lat_update(fio->io_vd, fio, VDEV_LAT_QUEUE,
+	    now - fio->io_queue_time);
+	fio->io_issue_time = now;
 
 	avl_add(&vq->vq_pending_tree, fio);
 
@@ -282,6 +292,7 @@ vdev_queue_io(zio_t *zio)
 
 	zio->io_deadline = (zio->io_timestamp >> zfs_vdev_time_shift) +
 	    zio->io_priority;
+	zio->io_queue_time = gethrtime();
 
 	vdev_queue_io_add(vq, zio);
 
@@ -304,6 +315,17 @@ vdev_queue_io_done(zio_t *zio)
 	zio_issue_func_t *func;
 	int i;
 
+	/*
+	 * An aggregated I/O is charged to the class of its first delegate;
+	 * the aggregate itself always runs at ZIO_PRIORITY_NOW.  I/Os that
+	 * bypassed the queue have no issue time and aren't counted.
+	 */
+	if (zio->io_issue_time != 0) {
+		vdev_lat_update(zio->io_vd, zio->io_delegate_list != NULL ?
+		    zio->io_delegate_list : zio, VDEV_LAT_SERVICE,
+		    gethrtime() - zio->io_issue_time);
+	}
+
 	mutex_enter(&vq->vq_lock);
 
 	avl_remove(&vq->vq_pending_tree, zio);
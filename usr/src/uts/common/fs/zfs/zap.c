@@ -372,19 +372,28 @@ static uint64_t
 zap_allocate_blocks(zap_t *zap, int nblocks)
 {
 	uint64_t newblk;
-	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
+	mutex_enter(&zap->zap_f.zap_num_entries_mtx);
 	newblk = zap->zap_f.zap_phys->zap_freeblk;
 	zap->zap_f.zap_phys->zap_freeblk += nblocks;
+	mutex_exit(&zap->zap_f.zap_num_entries_mtx);
 	return (newblk);
 }
 
+/*
+ * Leaves may be created with only a reader hold on the zap (see
+ * zap_expand_leaf()), so the header updates go through
+ * zap_num_entries_mtx.
+ */
 static zap_leaf_t *
 zap_create_leaf(zap_t *zap, dmu_tx_t *tx)
 {
 	void *winner;
 	zap_leaf_t *l = kmem_alloc(sizeof (zap_leaf_t), KM_SLEEP);
 
-	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
+
+	dmu_buf_will_dirty(zap->zap_dbuf, tx);
 
 	rw_init(&l->l_rwlock, 0, 0, 0);
 	rw_enter(&l->l_rwlock, RW_WRITER);
@@ -400,7 +409,9 @@ zap_create_leaf(zap_t *zap, dmu_tx_t *tx)
 
 	zap_leaf_init(l);
 
+	mutex_enter(&zap->zap_f.zap_num_entries_mtx);
 	zap->zap_f.zap_phys->zap_num_leafs++;
+	mutex_exit(&zap->zap_f.zap_num_entries_mtx);
 
 	return (l);
 }
@@ -543,13 +554,19 @@ zap_idx_to_blk(zap_t *zap, uint64_t idx, uint64_t *valp)
 	}
 }
 
+/*
+ * Pointer table entries may be stored with only a reader hold on the
+ * zap, provided the caller holds the writer lock on the leaf that the
+ * entry currently points to; see zap_expand_leaf().
+ */
 static int
 zap_set_idx_to_blk(zap_t *zap, uint64_t idx, uint64_t blk, dmu_tx_t *tx)
 {
 	ASSERT(tx != NULL);
-	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
 
 	if (zap->zap_f.zap_phys->zap_ptrtbl.zt_blk == 0) {
+		dmu_buf_will_dirty(zap->zap_dbuf, tx);
 		ZAP_EMBEDDED_PTRTBL_ENT(zap, idx) = blk;
 		return (0);
 	} else {
@@ -567,15 +584,28 @@ zap_deref_leaf(zap_t *zap, uint64_t h, dmu_tx_t *tx, krw_t lt, zap_leaf_t **lp)
 	ASSERT(zap->zap_dbuf == NULL ||
 	    zap->zap_f.zap_phys == zap->zap_dbuf->db_data);
 	ASSERT3U(zap->zap_f.zap_phys->zap_magic, ==, ZAP_MAGIC);
-	idx = ZAP_HASH_IDX(h, zap->zap_f.zap_phys->zap_ptrtbl.zt_shift);
-	err = zap_idx_to_blk(zap, idx, &blk);
-	if (err != 0)
-		return (err);
-	err = zap_get_leaf_byblk(zap, blk, tx, lt, lp);
 
-	ASSERT(err || ZAP_HASH_IDX(h, (*lp)->l_phys->l_hdr.lh_prefix_len) ==
-	    (*lp)->l_phys->l_hdr.lh_prefix);
-	return (err);
+	for (;;) {
+		idx = ZAP_HASH_IDX(h, zap->zap_f.zap_phys->zap_ptrtbl.zt_shift);
+		err = zap_idx_to_blk(zap, idx, &blk);
+		if (err != 0)
+			return (err);
+		err = zap_get_leaf_byblk(zap, blk, tx, lt, lp);
+		if (err != 0)
+			return (err);
+
+		if (ZAP_HASH_IDX(h, (*lp)->l_phys->l_hdr.lh_prefix_len) ==
+		    (*lp)->l_phys->l_hdr.lh_prefix)
+			return (0);
+
+		/*
+		 * The leaf was split between reading the pointer table
+		 * and getting the leaf lock; the table now points
+		 * elsewhere.
+		 */
+		ASSERT(!RW_WRITE_HELD(&zap->zap_rwlock));
+		zap_put_leaf(*lp);
+	}
 }
 
 static int
@@ -589,13 +619,22 @@ zap_expand_leaf(zap_t *zap, zap_leaf_t *l, uint64_t hash, dmu_tx_t *tx,
 
 	ASSERT3U(old_prefix_len, <=, zap->zap_f.zap_phys->zap_ptrtbl.zt_shift);
 	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
+	ASSERT(RW_WRITE_HELD(&l->l_rwlock));
 
 	ASSERT3U(ZAP_HASH_IDX(hash, old_prefix_len), ==,
 	    l->l_phys->l_hdr.lh_prefix);
 
-	if (zap_tryupgradedir(zap, tx) == 0 ||
-	    old_prefix_len == zap->zap_f.zap_phys->zap_ptrtbl.zt_shift) {
-		/* We failed to upgrade, or need to grow the pointer table */
+	/*
+	 * Splitting a leaf only touches the leaf itself, a new leaf and
+	 * the pointer table entries that currently point at the leaf, so
+	 * it can be done under a reader hold on the zap while we hold
+	 * the leaf's writer lock.  Lookups that read a stale pointer
+	 * notice the new prefix once they get the leaf lock and retry
+	 * (see zap_deref_leaf()).  Only growing the pointer table
+	 * itself needs the zap writer lock.
+	 */
+	if (old_prefix_len == zap->zap_f.zap_phys->zap_ptrtbl.zt_shift) {
+		/* We need to grow the pointer table */
 		objset_t *os = zap->zap_objset;
 		uint64_t object = zap->zap_object;
 
@@ -623,7 +662,6 @@ zap_expand_leaf(zap_t *zap, zap_leaf_t *l, uint64_t hash, dmu_tx_t *tx,
 			return (0);
 		}
 	}
-	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
 	ASSERT3U(old_prefix_len, <, zap->zap_f.zap_phys->zap_ptrtbl.zt_shift);
 	ASSERT3U(ZAP_HASH_IDX(hash, old_prefix_len), ==,
 	    l->l_phys->l_hdr.lh_prefix);
@@ -936,15 +974,6 @@ fzap_cursor_retrieve(zap_t *zap, zap_cursor_t *zc, zap_attribute_t *za)
 	/* retrieve the next entry at or after zc_hash/zc_cd */
 	/* if no entry, return ENOENT */
 
-	if (zc->zc_leaf &&
-	    (ZAP_HASH_IDX(zc->zc_hash,
-	    zc->zc_leaf->l_phys->l_hdr.lh_prefix_len) !=
-	    zc->zc_leaf->l_phys->l_hdr.lh_prefix)) {
-		rw_enter(&zc->zc_leaf->l_rwlock, RW_READER);
-		zap_put_leaf(zc->zc_leaf);
-		zc->zc_leaf = NULL;
-	}
-
 again:
 	if (zc->zc_leaf == NULL) {
 		err = zap_deref_leaf(zap, zc->zc_hash, NULL, RW_READER,
@@ -956,6 +985,18 @@ again:
 	}
 	l = zc->zc_leaf;
 
+	/*
+	 * The cached leaf may have been split since we last looked at it
+	 * (possibly while we hold the zap as reader), so only trust its
+	 * prefix once we have its lock.
+	 */
+	if (ZAP_HASH_IDX(zc->zc_hash, l->l_phys->l_hdr.lh_prefix_len) !=
+	    l->l_phys->l_hdr.lh_prefix) {
+		zap_put_leaf(zc->zc_leaf);
+		zc->zc_leaf = NULL;
+		goto again;
+	}
+
 	err = zap_leaf_lookup_closest(l, zc->zc_hash, zc->zc_cd, &zeh);
 
 	if (err == ENOENT) {
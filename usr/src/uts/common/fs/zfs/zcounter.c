@@ -0,0 +1,166 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#pragma ident	"%Z%%M%	%I%	%E% SMI"
+
+#include <sys/zfs_context.h>
+#include <sys/zcounter.h>
+
+/*
+ * Pick the shard for the current thread.  CPU_SEQID would be the natural
+ * choice, but it isn't meaningful on every platform we run on, so hash
+ * the thread pointer instead; a thread keeps hitting the same shard.
+ * Other per-thread sharded structures use this too.
+ */
+uint32_t
+zcounter_shard(void)
+{
+	uintptr_t h = (uintptr_t)curthread;
+
+	h = (h >> 4) ^ (h >> 10) ^ (h >> 16);
+	return (h % ZCOUNTER_SHARDS);
+}
+
+void
+zcounter_set_create(zcounter_set_t *zcs, uint32_t count)
+{
+	uint32_t stride;
+
+	ASSERT(count != 0);
+
+	/*
+	 * Round each shard up to a whole number of cache lines, and align
+	 * the first one, so that no two shards share a line.
+	 */
+	stride = P2ROUNDUP(count * sizeof (uint64_t), ZCOUNTER_ALIGN) /
+	    sizeof (uint64_t);
+
+	zcs->zcs_count = count;
+	zcs->zcs_stride = stride;
+	zcs->zcs_bufsize = ZCOUNTER_SHARDS * stride * sizeof (uint64_t) +
+	    ZCOUNTER_ALIGN;
+	zcs->zcs_buf = kmem_zalloc(zcs->zcs_bufsize, KM_SLEEP);
+	zcs->zcs_shard = (uint64_t *)P2ROUNDUP((uintptr_t)zcs->zcs_buf,
+	    ZCOUNTER_ALIGN);
+}
+
+void
+zcounter_set_destroy(zcounter_set_t *zcs)
+{
+	kmem_free(zcs->zcs_buf, zcs->zcs_bufsize);
+	zcs->zcs_buf = NULL;
+	zcs->zcs_shard = NULL;
+}
+
+void
+zcounter_add(zcounter_set_t *zcs, uint32_t idx, int64_t delta)
+{
+	ASSERT3U(idx, <, zcs->zcs_count);
+
+	atomic_add_64(&zcs->zcs_shard[zcounter_shard() * zcs->zcs_stride +
+	    idx], delta);
+}
+
+/*
+ * Sum a counter over all shards.  Updates racing with the sum may or may
+ * not be included.
+ */
+uint64_t
+zcounter_value(zcounter_set_t *zcs, uint32_t idx)
+{
+	uint64_t sum = 0;
+	int s;
+
+	ASSERT3U(idx, <, zcs->zcs_count);
+
+	for (s = 0; s < ZCOUNTER_SHARDS; s++)
+		sum += zcs->zcs_shard[s * zcs->zcs_stride + idx];
+
+	return (sum);
+}
+
+/*
+ * ks_update callback for a named kstat whose first zcs_count members are
+ * backed by the zcounter set in ks_private.
+ */
+int
+zcounter_kstat_update(kstat_t *ksp, int rw)
+{
+	zcounter_set_t *zcs = ksp->ks_private;
+	kstat_named_t *kn = ksp->ks_data;
+	uint32_t i;
+
+	if (rw == KSTAT_WRITE)
+		return (EACCES);
+
+	for (i = 0; i < zcs->zcs_count; i++)
+		kn[i].value.ui64 = zcounter_value(zcs, i);
+
+	return (0);
+}
+
+void
+zcounter_approx_create(zcounter_approx_t *zca, int64_t batch)
+{
+	ASSERT(batch > 0);
+
+	zca->zca_total = 0;
+	zca->zca_batch = batch;
+	zcounter_set_create(&zca->zca_delta, 1);
+}
+
+void
+zcounter_approx_destroy(zcounter_approx_t *zca)
+{
+	zcounter_set_destroy(&zca->zca_delta);
+}
+
+void
+zcounter_approx_add(zcounter_approx_t *zca, int64_t delta)
+{
+	zcounter_set_t *zcs = &zca->zca_delta;
+	uint64_t *dp = &zcs->zcs_shard[zcounter_shard() * zcs->zcs_stride];
+	int64_t d;
+
+	d = (int64_t)atomic_add_64_nv(dp, delta);
+	if (d < zca->zca_batch && d > -zca->zca_batch)
+		return;
+
+	/*
+	 * Move the delta to the total.  If another thread on this shard
+	 * got in first, the delta has changed; whoever pushes it over
+	 * the batch next will fold it.
+	 */
+	if (atomic_cas_64(dp, (uint64_t)d, 0) == (uint64_t)d)
+		atomic_add_64((uint64_t *)&zca->zca_total, d);
+}
+
+/*
+ * The approximate value of the counter.  Deltas still held in the shards
+ * can make the total briefly negative; that reads as zero.
+ */
+uint64_t
+zcounter_approx_value(zcounter_approx_t *zca)
+{
+	int64_t total = zca->zca_total;
+
+	return (total < 0 ? 0 : (uint64_t)total);
+}
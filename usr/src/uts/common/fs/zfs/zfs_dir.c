@@ -59,6 +59,7 @@
 #endif /*!__APPLE__*/
 #include <sys/zap.h>
 #include <sys/dmu.h>
+#include <sys/dnode.h>
 #include <sys/atomic.h>
 #include <sys/zfs_ctldir.h>
 #include <sys/dnlc.h>
@@ -1033,3 +1034,25 @@ zfs_sticky_remove_access(znode_t *zdp, znode_t *zp, cred_t *cr)
 	else
 		return (secpolicy_vnode_remove(cr));
 }
+
+/*
+ * Directory readahead: a readdir that is going to look at (or whose
+ * caller is going to stat) every entry runs zap readahead (see
+ * zap_ra_init()) zfs_dir_ra_window entries ahead of its cursor.
+ */
+int zfs_dir_ra_window = 128;	/* entries; 0 disables readahead */
+
+/*
+ * Start readahead for a readdir of dzp positioned at offset (using the
+ * same encoding as the readdir offset).  Returns NULL if readahead is
+ * disabled.
+ */
+zap_ra_t *
+zfs_dir_ra_init(znode_t *dzp, uint64_t offset)
+{
+	if (zfs_dir_ra_window <= 0)
+		return (NULL);
+
+	return (zap_ra_init(dzp->z_zfsvfs->z_os, dzp->z_id,
+	    offset <= 3 ? 0 : offset, zfs_dir_ra_window));
+}
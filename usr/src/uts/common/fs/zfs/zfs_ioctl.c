@@ -942,6 +942,32 @@ zfs_ioc_pool_get_history(zfs_cmd_t *zc)
 	return (error);
 }
 
+/*
+ * inputs:
+ * zc_name		name of the pool
+ * zc_nvlist_dst{_size}	buffer for the txg history nvlist
+ *
+ * outputs:
+ * zc_nvlist_dst{_size}	txg history, see spa_txg_history_get()
+ */
+static int
+zfs_ioc_pool_txg_history(zfs_cmd_t *zc)
+{
+	spa_t *spa;
+	nvlist_t *nvl;
+	int error;
+
+	if ((error = spa_open(zc->zc_name, &spa, FTAG)) != 0)
+		return (error);
+
+	nvl = spa_txg_history_get(spa);
+	spa_close(spa, FTAG);
+
+	error = put_nvlist(zc, nvl);
+	nvlist_free(nvl);
+	return (error);
+}
+
 static int
 zfs_ioc_dsobj_to_dsname(zfs_cmd_t *zc)
 {
@@ -1098,6 +1124,52 @@ zfs_ioc_vdev_setpath(zfs_cmd_t *zc)
 	return (error);
 }
 
+static boolean_t
+zfs_prop_wanted(nvlist_t *filter, zfs_prop_t prop)
+{
+	return (filter == NULL ||
+	    nvlist_lookup_boolean(filter, zfs_prop_to_name(prop)) == 0);
+}
+
+/*
+ * Gather the properties of an open objset, including the statistics that
+ * are reported as properties.  'stat' must come from dmu_objset_fast_stat().
+ * If 'filter' is not NULL, stored properties it doesn't name are never
+ * looked up and the objset contents are only read for the properties that
+ * live there; the in-core statistics are always added.
+ */
+static int
+zfs_objset_props(objset_t *os, dmu_objset_stats_t *stat, nvlist_t *filter,
+    nvlist_t **nvp)
+{
+	nvlist_t *nv;
+	int error;
+
+	if ((error = dsl_prop_get_all(os, &nv, filter)) != 0)
+		return (error);
+
+	dmu_objset_stats(os, nv);
+	/*
+	 * NB: {zpl,zvol}_get_stats() will read the objset contents,
+	 * which we aren't supposed to do with a
+	 * DS_MODE_STANDARD open, because it could be
+	 * inconsistent.  So this is a bit of a workaround...
+	 */
+	if (!stat->dds_inconsistent) {
+		if (dmu_objset_type(os) == DMU_OST_ZVOL) {
+			if (zfs_prop_wanted(filter, ZFS_PROP_VOLSIZE) ||
+			    zfs_prop_wanted(filter, ZFS_PROP_VOLBLOCKSIZE))
+				VERIFY(zvol_get_stats(os, nv) == 0);
+		} else if (dmu_objset_type(os) == DMU_OST_ZFS) {
+			if (zfs_prop_wanted(filter, ZFS_PROP_VERSION))
+				(void) zfs_get_stats(os, nv);
+		}
+	}
+
+	*nvp = nv;
+	return (0);
+}
+
 static int
 zfs_ioc_objset_stats(zfs_cmd_t *zc)
 {
@@ -1126,20 +1198,8 @@ retry:
 	dmu_objset_fast_stat(os, &zc->zc_objset_stats);
 
 	if (zc->zc_nvlist_dst != 0 &&
-	    (error = dsl_prop_get_all(os, &nv)) == 0) {
-		dmu_objset_stats(os, nv);
-		/*
-		 * NB: {zpl,zvol}_get_stats() will read the objset contents,
-		 * which we aren't supposed to do with a
-		 * DS_MODE_STANDARD open, because it could be
-		 * inconsistent.  So this is a bit of a workaround...
-		 */
-		if (!zc->zc_objset_stats.dds_inconsistent) {
-			if (dmu_objset_type(os) == DMU_OST_ZVOL)
-				VERIFY(zvol_get_stats(os, nv) == 0);
-			else if (dmu_objset_type(os) == DMU_OST_ZFS)
-				(void) zfs_get_stats(os, nv);
-		}
+	    (error = zfs_objset_props(os, &zc->zc_objset_stats, NULL,
+	    &nv)) == 0) {
 		error = put_nvlist(zc, nv);
 		nvlist_free(nv);
 	}
@@ -1250,6 +1310,182 @@ retry:
 	return (error);
 }
 
+/*
+ * Add one dataset to a batched listing: its fast stats as a raw
+ * dmu_objset_stats_t, and its properties, limited to the names in 'filter'
+ * when one was given.  zfs_objset_props() only gathers what the filter
+ * asks for; the in-core statistics it always adds are pruned here.
+ */
+static int
+zfs_list_batch_add(nvlist_t *batch, const char *name, nvlist_t *filter)
+{
+	objset_t *os;
+	dmu_objset_stats_t stat;
+	nvlist_t *entry, *props;
+	nvpair_t *elem, *next;
+	int error;
+
+retry:
+	error = dmu_objset_open(name, DMU_OST_ANY,
+	    DS_MODE_STANDARD | DS_MODE_READONLY, &os);
+	if (error != 0) {
+		if (error == EBUSY) {
+			delay(1);
+			goto retry;
+		}
+		return (error);
+	}
+
+	dmu_objset_fast_stat(os, &stat);
+
+	if ((error = zfs_objset_props(os, &stat, filter, &props)) != 0) {
+		dmu_objset_close(os);
+		return (error);
+	}
+	dmu_objset_close(os);
+
+	if (filter != NULL) {
+		for (elem = nvlist_next_nvpair(props, NULL); elem != NULL;
+		    elem = next) {
+			next = nvlist_next_nvpair(props, elem);
+			if (nvlist_lookup_boolean(filter,
+			    nvpair_name(elem)) != 0)
+				VERIFY(nvlist_remove_all(props,
+				    nvpair_name(elem)) == 0);
+		}
+	}
+
+	VERIFY(nvlist_alloc(&entry, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+	VERIFY(nvlist_add_byte_array(entry, ZFS_LIST_BATCH_STATS,
+	    (uchar_t *)&stat, sizeof (stat)) == 0);
+	VERIFY(nvlist_add_nvlist(entry, ZFS_LIST_BATCH_PROPS, props) == 0);
+	VERIFY(nvlist_add_nvlist(batch, name, entry) == 0);
+	nvlist_free(entry);
+	nvlist_free(props);
+
+	return (0);
+}
+
+/*
+ * inputs:
+ * zc_name		parent dataset
+ * zc_cookie		position to resume from, 0 to start
+ * zc_obj		ZFS_LIST_BATCH_* flags
+ * zc_guid		maximum number of datasets to return, 0 for default
+ * zc_nvlist_src{_size}	optional nvlist of property names to return
+ *
+ * outputs:
+ * zc_cookie		position to resume from on the next call
+ * zc_value		alternate root of the pool
+ * zc_nvlist_dst{_size}	nvlist of dataset name -> { stats, props }
+ *
+ * Returns the children (or, with ZFS_LIST_BATCH_SNAPSHOTS, the snapshots)
+ * of a dataset many at a time, along with everything a separate
+ * ZFS_IOC_OBJSET_STATS call would have returned for each of them.  ESRCH
+ * means there is nothing left.  On ENOMEM the cookie is left untouched so
+ * the caller can grow zc_nvlist_dst and repeat the call.
+ */
+static int
+zfs_ioc_list_batch(zfs_cmd_t *zc)
+{
+	objset_t *os;
+	nvlist_t *filter = NULL;
+	nvlist_t *batch;
+	boolean_t snapshots = (zc->zc_obj & ZFS_LIST_BATCH_SNAPSHOTS) != 0;
+	uint64_t cookie = zc->zc_cookie;
+	uint64_t max = zc->zc_guid;
+	uint64_t count = 0;
+	char name[MAXNAMELEN];
+	char *p;
+	int error;
+
+	if (max == 0 || max > ZFS_LIST_BATCH_MAX)
+		max = ZFS_LIST_BATCH_MAX;
+
+	if (zc->zc_nvlist_src != 0 &&
+	    (error = get_nvlist(zc, &filter)) != 0)
+		return (error);
+
+retry:
+	error = dmu_objset_open(zc->zc_name, DMU_OST_ANY,
+	    DS_MODE_STANDARD | DS_MODE_READONLY, &os);
+	if (error != 0) {
+		if (error == EBUSY) {
+			delay(1);
+			goto retry;
+		}
+		if (error == ENOENT)
+			error = ESRCH;
+		nvlist_free(filter);
+		return (error);
+	}
+
+	(void) strlcpy(name, zc->zc_name, sizeof (name));
+	if (snapshots) {
+		/*
+		 * A dataset name of maximum length cannot have any snapshots.
+		 */
+		if (strlcat(name, "@", sizeof (name)) >= sizeof (name)) {
+			dmu_objset_close(os);
+			nvlist_free(filter);
+			return (ESRCH);
+		}
+	} else {
+		p = strrchr(name, '/');
+		if (p == NULL || p[1] != '\0')
+			(void) strlcat(name, "/", sizeof (name));
+	}
+	p = name + strlen(name);
+
+	VERIFY(nvlist_alloc(&batch, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+
+	while (count < max) {
+		if (snapshots) {
+			error = dmu_snapshot_list_next(os,
+			    sizeof (name) - (p - name), p, NULL, &cookie);
+		} else {
+			error = dmu_dir_list_next(os,
+			    sizeof (name) - (p - name), p, NULL, &cookie);
+		}
+		if (error != 0)
+			break;
+
+		if (!snapshots && !INGLOBALZONE(curproc) &&
+		    !zone_dataset_visible(name, NULL))
+			continue;
+
+		/*
+		 * Hidden datasets (ie. with a '$' in their name) are never
+		 * shown to userland, so don't bother returning them.
+		 */
+		if (strchr(name, '$') != NULL)
+			continue;
+
+		/*
+		 * A dataset destroyed since it was listed is simply skipped.
+		 */
+		error = zfs_list_batch_add(batch, name, filter);
+		if (error == ENOENT)
+			continue;
+		if (error != 0)
+			break;
+		count++;
+	}
+
+	if (error == ENOENT)
+		error = (count == 0) ? ESRCH : 0;
+
+	if (error == 0 && (error = put_nvlist(zc, batch)) == 0)
+		zc->zc_cookie = cookie;
+
+	spa_altroot(dmu_objset_spa(os), zc->zc_value, sizeof (zc->zc_value));
+
+	dmu_objset_close(os);
+	nvlist_free(batch);
+	nvlist_free(filter);
+	return (error);
+}
+
 static int
 // In the 10a286 bits, the 'dev' parameter wasn't used/needed
 #ifdef __APPLE__
@@ -1867,6 +2103,103 @@ zfs_ioc_snapshot(zfs_cmd_t *zc)
 	    zc->zc_value, zc->zc_cookie));
 }
 
+/*
+ * ZFS_BATCH_SNAPSHOT: the names are full snapshot names in zc_name's
+ * pool.  The snapshots are created in as few txgs as possible, and each
+ * one succeeds or fails on its own.  Permissions are checked per
+ * snapshot.
+ */
+static int
+zfs_batch_snapshot(zfs_cmd_t *zc, nvlist_t *names, nvlist_t *errors)
+{
+	nvlist_t *snaps;
+	nvpair_t *pair;
+	size_t poollen = strlen(zc->zc_name);
+	char fsname[MAXNAMELEN];
+	char *name, *atp;
+	int error;
+
+	for (pair = nvlist_next_nvpair(names, NULL); pair;
+	    pair = nvlist_next_nvpair(names, pair)) {
+		name = nvpair_name(pair);
+		if (strncmp(name, zc->zc_name, poollen) != 0 ||
+		    (name[poollen] != '/' && name[poollen] != '@'))
+			return (EXDEV);
+	}
+
+	VERIFY(nvlist_alloc(&snaps, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+
+	for (pair = nvlist_next_nvpair(names, NULL); pair;
+	    pair = nvlist_next_nvpair(names, pair)) {
+		name = nvpair_name(pair);
+		atp = strchr(name, '@');
+		if (atp == NULL || atp - name >= sizeof (fsname) ||
+		    snapshot_namecheck(atp + 1, NULL, NULL) != 0) {
+			error = EINVAL;
+		} else {
+			(void) strlcpy(fsname, name, atp - name + 1);
+			error = zfs_secpolicy_snapshot_perms(fsname, CRED());
+		}
+
+		if (error)
+			VERIFY(nvlist_add_int32(errors, name, error) == 0);
+		else
+			VERIFY(nvlist_add_boolean(snaps, name) == 0);
+	}
+
+	error = dmu_objset_snapshot_batch(snaps, errors);
+	nvlist_free(snaps);
+
+	/* every snapshot that was not taken is in the error list */
+	return (nvlist_next_nvpair(errors, NULL) != NULL ? 0 : error);
+}
+
+/*
+ * inputs:
+ * zc_name		name of pool
+ * zc_cookie		operation (zfs_batch_op_t)
+ * zc_nvlist_src{_size}	nvlist of dataset names to operate on
+ *
+ * outputs:
+ * zc_nvlist_dst{_size}	nvlist of name -> error, for those names on which
+ *			the operation failed; the size is zero if there
+ *			is no such list
+ *
+ * An error is returned only if the batch as a whole could not be run.
+ * Failures of single operations are reported in zc_nvlist_dst instead,
+ * so that the batch is logged to the pool history for the operations
+ * that did succeed.
+ */
+static int
+zfs_ioc_batch(zfs_cmd_t *zc)
+{
+	nvlist_t *names, *errors;
+	int error;
+
+	if ((error = get_nvlist(zc, &names)) != 0)
+		return (error);
+
+	VERIFY(nvlist_alloc(&errors, NV_UNIQUE_NAME, KM_SLEEP) == 0);
+
+	switch (zc->zc_cookie) {
+	case ZFS_BATCH_SNAPSHOT:
+		error = zfs_batch_snapshot(zc, names, errors);
+		break;
+	default:
+		error = ENOTSUP;
+		break;
+	}
+
+	if (nvlist_next_nvpair(errors, NULL) == NULL)
+		zc->zc_nvlist_dst_size = 0;
+	else
+		error = put_nvlist(zc, errors);
+
+	nvlist_free(errors);
+	nvlist_free(names);
+	return (error);
+}
+
 int
 zfs_unmount_snap(char *name, void *arg)
 {
@@ -2324,8 +2657,21 @@ static zfs_ioc_vec_t zfs_ioc_vec[] = {
 	    DATASET_NAME, B_FALSE },
 	{ zfs_ioc_share, zfs_secpolicy_share, DATASET_NAME, B_FALSE },
 	{ zfs_ioc_inherit_prop, zfs_secpolicy_inherit, DATASET_NAME, B_TRUE },
+	{ zfs_ioc_list_batch, zfs_secpolicy_read, DATASET_NAME, B_FALSE },
+	{ zfs_ioc_pool_txg_history, zfs_secpolicy_read, POOL_NAME, B_FALSE },
+	{ zfs_ioc_batch, zfs_secpolicy_none, POOL_NAME, B_TRUE },
 };
 
+/*
+ * The number of ioctls this kernel implements, so that userland can tell
+ * whether a newer one is safe to issue.
+ */
+int
+zfs_ioc_count(void)
+{
+	return (sizeof (zfs_ioc_vec) / sizeof (zfs_ioc_vec[0]));
+}
+
 static int
 #ifdef __APPLE__
  zfsdev_ioctl(dev_t dev, u_long cmd, caddr_t data,  __unused int flag, struct proc *p)
@@ -2347,6 +2693,10 @@ static int
 #ifdef __APPLE__
 	vec = ZFS_IOC_NUM(cmd);
 	zc = (zfs_cmd_t *)data;
+	if (vec >= sizeof (zfs_ioc_vec) / sizeof (zfs_ioc_vec[0])) {
+		zc->zc_ioc_error = EINVAL;
+		return (0);
+	}
 	// 10a286 ctx = vfs_context_create(NULL) // again?
 	cr = (uintptr_t)NOCRED;    /* wants vfs_context_current() */
 	zc->zc_dev = dev;
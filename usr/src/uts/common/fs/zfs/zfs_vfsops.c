@@ -2117,6 +2117,14 @@ zfs_vfs_sysctl(int *name, __unused u_int namelen, user_addr_t oldp, size_t *oldl
 		error = ENOTSUP;
 #endif
 		return error;
+
+	case ZFS_SYSCTL_IOC_COUNT: {
+		int count = zfs_ioc_count();
+
+		if (newp)
+			return (EINVAL);
+		return (sysctl_int(oldp, oldlenp, USER_ADDR_NULL, 0, &count));
+	    }
 	}
 
 	return (ENOTSUP);
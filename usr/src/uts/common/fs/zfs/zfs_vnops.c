@@ -1052,6 +1052,35 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 		if (vn_has_cached_data(vp)) {
 			rw_exit(&zp->z_map_lock);
 			error = mappedwrite(vp, nbytes, uio, tx);
+		} else if (nbytes == max_blksz && zp->z_blksz == max_blksz &&
+		    P2PHASE(woff, max_blksz) == 0) {
+			/*
+			 * Full-block write: copy the data into a loaned ARC
+			 * buffer and give that to the dbuf, so that the old
+			 * contents never have to be copied aside.
+			 */
+			arc_buf_t *abuf = dmu_request_arcbuf(zfsvfs->z_os,
+			    max_blksz);
+			ssize_t cbytes;
+
+#ifdef __APPLE__
+			error = uio_move(abuf->b_data, nbytes, UIO_WRITE, uio);
+			cbytes = tx_bytes - uio_resid(uio);
+#else
+			error = uiomove(abuf->b_data, nbytes, UIO_WRITE, uio);
+			cbytes = tx_bytes - uio->uio_resid;
+#endif /* __APPLE__ */
+			if (error == 0) {
+				dmu_assign_arcbuf(zfsvfs->z_os, zp->z_id, woff,
+				    abuf, tx);
+			} else {
+				/* keep what was copied, like dmu_write_uio() */
+				if (cbytes > 0)
+					dmu_write(zfsvfs->z_os, zp->z_id, woff,
+					    cbytes, abuf->b_data, tx);
+				dmu_return_arcbuf(abuf);
+			}
+			rw_exit(&zp->z_map_lock);
 		} else {
 			error = dmu_write_uio(zfsvfs->z_os, zp->z_id,
 			    uio, nbytes, tx);
@@ -2289,6 +2318,7 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp)
 	int		outcount;
 	int		error;
 	uint8_t		prefetch;
+	zap_ra_t	*ra = NULL;
 #ifdef __APPLE__
 	int		extended;
 	int		numdirent;
@@ -2346,6 +2376,8 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp)
 		 */
 		zap_cursor_init_serialized(&zc, os, zp->z_id, offset);
 	}
+	if (prefetch)
+		ra = zfs_dir_ra_init(zp, offset);
 
 	/*
 	 * Get space to change directory entries into fs independent format.
@@ -2535,8 +2567,10 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp)
 
 		ASSERT(outcount <= bufsize);
 
-		/* Prefetch znode */
-		if (prefetch)
+		/*
+		 * Prefetch znode, unless the readahead window already has.
+		 */
+		if (prefetch && ra == NULL)
 			dmu_prefetch(os, objnum, 0, 0);
 
 		/*
@@ -2545,6 +2579,7 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp)
 		if (offset > 2 || (offset == 2 && !zfs_show_ctldir(zp))) {
 			zap_cursor_advance(&zc);
 			offset = zap_cursor_serialize(&zc);
+			zap_ra_advance(ra);
 		} else {
 			offset += 1;
 		}
@@ -2576,6 +2611,7 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp)
 #endif /* __APPLE__ */
 update:
 	zap_cursor_fini(&zc);
+	zap_ra_fini(ra);
 #ifdef __APPLE__
 	if (outbuf) {
 		kmem_free(outbuf, bufsize);
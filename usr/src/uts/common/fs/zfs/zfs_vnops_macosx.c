@@ -153,14 +153,23 @@ typedef struct attrinfo {
 	ATTR_FILE_DATAALLOCSIZE | ATTR_FILE_RSRCLENGTH | \
 	ATTR_FILE_RSRCALLOCSIZE)
 
+/*
+ * Attributes that can't be derived from the znode_phys_t alone and
+ * need an instantiated znode/vnode.
+ */
+#define ZFS_ZNODE_CMN_ATTRS	(ATTR_CMN_FNDRINFO | ATTR_CMN_USERACCESS)
+#define ZFS_ZNODE_DIR_ATTRS	(ATTR_DIR_MOUNTSTATUS)
+#define ZFS_ZNODE_FILE_ATTRS	(ATTR_FILE_RSRCLENGTH | ATTR_FILE_RSRCALLOCSIZE)
+
 int zfs_vnop_readdirattr(struct vnop_readdirattr_args *ap);
 
 
 static void  commonattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs, znode_t *zp,
-                            const char *name, ino64_t objnum, enum vtype vtype,
-                            boolean_t user64);
-static void  dirattrpack(attrinfo_t *aip, znode_t *zp);
-static void  fileattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs, znode_t *zp);
+                            znode_phys_t *pzp, const char *name, ino64_t objnum,
+                            enum vtype vtype, boolean_t user64);
+static void  dirattrpack(attrinfo_t *aip, znode_t *zp, znode_phys_t *pzp);
+static void  fileattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs, znode_t *zp,
+                          znode_phys_t *pzp, dmu_buf_t *db);
 static void  nameattrpack(attrinfo_t *aip, const char *name, int namelen);
 static int   getpackedsize(struct attrlist *alp, boolean_t user64);
 static void  getfinderinfo(znode_t *zp, znode_phys_t *pzp, cred_t *cr,
@@ -193,6 +202,8 @@ zfs_vnop_readdirattr(struct vnop_readdirattr_args *ap)
 	void		*varptr;  /* variable-length storage area */
 	boolean_t	user64 = vfs_context_is64bit(ap->a_context);
 	int		prefetch = 0;
+	boolean_t	needznode;
+	zap_ra_t	*ra = NULL;
 	int		error = 0;
 
 	*(ap->a_actualcount) = 0;
@@ -222,6 +233,14 @@ zfs_vnop_readdirattr(struct vnop_readdirattr_args *ap)
 	     (alp->dirattr != 0) || (alp->fileattr != 0)) {
 		prefetch = TRUE;
 	}
+	/*
+	 * Most attribute requests can be satisfied straight from the
+	 * znode_phys_t in the bonus buffer, which saves instantiating
+	 * (and later tearing down) a znode and vnode for every entry.
+	 */
+	needznode = ((alp->commonattr & ZFS_ZNODE_CMN_ATTRS) ||
+	    (alp->dirattr & ZFS_ZNODE_DIR_ATTRS) ||
+	    (alp->fileattr & ZFS_ZNODE_FILE_ATTRS));
 	/*
 	 * Setup a buffer to hold the packed attributes.
 	 */
@@ -256,11 +275,15 @@ zfs_vnop_readdirattr(struct vnop_readdirattr_args *ap)
 		 */
 		zap_cursor_init_serialized(&zc, zfsvfs->z_os, zp->z_id, offset);
 	}
+	if (prefetch)
+		ra = zfs_dir_ra_init(zp, offset);
 
 	while (1) {
 		ino64_t objnum;
 		enum vtype vtype = VNON;
 		znode_t *tmp_zp = NULL;
+		znode_phys_t *pzp = NULL;
+		dmu_buf_t *db = NULL;
 
 		/*
 		 * Note that the low 4 bits of the cookie returned by zap is 
@@ -299,6 +322,7 @@ zfs_vnop_readdirattr(struct vnop_readdirattr_args *ap)
 			    (alp->dirattr || alp->fileattr ||
 			     (alp->commonattr & ATTR_CMN_OBJTYPE))) {
 				prefetch = 1;
+				ra = zfs_dir_ra_init(zp, offset);
 			}
 		}
 
@@ -310,35 +334,57 @@ zfs_vnop_readdirattr(struct vnop_readdirattr_args *ap)
 		attrinfo.ai_attrbufpp = &attrptr;
 		attrinfo.ai_varbufpp = &varptr;
 
-		/* Grab znode if required */
-		if (prefetch) {
-			dmu_prefetch(zfsvfs->z_os, objnum, 0, 0);
+		/* Grab znode (or just its bonus buffer) if required */
+		if (prefetch && needznode) {
+			if (ra == NULL)
+				dmu_prefetch(zfsvfs->z_os, objnum, 0, 0);
 			if (zfs_zget(zfsvfs, objnum, &tmp_zp) == 0) {
-				if (vtype == VNON)
-					vtype = IFTOVT(tmp_zp->z_phys->zp_mode);
+				pzp = tmp_zp->z_phys;
+				db = tmp_zp->z_dbuf;
 			} else {
 				tmp_zp = NULL;
 				error = ENXIO;
 				goto update;
 			}
+		} else if (prefetch) {
+			dmu_object_info_t doi;
+
+			if (ra == NULL)
+				dmu_prefetch(zfsvfs->z_os, objnum, 0, 0);
+			if (dmu_bonus_hold(zfsvfs->z_os, objnum, FTAG, &db)) {
+				error = ENXIO;
+				goto update;
+			}
+			dmu_object_info_from_db(db, &doi);
+			if (doi.doi_bonus_type != DMU_OT_ZNODE ||
+			    doi.doi_bonus_size < sizeof (znode_phys_t)) {
+				dmu_buf_rele(db, FTAG);
+				error = ENXIO;
+				goto update;
+			}
+			pzp = db->db_data;
 		}
+		if (pzp && vtype == VNON)
+			vtype = IFTOVT(pzp->zp_mode);
 		/*
 		 * Pack entries into attribute buffer.
 		 */
 		if (alp->commonattr) {
-			commonattrpack(&attrinfo, zfsvfs, tmp_zp, zap.za_name,
-			               objnum, vtype, user64);
+			commonattrpack(&attrinfo, zfsvfs, tmp_zp, pzp,
+			               zap.za_name, objnum, vtype, user64);
 		}
 		if (alp->dirattr && vtype == VDIR) {
-			dirattrpack(&attrinfo, tmp_zp);
+			dirattrpack(&attrinfo, tmp_zp, pzp);
 		}
 		if (alp->fileattr && vtype != VDIR) {
-			fileattrpack(&attrinfo, zfsvfs, tmp_zp);
+			fileattrpack(&attrinfo, zfsvfs, tmp_zp, pzp, db);
 		}
 		/* All done with tmp znode. */
-		if (prefetch && tmp_zp) {
+		if (tmp_zp) {
 			vnode_put(ZTOV(tmp_zp));
 			tmp_zp = NULL;
+		} else if (db) {
+			dmu_buf_rele(db, FTAG);
 		}
 		attrbufsize = ((char *)varptr - (char *)attrbufptr);
 
@@ -366,6 +412,7 @@ zfs_vnop_readdirattr(struct vnop_readdirattr_args *ap)
 			    (offset == 2 && !zfs_show_ctldir(zp))) {
 				zap_cursor_advance(&zc);
 				offset = zap_cursor_serialize(&zc);
+				zap_ra_advance(ra);
 			} else {
 				offset += 1;
 			}
@@ -381,6 +428,7 @@ zfs_vnop_readdirattr(struct vnop_readdirattr_args *ap)
 	}
 update:
 	zap_cursor_fini(&zc);
+	zap_ra_fini(ra);
 
 	if (attrbufptr) {
 		FREE(attrbufptr, M_TEMP);
@@ -400,14 +448,19 @@ update:
 }
 
 
+/*
+ * The attribute packers take the znode_phys_t separately from the znode;
+ * zp may be NULL when the caller only holds the bonus buffer, in which
+ * case none of the ZFS_ZNODE_*_ATTRS may be requested.
+ */
 static void
-commonattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs, znode_t *zp, const char *name,
-               ino64_t objnum, enum vtype vtype, boolean_t user64)
+commonattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs, znode_t *zp,
+               znode_phys_t *pzp, const char *name, ino64_t objnum,
+               enum vtype vtype, boolean_t user64)
 {
 	attrgroup_t commonattr = aip->ai_attrlist->commonattr;
 	void *attrbufptr = *aip->ai_attrbufpp;
 	void *varbufptr = *aip->ai_varbufpp;
-	znode_phys_t *pzp = zp ? zp->z_phys : NULL;
 	struct mount *mp = zfsvfs->z_vfs;
 	cred_t  *cr = (cred_t *)vfs_context_ucred(aip->ai_context);
 	finderinfo_t finderinfo;
@@ -466,7 +519,7 @@ commonattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs, znode_t *zp, const char *name,
 		 * On Mac OS X we always export the root
 		 * directory id as 2 and its parent as 1
 		 */
-		if (zp && zp->z_id == zfsvfs->z_root)
+		if (pzp && objnum == zfsvfs->z_root)
 			parentid = 1;
 		else if (pzp && pzp->zp_parent == zfsvfs->z_root)
 			parentid = 2;
@@ -560,8 +613,8 @@ commonattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs, znode_t *zp, const char *name,
 		*((u_int32_t *)attrbufptr) = pzp->zp_mode;
 		attrbufptr = ((u_int32_t *)attrbufptr) + 1;
 	}
-	if (ATTR_CMN_FLAGS & commonattr) {
-		u_int32_t flags = zfs_getbsdflags(zp);
+	if (pzp && ATTR_CMN_FLAGS & commonattr) {
+		u_int32_t flags = zfs_phys_getbsdflags(pzp);
 
 		/* Shadow Finder Info's invisible bit to UF_HIDDEN */
 		if ((ATTR_CMN_FNDRINFO & commonattr) &&
@@ -606,7 +659,7 @@ commonattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs, znode_t *zp, const char *name,
 		 * On Mac OS X we always export the root
 		 * directory id as 2 and its parent as 1
 		 */
-		if (zp && zp->z_id == zfsvfs->z_root)
+		if (pzp && objnum == zfsvfs->z_root)
 			parentid = 1;
 		else if (pzp && pzp->zp_parent == zfsvfs->z_root)
 			parentid = 2;
@@ -623,11 +676,10 @@ commonattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs, znode_t *zp, const char *name,
 }
 
 static void
-dirattrpack(attrinfo_t *aip, znode_t *zp)
+dirattrpack(attrinfo_t *aip, znode_t *zp, znode_phys_t *pzp)
 {
 	attrgroup_t dirattr = aip->ai_attrlist->dirattr;
 	void *attrbufptr = *aip->ai_attrbufpp;
-	znode_phys_t *pzp = zp ? zp->z_phys : NULL;
 	u_int32_t entries;
 
 	if (ATTR_DIR_LINKCOUNT & dirattr) {
@@ -651,20 +703,20 @@ dirattrpack(attrinfo_t *aip, znode_t *zp)
 }
 
 static void
-fileattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs, znode_t *zp)
+fileattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs, znode_t *zp,
+             znode_phys_t *pzp, dmu_buf_t *db)
 {
 	attrgroup_t fileattr = aip->ai_attrlist->fileattr;
 	void *attrbufptr = *aip->ai_attrbufpp;
 	void *varbufptr = *aip->ai_varbufpp;
-	znode_phys_t *pzp = zp ? zp->z_phys : NULL;
 	uint64_t allocsize = 0;
+	uint32_t  blksize = 0;
 	cred_t  *cr = (cred_t *)vfs_context_ucred(aip->ai_context);
 
-	if ((ATTR_FILE_ALLOCSIZE | ATTR_FILE_DATAALLOCSIZE) & fileattr && zp) {
-		uint32_t  blksize;
+	if (db) {
 		u_longlong_t  nblks;
 
-		dmu_object_size_from_db(zp->z_dbuf, &blksize, &nblks);
+		dmu_object_size_from_db(db, &blksize, &nblks);
 		allocsize = (uint64_t)512LL * (uint64_t)nblks;
 	}
 	if (ATTR_FILE_LINKCOUNT & fileattr && pzp) {
@@ -679,9 +731,11 @@ fileattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs, znode_t *zp)
 		*((off_t *)attrbufptr) = allocsize;
 		attrbufptr = ((off_t *)attrbufptr) + 1;
 	}
-	if (ATTR_FILE_IOBLOCKSIZE & fileattr && zp) {
+	if (ATTR_FILE_IOBLOCKSIZE & fileattr && db) {
+		if (zp)
+			blksize = zp->z_blksz;
 		*((u_int32_t *)attrbufptr) =
-				zp->z_blksz ? zp->z_blksz : zfsvfs->z_max_blksz;
+				blksize ? blksize : zfsvfs->z_max_blksz;
 		attrbufptr = ((u_int32_t *)attrbufptr) + 1;
 	}
 	if (ATTR_FILE_DEVTYPE & fileattr && pzp) {
@@ -699,7 +753,7 @@ fileattrpack(attrinfo_t *aip, zfsvfs_t *zfsvfs, znode_t *zp)
 		*((off_t *)attrbufptr) = allocsize;
 		attrbufptr = ((off_t *)attrbufptr) + 1;
 	}
-	if ((ATTR_FILE_RSRCLENGTH | ATTR_FILE_RSRCALLOCSIZE) & fileattr && pzp) {
+	if ((ATTR_FILE_RSRCLENGTH | ATTR_FILE_RSRCALLOCSIZE) & fileattr && zp) {
 		uint64_t rsrcsize = 0;
 
 		if (pzp->zp_xattr) {
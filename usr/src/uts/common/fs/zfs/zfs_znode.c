@@ -1591,7 +1591,13 @@ zfs_obj_to_path(objset_t *osp, uint64_t obj, char *buf, int len)
 uint32_t
 zfs_getbsdflags(znode_t *zp)
 {
-	uint64_t  zflags = zp->z_phys->zp_flags;
+	return (zfs_phys_getbsdflags(zp->z_phys));
+}
+
+uint32_t
+zfs_phys_getbsdflags(znode_phys_t *pzp)
+{
+	uint64_t  zflags = pzp->zp_flags;
 	uint32_t  bsdflags = 0;
 
 	if (zflags & ZFS_NODUMP)
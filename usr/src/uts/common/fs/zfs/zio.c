@@ -360,7 +360,8 @@ zio_create(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp,
 	if (pio == NULL) {
 		if (type != ZIO_TYPE_NULL &&
 		    !(flags & ZIO_FLAG_CONFIG_HELD)) {
-			spa_config_enter(zio->io_spa, RW_READER, zio);
+			zio->io_config_slot =
+			    spa_config_enter_slot(zio->io_spa, zio);
 			zio->io_flags |= ZIO_FLAG_CONFIG_GRABBED;
 		}
 		zio->io_root = zio;
@@ -374,7 +375,8 @@ zio_create(zio_t *pio, spa_t *spa, uint64_t txg, blkptr_t *bp,
 		    !(pio->io_flags & ZIO_FLAG_CONFIG_GRABBED) &&
 		    !(pio->io_flags & ZIO_FLAG_CONFIG_HELD)) {
 			pio->io_flags |= ZIO_FLAG_CONFIG_GRABBED;
-			spa_config_enter(zio->io_spa, RW_READER, pio);
+			pio->io_config_slot =
+			    spa_config_enter_slot(zio->io_spa, pio);
 		}
 		if (stage < ZIO_STAGE_READY)
 			pio->io_children_notready++;
@@ -923,6 +925,11 @@ zio_done(zio_t *zio)
 	if (zio->io_done)
 		zio->io_done(zio);
 
+	if (zio->io_cdata != NULL) {
+		zio_buf_free(zio->io_cdata, zio->io_csize);
+		zio->io_cdata = NULL;
+	}
+
 	ASSERT(zio->io_delegate_list == NULL);
 	ASSERT(zio->io_delegate_next == NULL);
 
@@ -949,7 +956,7 @@ zio_done(zio_t *zio)
 	 * need to clear this (or any other) flag.
 	 */
 	if (zio->io_flags & ZIO_FLAG_CONFIG_GRABBED)
-		spa_config_exit(spa, zio);
+		spa_config_exit_slot(spa, zio->io_config_slot, zio);
 
 	if (zio->io_waiter != NULL) {
 		mutex_enter(&zio->io_lock);
@@ -1055,7 +1062,19 @@ zio_read_decompress(zio_t *zio)
 	    zio->io_data, zio->io_size))
 		zio->io_error = EIO;
 
-	zio_buf_free(data, bufsize);
+	/*
+	 * If the caller asked for it, hand the compressed copy to the
+	 * done callback instead of freeing it.  The callback may adopt
+	 * it by clearing io_cdata; otherwise zio_done() frees it.
+	 */
+	if ((zio->io_flags & ZIO_FLAG_KEEP_COMPRESSED) &&
+	    zio->io_error == 0) {
+		ASSERT3U(size, ==, bufsize);
+		zio->io_cdata = data;
+		zio->io_csize = bufsize;
+	} else {
+		zio_buf_free(data, bufsize);
+	}
 
 	zio_next_stage(zio);
 }
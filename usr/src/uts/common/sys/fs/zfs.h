@@ -261,6 +261,7 @@ extern zpool_prop_t zpool_prop_iter(zpool_prop_f, void *);
 #define	ZPOOL_CONFIG_ASIZE		"asize"
 #define	ZPOOL_CONFIG_DTL		"DTL"
 #define	ZPOOL_CONFIG_STATS		"stats"
+#define	ZPOOL_CONFIG_LATENCY		"latency"	/* vdev_lat_stat_t */
 #define	ZPOOL_CONFIG_WHOLE_DISK		"whole_disk"
 #define	ZPOOL_CONFIG_ERRCOUNT		"error_count"
 #define	ZPOOL_CONFIG_NOT_PRESENT	"not_present"
@@ -310,6 +311,12 @@ extern zpool_prop_t zpool_prop_iter(zpool_prop_f, void *);
 
 #define	ZPOOL_CACHE		ZPOOL_CACHE_DIR "/" ZPOOL_CACHE_FILE
 
+/*
+ * Results of the last device label scan, used by userland only.
+ */
+#define	ZPOOL_LABEL_CACHE	ZPOOL_CACHE_DIR "/zpool.labelcache"
+#define	ZPOOL_LABEL_CACHE_TMP	ZPOOL_CACHE_DIR "/.zpool.labelcache"
+
 /*
  * vdev states are ordered from least to most healthy.
  * A vdev that's CANT_OPEN or below is considered unusable.
@@ -410,6 +417,88 @@ typedef struct vdev_stat {
 	uint64_t	vs_scrub_end;		/* UTC scrub end time	*/
 } vdev_stat_t;
 
+/*
+ * Vdev latency histograms.  Leaf vdevs count every queued read and write
+ * twice: once for the time it waited in the vdev queue and once for the
+ * device service time, in power-of-two microsecond buckets (bucket 0 is
+ * under 2us, bucket n is [2^n, 2^(n+1)) us, the last bucket is ~8s and
+ * up).  I/Os are further split by priority into synchronous, asynchronous
+ * and scrub/resilver classes.  Interior vdevs report the sum of their
+ * children.  Like vdev_stat_t, this is passed as an nvlist uint64 array.
+ */
+#define	VDEV_LAT_BUCKETS	24
+
+typedef enum vdev_lat_type {
+	VDEV_LAT_READ,
+	VDEV_LAT_WRITE,
+	VDEV_LAT_TYPES
+} vdev_lat_type_t;
+
+typedef enum vdev_lat_class {
+	VDEV_LAT_SYNC,
+	VDEV_LAT_ASYNC,
+	VDEV_LAT_SCRUB,
+	VDEV_LAT_CLASSES
+} vdev_lat_class_t;
+
+typedef enum vdev_lat_kind {
+	VDEV_LAT_QUEUE,			/* waiting in the vdev queue	*/
+	VDEV_LAT_SERVICE,		/* issued to the device		*/
+	VDEV_LAT_KINDS
+} vdev_lat_kind_t;
+
+typedef struct vdev_lat_stat {
+	uint64_t	vls_hist[VDEV_LAT_TYPES][VDEV_LAT_CLASSES]
+			    [VDEV_LAT_KINDS][VDEV_LAT_BUCKETS];
+} vdev_lat_stat_t;
+
+/*
+ * Phases of spa_sync() timed in txg_stat_t.
+ */
+typedef enum txg_phase {
+	TXG_PHASE_FREES,		/* previous txg's deferred frees */
+	TXG_PHASE_DSL,			/* dsl_pool_sync(), all passes	*/
+	TXG_PHASE_VDEV,			/* vdev_sync(), all passes	*/
+	TXG_PHASE_MISC,			/* config, spares, errlog, bplist */
+	TXG_PHASE_CONFIG,		/* labels and uberblock		*/
+	TXG_PHASE_DONE,			/* zil clean, space accounting	*/
+	TXG_PHASES
+} txg_phase_t;
+
+/*
+ * Per-txg sync statistics.  Each pool keeps the most recent ones in a
+ * ring; like vdev_stat_t, all fields are 64-bit because the records are
+ * passed to userland as an nvlist uint64 array.
+ */
+typedef struct txg_stat {
+	uint64_t	ts_txg;			/* txg number		*/
+	uint64_t	ts_time;		/* UTC time sync finished */
+	uint64_t	ts_dirty;		/* bytes dirtied	*/
+	uint64_t	ts_written;		/* bytes written	*/
+	uint64_t	ts_writes;		/* write I/Os		*/
+	uint64_t	ts_passes;		/* sync passes		*/
+	uint64_t	ts_open_ns;		/* time spent open	*/
+	uint64_t	ts_quiesce_ns;		/* time to quiesce	*/
+	uint64_t	ts_wait_ns;		/* quiesced, not syncing */
+	uint64_t	ts_sync_ns;		/* time in spa_sync()	*/
+	uint64_t	ts_phase_ns[TXG_PHASES]; /* see txg_phase_t	*/
+} txg_stat_t;
+
+/*
+ * The sync and quiesce time histograms have power-of-two millisecond
+ * buckets: bucket 0 counts txgs under 2ms, bucket n counts [2^n, 2^(n+1))
+ * and the last bucket everything from ~32s up.
+ */
+#define	TXG_HISTOGRAM_BUCKETS	16
+
+/*
+ * Names of the members of the ZFS_IOC_POOL_TXG_HISTORY nvlist.
+ */
+#define	ZPOOL_TXG_HISTORY_COUNT		"count"
+#define	ZPOOL_TXG_HISTORY_RECORDS	"txgs"
+#define	ZPOOL_TXG_HISTORY_SYNC		"sync_histogram"
+#define	ZPOOL_TXG_HISTORY_QUIESCE	"quiesce_histogram"
+
 #define	ZFS_DRIVER	"zfs"
 #define	ZFS_DEV		"/dev/zfs"
 
@@ -484,6 +573,16 @@ typedef struct vdev_stat {
 #define	ZFS_IOC_ISCSI_PERM_CHECK    ZFS_IOC_CMD(43)
 #define	ZFS_IOC_SHARE		    ZFS_IOC_CMD(44)
 #define	ZFS_IOC_INHERIT_PROP	    ZFS_IOC_CMD(45)
+#define	ZFS_IOC_LIST_BATCH	    ZFS_IOC_CMD(46)
+#define	ZFS_IOC_POOL_TXG_HISTORY    ZFS_IOC_CMD(47)
+#define	ZFS_IOC_BATCH		    ZFS_IOC_CMD(48)
+
+/*
+ * Operations that ZFS_IOC_BATCH can apply to many datasets at once.
+ */
+typedef enum zfs_batch_op {
+	ZFS_BATCH_SNAPSHOT
+} zfs_batch_op_t;
 
 /*
  * Internal SPA load state.  Used by FMA diagnosis engine.
@@ -36,6 +36,7 @@ extern "C" {
 #define ZFS_SYSCTL_READONLY	2
 #define ZFS_SYSCTL_CONFIG_DEBUGMSG 3
 #define ZFS_SYSCTL_CONFIG_DPRINTF 4
+#define ZFS_SYSCTL_IOC_COUNT	5	/* number of ioctls implemented */
 
 
 #define ZFS_FOOTPRINT_VERSION	1
@@ -162,6 +162,14 @@ int nvlist_xunpack(char *, size_t, nvlist_t **, nv_alloc_t *);
 int nvlist_xdup(nvlist_t *, nvlist_t **, nv_alloc_t *);
 nv_alloc_t *nvlist_lookup_nv_alloc(nvlist_t *);
 
+/*
+ * Read-only unpack of natively encoded buffers.  The returned nvlist
+ * references string and array data inside the packed buffer, which must
+ * stay allocated and unmodified until the nvlist is freed.
+ */
+int nvlist_unpack_borrowed(char *, size_t, nvlist_t **, int);
+int nvlist_xunpack_borrowed(char *, size_t, nvlist_t **, nv_alloc_t *);
+
 int nvlist_add_nvpair(nvlist_t *, nvpair_t *);
 int nvlist_add_boolean(nvlist_t *, const char *);
 int nvlist_add_boolean_value(nvlist_t *, const char *, boolean_t);